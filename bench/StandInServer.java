@@ -0,0 +1,195 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+import java.io.BufferedReader;
+import java.io.InputStreamReader;
+import java.nio.charset.StandardCharsets;
+import java.util.Arrays;
+import java.util.concurrent.BlockingQueue;
+import java.util.concurrent.LinkedBlockingQueue;
+
+/**
+ * Stands in for the Minecraft server in the startup benchmark. Like the real server, main() loads the classes on its
+ * class path, starts a non-daemon "Server thread" that prints a "Done" line and then ticks every 50 ms, running the
+ * console commands read by a "Server console handler" thread between ticks, and returns; "stop" saves and exits the
+ * JVM.
+ *
+ * "jitter <seconds>" measures how long ticks take while "Worker-Main-<n>" threads (one per CPU) load the CPUs and the
+ * garbage collector, as chunk generation does: the time from when each tick was due to when its fixed work was done.
+ */
+public final class StandInServer {
+
+	private static final long TICK_NANOS = 50_000_000L;
+	/** Iterations of the work done in each tick, taking a millisecond or two. */
+	private static final int TICK_WORK = 200_000;
+
+	private static final BlockingQueue<String> commands = new LinkedBlockingQueue<>();
+	private static long[] tickTimes;
+	private static int tickCount;
+	private static long jitterEnd;
+	private static volatile boolean burning;
+	private static int sink;
+
+	public static void main(String[] arguments) throws Exception {
+
+		final long startTime = System.nanoTime();
+		// The class path holds standin.lib<i>.C<j> for i and j from 0 up, as generated by make-standin-jar.sh
+		int classes = 0;
+		int checksum = 0;
+		for(int i = 0; ; ++i) {
+			int j = 0;
+			for(Class<?> clazz; (clazz = load("standin.lib" + i + ".C" + j)) != null; ++j) {
+				checksum += (Integer)clazz.getMethod("touch").invoke(null);
+			}
+			if(j == 0) {
+				break;
+			}
+			classes += j;
+		}
+		final int loadedClasses = classes;
+		final int sum = checksum;
+
+		Thread serverThread = new Thread(() -> {
+			log("Loaded " + loadedClasses + " library classes (checksum " + sum + ")");
+			log(String.format("Done (%.3fs)! For help, type \"help\"", (System.nanoTime() - startTime) / 1e9));
+			Thread consoleThread = new Thread(() -> {
+				try(BufferedReader console = new BufferedReader(new InputStreamReader(System.in,
+								StandardCharsets.UTF_8))) {
+					for(String line = console.readLine(); line != null; line = console.readLine()) {
+						commands.add(line.trim());
+					}
+				} catch(Exception e) {
+					e.printStackTrace();
+				}
+			}, "Server console handler");
+			consoleThread.setDaemon(true);
+			consoleThread.start();
+
+			try {
+				for(long due = System.nanoTime(); ; due += TICK_NANOS) {
+					for(String command; (command = commands.poll()) != null;) {
+						run(command);
+					}
+					tick(due);
+					final long sleep = due + TICK_NANOS - System.nanoTime();
+					if(sleep > 0) {
+						Thread.sleep(sleep / 1_000_000, (int)(sleep % 1_000_000));
+					} else {
+						due = System.nanoTime() - TICK_NANOS;
+					}
+				}
+			} catch(InterruptedException e) {
+				e.printStackTrace();
+			}
+		}, "Server thread");
+		serverThread.start();
+	}
+
+	private static void run(String command) {
+
+		final String[] words = command.split(" ");
+		switch(words[0]) {
+			case "list":
+				log("There are 0 of a max of 20 players online: ");
+				break;
+			case "jitter":
+				final long seconds = (words.length > 1) ? Long.parseLong(words[1]) : 10;
+				tickTimes = new long[(int)(seconds * 1_000_000_000L / TICK_NANOS) + 1];
+				tickCount = 0;
+				jitterEnd = System.nanoTime() + seconds * 1_000_000_000L;
+				burning = true;
+				for(int i = 0; i < Runtime.getRuntime().availableProcessors(); ++i) {
+					Thread worker = new Thread(StandInServer::burn, "Worker-Main-" + i);
+					worker.setDaemon(true);
+					worker.start();
+				}
+				break;
+			case "save-all":
+				log("Saving the game (this may take a moment!)");
+				log("Saved the game");
+				break;
+			case "save-off":
+				log("Automatic saving is now disabled");
+				break;
+			case "save-on":
+				log("Automatic saving is now enabled");
+				break;
+			case "stop":
+				log("Stopping the server");
+				log("Saving worlds");
+				System.exit(0);
+				break;
+			default:
+				log("Unknown or incomplete command, see below for error");
+		}
+	}
+
+	/** Does a tick's fixed work, recording how long after due it was done if jitter is being measured. */
+	private static void tick(long due) {
+
+		int value = sink;
+		for(int i = 0; i < TICK_WORK; ++i) {
+			value = value * 31 + i;
+		}
+		sink = value;
+
+		if(tickTimes == null) {
+			return;
+		}
+		final long now = System.nanoTime();
+		if((now < jitterEnd) && (tickCount < tickTimes.length)) {
+			tickTimes[tickCount++] = now - due;
+			return;
+		}
+
+		burning = false;
+		final long[] sorted = Arrays.copyOf(tickTimes, tickCount);
+		tickTimes = null;
+		Arrays.sort(sorted);
+		if(sorted.length == 0) {
+			log("Tick times: no ticks measured");
+			return;
+		}
+		log(String.format("Tick times: p50 %.3f ms, p99 %.3f ms, max %.3f ms over %d ticks",
+				sorted[(sorted.length - 1) / 2] / 1e6, sorted[(int)Math.ceil(sorted.length * 0.99) - 1] / 1e6,
+				sorted[sorted.length - 1] / 1e6, sorted.length));
+	}
+
+	/** Keeps a CPU busy and the garbage collector working until jitter has been measured. */
+	private static void burn() {
+
+		int value = 0;
+		while(burning) {
+			final int[] garbage = new int[16 * 1024];
+			for(int i = 0; i < garbage.length; ++i) {
+				garbage[i] = value += i;
+			}
+			value += garbage[value & (garbage.length - 1)];
+		}
+		sink += value;
+	}
+
+	private static Class<?> load(String name) {
+
+		try {
+			return Class.forName(name);
+		} catch(ClassNotFoundException e) {
+			return null;
+		}
+	}
+
+	private static void log(String message) {
+
+		System.out.printf("[%tT] [Server thread/INFO]: %s%n", System.currentTimeMillis(), message);
+		System.out.flush();
+	}
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Builds the stand-in server used by the startup benchmark into OUTPUT_DIRECTORY: server.jar, whose manifest
+# references LIBRARIES library JARs (default 48) of CLASSES classes each (default 100), all of which the stand-in
+# loads at startup.
+#
+# Usage: make-standin-jar.sh StandInServer.java OUTPUT_DIRECTORY
+set -e
+
+source=$1
+output=$2
+libraries=${LIBRARIES:-48}
+classes=${CLASSES:-100}
+javac=${JAVAC:-javac}
+jar=${JAR:-jar}
+
+rm -rf "$output"
+mkdir -p "$output/classes/server" "$output/lib"
+
+# The manifest limits lines to 72 bytes, so each further Class-Path entry goes on a continuation line of its own
+printf 'Main-Class: StandInServer\n' > "$output/manifest"
+
+i=0
+while [ "$i" -lt "$libraries" ]; do
+	mkdir -p "$output/src/standin/lib$i" "$output/classes/lib$i"
+	j=0
+	while [ "$j" -lt "$classes" ]; do
+		printf 'package standin.lib%d;\npublic final class C%d { public static int touch() { return %d; } }\n' \
+			"$i" "$j" "$j" > "$output/src/standin/lib$i/C$j.java"
+		j=$((j + 1))
+	done
+	"$javac" -nowarn -d "$output/classes/lib$i" "$output/src/standin/lib$i"/*.java
+	"$jar" cf "$output/lib/lib$i.jar" -C "$output/classes/lib$i" .
+	if [ "$i" -eq 0 ]; then
+		printf 'Class-Path: lib/lib0.jar\n' >> "$output/manifest"
+	else
+		printf '  lib/lib%d.jar\n' "$i" >> "$output/manifest"
+	fi
+	i=$((i + 1))
+done
+
+"$javac" -nowarn -d "$output/classes/server" "$source"
+"$jar" cfm "$output/server.jar" "$output/manifest" -C "$output/classes/server" .
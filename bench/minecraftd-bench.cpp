@@ -0,0 +1,579 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <giomm.h>
+#include <glibmm.h>
+
+/*
+ * Measures how long minecraftd takes to start, answer a command and stop, by running it repeatedly against the
+ * stand-in server built by make-standin-jar.sh, on a private D-Bus daemon standing in for the system bus. With
+ * --jitter, it also measures how long the stand-in's ticks take while its other threads load every CPU; comparing runs
+ * with and without --classify-threads shows what the jvm.threads rules do for the tick thread.
+ */
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	const Glib::ustring BUS_NAME{"net.za.slyfox.Minecraftd1"};
+	const Glib::ustring OBJECT_PATH{"/net/za/slyfox/Minecraftd1"};
+	const std::chrono::seconds STARTUP_TIMEOUT{120};
+	const std::chrono::seconds SHUTDOWN_TIMEOUT{60};
+	const std::chrono::milliseconds POLL_INTERVAL{1};
+
+	/** Phases in the order they are reported. */
+	const char *const PHASES[] = {"dlopen", "JNI_CreateJavaVM", "main_class_lookup", "dbus_ready", "server_done",
+		"command_round_trip", "tick_p50", "tick_p99", "tick_max", "shutdown"};
+
+	struct Options {
+		std::string minecraftd;
+		std::string jar;
+		std::string jvmLibrary;
+		/** Log4j 2 configuration for minecraftd to use, or empty for its installed default. */
+		std::string logConfiguration;
+		std::string output{"bench-results.json"};
+		unsigned int runs = 10;
+		unsigned int warmupRuns = 1;
+		unsigned int commands = 20;
+		/** Seconds over which tick times are measured in each run, or zero not to measure them. */
+		unsigned int jitterSeconds = 0;
+		bool classDataSharing = false;
+		bool classifyThreads = false;
+		bool keep = false;
+	};
+
+	/** Output of a child process, split into lines and stamped with the time each was read. */
+	class Output {
+		public:
+			Output(int fd) : fd_(fd), thread_{&Output::run, this} { }
+			Output(const Output&) = delete;
+			~Output() { thread_.join(); close(fd_); }
+
+			/**
+			 * Waits for the count'th line (counting from 1) containing text, returning the time it was read. Throws
+			 * std::runtime_error if it has not appeared by deadline.
+			 */
+			Clock::time_point waitFor(const std::string &text, unsigned int count, Clock::time_point deadline,
+					std::string *line = nullptr) {
+
+				std::unique_lock<std::mutex> lock{mutex_};
+				for(;;) {
+					unsigned int seen = 0;
+					for(const auto &entry: lines_) {
+						if((entry.second.find(text) != std::string::npos) && (++seen == count)) {
+							if(line != nullptr) {
+								*line = entry.second;
+							}
+							return entry.first;
+						}
+					}
+					if(closed_) {
+						throw std::runtime_error{"minecraftd exited before printing \"" + text + '"'};
+					} else if(condition_.wait_until(lock, deadline) == std::cv_status::timeout) {
+						throw std::runtime_error{"Timed out waiting for \"" + text + '"'};
+					}
+				}
+			}
+
+			std::string text() {
+
+				std::lock_guard<std::mutex> lock{mutex_};
+				std::string text;
+				for(const auto &entry: lines_) {
+					text += entry.second + '\n';
+				}
+				return text;
+			}
+
+		private:
+			void run() {
+
+				std::string pending;
+				char buffer[4096];
+				for(;;) {
+					ssize_t count = read(fd_, buffer, sizeof(buffer));
+					if((count < 0) && (errno == EINTR)) {
+						continue;
+					} else if(count <= 0) {
+						break;
+					}
+
+					const auto now = Clock::now();
+					pending.append(buffer, count);
+					std::lock_guard<std::mutex> lock{mutex_};
+					for(auto end = pending.find('\n'); end != std::string::npos; end = pending.find('\n')) {
+						lines_.emplace_back(now, pending.substr(0, end));
+						pending.erase(0, end + 1);
+					}
+					condition_.notify_all();
+				}
+
+				std::lock_guard<std::mutex> lock{mutex_};
+				closed_ = true;
+				condition_.notify_all();
+			}
+
+			bool closed_ = false;
+			std::condition_variable condition_;
+			const int fd_;
+			std::vector<std::pair<Clock::time_point, std::string>> lines_;
+			std::mutex mutex_;
+			std::thread thread_;
+	};
+
+	double milliseconds(Clock::duration duration) {
+
+		return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(duration).count();
+	}
+
+	/** Starts program with the given arguments and extra environment, returning its pid and its merged output. */
+	pid_t spawn(const std::vector<std::string> &arguments, const std::vector<std::string> &environment, int &outputFd) {
+
+		int fds[2];
+		if(pipe2(fds, O_CLOEXEC) != 0) {
+			throw std::system_error(errno, std::system_category());
+		}
+
+		const pid_t pid = fork();
+		if(pid == -1) {
+			throw std::system_error(errno, std::system_category());
+		} else if(pid == 0) {
+			const int null = open("/dev/null", O_RDONLY);
+			if((null == -1) || (dup2(null, STDIN_FILENO) == -1) || (dup2(fds[1], STDOUT_FILENO) == -1)
+					|| (dup2(fds[1], STDERR_FILENO) == -1)) {
+				_exit(127);
+			}
+			for(const auto &variable: environment) {
+				putenv(const_cast<char*>(variable.c_str()));
+			}
+			std::vector<char*> argv;
+			for(const auto &argument: arguments) {
+				argv.push_back(const_cast<char*>(argument.c_str()));
+			}
+			argv.push_back(nullptr);
+			execvp(argv[0], argv.data());
+			std::perror(argv[0]);
+			_exit(127);
+		}
+
+		close(fds[1]);
+		outputFd = fds[0];
+		return pid;
+	}
+
+	/** Waits for pid to exit, killing it if it has not by deadline. Returns false if it had to be killed. */
+	bool reap(pid_t pid, Clock::time_point deadline) {
+
+		for(;;) {
+			int status;
+			const pid_t result = waitpid(pid, &status, WNOHANG);
+			if((result == pid) || ((result == -1) && (errno != EINTR))) {
+				return true;
+			} else if(Clock::now() >= deadline) {
+				kill(pid, SIGKILL);
+				waitpid(pid, &status, 0);
+				return false;
+			}
+			std::this_thread::sleep_for(POLL_INTERVAL);
+		}
+	}
+
+	/** A private dbus-daemon, standing in for the system bus so that minecraftd may own its name unprivileged. */
+	class Bus {
+		public:
+			Bus() {
+
+				int outputFd;
+				pid_ = spawn({"dbus-daemon", "--session", "--nofork", "--print-address=1"}, {}, outputFd);
+				output_.reset(new Output{outputFd});
+				std::string line;
+				output_->waitFor(":", 1, Clock::now() + std::chrono::seconds{10}, &line);
+				address_ = line;
+				connection_ = Gio::DBus::Connection::create_for_address_sync(address_,
+						Gio::DBus::CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+						| Gio::DBus::CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION);
+			}
+			Bus(const Bus&) = delete;
+
+			~Bus() {
+
+				connection_.reset();
+				kill(pid_, SIGTERM);
+				reap(pid_, Clock::now() + std::chrono::seconds{5});
+			}
+
+			const std::string &address() const { return address_; }
+
+			Glib::VariantContainerBase call(const Glib::ustring &method,
+					const Glib::VariantContainerBase &parameters = Glib::VariantContainerBase{}) {
+
+				return connection_->call_sync(OBJECT_PATH, BUS_NAME, method, parameters, BUS_NAME);
+			}
+
+			bool hasOwner() {
+
+				Glib::VariantContainerBase reply = connection_->call_sync("/org/freedesktop/DBus",
+						"org.freedesktop.DBus", "NameHasOwner", Glib::VariantContainerBase::create_tuple(
+							Glib::Variant<Glib::ustring>::create(BUS_NAME)), "org.freedesktop.DBus");
+				Glib::Variant<bool> hasOwner;
+				reply.get_child(hasOwner, 0);
+				return hasOwner.get();
+			}
+
+		private:
+			std::string address_;
+			Glib::RefPtr<Gio::DBus::Connection> connection_;
+			std::unique_ptr<Output> output_;
+			pid_t pid_;
+	};
+
+	std::string writeConfiguration(const Options &options, const std::string &directory) {
+
+		const std::string path{directory + "/minecraftd.conf"};
+		std::ofstream out{path};
+		out << "serverDirectory = \"" << directory << "/server\";\n"
+			<< "backupDirectory = \"" << directory << "/backups\";\n"
+			<< "jar = \"" << options.jar << "\";\n";
+		// Otherwise minecraftd uses its installed log configuration, so that readiness is measured as it would be there
+		if(!options.logConfiguration.empty()) {
+			out << "customLogConfiguration = \"" << options.logConfiguration << "\";\n";
+		}
+		out << "jvm: {\n";
+		if(!options.jvmLibrary.empty()) {
+			out << "\tjvmLibrary = \"" << options.jvmLibrary << "\";\n";
+		}
+		if(options.classDataSharing) {
+			out << "\tclassDataSharing = \"" << directory << "/cds\";\n";
+		} else {
+			out << "\tclassDataSharing = false;\n";
+		}
+		if(options.classifyThreads) {
+			// The tick thread is given a CPU of its own, and every other JVM thread the rest, at a lower priority
+			cpu_set_t allowed;
+			if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+				throw std::system_error(errno, std::system_category());
+			}
+			std::vector<int> cpus;
+			for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+				if(CPU_ISSET(cpu, &allowed)) {
+					cpus.push_back(cpu);
+				}
+			}
+			out << "\tthreads = (\n"
+				<< "\t\t{ role = \"tick\"; pattern = \"^Server thread$\"; cpus = \"" << cpus.front() << "\"; },\n"
+				<< "\t\t{ role = \"other\"; pattern = \".\"; nice = 10;";
+			if(cpus.size() > 1) {
+				out << " cpus = \"" << cpus[1] << '-' << cpus.back() << "\";";
+			}
+			out << " }\n"
+				<< "\t);\n";
+		}
+		out << "\tprofiling = false;\n"
+			<< "\targuments = [ \"-Xms256M\", \"-Xmx256M\" ];\n"
+			<< "};\n"
+			<< "metrics: {\n"
+			<< "\tinterval = 0;\n"
+			<< "};\n";
+		out.close();
+		if(!out) {
+			throw std::runtime_error{"Failed to write " + path};
+		}
+		return path;
+	}
+
+	/** Starts, exercises and stops minecraftd once, adding the duration of each phase to samples. */
+	void runOnce(const Options &options, Bus &bus, const std::string &configuration,
+			std::map<std::string, std::vector<double>> &samples) {
+
+		int outputFd;
+		const auto startTime = Clock::now();
+		const pid_t pid = spawn({options.minecraftd, "--config", configuration},
+				{"DBUS_SYSTEM_BUS_ADDRESS=" + bus.address()}, outputFd);
+		Output output{outputFd};
+
+		try {
+			const auto deadline = startTime + STARTUP_TIMEOUT;
+			std::string phases;
+			output.waitFor("JVM startup phases:", 1, deadline, &phases);
+			unsigned long long load, create, lookup;
+			if(std::sscanf(phases.c_str() + phases.find("JVM startup phases:"),
+						"JVM startup phases: dlopen %llu us, JNI_CreateJavaVM %llu us, main class lookup %llu us",
+						&load, &create, &lookup) != 3) {
+				throw std::runtime_error{"Could not parse: " + phases};
+			}
+			samples["dlopen"].push_back(load / 1000.0);
+			samples["JNI_CreateJavaVM"].push_back(create / 1000.0);
+			samples["main_class_lookup"].push_back(lookup / 1000.0);
+
+			while(!bus.hasOwner()) {
+				if(Clock::now() >= deadline) {
+					throw std::runtime_error{"Timed out waiting for minecraftd to own its bus name"};
+				}
+				std::this_thread::sleep_for(POLL_INTERVAL);
+			}
+			samples["dbus_ready"].push_back(milliseconds(Clock::now() - startTime));
+			samples["server_done"].push_back(milliseconds(output.waitFor("Done (", 1, deadline) - startTime));
+
+			// From the call to the server's answer appearing on its console, which is before ExecuteCommand returns
+			for(unsigned int i = 1; i <= options.commands; ++i) {
+				const auto commandTime = Clock::now();
+				bus.call("ExecuteCommand", Glib::VariantContainerBase::create_tuple(
+							Glib::Variant<Glib::ustring>::create("list")));
+				samples["command_round_trip"].push_back(milliseconds(output.waitFor("players online", i,
+								commandTime + std::chrono::seconds{10}) - commandTime));
+			}
+
+			if(options.jitterSeconds > 0) {
+				bus.call("ExecuteCommand", Glib::VariantContainerBase::create_tuple(
+							Glib::Variant<Glib::ustring>::create("jitter " + std::to_string(options.jitterSeconds))));
+				std::string ticks;
+				output.waitFor("Tick times:", 1, Clock::now() + std::chrono::seconds{options.jitterSeconds + 30},
+						&ticks);
+				double p50, p99, max;
+				if(std::sscanf(ticks.c_str() + ticks.find("Tick times:"),
+							"Tick times: p50 %lf ms, p99 %lf ms, max %lf ms", &p50, &p99, &max) != 3) {
+					throw std::runtime_error{"Could not parse: " + ticks};
+				}
+				samples["tick_p50"].push_back(p50);
+				samples["tick_p99"].push_back(p99);
+				samples["tick_max"].push_back(max);
+			}
+
+			const auto stopTime = Clock::now();
+			bus.call("Stop");
+			if(!reap(pid, stopTime + SHUTDOWN_TIMEOUT)) {
+				throw std::runtime_error{"Timed out waiting for minecraftd to exit"};
+			}
+			samples["shutdown"].push_back(milliseconds(Clock::now() - stopTime));
+		} catch(const Glib::Error &e) {
+			kill(pid, SIGKILL);
+			reap(pid, Clock::now() + SHUTDOWN_TIMEOUT);
+			std::cerr << output.text();
+			throw std::runtime_error{"D-Bus call failed: " + std::string{e.what()}};
+		} catch(const std::exception &e) {
+			kill(pid, SIGKILL);
+			reap(pid, Clock::now() + SHUTDOWN_TIMEOUT);
+			std::cerr << output.text();
+			throw;
+		}
+	}
+
+	/** Nearest-rank percentile of sorted samples. */
+	double percentile(const std::vector<double> &sorted, double p) {
+
+		const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+		return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+	}
+
+	void writeResults(const Options &options, const std::map<std::string, std::vector<double>> &samples) {
+
+		char timestamp[32];
+		const std::time_t now = std::time(nullptr);
+		std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+		std::ofstream out{options.output};
+		out << std::fixed << std::setprecision(3)
+			<< "{\n"
+			<< "\t\"timestamp\": \"" << timestamp << "\",\n"
+			<< "\t\"runs\": " << options.runs << ",\n"
+			<< "\t\"commandsPerRun\": " << options.commands << ",\n"
+			<< "\t\"classDataSharing\": " << (options.classDataSharing ? "true" : "false") << ",\n"
+			<< "\t\"classifyThreads\": " << (options.classifyThreads ? "true" : "false") << ",\n"
+			<< "\t\"unit\": \"ms\",\n"
+			<< "\t\"phases\": {";
+
+		std::cout << std::left << std::setw(20) << "phase" << std::right << std::setw(10) << "p50" << std::setw(10)
+			<< "p90" << std::setw(10) << "p99" << std::setw(10) << "max" << "  (ms)" << std::endl
+			<< std::fixed << std::setprecision(2);
+		bool first = true;
+		for(const char *phase: PHASES) {
+			if(samples.count(phase) == 0) {
+				continue;
+			}
+			std::vector<double> sorted{samples.at(phase)};
+			std::sort(sorted.begin(), sorted.end());
+			double total = 0;
+			for(double sample: sorted) {
+				total += sample;
+			}
+
+			out << (first ? "\n" : ",\n") << "\t\t\"" << phase << "\": {\n"
+				<< "\t\t\t\"count\": " << sorted.size() << ",\n"
+				<< "\t\t\t\"min\": " << sorted.front() << ",\n"
+				<< "\t\t\t\"mean\": " << total / sorted.size() << ",\n"
+				<< "\t\t\t\"p50\": " << percentile(sorted, 50) << ",\n"
+				<< "\t\t\t\"p90\": " << percentile(sorted, 90) << ",\n"
+				<< "\t\t\t\"p99\": " << percentile(sorted, 99) << ",\n"
+				<< "\t\t\t\"max\": " << sorted.back() << ",\n"
+				<< "\t\t\t\"samples\": [";
+			for(const auto &sample: samples.at(phase)) {
+				out << ((&sample == &samples.at(phase).front()) ? "" : ", ") << sample;
+			}
+			out << "]\n\t\t}";
+			first = false;
+
+			std::cout << std::left << std::setw(20) << phase << std::right << std::setw(10) << percentile(sorted, 50)
+				<< std::setw(10) << percentile(sorted, 90) << std::setw(10) << percentile(sorted, 99)
+				<< std::setw(10) << sorted.back() << std::endl;
+		}
+		out << "\n\t}\n}\n";
+
+		out.close();
+		if(!out) {
+			throw std::runtime_error{"Failed to write " + options.output};
+		}
+		std::cout << "Results written to " << options.output << std::endl;
+	}
+}
+
+int main(int argc, char **argv) {
+
+	Options options;
+	std::vector<std::string> arguments{argv + 1, argv + argc};
+	for(auto it = arguments.cbegin(); it != arguments.cend(); ++it) {
+		auto value = [&]() -> const std::string& {
+			if(++it == arguments.cend()) {
+				std::cerr << "Error: " << *(it - 1) << " requires an argument" << std::endl;
+				std::exit(1);
+			}
+			return *it;
+		};
+
+		if((*it == "--help") || (*it == "-h")) {
+			std::cout << "Usage: " << argv[0] << " --minecraftd <path> --jar <path> [options]" << std::endl << std::endl
+				<< "  --jvm-library <path>\tJVM library for minecraftd to load" << std::endl
+				<< "  --log-config <path>\tLog4j 2 configuration (default: minecraftd's installed one)" << std::endl
+				<< "  --runs <n>\t\tMeasured runs (default: " << options.runs << ')' << std::endl
+				<< "  --warmup <n>\t\tUnmeasured runs beforehand (default: " << options.warmupRuns << ')' << std::endl
+				<< "  --commands <n>\tCommands per run (default: " << options.commands << ')' << std::endl
+				<< "  --cds\t\t\tEnables class-data sharing" << std::endl
+				<< "  --jitter <s>\t\tMeasures tick times under load for s seconds per run" << std::endl
+				<< "  --classify-threads\tGives the tick thread a CPU of its own (see jvm.threads)" << std::endl
+				<< "  --output <path>\tJSON results file (default: " << options.output << ')' << std::endl
+				<< "  --keep\t\tKeeps the working directory" << std::endl;
+			return 0;
+		} else if(*it == "--minecraftd") {
+			options.minecraftd = value();
+		} else if(*it == "--jar") {
+			options.jar = value();
+		} else if(*it == "--jvm-library") {
+			options.jvmLibrary = value();
+		} else if(*it == "--log-config") {
+			options.logConfiguration = value();
+		} else if(*it == "--runs") {
+			options.runs = std::stoul(value());
+		} else if(*it == "--warmup") {
+			options.warmupRuns = std::stoul(value());
+		} else if(*it == "--commands") {
+			options.commands = std::stoul(value());
+		} else if(*it == "--cds") {
+			options.classDataSharing = true;
+		} else if(*it == "--jitter") {
+			options.jitterSeconds = std::stoul(value());
+		} else if(*it == "--classify-threads") {
+			options.classifyThreads = true;
+		} else if(*it == "--output") {
+			options.output = value();
+		} else if(*it == "--keep") {
+			options.keep = true;
+		} else {
+			std::cerr << "Unknown option: " << *it << std::endl;
+			return 1;
+		}
+	}
+
+	if(options.minecraftd.empty() || options.jar.empty() || (options.runs == 0) || (options.commands == 0)) {
+		std::cerr << "--minecraftd and --jar are required, and --runs and --commands must be positive" << std::endl;
+		return 1;
+	}
+
+	// minecraftd changes to its server directory, so its paths must be absolute
+	for(std::string *path: {&options.minecraftd, &options.jar, &options.logConfiguration}) {
+		if(path->empty()) {
+			continue;
+		}
+		char *absolute = realpath(path->c_str(), nullptr);
+		if(absolute == nullptr) {
+			std::cerr << *path << ": " << std::strerror(errno) << std::endl;
+			return 1;
+		}
+		*path = absolute;
+		std::free(absolute);
+	}
+
+	char directory[] = "/tmp/minecraftd-bench.XXXXXX";
+	if(mkdtemp(directory) == nullptr) {
+		std::cerr << "Failed to create working directory: " << std::strerror(errno) << std::endl;
+		return 1;
+	}
+
+	int status = 0;
+	try {
+		Gio::init();
+		Bus bus;
+		const std::string configuration = writeConfiguration(options, directory);
+
+		std::map<std::string, std::vector<double>> samples;
+		for(unsigned int i = 0; i < options.warmupRuns; ++i) {
+			std::cout << "Warm-up run " << (i + 1) << '/' << options.warmupRuns << std::endl;
+			std::map<std::string, std::vector<double>> discarded;
+			runOnce(options, bus, configuration, discarded);
+		}
+		for(unsigned int i = 0; i < options.runs; ++i) {
+			std::cout << "Run " << (i + 1) << '/' << options.runs << std::endl;
+			runOnce(options, bus, configuration, samples);
+		}
+		writeResults(options, samples);
+	} catch(const Glib::Error &e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		status = 1;
+	} catch(const std::exception &e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		status = 1;
+	}
+
+	if(options.keep) {
+		std::cout << "Working directory kept in " << directory << std::endl;
+	} else if(std::system(("rm -rf '" + std::string{directory} + "'").c_str()) != 0) {
+		std::cerr << "Failed to remove " << directory << std::endl;
+	}
+	return status;
+}
@@ -0,0 +1,1290 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <giomm.h>
+#include <glibmm.h>
+#include <zlib.h>
+
+/*
+ * Puts a Minecraft server under the load of many players without recruiting any: opens thousands of connections from
+ * one process, each a headless client that logs in, walks a scripted path, chats and runs commands, all on a single
+ * epoll loop. While it runs, the server's tick times are sampled through minecraftd's D-Bus interface; at the end, the
+ * latency of connecting and logging in, the tick times and each connection's throughput are reported, and written as
+ * JSON for comparison between runs (of different JVM arguments, say, or minecraftd builds).
+ *
+ * The server must be in offline mode (online-mode=false), as the players can not authenticate with Mojang, and speak
+ * protocol 767 (Minecraft 1.21 and 1.21.1); the packet IDs below would need updating for other versions. A flat world
+ * (level-type=flat) with allow-flight=true keeps players walking a path from being corrected or kicked by the server's
+ * movement checks, and spawn-protection and max-players must allow for them.
+ */
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	const Glib::ustring BUS_NAME{"net.za.slyfox.Minecraftd1"};
+	const Glib::ustring INTERFACE{"net.za.slyfox.Minecraftd1"};
+
+	const int32_t PROTOCOL_VERSION = 767;
+	/** Interval at which players move, as the client does once per tick. */
+	const std::chrono::milliseconds TICK_INTERVAL{50};
+	const std::chrono::seconds STATUS_INTERVAL{5};
+	const int MAX_EVENTS = 256;
+	/** Most bytes of a packet buffered; anything the players do not act on is skipped as it arrives instead. */
+	const size_t MAX_PACKET_SIZE = 2 * 1024 * 1024;
+
+	/** IDs of the packets of protocol 767 that the players send, or act on when received. */
+	namespace packets {
+		const int32_t HANDSHAKE = 0x00;
+
+		const int32_t LOGIN_DISCONNECT = 0x00;
+		const int32_t ENCRYPTION_REQUEST = 0x01;
+		const int32_t LOGIN_SUCCESS = 0x02;
+		const int32_t SET_COMPRESSION = 0x03;
+		const int32_t LOGIN_PLUGIN_REQUEST = 0x04;
+		const int32_t LOGIN_START = 0x00;
+		const int32_t LOGIN_PLUGIN_RESPONSE = 0x02;
+		const int32_t LOGIN_ACKNOWLEDGED = 0x03;
+
+		const int32_t CONFIGURATION_DISCONNECT = 0x02;
+		const int32_t FINISH_CONFIGURATION = 0x03;
+		const int32_t CONFIGURATION_KEEP_ALIVE = 0x04;
+		const int32_t KNOWN_PACKS = 0x0E;
+		const int32_t CLIENT_INFORMATION = 0x00;
+		const int32_t ACKNOWLEDGE_FINISH_CONFIGURATION = 0x03;
+		const int32_t CONFIGURATION_KEEP_ALIVE_RESPONSE = 0x04;
+		const int32_t SERVERBOUND_KNOWN_PACKS = 0x07;
+
+		const int32_t CHUNK_BATCH_FINISHED = 0x0C;
+		const int32_t PLAY_DISCONNECT = 0x1D;
+		const int32_t PLAY_KEEP_ALIVE = 0x26;
+		const int32_t PLAY_LOGIN = 0x2B;
+		const int32_t SYNCHRONIZE_PLAYER_POSITION = 0x40;
+		const int32_t CONFIRM_TELEPORTATION = 0x00;
+		const int32_t CHAT_COMMAND = 0x04;
+		const int32_t CHAT_MESSAGE = 0x06;
+		const int32_t CHUNK_BATCH_RECEIVED = 0x08;
+		const int32_t PLAY_KEEP_ALIVE_RESPONSE = 0x18;
+		const int32_t SET_PLAYER_POSITION = 0x1A;
+	}
+
+	struct Options {
+		std::string host{"127.0.0.1"};
+		unsigned int port = 25565;
+		unsigned int players = 100;
+		/** Connections opened per second until players are connected. */
+		double rate = 20;
+		std::chrono::seconds duration{120};
+		std::string namePrefix{"loadgen"};
+		/** Path walked by each player, as offsets in blocks from its origin; a square by default. */
+		std::vector<std::pair<double, double>> path{{0, 0}, {16, 0}, {16, 16}, {0, 16}};
+		/** Distance between the origins of the players, which are laid out on a grid around the spawn point. */
+		double spread = 32;
+		/** Blocks per second, as a player walks. */
+		double speed = 4.317;
+		int viewDistance = 10;
+		/** Interval between each player's chat messages and commands, which alternate. */
+		std::chrono::seconds chatInterval{60};
+		std::vector<std::string> messages{"Hello from the load generator"};
+		std::vector<std::string> commands{"list", "me is walking in circles"};
+		bool dbus = true;
+		Glib::ustring objectPath{"/net/za/slyfox/Minecraftd1"};
+		std::string busAddress;
+		std::chrono::seconds sampleInterval{5};
+		std::string output{"loadgen-results.json"};
+	};
+
+	double milliseconds(Clock::duration duration) {
+
+		return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(duration).count();
+	}
+
+	/** Nearest-rank percentile of sorted samples. */
+	double percentile(const std::vector<double> &sorted, double p) {
+
+		const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+		return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+	}
+
+	enum class Parse { INCOMPLETE, MALFORMED, COMPLETE };
+
+	Parse readVarInt(const char *data, size_t size, size_t &position, int32_t &value) {
+
+		uint32_t result = 0;
+		for(int shift = 0; shift < 35; shift += 7) {
+			if(position >= size) {
+				return Parse::INCOMPLETE;
+			}
+			const unsigned char byte = data[position++];
+			result |= uint32_t{byte & 0x7Fu} << shift;
+			if((byte & 0x80) == 0) {
+				value = static_cast<int32_t>(result);
+				return Parse::COMPLETE;
+			}
+		}
+		return Parse::MALFORMED;
+	}
+
+	std::string writeVarInt(uint32_t value) {
+
+		std::string result;
+		do {
+			const unsigned char byte = value & 0x7F;
+			value >>= 7;
+			result += static_cast<char>(byte | ((value != 0) ? 0x80 : 0));
+		} while(value != 0);
+		return result;
+	}
+
+	/** Builds the body of a packet: its fields, in the protocol's big-endian encoding, after the packet ID. */
+	class Writer {
+		public:
+			Writer(int32_t id) { varInt(id); }
+
+			Writer &boolean(bool value) { data_ += static_cast<char>(value ? 1 : 0); return *this; }
+			Writer &byte(uint8_t value) { data_ += static_cast<char>(value); return *this; }
+			Writer &float32(float value) {
+				uint32_t bits;
+				std::memcpy(&bits, &value, sizeof(bits));
+				return integer(bits, 4);
+			}
+			Writer &float64(double value) {
+				uint64_t bits;
+				std::memcpy(&bits, &value, sizeof(bits));
+				return integer(bits, 8);
+			}
+			Writer &integer(uint64_t value, int bytes) {
+				for(int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+					data_ += static_cast<char>(value >> shift);
+				}
+				return *this;
+			}
+			Writer &raw(const std::string &value) { data_ += value; return *this; }
+			Writer &string(const std::string &value) { varInt(value.size()); data_ += value; return *this; }
+			Writer &varInt(uint32_t value) { data_ += writeVarInt(value); return *this; }
+
+			const std::string &data() const { return data_; }
+
+		private:
+			std::string data_;
+	};
+
+	/** Reads the fields of a received packet, after its ID; reading past the end throws std::out_of_range. */
+	class Reader {
+		public:
+			Reader(const std::string &data, size_t position) : data_(data), position_{position} { }
+
+			uint8_t byte() { need(1); return data_[position_++]; }
+			double float64() {
+				const uint64_t bits = integer(8);
+				double value;
+				std::memcpy(&value, &bits, sizeof(value));
+				return value;
+			}
+			uint64_t integer(int bytes) {
+				need(bytes);
+				uint64_t value = 0;
+				for(int i = 0; i < bytes; ++i) {
+					value = (value << 8) | static_cast<unsigned char>(data_[position_++]);
+				}
+				return value;
+			}
+			std::string string() {
+				const int32_t length = varInt();
+				if(length < 0) {
+					throw std::out_of_range{"negative string length"};
+				}
+				need(length);
+				position_ += length;
+				return data_.substr(position_ - length, length);
+			}
+			int32_t varInt() {
+				int32_t value;
+				if(readVarInt(data_.data(), data_.size(), position_, value) != Parse::COMPLETE) {
+					throw std::out_of_range{"malformed VarInt"};
+				}
+				return value;
+			}
+			/** The rest of the packet. */
+			std::string rest() const { return data_.substr(position_); }
+
+		private:
+			void need(size_t bytes) const {
+				if(data_.size() - position_ < bytes) {
+					throw std::out_of_range{"packet too short"};
+				}
+			}
+
+			const std::string &data_;
+			size_t position_;
+	};
+
+	/**
+	 * Extracts the text of a disconnection reason: JSON text during login, or from 1.20.3 a text component in network
+	 * NBT, of which the first string (the plain text of a component, or the "text" of a compound) is taken.
+	 */
+	std::string reasonText(const std::string &reason, bool nbt) {
+
+		if(!nbt) {
+			return reason;
+		}
+		size_t position = std::string::npos;
+		if(!reason.empty() && (reason[0] == 0x08)) {
+			position = 1;
+		} else {
+			const std::string key{"\x08\x00\x04text", 7};
+			position = reason.find(key);
+			position = (position == std::string::npos) ? position : position + key.size();
+		}
+		if((position == std::string::npos) || (position + 2 > reason.size())) {
+			return "(unreadable reason)";
+		}
+		const size_t length = (static_cast<unsigned char>(reason[position]) << 8)
+			| static_cast<unsigned char>(reason[position + 1]);
+		return reason.substr(position + 2, length);
+	}
+
+	/** Inflates the packets the players act on, with one z_stream for the process rather than one per packet. */
+	class Inflater {
+		public:
+			Inflater() {
+
+				if(inflateInit(&stream_) != Z_OK) {
+					throw std::runtime_error{"Failed to initialise zlib"};
+				}
+			}
+			Inflater(const Inflater&) = delete;
+			~Inflater() { inflateEnd(&stream_); }
+
+			/**
+			 * Inflates as much of input as fits in size bytes of output, setting size to the bytes produced. Returns
+			 * false if input is corrupt, but not if it is merely the start of a stream.
+			 */
+			bool inflate(const char *input, size_t inputSize, char *output, size_t &size) {
+
+				inflateReset(&stream_);
+				stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input));
+				stream_.avail_in = inputSize;
+				stream_.next_out = reinterpret_cast<Bytef*>(output);
+				stream_.avail_out = size;
+				const int result = ::inflate(&stream_, Z_SYNC_FLUSH);
+				size -= stream_.avail_out;
+				return (result == Z_OK) || (result == Z_STREAM_END) || (result == Z_BUF_ERROR);
+			}
+
+		private:
+			z_stream stream_{};
+	};
+
+	/**
+	 * One simulated player: connects, logs in and configures as a vanilla client would, then once the server has placed
+	 * it walks its path, chats and runs commands. Packets the player does not act on, chunks above all, are recognised
+	 * by their ID and skipped as they arrive, so that thousands of players need neither the memory nor the CPU to keep
+	 * up.
+	 */
+	class Connection {
+		public:
+			enum class State { CONNECTING, LOGIN, CONFIGURATION, PLAY, CLOSED };
+
+			Connection(const Options &options, Inflater &inflater, int epollFd, int fd, unsigned int index,
+					Clock::time_point start) : options_(options), inflater_(inflater), epollFd_{epollFd}, fd_{fd},
+					index_{index}, name_{options.namePrefix + std::to_string(index)}, random_{index},
+					connectStart_{start} {
+
+				epoll_event event{};
+				event.events = EPOLLIN | EPOLLOUT;
+				event.data.ptr = this;
+				if(epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd_, &event) != 0) {
+					const int error = errno;
+					close(fd_);
+					throw std::system_error{error, std::system_category(), "Failed to poll connection"};
+				}
+			}
+			Connection(const Connection&) = delete;
+
+			~Connection() {
+
+				if(fd_ >= 0) {
+					close(fd_);
+				}
+			}
+
+			const std::string &failure() const { return failure_; }
+			State state() const { return state_; }
+
+			/** Bytes received and sent per second, from connecting until the connection closed or now. */
+			bool throughput(Clock::time_point now, double &in, double &out) const {
+
+				if(connected_ == Clock::time_point{}) {
+					return false;
+				}
+				const double seconds = std::chrono::duration<double>(
+						((state_ == State::CLOSED) ? closed_ : now) - connected_).count();
+				if(seconds <= 0) {
+					return false;
+				}
+				in = bytesIn_ / seconds;
+				out = bytesOut_ / seconds;
+				return true;
+			}
+
+			/** Handles events polled for the connection. Latencies are appended to the vectors as they are measured. */
+			void onEvents(uint32_t events, std::vector<double> &connectLatencies, std::vector<double> &loginLatencies) {
+
+				if(state_ == State::CONNECTING) {
+					onConnected(connectLatencies);
+				} else if(state_ != State::CLOSED) {
+					if((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) {
+						onReadable();
+					}
+				}
+				if((loggedIn_ != Clock::time_point{}) && !loginReported_) {
+					loginLatencies.push_back(milliseconds(loggedIn_ - connected_));
+					loginReported_ = true;
+				}
+				flush();
+			}
+
+			/** Moves the player along its path, and chats, once per tick. */
+			void tick(Clock::time_point now, unsigned int &messages, unsigned int &commands) {
+
+				if((state_ != State::PLAY) && (state_ != State::CLOSED) && (now - connectStart_ > LOGIN_TIMEOUT)) {
+					fail("Timed out logging in");
+					return;
+				} else if((state_ != State::PLAY) || !positioned_) {
+					return;
+				}
+
+				const std::pair<double, double> &waypoint = options_.path[waypoint_];
+				const double dx = originX_ + waypoint.first - x_;
+				const double dz = originZ_ + waypoint.second - z_;
+				const double distance = std::sqrt(dx * dx + dz * dz);
+				const double step = options_.speed * std::chrono::duration<double>(TICK_INTERVAL).count();
+				if(distance <= step) {
+					x_ += dx;
+					z_ += dz;
+					waypoint_ = (waypoint_ + 1) % options_.path.size();
+				} else {
+					x_ += dx / distance * step;
+					z_ += dz / distance * step;
+				}
+				send(Writer{packets::SET_PLAYER_POSITION}.float64(x_).float64(y_).float64(z_).boolean(true));
+
+				if(now >= nextChat_) {
+					if((chats_++ % 2 == 0) && !options_.messages.empty()) {
+						const std::string &message = options_.messages[random_() % options_.messages.size()];
+						const auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+								std::chrono::system_clock::now().time_since_epoch()).count();
+						// Unsigned, with no acknowledged messages: a fixed bit set of 20 bits
+						send(Writer{packets::CHAT_MESSAGE}.string(message).integer(timestamp, 8)
+								.integer(random_(), 8).boolean(false).varInt(0).raw(std::string(3, '\0')));
+						++messages;
+					} else if(!options_.commands.empty()) {
+						send(Writer{packets::CHAT_COMMAND}.string(
+									options_.commands[random_() % options_.commands.size()]));
+						++commands;
+					}
+					scheduleChat(now, 0.5);
+				}
+				flush();
+			}
+
+		private:
+			/** A player not in the play state this long after connecting is given up on. */
+			static constexpr std::chrono::seconds LOGIN_TIMEOUT{30};
+			/** Chunks per tick the players ask for, about what a vanilla client on a fast connection settles at. */
+			static constexpr float CHUNKS_PER_TICK = 20.0f;
+
+			void configure(int32_t id, Reader &reader) {
+
+				if(id == packets::KNOWN_PACKS) {
+					// Knowing no packs, the player is sent the registries in full, as a modded client would be
+					send(Writer{packets::SERVERBOUND_KNOWN_PACKS}.varInt(0));
+				} else if(id == packets::CONFIGURATION_KEEP_ALIVE) {
+					send(Writer{packets::CONFIGURATION_KEEP_ALIVE_RESPONSE}.integer(reader.integer(8), 8));
+				} else if(id == packets::FINISH_CONFIGURATION) {
+					send(Writer{packets::ACKNOWLEDGE_FINISH_CONFIGURATION});
+					state_ = State::PLAY;
+				} else if(id == packets::CONFIGURATION_DISCONNECT) {
+					fail("Disconnected: " + reasonText(reader.rest(), true));
+				}
+			}
+
+			void fail(const std::string &reason) {
+
+				if(state_ == State::CLOSED) {
+					return;
+				}
+				failure_ = reason;
+				state_ = State::CLOSED;
+				closed_ = Clock::now();
+				epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd_, nullptr);
+				close(fd_);
+				fd_ = -1;
+				input_.clear();
+				output_.clear();
+			}
+
+			void flush() {
+
+				while((state_ != State::CLOSED) && !output_.empty()) {
+					const ssize_t sent = ::send(fd_, output_.data(), output_.size(), MSG_NOSIGNAL);
+					if(sent >= 0) {
+						bytesOut_ += sent;
+						output_.erase(0, sent);
+					} else if((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+						break;
+					} else if(errno != EINTR) {
+						fail(std::string{"Failed to send: "} + std::strerror(errno));
+					}
+				}
+
+				const bool pollOutput = (state_ == State::CONNECTING) || !output_.empty();
+				if((state_ != State::CLOSED) && (pollOutput != pollingOutput_)) {
+					epoll_event event{};
+					event.events = EPOLLIN | (pollOutput ? static_cast<uint32_t>(EPOLLOUT) : 0);
+					event.data.ptr = this;
+					epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd_, &event);
+					pollingOutput_ = pollOutput;
+				}
+			}
+
+			void handle(const char *frame, size_t size) {
+
+				std::string packet;
+				if(compressionThreshold_ < 0) {
+					packet.assign(frame, size);
+				} else {
+					size_t position = 0;
+					int32_t dataLength = 0;
+					readVarInt(frame, size, position, dataLength);
+					if(dataLength == 0) {
+						packet.assign(frame + position, size - position);
+					} else if((dataLength < 0) || (static_cast<size_t>(dataLength) > MAX_PACKET_SIZE)) {
+						fail("Malformed compressed packet");
+						return;
+					} else {
+						packet.resize(dataLength);
+						size_t inflated = dataLength;
+						if(!inflater_.inflate(frame + position, size - position, &packet[0], inflated)
+								|| (inflated != packet.size())) {
+							fail("Corrupt compressed packet");
+							return;
+						}
+					}
+				}
+
+				try {
+					Reader reader{packet, 0};
+					const int32_t id = reader.varInt();
+					if(state_ == State::LOGIN) {
+						login(id, reader);
+					} else if(state_ == State::CONFIGURATION) {
+						configure(id, reader);
+					} else if(state_ == State::PLAY) {
+						play(id, reader);
+					}
+				} catch(const std::out_of_range &e) {
+					fail(std::string{"Malformed packet: "} + e.what());
+				}
+			}
+
+			/** Whether the player acts on packets with this ID in its current state, rather than skipping them. */
+			bool interesting(int32_t id) const {
+
+				if(state_ == State::CONFIGURATION) {
+					return (id == packets::KNOWN_PACKS) || (id == packets::CONFIGURATION_KEEP_ALIVE)
+						|| (id == packets::FINISH_CONFIGURATION) || (id == packets::CONFIGURATION_DISCONNECT);
+				} else if(state_ == State::PLAY) {
+					return (id == packets::PLAY_KEEP_ALIVE) || (id == packets::SYNCHRONIZE_PLAYER_POSITION)
+						|| (id == packets::CHUNK_BATCH_FINISHED) || (id == packets::PLAY_LOGIN)
+						|| (id == packets::PLAY_DISCONNECT);
+				}
+				return true;
+			}
+
+			void login(int32_t id, Reader &reader) {
+
+				if(id == packets::SET_COMPRESSION) {
+					compressionThreshold_ = reader.varInt();
+				} else if(id == packets::LOGIN_SUCCESS) {
+					send(Writer{packets::LOGIN_ACKNOWLEDGED});
+					state_ = State::CONFIGURATION;
+					// Locale, view distance, chat mode (enabled), chat colours, skin parts, main hand (right), text
+					// filtering and server listing
+					send(Writer{packets::CLIENT_INFORMATION}.string("en_us").byte(options_.viewDistance).varInt(0)
+							.boolean(true).byte(0x7F).varInt(1).boolean(false).boolean(true));
+				} else if(id == packets::LOGIN_PLUGIN_REQUEST) {
+					send(Writer{packets::LOGIN_PLUGIN_RESPONSE}.varInt(reader.varInt()).boolean(false));
+				} else if(id == packets::ENCRYPTION_REQUEST) {
+					fail("The server is in online mode");
+				} else if(id == packets::LOGIN_DISCONNECT) {
+					fail("Disconnected: " + reasonText(reader.string(), false));
+				}
+			}
+
+			void onConnected(std::vector<double> &connectLatencies) {
+
+				int error = 0;
+				socklen_t length = sizeof(error);
+				if(getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &length) != 0) {
+					error = errno;
+				}
+				if(error == EINPROGRESS) {
+					return;
+				} else if(error != 0) {
+					fail(std::string{"Failed to connect: "} + std::strerror(error));
+					return;
+				}
+
+				connected_ = Clock::now();
+				connectLatencies.push_back(milliseconds(connected_ - connectStart_));
+				state_ = State::LOGIN;
+				// Offline-mode UUIDs are derived from the name by the server, which ignores the one sent
+				send(Writer{packets::HANDSHAKE}.varInt(PROTOCOL_VERSION).string(options_.host)
+						.integer(options_.port, 2).varInt(2));
+				send(Writer{packets::LOGIN_START}.string(name_).integer(0, 8).integer(index_, 8));
+			}
+
+			void onReadable() {
+
+				char buffer[64 * 1024];
+				// Level-triggered, so a connection with more to read is returned to after the others have had a turn
+				for(int reads = 0; (reads < 16) && (state_ != State::CLOSED); ++reads) {
+					const ssize_t received = recv(fd_, buffer, sizeof(buffer), 0);
+					if(received > 0) {
+						receive(buffer, received);
+					} else if(received == 0) {
+						fail("Connection closed by the server");
+					} else if((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+						break;
+					} else if(errno != EINTR) {
+						fail(std::string{"Failed to receive: "} + std::strerror(errno));
+					}
+				}
+			}
+
+			/**
+			 * Reads the ID of the packet at the start of frame, which need not be complete: of a compressed packet,
+			 * only as much is inflated as holds the ID.
+			 */
+			Parse peekId(const char *frame, size_t size, int32_t &id) const {
+
+				size_t position = 0;
+				if(compressionThreshold_ < 0) {
+					return readVarInt(frame, size, position, id);
+				}
+				int32_t dataLength;
+				const Parse parse = readVarInt(frame, size, position, dataLength);
+				if(parse != Parse::COMPLETE) {
+					return parse;
+				} else if(dataLength == 0) {
+					return readVarInt(frame, size, position, id);
+				}
+				char prefix[5];
+				size_t inflated = sizeof(prefix);
+				if(!inflater_.inflate(frame + position, size - position, prefix, inflated)) {
+					return Parse::MALFORMED;
+				}
+				position = 0;
+				return readVarInt(prefix, inflated, position, id);
+			}
+
+			void play(int32_t id, Reader &reader) {
+
+				if(id == packets::PLAY_KEEP_ALIVE) {
+					send(Writer{packets::PLAY_KEEP_ALIVE_RESPONSE}.integer(reader.integer(8), 8));
+				} else if(id == packets::SYNCHRONIZE_PLAYER_POSITION) {
+					const double x = reader.float64(), y = reader.float64(), z = reader.float64();
+					reader.integer(8);
+					const uint8_t relative = reader.byte();
+					const int32_t teleport = reader.varInt();
+					x_ = ((relative & 0x01) != 0) ? x_ + x : x;
+					y_ = ((relative & 0x02) != 0) ? y_ + y : y;
+					z_ = ((relative & 0x04) != 0) ? z_ + z : z;
+					send(Writer{packets::CONFIRM_TELEPORTATION}.varInt(teleport));
+					send(Writer{packets::SET_PLAYER_POSITION}.float64(x_).float64(y_).float64(z_).boolean(true));
+					if(!positioned_) {
+						// Players are laid out on a grid around where the first is placed, so that each walks its
+						// path in a different part of the world, as a server's players would
+						const unsigned int side = std::ceil(std::sqrt(options_.players));
+						originX_ = x_ + (static_cast<double>(index_ % side) - side / 2.0) * options_.spread;
+						originZ_ = z_ + (static_cast<double>(index_ / side) - side / 2.0) * options_.spread;
+						positioned_ = true;
+					}
+				} else if(id == packets::CHUNK_BATCH_FINISHED) {
+					send(Writer{packets::CHUNK_BATCH_RECEIVED}.float32(CHUNKS_PER_TICK));
+				} else if(id == packets::PLAY_LOGIN) {
+					loggedIn_ = Clock::now();
+					scheduleChat(loggedIn_, 0.0);
+				} else if(id == packets::PLAY_DISCONNECT) {
+					fail("Disconnected: " + reasonText(reader.rest(), true));
+				}
+			}
+
+			/**
+			 * Splits received data into packets, buffering those the player acts on until they are complete and
+			 * skipping the rest as they arrive.
+			 */
+			void receive(const char *data, size_t size) {
+
+				bytesIn_ += size;
+				const size_t skipped = std::min(skip_, size);
+				skip_ -= skipped;
+				input_.append(data + skipped, size - skipped);
+
+				size_t consumed = 0;
+				while((state_ != State::CLOSED) && (consumed < input_.size())) {
+					size_t position = consumed;
+					int32_t length;
+					const Parse parse = readVarInt(input_.data(), input_.size(), position, length);
+					if(parse == Parse::INCOMPLETE) {
+						break;
+					} else if((parse == Parse::MALFORMED) || (length <= 0)) {
+						fail("Malformed packet length");
+						return;
+					}
+
+					const size_t available = std::min<size_t>(input_.size() - position, length);
+					int32_t id;
+					const Parse idParse = peekId(input_.data() + position, available, id);
+					if((idParse == Parse::MALFORMED)
+							|| ((idParse == Parse::INCOMPLETE) && (available == static_cast<size_t>(length)))) {
+						fail("Malformed packet");
+						return;
+					} else if((idParse == Parse::COMPLETE) && !interesting(id)) {
+						skip_ = length - available;
+						consumed = position + available;
+					} else if(available < static_cast<size_t>(length)) {
+						if((idParse == Parse::COMPLETE) && (static_cast<size_t>(length) > MAX_PACKET_SIZE)) {
+							fail("Packet too large");
+							return;
+						}
+						break;
+					} else {
+						consumed = position + length;
+						handle(input_.data() + position, length);
+					}
+				}
+				if(state_ != State::CLOSED) {
+					input_.erase(0, consumed);
+				}
+			}
+
+			/** Schedules the next chat message or command, between minimum and minimum + 1 chat intervals from now. */
+			void scheduleChat(Clock::time_point now, double minimum) {
+
+				std::uniform_real_distribution<double> factor{minimum, minimum + 1.0};
+				nextChat_ = now + std::chrono::duration_cast<Clock::duration>(
+						options_.chatInterval * factor(random_));
+			}
+
+			void send(const Writer &packet) {
+
+				const std::string &data = packet.data();
+				if(compressionThreshold_ < 0) {
+					output_ += writeVarInt(data.size()) + data;
+				} else if(data.size() < static_cast<size_t>(compressionThreshold_)) {
+					output_ += writeVarInt(data.size() + 1) + '\0' + data;
+				} else {
+					uLongf compressedSize = compressBound(data.size());
+					std::string compressed(compressedSize, '\0');
+					compress2(reinterpret_cast<Bytef*>(&compressed[0]), &compressedSize,
+							reinterpret_cast<const Bytef*>(data.data()), data.size(), Z_DEFAULT_COMPRESSION);
+					compressed.resize(compressedSize);
+					const std::string dataLength = writeVarInt(data.size());
+					output_ += writeVarInt(dataLength.size() + compressed.size()) + dataLength + compressed;
+				}
+			}
+
+			const Options &options_;
+			Inflater &inflater_;
+			int epollFd_;
+			int fd_;
+			unsigned int index_;
+			std::string name_;
+			std::minstd_rand random_;
+
+			State state_ = State::CONNECTING;
+			std::string failure_;
+			int32_t compressionThreshold_ = -1;
+			std::string input_;
+			std::string output_;
+			bool pollingOutput_ = true;
+			/** Bytes still to arrive of a packet being skipped. */
+			size_t skip_ = 0;
+
+			Clock::time_point connectStart_;
+			Clock::time_point connected_;
+			Clock::time_point loggedIn_;
+			Clock::time_point closed_;
+			bool loginReported_ = false;
+			uint64_t bytesIn_ = 0;
+			uint64_t bytesOut_ = 0;
+
+			bool positioned_ = false;
+			double x_ = 0, y_ = 0, z_ = 0;
+			double originX_ = 0, originZ_ = 0;
+			size_t waypoint_ = 0;
+			unsigned int chats_ = 0;
+			Clock::time_point nextChat_;
+	};
+
+	constexpr std::chrono::seconds Connection::LOGIN_TIMEOUT;
+	constexpr float Connection::CHUNKS_PER_TICK;
+
+	/** A sample of the server's tick times, with the number of players in the play state when it was taken. */
+	struct TickSample {
+		double elapsed;
+		unsigned int players;
+		double meanTickTime;
+		double maxTickTime;
+	};
+
+	/**
+	 * Samples the server's tick times from minecraftd's D-Bus object, on a thread of its own so that a slow bus never
+	 * holds up the players.
+	 */
+	class TickSampler {
+		public:
+			TickSampler(const Options &options, const std::atomic<unsigned int> &players, Clock::time_point start)
+					: options_(options), players_(players), start_{start} {
+
+				connection_ = options.busAddress.empty()
+					? Gio::DBus::Connection::get_sync(Gio::DBus::BUS_TYPE_SYSTEM)
+					: Gio::DBus::Connection::create_for_address_sync(options.busAddress,
+							Gio::DBus::CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+							| Gio::DBus::CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION);
+				// Read once up front, so that a minecraftd that is not there fails the run before any player connects
+				get("MeanTickTime");
+				thread_ = std::thread{&TickSampler::run, this};
+			}
+			TickSampler(const TickSampler&) = delete;
+
+			~TickSampler() {
+
+				{
+					std::lock_guard<std::mutex> lock{mutex_};
+					stopping_ = true;
+				}
+				condition_.notify_all();
+				thread_.join();
+			}
+
+			std::vector<TickSample> samples() {
+
+				std::lock_guard<std::mutex> lock{mutex_};
+				return samples_;
+			}
+
+		private:
+			double get(const Glib::ustring &property) {
+
+				Glib::VariantContainerBase reply = connection_->call_sync(options_.objectPath,
+						"org.freedesktop.DBus.Properties", "Get", Glib::VariantContainerBase::create_tuple({
+							Glib::Variant<Glib::ustring>::create(INTERFACE),
+							Glib::Variant<Glib::ustring>::create(property)}), BUS_NAME);
+				Glib::Variant<Glib::VariantBase> value;
+				reply.get_child(value, 0);
+				return Glib::VariantBase::cast_dynamic<Glib::Variant<double>>(value.get()).get();
+			}
+
+			void run() {
+
+				std::unique_lock<std::mutex> lock{mutex_};
+				while(!condition_.wait_for(lock, options_.sampleInterval, [this]() { return stopping_; })) {
+					lock.unlock();
+					TickSample sample;
+					sample.elapsed = std::chrono::duration<double>(Clock::now() - start_).count();
+					sample.players = players_;
+					bool sampled = false;
+					try {
+						sample.meanTickTime = get("MeanTickTime");
+						sample.maxTickTime = get("MaxTickTime");
+						sampled = true;
+					} catch(const Glib::Error &e) {
+						std::cerr << "Failed to sample tick times: " << e.what() << std::endl;
+					}
+					lock.lock();
+					if(sampled) {
+						samples_.push_back(sample);
+					}
+				}
+			}
+
+			const Options &options_;
+			const std::atomic<unsigned int> &players_;
+			Clock::time_point start_;
+			Glib::RefPtr<Gio::DBus::Connection> connection_;
+
+			std::mutex mutex_;
+			std::condition_variable condition_;
+			bool stopping_ = false;
+			std::vector<TickSample> samples_;
+			std::thread thread_;
+	};
+
+	volatile std::sig_atomic_t interrupted = 0;
+
+	void onInterrupt(int) {
+
+		interrupted = 1;
+	}
+
+	struct Results {
+		std::map<std::string, std::vector<double>> samples;
+		std::vector<TickSample> ticks;
+		std::map<std::string, unsigned int> failures;
+		unsigned int opened = 0;
+		unsigned int playing = 0;
+		unsigned int messages = 0;
+		unsigned int commands = 0;
+		double elapsed = 0;
+	};
+
+	/**
+	 * Opens connections at the configured rate and drives them all from one epoll loop, ticking every player every
+	 * TICK_INTERVAL, until the duration has passed or the run is interrupted.
+	 */
+	void runLoad(const Options &options, const addrinfo &address, Results &results) {
+
+		const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+		const int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if((epollFd < 0) || (timerFd < 0)) {
+			throw std::system_error{errno, std::system_category(), "Failed to create event loop"};
+		}
+		itimerspec interval{};
+		interval.it_interval.tv_nsec = std::chrono::nanoseconds{TICK_INTERVAL}.count();
+		interval.it_value = interval.it_interval;
+		epoll_event timerEvent{};
+		timerEvent.events = EPOLLIN;
+		timerEvent.data.ptr = nullptr;
+		if((timerfd_settime(timerFd, 0, &interval, nullptr) != 0)
+				|| (epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &timerEvent) != 0)) {
+			throw std::system_error{errno, std::system_category(), "Failed to start tick timer"};
+		}
+
+		Inflater inflater;
+		std::vector<std::unique_ptr<Connection>> connections;
+		std::vector<double> &connectLatencies = results.samples["connect_latency"];
+		std::vector<double> &loginLatencies = results.samples["login_latency"];
+		std::atomic<unsigned int> playing{0};
+		const Clock::time_point start = Clock::now();
+		std::unique_ptr<TickSampler> sampler;
+		if(options.dbus) {
+			sampler.reset(new TickSampler{options, playing, start});
+		}
+
+		// The ramp is over once every connection has been opened; tick times are only summarised from then on
+		const double rampSeconds = options.players / options.rate;
+		Clock::time_point nextStatus = start;
+		epoll_event events[MAX_EVENTS];
+		Clock::time_point now = start;
+		while((now - start < options.duration) && (interrupted == 0)) {
+			const int count = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+			if((count < 0) && (errno != EINTR)) {
+				throw std::system_error{errno, std::system_category(), "Failed to poll connections"};
+			}
+
+			bool ticked = false;
+			for(int i = 0; i < count; ++i) {
+				if(events[i].data.ptr == nullptr) {
+					uint64_t expirations;
+					ticked = (read(timerFd, &expirations, sizeof(expirations)) > 0) || ticked;
+				} else {
+					static_cast<Connection*>(events[i].data.ptr)->onEvents(events[i].events, connectLatencies,
+							loginLatencies);
+				}
+			}
+			if(!ticked) {
+				continue;
+			}
+
+			now = Clock::now();
+			const double elapsed = std::chrono::duration<double>(now - start).count();
+			const unsigned int due = std::min<unsigned int>(options.players, elapsed * options.rate + 1);
+			while(results.opened < due) {
+				const unsigned int index = results.opened++;
+				const Clock::time_point connectStart = Clock::now();
+				const int fd = socket(address.ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+				const int noDelay = 1;
+				if((fd < 0) || (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) != 0)
+						|| ((connect(fd, address.ai_addr, address.ai_addrlen) != 0) && (errno != EINPROGRESS))) {
+					++results.failures[std::string{"Failed to connect: "} + std::strerror(errno)];
+					if(fd >= 0) {
+						close(fd);
+					}
+					continue;
+				}
+				try {
+					connections.emplace_back(new Connection{options, inflater, epollFd, fd, index, connectStart});
+				} catch(const std::system_error &e) {
+					++results.failures[e.what()];
+				}
+			}
+
+			unsigned int counts[5] = {};
+			for(const auto &connection: connections) {
+				connection->tick(now, results.messages, results.commands);
+				++counts[static_cast<int>(connection->state())];
+			}
+			playing = counts[static_cast<int>(Connection::State::PLAY)];
+
+			if(now >= nextStatus) {
+				std::cout << "[" << std::setw(5) << static_cast<unsigned int>(elapsed) << "s] connecting "
+					<< counts[static_cast<int>(Connection::State::CONNECTING)] << ", logging in "
+					<< (counts[static_cast<int>(Connection::State::LOGIN)]
+							+ counts[static_cast<int>(Connection::State::CONFIGURATION)])
+					<< ", playing " << playing << ", failed "
+					<< (counts[static_cast<int>(Connection::State::CLOSED)] + results.opened - connections.size());
+				const std::vector<TickSample> ticks = sampler ? sampler->samples() : std::vector<TickSample>{};
+				if(!ticks.empty()) {
+					std::cout << std::fixed << std::setprecision(1) << "; ticks: mean " << ticks.back().meanTickTime
+						<< " ms, max " << ticks.back().maxTickTime << " ms";
+				}
+				std::cout << std::endl;
+				nextStatus += STATUS_INTERVAL;
+			}
+		}
+
+		results.elapsed = std::chrono::duration<double>(now - start).count();
+		results.playing = playing;
+		for(const auto &connection: connections) {
+			double in, out;
+			if(connection->throughput(now, in, out)) {
+				results.samples["bytes_in_per_second"].push_back(in);
+				results.samples["bytes_out_per_second"].push_back(out);
+			}
+			if(connection->state() == Connection::State::CLOSED) {
+				++results.failures[connection->failure()];
+			}
+		}
+		if(sampler) {
+			results.ticks = sampler->samples();
+			for(const TickSample &sample: results.ticks) {
+				if(sample.elapsed >= rampSeconds) {
+					results.samples["mean_tick_time"].push_back(sample.meanTickTime);
+					results.samples["max_tick_time"].push_back(sample.maxTickTime);
+				}
+			}
+		}
+		connections.clear();
+		close(timerFd);
+		close(epollFd);
+	}
+
+	void writeResults(const Options &options, const Results &results) {
+
+		// Measurements in the order they are reported, with their units
+		const std::pair<const char*, const char*> measurements[] = {{"connect_latency", "ms"},
+			{"login_latency", "ms"}, {"mean_tick_time", "ms"}, {"max_tick_time", "ms"},
+			{"bytes_in_per_second", "B/s"}, {"bytes_out_per_second", "B/s"}};
+
+		char timestamp[32];
+		const std::time_t now = std::time(nullptr);
+		std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+		std::ofstream out{options.output};
+		out << std::fixed << std::setprecision(3)
+			<< "{\n"
+			<< "\t\"timestamp\": \"" << timestamp << "\",\n"
+			<< "\t\"players\": " << options.players << ",\n"
+			<< "\t\"rate\": " << options.rate << ",\n"
+			<< "\t\"duration\": " << results.elapsed << ",\n"
+			<< "\t\"opened\": " << results.opened << ",\n"
+			<< "\t\"playing\": " << results.playing << ",\n"
+			<< "\t\"chatMessages\": " << results.messages << ",\n"
+			<< "\t\"commands\": " << results.commands << ",\n"
+			<< "\t\"failures\": {";
+		for(const auto &failure: results.failures) {
+			std::string reason;
+			for(char c: failure.first) {
+				if((c == '"') || (c == '\\')) {
+					reason += '\\';
+				}
+				reason += (static_cast<unsigned char>(c) < 0x20) ? ' ' : c;
+			}
+			out << ((&failure == &*results.failures.begin()) ? "\n" : ",\n") << "\t\t\"" << reason << "\": "
+				<< failure.second;
+		}
+		out << (results.failures.empty() ? "},\n" : "\n\t},\n") << "\t\"measurements\": {";
+
+		std::cout << std::left << std::setw(22) << "measurement" << std::right << std::setw(12) << "p50"
+			<< std::setw(12) << "p90" << std::setw(12) << "p99" << std::setw(12) << "max" << std::endl
+			<< std::fixed << std::setprecision(2);
+		bool first = true;
+		for(const auto &measurement: measurements) {
+			const auto samples = results.samples.find(measurement.first);
+			if((samples == results.samples.end()) || samples->second.empty()) {
+				continue;
+			}
+			std::vector<double> sorted{samples->second};
+			std::sort(sorted.begin(), sorted.end());
+			double total = 0;
+			for(double sample: sorted) {
+				total += sample;
+			}
+
+			out << (first ? "\n" : ",\n") << "\t\t\"" << measurement.first << "\": {\n"
+				<< "\t\t\t\"unit\": \"" << measurement.second << "\",\n"
+				<< "\t\t\t\"count\": " << sorted.size() << ",\n"
+				<< "\t\t\t\"min\": " << sorted.front() << ",\n"
+				<< "\t\t\t\"mean\": " << total / sorted.size() << ",\n"
+				<< "\t\t\t\"p50\": " << percentile(sorted, 50) << ",\n"
+				<< "\t\t\t\"p90\": " << percentile(sorted, 90) << ",\n"
+				<< "\t\t\t\"p99\": " << percentile(sorted, 99) << ",\n"
+				<< "\t\t\t\"max\": " << sorted.back() << "\n"
+				<< "\t\t}";
+			first = false;
+
+			std::cout << std::left << std::setw(22) << measurement.first << std::right << std::setw(12)
+				<< percentile(sorted, 50) << std::setw(12) << percentile(sorted, 90) << std::setw(12)
+				<< percentile(sorted, 99) << std::setw(12) << sorted.back() << "  (" << measurement.second << ')'
+				<< std::endl;
+		}
+
+		out << "\n\t},\n\t\"tickSamples\": [";
+		for(const TickSample &sample: results.ticks) {
+			out << ((&sample == &results.ticks.front()) ? "\n" : ",\n") << "\t\t{\"elapsed\": " << sample.elapsed
+				<< ", \"players\": " << sample.players << ", \"mean\": " << sample.meanTickTime << ", \"max\": "
+				<< sample.maxTickTime << '}';
+		}
+		out << (results.ticks.empty() ? "]\n}\n" : "\n\t]\n}\n");
+
+		out.close();
+		if(!out) {
+			throw std::runtime_error{"Failed to write " + options.output};
+		}
+		for(const auto &failure: results.failures) {
+			std::cout << failure.second << " connection(s) failed: " << failure.first << std::endl;
+		}
+		std::cout << results.playing << " of " << options.players << " players were playing at the end; results "
+			"written to " << options.output << std::endl;
+	}
+
+	std::vector<std::pair<double, double>> readPath(const std::string &path) {
+
+		std::ifstream in{path};
+		if(!in) {
+			throw std::runtime_error{"Failed to read " + path};
+		}
+		std::vector<std::pair<double, double>> waypoints;
+		std::string line;
+		while(std::getline(in, line)) {
+			line = line.substr(0, line.find('#'));
+			if(line.find_first_not_of(" \t\r") == std::string::npos) {
+				continue;
+			}
+			std::istringstream fields{line};
+			std::pair<double, double> waypoint;
+			if(!(fields >> waypoint.first >> waypoint.second)) {
+				throw std::runtime_error{path + ": expected \"dx dz\", got \"" + line + '"'};
+			}
+			waypoints.push_back(waypoint);
+		}
+		if(waypoints.empty()) {
+			throw std::runtime_error{path + " has no waypoints"};
+		}
+		return waypoints;
+	}
+}
+
+int main(int argc, char **argv) {
+
+	Options options;
+	bool defaultMessages = true;
+	bool defaultCommands = true;
+	std::vector<std::string> arguments{argv + 1, argv + argc};
+	try {
+		for(auto it = arguments.cbegin(); it != arguments.cend(); ++it) {
+			auto value = [&]() -> const std::string& {
+				if(++it == arguments.cend()) {
+					std::cerr << "Error: " << *(it - 1) << " requires an argument" << std::endl;
+					std::exit(1);
+				}
+				return *it;
+			};
+
+			if((*it == "--help") || (*it == "-h")) {
+				std::cout << "Usage: " << argv[0] << " [options]" << std::endl << std::endl
+					<< "  --host <address>\tServer address (default: " << options.host << ')' << std::endl
+					<< "  --port <n>\t\tServer port (default: " << options.port << ')' << std::endl
+					<< "  --players <n>\t\tConnections to open (default: " << options.players << ')' << std::endl
+					<< "  --rate <n>\t\tConnections opened per second (default: " << options.rate << ')' << std::endl
+					<< "  --duration <s>\tLength of the run (default: " << options.duration.count() << ')'
+					<< std::endl
+					<< "  --prefix <name>\tPrefix of the player names (default: " << options.namePrefix << ')'
+					<< std::endl
+					<< "  --path <path>\t\tFile of \"dx dz\" waypoints each player walks in a loop" << std::endl
+					<< "  \t\t\t(default: a square of 16 blocks)" << std::endl
+					<< "  --spread <blocks>\tDistance between the players' paths (default: " << options.spread << ')'
+					<< std::endl
+					<< "  --speed <blocks/s>\tWalking speed (default: " << options.speed << ')' << std::endl
+					<< "  --view-distance <n>\tView distance asked for (default: " << options.viewDistance << ')'
+					<< std::endl
+					<< "  --chat-interval <s>\tMean interval between each player's messages and commands" << std::endl
+					<< "  \t\t\t(default: " << options.chatInterval.count() << ')' << std::endl
+					<< "  --message <text>\tChat message to send, repeatable" << std::endl
+					<< "  --command <text>\tCommand to run, without the slash, repeatable" << std::endl
+					<< "  --no-dbus\t\tDoes not sample tick times from minecraftd" << std::endl
+					<< "  --bus-address <addr>\tD-Bus address to sample from (default: the system bus)" << std::endl
+					<< "  --object <path>\tminecraftd object to sample (default: " << options.objectPath << ')'
+					<< std::endl
+					<< "  --sample-interval <s>\tInterval between tick time samples (default: "
+					<< options.sampleInterval.count() << ')' << std::endl
+					<< "  --output <path>\tJSON results file (default: " << options.output << ')' << std::endl;
+				return 0;
+			} else if(*it == "--host") {
+				options.host = value();
+			} else if(*it == "--port") {
+				options.port = std::stoul(value());
+			} else if(*it == "--players") {
+				options.players = std::stoul(value());
+			} else if(*it == "--rate") {
+				options.rate = std::stod(value());
+			} else if(*it == "--duration") {
+				options.duration = std::chrono::seconds{std::stoul(value())};
+			} else if(*it == "--prefix") {
+				options.namePrefix = value();
+			} else if(*it == "--path") {
+				options.path = readPath(value());
+			} else if(*it == "--spread") {
+				options.spread = std::stod(value());
+			} else if(*it == "--speed") {
+				options.speed = std::stod(value());
+			} else if(*it == "--view-distance") {
+				options.viewDistance = std::stoi(value());
+			} else if(*it == "--chat-interval") {
+				options.chatInterval = std::chrono::seconds{std::stoul(value())};
+			} else if(*it == "--message") {
+				if(defaultMessages) {
+					options.messages.clear();
+					defaultMessages = false;
+				}
+				options.messages.push_back(value());
+			} else if(*it == "--command") {
+				if(defaultCommands) {
+					options.commands.clear();
+					defaultCommands = false;
+				}
+				options.commands.push_back(value());
+			} else if(*it == "--no-dbus") {
+				options.dbus = false;
+			} else if(*it == "--bus-address") {
+				options.busAddress = value();
+			} else if(*it == "--object") {
+				options.objectPath = value();
+			} else if(*it == "--sample-interval") {
+				options.sampleInterval = std::chrono::seconds{std::stoul(value())};
+			} else if(*it == "--output") {
+				options.output = value();
+			} else {
+				std::cerr << "Unknown option: " << *it << std::endl;
+				return 1;
+			}
+		}
+	} catch(const std::exception &e) {
+		std::cerr << "Invalid arguments: " << e.what() << std::endl;
+		return 1;
+	}
+
+	// Player names are limited to 16 characters, and chat messages to 256
+	const size_t longestName = options.namePrefix.size() + std::to_string(options.players - 1).size();
+	if((options.players == 0) || (options.rate <= 0) || (options.speed <= 0) || (options.port == 0)
+			|| (options.port > 65535) || (options.chatInterval.count() == 0) || (options.sampleInterval.count() == 0)
+			|| (longestName > 16) || (options.viewDistance < 2) || (options.viewDistance > 32)) {
+		std::cerr << "--players, --rate, --speed, --chat-interval and --sample-interval must be positive, --port a "
+			"port, --view-distance between 2 and 32, and player names at most 16 characters" << std::endl;
+		return 1;
+	}
+	for(const std::string &message: options.messages) {
+		if(message.empty() || (message.size() > 256)) {
+			std::cerr << "Chat messages must be between 1 and 256 characters" << std::endl;
+			return 1;
+		}
+	}
+
+	// Each player needs a descriptor, which the default soft limit of 1024 falls short of
+	rlimit limit;
+	if((getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < options.players + 64)) {
+		limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, options.players + 64);
+		if((setrlimit(RLIMIT_NOFILE, &limit) != 0) || (limit.rlim_cur < options.players + 64)) {
+			std::cerr << "Warning: the descriptor limit of " << limit.rlim_cur << " is too low for "
+				<< options.players << " players" << std::endl;
+		}
+	}
+
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *address;
+	const int error = getaddrinfo(options.host.c_str(), std::to_string(options.port).c_str(), &hints, &address);
+	if(error != 0) {
+		std::cerr << "Failed to resolve " << options.host << ": " << gai_strerror(error) << std::endl;
+		return 1;
+	}
+
+	std::signal(SIGINT, onInterrupt);
+	std::signal(SIGTERM, onInterrupt);
+
+	int status = 0;
+	try {
+		Gio::init();
+		std::cout << "Opening " << options.players << " connections to " << options.host << ':' << options.port
+			<< " at " << options.rate << " per second, for " << options.duration.count() << " seconds" << std::endl;
+		Results results;
+		runLoad(options, *address, results);
+		writeResults(options, results);
+	} catch(const Glib::Error &e) {
+		std::cerr << "Load generation failed: " << e.what() << std::endl;
+		status = 1;
+	} catch(const std::exception &e) {
+		std::cerr << "Load generation failed: " << e.what() << std::endl;
+		status = 1;
+	}
+	freeaddrinfo(address);
+	return status;
+}
@@ -0,0 +1,450 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "Backup.h"
+#include "parallel.h"
+
+using namespace minecraftd;
+
+namespace {
+	const std::string INDEX_HEADER{"minecraftd-backup-index 1"};
+
+	/** How often the console is checked for the server reporting that it has saved, in milliseconds. */
+	const unsigned int SAVE_POLL_INTERVAL = 100;
+
+	/** Closes a file descriptor when it goes out of scope. */
+	class FileDescriptor {
+		public:
+			explicit FileDescriptor(int fd) : fd_{fd} {
+				if(fd_ == -1) {
+					throw std::system_error(errno, std::system_category());
+				}
+			}
+			FileDescriptor(const FileDescriptor&) = delete;
+			~FileDescriptor() { close(fd_); }
+
+			operator int() const { return fd_; }
+
+		private:
+			const int fd_;
+	};
+
+	void makeDirectory(const std::string &path) {
+
+		if(g_mkdir_with_parents(path.c_str(), 0755) != 0) {
+			throw std::system_error(errno, std::system_category());
+		}
+	}
+
+	/**
+	 * Copies source to destination, sharing the underlying storage (reflink) where the file system supports it, and
+	 * otherwise copying in the kernel with copy_file_range.
+	 */
+	void copyFile(const std::string &source, const std::string &destination) {
+
+		FileDescriptor in{open(source.c_str(), O_RDONLY | O_CLOEXEC)};
+		FileDescriptor out{open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+		if(ioctl(out, FICLONE, static_cast<int>(in)) == 0) {
+			return;
+		}
+
+		bool useCopyFileRange = true;
+		std::vector<char> buffer;
+		for(;;) {
+			ssize_t copied;
+			if(useCopyFileRange) {
+				copied = copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0);
+				if((copied == -1) && ((errno == EXDEV) || (errno == ENOSYS) || (errno == EINVAL)
+						|| (errno == EOPNOTSUPP))) {
+					useCopyFileRange = false;
+					buffer.resize(1 << 20);
+					continue;
+				}
+			} else {
+				copied = read(in, buffer.data(), buffer.size());
+				for(ssize_t written = 0; (copied > 0) && (written < copied);) {
+					ssize_t count = write(out, buffer.data() + written, copied - written);
+					if(count == -1) {
+						throw std::system_error(errno, std::system_category());
+					}
+					written += count;
+				}
+			}
+
+			if(copied == 0) {
+				return;
+			} else if((copied == -1) && (errno != EINTR)) {
+				throw std::system_error(errno, std::system_category());
+			}
+		}
+	}
+
+	std::string hashFile(const std::string &path) {
+
+		FileDescriptor fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+		Glib::Checksum checksum{Glib::Checksum::CHECKSUM_SHA256};
+		std::vector<guchar> buffer(1 << 20);
+		for(;;) {
+			ssize_t count = read(fd, buffer.data(), buffer.size());
+			if(count == 0) {
+				break;
+			} else if(count == -1) {
+				if(errno == EINTR) {
+					continue;
+				}
+				throw std::system_error(errno, std::system_category());
+			}
+			checksum.update(buffer.data(), count);
+		}
+
+		// Staged copies are only read once, so need not stay cached
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		return checksum.get_string();
+	}
+
+	std::string objectPath(const std::string &backupDirectory, const std::string &hash) {
+
+		return backupDirectory + "/objects/" + hash.substr(0, 2) + '/' + hash;
+	}
+
+	/** Writes contents to path atomically, by way of a temporary file. */
+	void writeFile(const std::string &path, const std::string &contents) {
+
+		const std::string temporaryPath{path + ".tmp"};
+		{
+			std::ofstream file{temporaryPath, std::ios::trunc};
+			file << contents;
+			file.flush();
+			if(!file) {
+				throw std::runtime_error{"Failed to write " + temporaryPath};
+			}
+		}
+		if(std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+			throw std::system_error(errno, std::system_category(), path);
+		}
+	}
+}
+
+const std::chrono::seconds Backup::SAVE_TIMEOUT{300};
+
+Backup::Backup(const std::string &serverDirectory, const std::string &backupDirectory,
+		const std::vector<std::string> &exclude, CommandExecutor &executor, const ConsoleBuffer &console)
+	: backupDirectory_(backupDirectory), console_(console), exclude_(exclude), executor_(executor),
+	phase_{Phase::IDLE}, saveSequence_{0}, serverDirectory_(serverDirectory) {
+
+	exclude_.push_back(backupDirectory_);
+	dispatcher_.connect(sigc::mem_fun(*this, &Backup::onDispatch));
+}
+
+Backup::~Backup() {
+
+	if(thread_.joinable()) {
+		thread_.join();
+	}
+}
+
+bool Backup::start(const Callback &callback) {
+
+	if(phase_ != Phase::IDLE) {
+		return false;
+	}
+
+	callback_ = callback;
+	error_.clear();
+	files_.clear();
+	result_ = Result{};
+	phase_ = Phase::SAVING;
+	saveOffStart_ = std::chrono::steady_clock::now();
+
+	const bool queued = executor_.execute("save-off", [this](bool written, const std::vector<std::string>&) {
+		if(!written) {
+			fail("Failed to turn off saving");
+			return;
+		}
+
+		// Only output following the save-all command can report its completion
+		saveSequence_ = console_.sequence();
+		const bool queued = executor_.execute("save-all flush", [this](bool written,
+				const std::vector<std::string>&) {
+			if(!written) {
+				executor_.execute("save-on", [](bool, const std::vector<std::string>&) {});
+				fail("Failed to save the world");
+				return;
+			}
+
+			saveDeadline_ = std::chrono::steady_clock::now() + SAVE_TIMEOUT;
+			Glib::signal_timeout().connect(sigc::mem_fun(*this, &Backup::onWaitForSave), SAVE_POLL_INTERVAL);
+		});
+		if(!queued) {
+			executor_.execute("save-on", [](bool, const std::vector<std::string>&) {});
+			fail("Failed to save the world");
+		}
+	});
+	if(!queued) {
+		fail("Too many commands are awaiting execution");
+	}
+	return true;
+}
+
+void Backup::fail(const std::string &error) {
+
+	std::cerr << "Backup failed: " << error << std::endl;
+	phase_ = Phase::IDLE;
+	Callback callback{std::move(callback_)};
+	callback(error, Result{});
+}
+
+void Backup::finish() {
+
+	std::cout << "Backup " << result_.snapshot << " complete: " << result_.files << " files, " << result_.filesCopied
+		<< " changed (" << result_.bytesCopied << " bytes); saving was off for " << result_.saveOffTime.count()
+		<< " ms" << std::endl;
+	phase_ = Phase::IDLE;
+	Callback callback{std::move(callback_)};
+	callback(std::string{}, result_);
+}
+
+bool Backup::onWaitForSave() {
+
+	const uint64_t sequence = console_.sequence();
+	for(const auto &line: console_.since(saveSequence_, sequence - saveSequence_)) {
+		// "Saved the game" on current servers, "Saved the world" on older ones
+		if(line.text.find("Saved the ") != std::string::npos) {
+			phase_ = Phase::STAGING;
+			runInBackground(std::bind(&Backup::stage, this));
+			return false;
+		}
+	}
+	saveSequence_ = sequence;
+
+	if(std::chrono::steady_clock::now() >= saveDeadline_) {
+		executor_.execute("save-on", [](bool, const std::vector<std::string>&) {});
+		fail("Timed out waiting for the server to save the world");
+		return false;
+	}
+	return true;
+}
+
+void Backup::runInBackground(const std::function<void()> &task) {
+
+	thread_ = std::thread{[this, task] {
+		try {
+			task();
+		} catch(const std::exception &e) {
+			error_ = e.what();
+		}
+		dispatcher_.emit();
+	}};
+}
+
+void Backup::onDispatch() {
+
+	thread_.join();
+	if(phase_ == Phase::STAGING) {
+		executor_.execute("save-on", [](bool written, const std::vector<std::string>&) {
+			if(!written) {
+				std::cerr << "Failed to turn saving back on after backup" << std::endl;
+			}
+		});
+		result_.saveOffTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - saveOffStart_);
+
+		if(!error_.empty()) {
+			fail(error_);
+			return;
+		}
+		phase_ = Phase::STORING;
+		runInBackground(std::bind(&Backup::store, this));
+	} else if(phase_ == Phase::STORING) {
+		if(!error_.empty()) {
+			fail(error_);
+			return;
+		}
+		finish();
+	}
+}
+
+void Backup::listFiles(const std::string &root, const std::string &relativePath,
+		const std::set<std::pair<dev_t, ino_t>> &exclude, std::vector<File> &files) {
+
+	const std::string path{relativePath.empty() ? root : root + '/' + relativePath};
+	DIR *directory = opendir(path.c_str());
+	if(directory == nullptr) {
+		throw std::system_error(errno, std::system_category(), path);
+	}
+
+	std::vector<std::string> subdirectories;
+	for(dirent *entry = readdir(directory); entry != nullptr; entry = readdir(directory)) {
+		const std::string name{entry->d_name};
+		if((name == ".") || (name == "..")) {
+			continue;
+		}
+
+		struct stat entryStat;
+		if(fstatat(dirfd(directory), entry->d_name, &entryStat, AT_SYMLINK_NOFOLLOW) != 0) {
+			continue;
+		}
+
+		const std::string entryPath{relativePath.empty() ? name : relativePath + '/' + name};
+		if(S_ISDIR(entryStat.st_mode)) {
+			if(exclude.count(std::make_pair(entryStat.st_dev, entryStat.st_ino)) == 0) {
+				subdirectories.push_back(entryPath);
+			}
+		} else if(S_ISREG(entryStat.st_mode)) {
+			files.push_back(File{entryPath, entryStat.st_size,
+				entryStat.st_mtim.tv_sec * 1000000000LL + entryStat.st_mtim.tv_nsec, entryStat.st_mode & 07777,
+				std::string{}, std::string{}});
+		}
+	}
+	closedir(directory);
+
+	for(const auto &subdirectory: subdirectories) {
+		listFiles(root, subdirectory, exclude, files);
+	}
+}
+
+void Backup::stage() {
+
+	const std::string stagingDirectory{backupDirectory_ + "/staging"};
+	makeDirectory(stagingDirectory);
+	// Left behind by a backup that was interrupted
+	Glib::Dir staging{stagingDirectory};
+	for(std::string name = staging.read_name(); !name.empty(); name = staging.read_name()) {
+		std::remove((stagingDirectory + '/' + name).c_str());
+	}
+
+	std::set<std::pair<dev_t, ino_t>> exclude;
+	for(const auto &path: exclude_) {
+		struct stat pathStat;
+		if(stat(path.c_str(), &pathStat) == 0) {
+			exclude.insert(std::make_pair(pathStat.st_dev, pathStat.st_ino));
+		}
+	}
+	listFiles(serverDirectory_, std::string{}, exclude, files_);
+
+	// Files whose size and modification time match the last snapshot are assumed to be unchanged
+	std::unordered_map<std::string, File> index;
+	std::ifstream indexFile{backupDirectory_ + "/index"};
+	std::string line;
+	if(std::getline(indexFile, line) && (line == INDEX_HEADER)) {
+		while(std::getline(indexFile, line)) {
+			std::istringstream fields{line};
+			File file;
+			if((fields >> file.size >> file.modificationTime >> file.hash) && fields.get()
+					&& std::getline(fields, file.path)) {
+				index.emplace(file.path, file);
+			}
+		}
+	}
+
+	std::vector<File*> changed;
+	for(auto &file: files_) {
+		auto cached = index.find(file.path);
+		if((cached != index.end()) && (cached->second.size == file.size)
+				&& (cached->second.modificationTime == file.modificationTime)
+				&& (access(objectPath(backupDirectory_, cached->second.hash).c_str(), F_OK) == 0)) {
+			file.hash = cached->second.hash;
+		} else {
+			file.stagedPath = stagingDirectory + '/' + std::to_string(changed.size());
+			changed.push_back(&file);
+		}
+	}
+
+	parallelFor(changed.size(), [&](size_t i) {
+		try {
+			copyFile(serverDirectory_ + '/' + changed[i]->path, changed[i]->stagedPath);
+		} catch(const std::system_error &e) {
+			if(e.code().value() != ENOENT) {
+				throw;
+			}
+			// Deleted since it was listed
+			changed[i]->stagedPath.clear();
+			changed[i]->path.clear();
+		}
+	});
+
+	files_.erase(std::remove_if(files_.begin(), files_.end(), [](const File &file) { return file.path.empty(); }),
+			files_.end());
+}
+
+void Backup::store() {
+
+	parallelFor(files_.size(), [this](size_t i) {
+		File &file = files_[i];
+		if(file.stagedPath.empty()) {
+			return;
+		}
+
+		file.hash = hashFile(file.stagedPath);
+		const std::string object{objectPath(backupDirectory_, file.hash)};
+		if(access(object.c_str(), F_OK) == 0) {
+			std::remove(file.stagedPath.c_str());
+			return;
+		}
+		makeDirectory(Glib::path_get_dirname(object));
+		if(std::rename(file.stagedPath.c_str(), object.c_str()) != 0) {
+			throw std::system_error(errno, std::system_category(), object);
+		}
+	});
+
+	std::sort(files_.begin(), files_.end(), [](const File &a, const File &b) { return a.path < b.path; });
+
+	std::ostringstream manifest;
+	std::ostringstream index;
+	index << INDEX_HEADER << '\n';
+	for(const auto &file: files_) {
+		manifest << file.hash << '\t' << std::oct << file.mode << std::dec << '\t' << file.path << '\n';
+		index << file.size << '\t' << file.modificationTime << '\t' << file.hash << '\t' << file.path << '\n';
+
+		++result_.files;
+		if(!file.stagedPath.empty()) {
+			++result_.filesCopied;
+			result_.bytesCopied += file.size;
+		}
+	}
+
+	char timestamp[32];
+	const std::time_t now = std::time(nullptr);
+	std::strftime(timestamp, sizeof(timestamp), "%Y%m%dT%H%M%SZ", std::gmtime(&now));
+	const std::string snapshotDirectory{backupDirectory_ + "/snapshots"};
+	makeDirectory(snapshotDirectory);
+	result_.snapshot = timestamp;
+	for(int i = 1; access((snapshotDirectory + '/' + result_.snapshot).c_str(), F_OK) == 0; ++i) {
+		result_.snapshot = std::string{timestamp} + '-' + std::to_string(i);
+	}
+
+	writeFile(snapshotDirectory + '/' + result_.snapshot, manifest.str());
+	writeFile(backupDirectory_ + "/index", index.str());
+}
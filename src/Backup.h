@@ -0,0 +1,115 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <glibmm.h>
+
+#include "CommandExecutor.h"
+#include "ConsoleBuffer.h"
+
+namespace minecraftd {
+
+	/**
+	 * Takes incremental, content-addressed snapshots of a server directory. Each file is stored once, as
+	 * objects/<sha256>, beneath the backup directory, and each snapshot is a manifest in snapshots/ listing the objects
+	 * making up the server directory at that time.
+	 *
+	 * Saving is only turned off for as long as it takes to clone the files that changed since the last snapshot into
+	 * a staging area (by reflink where the file system supports it), after which it is turned back on and the staged
+	 * files are hashed and stored in parallel.
+	 */
+	class Backup {
+		public:
+			struct Result {
+				std::string snapshot;
+				uint64_t files;
+				/** Number of files, and their total size, that had changed since the last snapshot. */
+				uint64_t filesCopied;
+				uint64_t bytesCopied;
+				/** Time for which saving was turned off. */
+				std::chrono::milliseconds saveOffTime;
+			};
+
+			/** Called with the result of the backup, or with a non-empty error message if it failed. */
+			typedef std::function<void(const std::string &error, const Result &result)> Callback;
+
+			/** Time to wait for the server to report that it has saved the world, before giving up. */
+			static const std::chrono::seconds SAVE_TIMEOUT;
+
+			/**
+			 * Creates a backup of serverDirectory into backupDirectory, skipping any of the directories in exclude
+			 * (as well as backupDirectory itself) should they lie within it.
+			 */
+			Backup(const std::string &serverDirectory, const std::string &backupDirectory,
+					const std::vector<std::string> &exclude, CommandExecutor &executor, const ConsoleBuffer &console);
+			Backup(const Backup&) = delete;
+			~Backup();
+
+			/** Starts a backup, returning false if one is already running. */
+			bool start(const Callback &callback);
+
+		private:
+			struct File {
+				std::string path;
+				off_t size;
+				long long modificationTime;
+				mode_t mode;
+				std::string hash;
+				/** Path of the file's copy in the staging directory, if it changed since the last snapshot. */
+				std::string stagedPath;
+			};
+
+			enum class Phase { IDLE, SAVING, STAGING, STORING };
+
+			void fail(const std::string &error);
+			void finish();
+			void onDispatch();
+			bool onWaitForSave();
+			void runInBackground(const std::function<void()> &task);
+
+			/** Lists the server directory, and copies files changed since the last snapshot to the staging area. */
+			void stage();
+			/** Hashes the staged files into the object store, and writes the snapshot manifest. */
+			void store();
+
+			static void listFiles(const std::string &root, const std::string &relativePath,
+					const std::set<std::pair<dev_t, ino_t>> &exclude, std::vector<File> &files);
+
+			const std::string backupDirectory_;
+			Callback callback_;
+			const ConsoleBuffer &console_;
+			Glib::Dispatcher dispatcher_;
+			std::string error_;
+			std::vector<std::string> exclude_;
+			CommandExecutor &executor_;
+			std::vector<File> files_;
+			Phase phase_;
+			Result result_;
+			std::chrono::steady_clock::time_point saveDeadline_;
+			std::chrono::steady_clock::time_point saveOffStart_;
+			uint64_t saveSequence_;
+			const std::string serverDirectory_;
+			std::thread thread_;
+	};
+}
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "ClassPreloader.h"
+
+using namespace minecraftd;
+
+namespace {
+	/** Marks the classes of a profile that are defined by the server's class loader, rather than the system one. */
+	const std::string SERVER_CLASS_PREFIX{"server:"};
+	/** Signature prefix of the server's classes, by which the class loader of a bundled server is recognized. */
+	const char *const SERVER_SIGNATURE_PREFIX = "Lnet/minecraft/";
+
+	/**
+	 * Converts a class signature ("Lnet/minecraft/server/Main;") to the binary name Class.forName takes
+	 * ("net.minecraft.server.Main"), returning false for classes that can not be found by name: hidden and anonymous
+	 * classes (such as those of lambdas) and proxies.
+	 */
+	bool toBinaryName(const char *signature, std::string &name) {
+
+		const size_t length = std::strlen(signature);
+		if((length < 3) || (signature[0] != 'L') || (signature[length - 1] != ';')
+				|| (std::strstr(signature, "$$Lambda") != nullptr) || (std::strstr(signature, ".0x") != nullptr)
+				|| (std::strstr(signature, "$Proxy") != nullptr)) {
+			return false;
+		}
+		name.assign(signature + 1, length - 2);
+		std::replace(name.begin(), name.end(), '/', '.');
+		return true;
+	}
+}
+
+const unsigned int ClassPreloader::MAX_THREADS;
+
+ClassPreloader::ClassPreloader(JavaVM *jvm, const std::string &profilePath, std::chrono::seconds recordTime)
+	: failed_{0}, jvm_{jvm}, jvmti_{nullptr}, loaderFd_{eventfd(0, EFD_CLOEXEC)}, next_{0}, nextServer_{0},
+	profilePath_{profilePath}, recording_{false}, running_{0}, serverLoader_{nullptr},
+	startTime_{std::chrono::steady_clock::now()}, stopFd_{eventfd(0, EFD_CLOEXEC)} {
+
+	if((loaderFd_ == -1) || (stopFd_ == -1)) {
+		const int error = errno;
+		if(loaderFd_ != -1) {
+			close(loaderFd_);
+		}
+		if(stopFd_ != -1) {
+			close(stopFd_);
+		}
+		throw std::system_error(error, std::system_category());
+	}
+
+	JNIEnv *jni;
+	if(jvm->GetEnv(reinterpret_cast<void**>(&jni), JNI_VERSION_1_6) != JNI_OK) {
+		close(loaderFd_);
+		close(stopFd_);
+		throw std::runtime_error{"The calling thread is not attached to the JVM"};
+	}
+	jclass ClassLoader = jni->FindClass("java/lang/ClassLoader");
+	jmethodID ClassLoader_getSystemClassLoader = (ClassLoader == nullptr) ? nullptr
+		: jni->GetStaticMethodID(ClassLoader, "getSystemClassLoader", "()Ljava/lang/ClassLoader;");
+	jmethodID ClassLoader_getParent = (ClassLoader == nullptr) ? nullptr
+		: jni->GetMethodID(ClassLoader, "getParent", "()Ljava/lang/ClassLoader;");
+	if(ClassLoader_getParent == nullptr) {
+		jni->ExceptionClear();
+		close(loaderFd_);
+		close(stopFd_);
+		throw std::runtime_error{"Failed to look up java.lang.ClassLoader"};
+	}
+	for(jobject loader = jni->CallStaticObjectMethod(ClassLoader, ClassLoader_getSystemClassLoader);
+			loader != nullptr;) {
+		loaders_.push_back(jni->NewGlobalRef(loader));
+		jobject parent = jni->CallObjectMethod(loader, ClassLoader_getParent);
+		jni->DeleteLocalRef(loader);
+		loader = parent;
+	}
+	jni->ExceptionClear();
+
+	std::ifstream profile{profilePath_};
+	for(std::string line; std::getline(profile, line);) {
+		if(line.compare(0, SERVER_CLASS_PREFIX.size(), SERVER_CLASS_PREFIX) == 0) {
+			serverClasses_.push_back(line.substr(SERVER_CLASS_PREFIX.size()));
+		} else if(!line.empty()) {
+			classes_.push_back(line);
+		}
+	}
+	recording_ = (classes_.empty() && serverClasses_.empty()) || loaders_.empty();
+
+	// On replay, the hook is only needed to find the class loader of a bundled server
+	if(recording_ || !serverClasses_.empty()) {
+		const char *error = nullptr;
+		jvmtiEventCallbacks callbacks;
+		std::memset(&callbacks, 0, sizeof(callbacks));
+		callbacks.ClassPrepare = &ClassPreloader::onClassPrepare;
+		if(jvm->GetEnv(reinterpret_cast<void**>(&jvmti_), JVMTI_VERSION_1_2) != JNI_OK) {
+			jvmti_ = nullptr;
+			error = "JVM does not support JVMTI 1.2";
+		} else if((jvmti_->SetEnvironmentLocalStorage(this) != JVMTI_ERROR_NONE)
+				|| (jvmti_->SetEventCallbacks(&callbacks, sizeof(callbacks)) != JVMTI_ERROR_NONE)
+				|| (jvmti_->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE, nullptr)
+					!= JVMTI_ERROR_NONE)) {
+			jvmti_->DisposeEnvironment();
+			jvmti_ = nullptr;
+			error = "Failed to enable JVMTI class events";
+		}
+		if((error != nullptr) && recording_) {
+			close(loaderFd_);
+			close(stopFd_);
+			throw std::runtime_error{error};
+		} else if(error != nullptr) {
+			std::cerr << error << "; the server's own classes will not be preloaded" << std::endl;
+			serverClasses_.clear();
+		}
+	}
+
+	if(recording_) {
+		std::cout << "Recording the classes loaded over the first " << recordTime.count() << " s to " << profilePath_
+			<< std::endl;
+		running_ = 1;
+		threads_.emplace_back(&ClassPreloader::record, this, recordTime);
+		return;
+	}
+	const unsigned int threads = std::max(1U, std::min(MAX_THREADS, std::thread::hardware_concurrency() / 2));
+	std::cout << "Preloading " << (classes_.size() + serverClasses_.size()) << " classes on " << threads << " threads"
+		<< std::endl;
+	running_ = threads;
+	for(unsigned int i = 0; i < threads; ++i) {
+		threads_.emplace_back(&ClassPreloader::preload, this, i);
+	}
+}
+
+ClassPreloader::~ClassPreloader() {
+
+	const uint64_t one = 1;
+	if(write(stopFd_, &one, sizeof(one)) == sizeof(one)) {
+		for(auto &thread: threads_) {
+			thread.join();
+		}
+	} else {
+		for(auto &thread: threads_) {
+			thread.detach();
+		}
+	}
+	close(loaderFd_);
+	close(stopFd_);
+}
+
+void JNICALL ClassPreloader::onClassPrepare(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jclass clazz) {
+
+	ClassPreloader *preloader;
+	jobject loader;
+	if((jvmti->GetEnvironmentLocalStorage(reinterpret_cast<void**>(&preloader)) != JVMTI_ERROR_NONE)
+			|| (preloader == nullptr) || (jvmti->GetClassLoader(clazz, &loader) != JVMTI_ERROR_NONE)) {
+		return;
+	}
+	bool system = loader == nullptr;
+	for(auto i = preloader->loaders_.begin(); !system && (i != preloader->loaders_.end()); ++i) {
+		system = jni->IsSameObject(loader, *i);
+	}
+	jobject serverLoader = preloader->serverLoader_.load();
+	bool server = !system && (serverLoader != nullptr) && jni->IsSameObject(loader, serverLoader);
+
+	// Until the server's class loader is found, any other class loader may be it
+	const bool candidate = !system && (serverLoader == nullptr);
+	char *signature;
+	if((!candidate && !(preloader->recording_ && (system || server)))
+			|| (jvmti->GetClassSignature(clazz, &signature, nullptr) != JVMTI_ERROR_NONE)) {
+		jni->DeleteLocalRef(loader);
+		return;
+	}
+	if(candidate && (std::strncmp(signature, SERVER_SIGNATURE_PREFIX, std::strlen(SERVER_SIGNATURE_PREFIX)) == 0)) {
+		std::lock_guard<std::mutex> lock{preloader->mutex_};
+		if(preloader->serverLoader_.load() == nullptr) {
+			preloader->serverLoader_ = jni->NewGlobalRef(loader);
+			if(!preloader->recording_) {
+				jvmti->SetEventNotificationMode(JVMTI_DISABLE, JVMTI_EVENT_CLASS_PREPARE, nullptr);
+			}
+			const uint64_t one = 1;
+			if(write(preloader->loaderFd_, &one, sizeof(one)) != sizeof(one)) {
+				std::cerr << "Failed to signal the server's class loader to the class preloader" << std::endl;
+			}
+		}
+		server = jni->IsSameObject(loader, preloader->serverLoader_.load());
+	}
+	jni->DeleteLocalRef(loader);
+
+	std::string name;
+	if(preloader->recording_ && (system || server) && toBinaryName(signature, name)) {
+		std::lock_guard<std::mutex> lock{preloader->mutex_};
+		(system ? preloader->classes_ : preloader->serverClasses_).push_back(std::move(name));
+	}
+	jvmti->Deallocate(reinterpret_cast<unsigned char*>(signature));
+}
+
+bool ClassPreloader::loadClasses(JNIEnv *jni, const std::vector<std::string> &classes, std::atomic<size_t> &next,
+		jobject loader) {
+
+	// Class.forName without initialization loads a class; listing its constructors makes HotSpot link (and verify) it
+	jclass Class = jni->FindClass("java/lang/Class");
+	jmethodID Class_forName = jni->GetStaticMethodID(Class, "forName",
+			"(Ljava/lang/String;ZLjava/lang/ClassLoader;)Ljava/lang/Class;");
+	jmethodID Class_getDeclaredConstructors = jni->GetMethodID(Class, "getDeclaredConstructors",
+			"()[Ljava/lang/reflect/Constructor;");
+	if(Class_getDeclaredConstructors == nullptr) {
+		jni->ExceptionClear();
+		return false;
+	}
+	pollfd pollFd{stopFd_, POLLIN, 0};
+	bool stopped = false;
+	for(size_t i = next++; i < classes.size(); i = next++) {
+		if((i % 64 == 0) && (poll(&pollFd, 1, 0) > 0)) {
+			stopped = true;
+			break;
+		}
+
+		jni->PushLocalFrame(8);
+		jstring name = jni->NewStringUTF(classes[i].c_str());
+		jobject clazz = jni->CallStaticObjectMethod(Class, Class_forName, name, JNI_FALSE, loader);
+		if(clazz != nullptr) {
+			jni->CallObjectMethod(clazz, Class_getDeclaredConstructors);
+		}
+		if(jni->ExceptionCheck()) {
+			// Classes from another version of the JAR, or that fail verification, are left for the server to report
+			jni->ExceptionClear();
+			++failed_;
+		}
+		jni->PopLocalFrame(nullptr);
+	}
+	jni->DeleteLocalRef(Class);
+	return !stopped;
+}
+
+void ClassPreloader::preload(unsigned int index) {
+
+	JNIEnv *jni;
+	const std::string threadName{"minecraftd class preloader " + std::to_string(index)};
+	JavaVMAttachArgs attachArguments{JNI_VERSION_1_6, const_cast<char*>(threadName.c_str()), nullptr};
+	if(jvm_->AttachCurrentThreadAsDaemon(reinterpret_cast<void**>(&jni), &attachArguments) != JNI_OK) {
+		std::cerr << "Failed to attach a class preloading thread to the JVM" << std::endl;
+		--running_;
+		return;
+	}
+
+	// A bundled server's class loader only exists once the bundle has unpacked and started the server
+	if(loadClasses(jni, classes_, next_, loaders_.front()) && !serverClasses_.empty()) {
+		pollfd pollFds[]{{loaderFd_, POLLIN, 0}, {stopFd_, POLLIN, 0}};
+		while((poll(pollFds, 2, -1) == -1) && (errno == EINTR)) {
+		}
+		if(pollFds[0].revents & POLLIN) {
+			loadClasses(jni, serverClasses_, nextServer_, serverLoader_.load());
+		}
+	}
+	if(!serverClasses_.empty() && (serverLoader_.load() == nullptr)) {
+		jvmti_->SetEventNotificationMode(JVMTI_DISABLE, JVMTI_EVENT_CLASS_PREPARE, nullptr);
+	}
+	jni->ExceptionClear();
+	jvm_->DetachCurrentThread();
+
+	if(--running_ == 0) {
+		const size_t loaded = std::min(next_.load(), classes_.size()) + std::min(nextServer_.load(),
+				serverClasses_.size()) - failed_;
+		std::cout << "Preloaded " << loaded << " classes in " << std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - startTime_).count() << " ms (" << failed_ << " could not be loaded)"
+			<< std::endl;
+	}
+}
+
+void ClassPreloader::record(std::chrono::seconds recordTime) {
+
+	pollfd pollFd{stopFd_, POLLIN, 0};
+	const bool stopped = poll(&pollFd, 1, std::chrono::duration_cast<std::chrono::milliseconds>(recordTime).count())
+		> 0;
+
+	// JVMTI is only called from threads attached to the JVM
+	JNIEnv *jni;
+	JavaVMAttachArgs attachArguments{JNI_VERSION_1_6, const_cast<char*>("minecraftd class recorder"), nullptr};
+	if(jvm_->AttachCurrentThreadAsDaemon(reinterpret_cast<void**>(&jni), &attachArguments) != JNI_OK) {
+		std::cerr << "Failed to attach the class recording thread to the JVM" << std::endl;
+		return;
+	}
+	jvmti_->SetEventNotificationMode(JVMTI_DISABLE, JVMTI_EVENT_CLASS_PREPARE, nullptr);
+	jvm_->DetachCurrentThread();
+
+	// A run stopped early has not seen the classes gameplay needs, so its profile is not kept
+	if(stopped) {
+		return;
+	}
+	std::vector<std::string> classes, serverClasses;
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		classes.swap(classes_);
+		serverClasses.swap(serverClasses_);
+	}
+	const std::string temporaryPath{profilePath_ + ".tmp"};
+	{
+		std::ofstream profile{temporaryPath, std::ios::trunc};
+		for(const auto &name: classes) {
+			profile << name << '\n';
+		}
+		for(const auto &name: serverClasses) {
+			profile << SERVER_CLASS_PREFIX << name << '\n';
+		}
+		if(!profile) {
+			std::cerr << "Failed to write class profile " << temporaryPath << std::endl;
+			return;
+		}
+	}
+	if(std::rename(temporaryPath.c_str(), profilePath_.c_str()) != 0) {
+		std::cerr << "Failed to write class profile " << profilePath_ << ": " << std::strerror(errno) << std::endl;
+		return;
+	}
+	std::cout << "Recorded " << (classes.size() + serverClasses.size()) << " classes to " << profilePath_
+		<< "; they will be preloaded from the next start" << std::endl;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <jni.h>
+#include <jvmti.h>
+
+namespace minecraftd {
+
+	/**
+	 * Moves the loading of the classes a server needs out of gameplay: the classes prepared during the first minutes
+	 * of a run are recorded to a profile, and on later runs they are loaded and linked in parallel while the world
+	 * loads, rather than on demand when the first players join and the first commands run.
+	 *
+	 * Recording uses a JVMTI ClassPrepare hook of its own, keeping the classes defined by the system class loader and
+	 * its ancestors (those that Class.forName with the system class loader finds again), and those defined by the
+	 * server's class loader. Servers since 1.18 are bundles, which load the server in a class loader of their own once
+	 * they run; that class loader is the first outside the system class loader's chain to define a net.minecraft
+	 * class, and is found the same way on replay, where its classes are loaded once it exists.
+	 *
+	 * Replay runs on a pool of native threads attached to the JVM. Classes are not initialized: the server's static
+	 * initializers expect to run in the order it triggers them in, and initializing them from several threads at once
+	 * could deadlock.
+	 */
+	class ClassPreloader {
+		public:
+			/** Most threads the replay uses; it is also limited to half the CPUs. */
+			static const unsigned int MAX_THREADS = 4;
+
+			/**
+			 * If profilePath exists, starts preloading the classes it lists. Otherwise, starts recording the classes
+			 * prepared over recordTime, writing them to profilePath once it has passed. Must be called on a thread
+			 * attached to jvm, before the server starts. Throws std::runtime_error if the JVM does not support JVMTI.
+			 */
+			ClassPreloader(JavaVM *jvm, const std::string &profilePath, std::chrono::seconds recordTime);
+			ClassPreloader(const ClassPreloader&) = delete;
+			~ClassPreloader();
+
+		private:
+			static void JNICALL onClassPrepare(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jclass clazz);
+
+			/** Loads and links classes through loader, sharing them out with next; returns false if stopped early. */
+			bool loadClasses(JNIEnv *jni, const std::vector<std::string> &classes, std::atomic<size_t> &next,
+					jobject loader);
+			void preload(unsigned int index);
+			void record(std::chrono::seconds recordTime);
+
+			std::vector<std::string> classes_;
+			std::atomic<size_t> failed_;
+			JavaVM *const jvm_;
+			jvmtiEnv *jvmti_;
+			/** Signalled once serverLoader_ is set. */
+			int loaderFd_;
+			/** Global references to the class loaders whose classes are recorded, and replayed through the first. */
+			std::vector<jobject> loaders_;
+			std::mutex mutex_;
+			std::atomic<size_t> next_;
+			std::atomic<size_t> nextServer_;
+			const std::string profilePath_;
+			bool recording_;
+			std::atomic<unsigned int> running_;
+			std::vector<std::string> serverClasses_;
+			/** Global reference to the class loader of a bundled server, once it has defined its first class. */
+			std::atomic<jobject> serverLoader_;
+			std::chrono::steady_clock::time_point startTime_;
+			int stopFd_;
+			std::vector<std::thread> threads_;
+	};
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <utility>
+
+#include "CommandExecutor.h"
+
+using namespace minecraftd;
+
+namespace {
+	/** How often the console is checked for new output while a command is executing, in milliseconds. */
+	const unsigned int POLL_INTERVAL = 5;
+}
+
+const std::chrono::milliseconds CommandExecutor::QUIET_PERIOD{50};
+const std::chrono::milliseconds CommandExecutor::TIMEOUT{1000};
+const size_t CommandExecutor::MAX_PENDING;
+
+CommandExecutor::CommandExecutor(CommandQueue &commandQueue, const ConsoleBuffer &console)
+	: commandQueue_(commandQueue), console_(console), executing_(false), firstSequence_(0), held_(false),
+	lastSequence_(0) {
+}
+
+CommandExecutor::~CommandExecutor() {
+
+	pollSource_.disconnect();
+}
+
+bool CommandExecutor::execute(const std::string &command, const Callback &callback) {
+
+	if(pending_.size() >= MAX_PENDING) {
+		return false;
+	}
+
+	pending_.push_back(Execution{command, callback});
+	if(!executing_ && !held_) {
+		startNext();
+	}
+	return true;
+}
+
+void CommandExecutor::setHeld(bool held) {
+
+	held_ = held;
+	if(!held_ && !executing_) {
+		startNext();
+	}
+}
+
+void CommandExecutor::abandon() {
+
+	// The command being executed, if any, still completes with its output
+	std::deque<Execution> abandoned;
+	abandoned.swap(pending_);
+	for(const auto &execution: abandoned) {
+		execution.callback(false, std::vector<std::string>{});
+	}
+}
+
+void CommandExecutor::startNext() {
+
+	executing_ = true;
+	while(!held_ && !pending_.empty()) {
+		Execution execution = std::move(pending_.front());
+		pending_.pop_front();
+		firstSequence_ = lastSequence_ = console_.sequence();
+		if(commandQueue_.push(execution.command)) {
+			current_ = std::move(execution.callback);
+			deadline_ = limit_ = std::chrono::steady_clock::now() + TIMEOUT;
+			pollSource_ = Glib::signal_timeout().connect(sigc::mem_fun(*this, &CommandExecutor::onPoll),
+					POLL_INTERVAL);
+			return;
+		}
+		execution.callback(false, std::vector<std::string>{});
+	}
+	executing_ = false;
+}
+
+bool CommandExecutor::onPoll() {
+
+	const auto now = std::chrono::steady_clock::now();
+	const uint64_t sequence = console_.sequence();
+	if((sequence != lastSequence_) && (now < limit_)) {
+		lastSequence_ = sequence;
+		deadline_ = std::min(now + QUIET_PERIOD, limit_);
+		return true;
+	} else if(now < deadline_) {
+		return true;
+	}
+
+	std::vector<std::string> output;
+	for(const auto &line: console_.since(firstSequence_, lastSequence_ - firstSequence_)) {
+		output.push_back(line.text);
+	}
+
+	Callback callback = std::move(current_);
+	callback(true, output);
+
+	executing_ = false;
+	if(!held_) {
+		startNext();
+	}
+	return false;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <glibmm.h>
+
+#include "CommandQueue.h"
+#include "ConsoleBuffer.h"
+
+namespace minecraftd {
+
+	/**
+	 * Executes console commands one at a time, collecting the console output that follows each. A command is
+	 * considered complete once the console has been quiet for QUIET_PERIOD after producing output, and at the latest
+	 * TIMEOUT after it was written, whether or not the console has gone quiet. Commands are run on the GLib main loop.
+	 *
+	 * This writes to the console rather than calling the server's command dispatcher through JNI, whose classes and
+	 * methods are obfuscated differently in every server version. Output is therefore attributed by time alone:
+	 * whatever the console prints between a command being written and it completing is taken to be its output,
+	 * including lines the server logged for other reasons meanwhile (chat, players joining, autosaves). A command that
+	 * prints nothing takes the full TIMEOUT, and as commands run one at a time, each waiting out at least a
+	 * QUIET_PERIOD, they complete at most one per QUIET_PERIOD, and only one per TIMEOUT if they print nothing.
+	 */
+	class CommandExecutor {
+		public:
+			/** Called with false if the command could not be written to the console, or true and its output. */
+			typedef std::function<void(bool written, const std::vector<std::string> &output)> Callback;
+
+			static const std::chrono::milliseconds QUIET_PERIOD;
+			static const std::chrono::milliseconds TIMEOUT;
+			static const size_t MAX_PENDING = 256;
+
+			CommandExecutor(CommandQueue &commandQueue, const ConsoleBuffer &console);
+			CommandExecutor(const CommandExecutor&) = delete;
+			~CommandExecutor();
+
+			/**
+			 * Queues command for execution, calling callback with its output once it completes. Returns false if too
+			 * many commands are already pending.
+			 */
+			bool execute(const std::string &command, const Callback &callback);
+
+			/**
+			 * While held, commands are queued but not written to the console; releasing the executor starts on those
+			 * queued meanwhile.
+			 */
+			void setHeld(bool held);
+			/** Fails every command not yet written to the console, as though the console could not be written to. */
+			void abandon();
+
+		private:
+			struct Execution {
+				std::string command;
+				Callback callback;
+			};
+
+			/**
+			 * Writes the command at the head of the queue to the console, if there is one, failing those that can not
+			 * be written. Callbacks that execute further commands meanwhile only queue them.
+			 */
+			void startNext();
+			bool onPoll();
+
+			CommandQueue &commandQueue_;
+			const ConsoleBuffer &console_;
+			/** Callback of the command being executed. */
+			Callback current_;
+			std::chrono::steady_clock::time_point deadline_;
+			/**
+			 * Whether a command is being executed, or startNext or a completion callback is running; no command is
+			 * started meanwhile.
+			 */
+			bool executing_;
+			/** Latest the command being executed completes, however busy the console is. */
+			std::chrono::steady_clock::time_point limit_;
+			uint64_t firstSequence_;
+			bool held_;
+			uint64_t lastSequence_;
+			/** Commands not yet written to the console. */
+			std::deque<Execution> pending_;
+			sigc::connection pollSource_;
+	};
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "CommandQueue.h"
+
+using namespace minecraftd;
+
+const size_t CommandQueue::DEFAULT_CAPACITY;
+
+CommandQueue::CommandQueue(int fd, size_t capacity)
+	: capacity_(capacity), eventFd_(-1), fd_(fd), statistics_(), writeOffset_(0) {
+
+	int flags = fcntl(fd_, F_GETFL);
+	if((flags == -1) || (fcntl(fd_, F_SETFL, flags | O_NONBLOCK) == -1)) {
+		throw std::system_error(errno, std::system_category());
+	}
+
+	eventFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(eventFd_ == -1) {
+		throw std::system_error(errno, std::system_category());
+	}
+
+	statistics_.capacity = capacity_;
+	wakeupSource_ = Glib::signal_io().connect(sigc::mem_fun(*this, &CommandQueue::onWakeup), eventFd_, Glib::IO_IN);
+}
+
+CommandQueue::~CommandQueue() {
+
+	wakeupSource_.disconnect();
+	writableSource_.disconnect();
+	close(eventFd_);
+}
+
+bool CommandQueue::push(std::string command) {
+
+	if(command.empty() || (*command.crbegin() != '\n')) {
+		command.push_back('\n');
+	}
+
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		if(commands_.size() >= capacity_) {
+			++statistics_.rejected;
+			return false;
+		}
+
+		commands_.push_back(Command{std::move(command), std::chrono::steady_clock::now()});
+		++statistics_.enqueued;
+		statistics_.highWaterMark = std::max<uint32_t>(statistics_.highWaterMark, commands_.size());
+	}
+
+	const uint64_t one = 1;
+	if((write(eventFd_, &one, sizeof(one)) == -1) && (errno != EAGAIN)) {
+		throw std::system_error(errno, std::system_category());
+	}
+	return true;
+}
+
+CommandQueue::Statistics CommandQueue::statistics() const {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	Statistics statistics = statistics_;
+	statistics.depth = commands_.size();
+	return statistics;
+}
+
+bool CommandQueue::onWakeup(Glib::IOCondition condition) {
+
+	uint64_t count;
+	while(read(eventFd_, &count, sizeof(count)) > 0) {
+		// Drain the counter; the queue itself says how much work there is
+	}
+
+	if(!writableSource_.connected() && flush()) {
+		writableSource_ = Glib::signal_io().connect(sigc::mem_fun(*this, &CommandQueue::onWritable), fd_,
+				Glib::IO_OUT);
+	}
+	return true;
+}
+
+bool CommandQueue::onWritable(Glib::IOCondition condition) {
+
+	return flush();
+}
+
+bool CommandQueue::flush() {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	while(!commands_.empty()) {
+		std::vector<iovec> iov;
+		iov.reserve(std::min<size_t>(commands_.size(), IOV_MAX));
+		for(auto it = commands_.begin(); (it != commands_.end()) && (iov.size() < IOV_MAX); ++it) {
+			const size_t offset = iov.empty() ? writeOffset_ : 0;
+			iov.push_back(iovec{const_cast<char*>(it->text.data()) + offset, it->text.size() - offset});
+		}
+
+		ssize_t written = writev(fd_, iov.data(), iov.size());
+		if(written == -1) {
+			if(errno == EINTR) {
+				continue;
+			} else if(errno == EAGAIN) {
+				return true;
+			}
+
+			std::cerr << "Failed to write to console: " << std::system_category().message(errno)
+				<< "; discarding " << commands_.size() << " queued commands" << std::endl;
+			statistics_.dropped += commands_.size();
+			commands_.clear();
+			writeOffset_ = 0;
+			return false;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		size_t remaining = written + writeOffset_;
+		while(!commands_.empty() && (remaining >= commands_.front().text.size())) {
+			remaining -= commands_.front().text.size();
+			statistics_.lastLatency = std::chrono::duration_cast<std::chrono::microseconds>(
+					now - commands_.front().enqueued).count();
+			statistics_.maxLatency = std::max(statistics_.maxLatency, statistics_.lastLatency);
+			commands_.pop_front();
+		}
+		writeOffset_ = remaining;
+	}
+	return false;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include <glibmm.h>
+
+namespace minecraftd {
+
+	/**
+	 * Bounded queue of console commands destined for the server's standard input. Commands may be pushed from any
+	 * thread; they are written by the GLib main loop, which is woken through an eventfd and batches everything queued
+	 * into a single writev on the (non-blocking) console pipe. A full queue or a stalled console reader therefore never
+	 * blocks the caller.
+	 */
+	class CommandQueue {
+		public:
+			struct Statistics {
+				uint32_t depth;
+				uint32_t capacity;
+				uint32_t highWaterMark;
+				uint64_t enqueued;
+				uint64_t rejected;
+				uint64_t dropped;
+				/** Time from a command being queued to its last byte being written, in microseconds. */
+				uint64_t lastLatency;
+				uint64_t maxLatency;
+			};
+
+			static const size_t DEFAULT_CAPACITY = 1024;
+
+			/** Creates a queue writing to fd, which is switched to non-blocking mode. */
+			CommandQueue(int fd, size_t capacity = DEFAULT_CAPACITY);
+			CommandQueue(const CommandQueue&) = delete;
+			~CommandQueue();
+
+			/**
+			 * Queues a command, appending a newline if it does not already end with one. Returns false, without
+			 * queueing the command, if the queue is full.
+			 */
+			bool push(std::string command);
+
+			Statistics statistics() const;
+
+		private:
+			struct Command {
+				std::string text;
+				std::chrono::steady_clock::time_point enqueued;
+			};
+
+			bool onWakeup(Glib::IOCondition condition);
+			bool onWritable(Glib::IOCondition condition);
+			/** Writes as much of the queue as the pipe will accept. Returns true if commands remain queued. */
+			bool flush();
+
+			const size_t capacity_;
+			std::deque<Command> commands_;
+			int eventFd_;
+			const int fd_;
+			mutable std::mutex mutex_;
+			Statistics statistics_;
+			sigc::connection wakeupSource_;
+			sigc::connection writableSource_;
+			/** Number of bytes of the command at the head of the queue that have already been written. */
+			size_t writeOffset_;
+	};
+}
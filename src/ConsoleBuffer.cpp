@@ -0,0 +1,209 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "ConsoleBuffer.h"
+
+using namespace minecraftd;
+
+const size_t ConsoleBuffer::DEFAULT_CAPACITY;
+const size_t ConsoleBuffer::MAX_LINE_LENGTH;
+
+namespace {
+	void forward(int fd, const char *buffer, size_t size) {
+
+		while(size > 0) {
+			ssize_t written = write(fd, buffer, size);
+			if(written == -1) {
+				if(errno == EINTR) {
+					continue;
+				}
+				// The journal going away must not take the server with it; the line is still buffered
+				return;
+			}
+			buffer += written;
+			size -= written;
+		}
+	}
+}
+
+ConsoleBuffer::ConsoleBuffer(const std::vector<Stream> &streams, size_t capacity)
+	: capacity_(capacity), lines_(capacity), nextSequence_(0), stopFd_(-1) {
+
+	for(const auto &stream: streams) {
+		sources_.push_back(Source{stream, std::string{}});
+	}
+
+	stopFd_ = eventfd(0, EFD_CLOEXEC);
+	if(stopFd_ == -1) {
+		throw std::system_error(errno, std::system_category());
+	}
+
+	thread_ = std::thread{&ConsoleBuffer::run, this};
+}
+
+ConsoleBuffer::~ConsoleBuffer() {
+
+	const uint64_t one = 1;
+	if(write(stopFd_, &one, sizeof(one)) == sizeof(one)) {
+		thread_.join();
+	} else {
+		thread_.detach();
+	}
+	close(stopFd_);
+
+	for(auto &source: sources_) {
+		if(source.stream.restoreFd != -1) {
+			// Restore the original stream first, so that nothing written from here on hits a pipe without a reader
+			dup2(source.stream.forwardFd, source.stream.restoreFd);
+		}
+		if(source.stream.fd != -1) {
+			close(source.stream.fd);
+		}
+		close(source.stream.forwardFd);
+	}
+}
+
+ConsoleBuffer::Stream ConsoleBuffer::redirect(int fd) {
+
+	int pipeFds[2];
+	if(pipe2(pipeFds, O_CLOEXEC) == -1) {
+		throw std::system_error(errno, std::system_category());
+	}
+
+	Stream stream{pipeFds[0], fcntl(fd, F_DUPFD_CLOEXEC, 0), fd};
+	if((stream.forwardFd == -1) || (dup2(pipeFds[1], fd) == -1)) {
+		const int error = errno;
+		close(pipeFds[0]);
+		close(pipeFds[1]);
+		if(stream.forwardFd != -1) {
+			close(stream.forwardFd);
+		}
+		throw std::system_error(error, std::system_category());
+	}
+	close(pipeFds[1]);
+	return stream;
+}
+
+uint64_t ConsoleBuffer::sequence() const {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	return nextSequence_;
+}
+
+std::vector<ConsoleBuffer::Line> ConsoleBuffer::tail(size_t count) const {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	const uint64_t available = std::min<uint64_t>(nextSequence_, capacity_);
+	const uint64_t first = nextSequence_ - std::min<uint64_t>(count, available);
+
+	std::vector<Line> result;
+	result.reserve(nextSequence_ - first);
+	for(uint64_t sequence = first; sequence < nextSequence_; ++sequence) {
+		result.push_back(lines_[sequence % capacity_]);
+	}
+	return result;
+}
+
+std::vector<ConsoleBuffer::Line> ConsoleBuffer::since(uint64_t sequence, size_t count) const {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	const uint64_t oldest = nextSequence_ - std::min<uint64_t>(nextSequence_, capacity_);
+	const uint64_t first = std::max(sequence, oldest);
+	const uint64_t last = std::min<uint64_t>(nextSequence_, first + count);
+
+	std::vector<Line> result;
+	for(uint64_t current = first; current < last; ++current) {
+		result.push_back(lines_[current % capacity_]);
+	}
+	return result;
+}
+
+void ConsoleBuffer::append(std::string text) {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	Line &line = lines_[nextSequence_ % capacity_];
+	line.sequence = nextSequence_++;
+	line.text = std::move(text);
+	line.time = std::chrono::steady_clock::now();
+}
+
+void ConsoleBuffer::run() {
+
+	std::vector<char> buffer(65536);
+	std::vector<pollfd> pollFds;
+	for(;;) {
+		pollFds.clear();
+		pollFds.push_back(pollfd{stopFd_, POLLIN, 0});
+		for(const auto &source: sources_) {
+			pollFds.push_back(pollfd{source.stream.fd, POLLIN, 0});
+		}
+
+		if(poll(pollFds.data(), pollFds.size(), -1) == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+
+		for(size_t i = 1; i < pollFds.size(); ++i) {
+			if(!(pollFds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+				continue;
+			}
+
+			Source &source = sources_[i - 1];
+			ssize_t count = read(source.stream.fd, buffer.data(), buffer.size());
+			if(count == -1) {
+				continue;
+			} else if(count == 0) {
+				if(!source.partial.empty()) {
+					append(std::move(source.partial));
+					source.partial.clear();
+				}
+				close(source.stream.fd);
+				// A negative descriptor is ignored by poll
+				source.stream.fd = -1;
+				continue;
+			}
+
+			forward(source.stream.forwardFd, buffer.data(), count);
+
+			const char *begin = buffer.data();
+			const char *end = begin + count;
+			while(begin != end) {
+				const char *newline = std::find(begin, end, '\n');
+				const size_t length = std::min<size_t>(newline - begin, MAX_LINE_LENGTH - source.partial.size());
+				source.partial.append(begin, length);
+				begin += length;
+				if((begin == newline) && (newline != end)) {
+					++begin;
+				} else if(source.partial.size() < MAX_LINE_LENGTH) {
+					continue;
+				}
+				append(std::move(source.partial));
+				source.partial.clear();
+			}
+		}
+
+		if(pollFds[0].revents & POLLIN) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace minecraftd {
+
+	/**
+	 * Fixed-size buffer of the most recent lines written to a server's standard output and standard error. The
+	 * streams are drained by a dedicated thread, so that the server never blocks on a full pipe even before the GLib
+	 * main loop is running, and every byte read is passed on unchanged to the original stream (normally the journal).
+	 */
+	class ConsoleBuffer {
+		public:
+			struct Line {
+				/** Position of the line in the stream of all lines ever captured, starting at zero. */
+				uint64_t sequence;
+				std::string text;
+				/** Time at which the end of the line was read. */
+				std::chrono::steady_clock::time_point time;
+			};
+
+			/**
+			 * A pipe read end to drain, and the file descriptor to forward what is read to. If restoreFd is not -1,
+			 * forwardFd is duplicated back onto it when the buffer is destroyed.
+			 */
+			struct Stream {
+				int fd;
+				int forwardFd;
+				int restoreFd;
+			};
+
+			static const size_t DEFAULT_CAPACITY = 4096;
+			/** Lines longer than this are split, so that a runaway writer cannot exhaust memory. */
+			static const size_t MAX_LINE_LENGTH = 8192;
+
+			/** Takes ownership of the file descriptors of streams, and starts draining them. */
+			ConsoleBuffer(const std::vector<Stream> &streams, size_t capacity = DEFAULT_CAPACITY);
+			ConsoleBuffer(const ConsoleBuffer&) = delete;
+			~ConsoleBuffer();
+
+			/**
+			 * Redirects fd (e.g. STDOUT_FILENO) in this process into a new pipe, returning a Stream that reads from
+			 * that pipe and forwards to a duplicate of the original file descriptor.
+			 */
+			static Stream redirect(int fd);
+
+			/** Returns the sequence number the next captured line will have. */
+			uint64_t sequence() const;
+			/** Returns up to count of the most recent lines, oldest first. */
+			std::vector<Line> tail(size_t count) const;
+			/**
+			 * Returns up to count lines, oldest first, starting from sequence (or from the oldest line still buffered,
+			 * if that is later).
+			 */
+			std::vector<Line> since(uint64_t sequence, size_t count) const;
+
+		private:
+			struct Source {
+				Stream stream;
+				std::string partial;
+			};
+
+			void append(std::string text);
+			void run();
+
+			const size_t capacity_;
+			std::vector<Line> lines_;
+			mutable std::mutex mutex_;
+			uint64_t nextSequence_;
+			std::vector<Source> sources_;
+			int stopFd_;
+			std::thread thread_;
+	};
+}
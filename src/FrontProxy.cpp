@@ -0,0 +1,677 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "FrontProxy.h"
+
+using minecraftd::FrontProxy;
+
+namespace {
+	const uint64_t LISTEN_TOKEN = ~uint64_t{0};
+	const uint64_t STOP_TOKEN = ~uint64_t{0} - 1;
+	const int CLIENT = 0;
+	const int BACKEND = 1;
+
+	/** Most bytes moved through a pipe in one splice() call; the default pipe capacity. */
+	const size_t SPLICE_SIZE = 64 * 1024;
+	/** Most splice() round trips made for one connection per event, so that one busy player cannot starve others. */
+	const int MAX_SPLICES_PER_EVENT = 16;
+	const int MAX_EVENTS = 256;
+	/** How often parked logins retry the server, in milliseconds. */
+	const int RETRY_INTERVAL = 250;
+	/** A parked connection sending more than this before the server is up is not a Minecraft client. */
+	const size_t MAX_PARKED_INPUT = 4096;
+
+	const int32_t STATE_STATUS = 1;
+
+	enum class Parse { INCOMPLETE, MALFORMED, COMPLETE };
+
+	Parse readVarInt(const std::string &data, size_t &position, int32_t &value) {
+
+		uint32_t result = 0;
+		for(int shift = 0; shift < 35; shift += 7) {
+			if(position >= data.size()) {
+				return Parse::INCOMPLETE;
+			}
+			const unsigned char byte = data[position++];
+			result |= uint32_t{byte & 0x7Fu} << shift;
+			if((byte & 0x80) == 0) {
+				value = static_cast<int32_t>(result);
+				return Parse::COMPLETE;
+			}
+		}
+		return Parse::MALFORMED;
+	}
+
+	std::string writeVarInt(uint32_t value) {
+
+		std::string result;
+		do {
+			const unsigned char byte = value & 0x7F;
+			value >>= 7;
+			result += static_cast<char>(byte | ((value != 0) ? 0x80 : 0));
+		} while(value != 0);
+		return result;
+	}
+
+	/** Splits the next length-prefixed packet off the front of data into packet (packet ID and payload). */
+	Parse readPacket(std::string &data, std::string &packet) {
+
+		size_t position = 0;
+		int32_t length;
+		const Parse parse = readVarInt(data, position, length);
+		if(parse != Parse::COMPLETE) {
+			return parse;
+		} else if((length <= 0) || (static_cast<size_t>(length) > MAX_PARKED_INPUT)) {
+			return Parse::MALFORMED;
+		} else if(data.size() - position < static_cast<size_t>(length)) {
+			return Parse::INCOMPLETE;
+		}
+		packet = data.substr(position, length);
+		data.erase(0, position + length);
+		return Parse::COMPLETE;
+	}
+
+	std::string makePacket(int32_t id, const std::string &payload) {
+
+		const std::string body = writeVarInt(id) + payload;
+		return writeVarInt(body.size()) + body;
+	}
+
+	/** Reads key from server.properties, undoing the escaping of Java properties files except for \u escapes. */
+	std::string readProperty(const std::string &serverDirectory, const std::string &key, const std::string &fallback) {
+
+		std::ifstream in{serverDirectory + "/server.properties"};
+		std::string line;
+		while(std::getline(in, line)) {
+			if(line.compare(0, key.size() + 1, key + '=') != 0) {
+				continue;
+			}
+			std::string value;
+			for(size_t i = key.size() + 1; i < line.size(); ++i) {
+				if((line[i] == '\\') && (i + 1 < line.size()) && (line[i + 1] != 'u')) {
+					++i;
+				}
+				value += line[i];
+			}
+			return value;
+		}
+		return fallback;
+	}
+
+	/** Quotes text as a JSON string. \u escapes (from server.properties) are passed through, as JSON shares them. */
+	std::string jsonString(const std::string &text) {
+
+		std::string result{"\""};
+		for(size_t i = 0; i < text.size(); ++i) {
+			const char c = text[i];
+			if((c == '\\') && (i + 1 < text.size()) && (text[i + 1] == 'u')) {
+				result += c;
+			} else if((c == '"') || (c == '\\')) {
+				result += '\\';
+				result += c;
+			} else if(static_cast<unsigned char>(c) < 0x20) {
+				char escape[7];
+				std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+				result += escape;
+			} else {
+				result += c;
+			}
+		}
+		return result + '"';
+	}
+
+	std::string formatPeer(const sockaddr_storage &address) {
+
+		char host[INET6_ADDRSTRLEN] = "?";
+		unsigned int port = 0;
+		if(address.ss_family == AF_INET) {
+			const sockaddr_in &in = reinterpret_cast<const sockaddr_in&>(address);
+			inet_ntop(AF_INET, &in.sin_addr, host, sizeof(host));
+			port = ntohs(in.sin_port);
+		} else if(address.ss_family == AF_INET6) {
+			const sockaddr_in6 &in6 = reinterpret_cast<const sockaddr_in6&>(address);
+			inet_ntop(AF_INET6, &in6.sin6_addr, host, sizeof(host));
+			return '[' + std::string{host} + "]:" + std::to_string(ntohs(in6.sin6_port));
+		}
+		return std::string{host} + ':' + std::to_string(port);
+	}
+
+	void closeFd(int &fd) {
+
+		if(fd != -1) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+}
+
+/** One direction of a relayed connection: bytes spliced from one socket into a pipe, and from there to the other. */
+struct FrontProxy::Direction {
+	int pipe[2] = {-1, -1};
+	/** Bytes in the pipe not yet written to the destination socket. */
+	size_t pending = 0;
+	/** Whether the source socket has reached end of file, and whether that has been passed on. */
+	bool eof = false;
+	bool shutDown = false;
+	uint64_t bytes = 0;
+
+	/** Moves what it can from one socket to the other; returns false on an error that ends the connection. */
+	bool pump(int from, int to) {
+
+		for(int i = 0; i < MAX_SPLICES_PER_EVENT; ++i) {
+			if(pending == 0) {
+				if(eof) {
+					if(!shutDown) {
+						shutdown(to, SHUT_WR);
+						shutDown = true;
+					}
+					return true;
+				}
+				const ssize_t count = splice(from, nullptr, pipe[1], nullptr, SPLICE_SIZE,
+						SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				if(count == 0) {
+					eof = true;
+					continue;
+				} else if(count < 0) {
+					return (errno == EAGAIN) || (errno == EINTR);
+				}
+				pending = count;
+			}
+
+			const ssize_t count = splice(pipe[0], nullptr, to, nullptr, pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if(count < 0) {
+				return (errno == EAGAIN) || (errno == EINTR);
+			}
+			pending -= count;
+			bytes += count;
+		}
+		return true;
+	}
+};
+
+struct FrontProxy::Connection {
+	enum class State { PARKED, CONNECTING, RELAYING, CLOSED };
+
+	uint64_t id;
+	int fds[2];
+	/** Events each socket is registered for with epoll, or -1 if it is not registered. */
+	int64_t registered[2];
+	std::string peer;
+	std::chrono::steady_clock::time_point start;
+	State state;
+	/** Bytes received while parked, replayed to the server on hand-over. */
+	std::string input;
+	bool handshakeRead;
+	bool status;
+	int32_t protocol;
+	/** Client to server, and server to client. */
+	Direction upstream;
+	Direction downstream;
+};
+
+const std::chrono::seconds FrontProxy::PARK_TIMEOUT{60};
+
+FrontProxy::FrontProxy(const std::string &address, unsigned int port, unsigned int backendPort,
+		const std::string &serverDirectory)
+	: backendPort_{backendPort},
+	epollFd_{-1},
+	lastRetry_{},
+	listenFd_{-1},
+	maxPlayers_{static_cast<unsigned int>(std::strtoul(readProperty(serverDirectory, "max-players", "20").c_str(),
+				nullptr, 10))},
+	motd_{readProperty(serverDirectory, "motd", "A Minecraft Server")},
+	nextId_{0},
+	spareFd_{-1},
+	stopFd_{-1} {
+
+	// Each relayed connection takes two sockets and two pipes
+	rlimit limit;
+	if((getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < limit.rlim_max)) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *addresses;
+	const int rc = getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &addresses);
+	if(rc != 0) {
+		throw std::runtime_error{"Invalid proxy address " + address + ": " + gai_strerror(rc)};
+	}
+
+	const int one = 1;
+	listenFd_ = socket(addresses->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if((listenFd_ == -1) || (setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0)
+			|| (bind(listenFd_, addresses->ai_addr, addresses->ai_addrlen) != 0)
+			|| (listen(listenFd_, SOMAXCONN) != 0)) {
+		const int error = errno;
+		freeaddrinfo(addresses);
+		closeFd(listenFd_);
+		throw std::system_error(error, std::system_category(), "Failed to listen on proxy port "
+				+ std::to_string(port));
+	}
+	freeaddrinfo(addresses);
+	spareFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+	epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+	stopFd_ = eventfd(0, EFD_CLOEXEC);
+	epoll_event listenEvent{EPOLLIN, {}};
+	listenEvent.data.u64 = LISTEN_TOKEN;
+	epoll_event stopEvent{EPOLLIN, {}};
+	stopEvent.data.u64 = STOP_TOKEN;
+	if((epollFd_ == -1) || (stopFd_ == -1) || (epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &listenEvent) != 0)
+			|| (epoll_ctl(epollFd_, EPOLL_CTL_ADD, stopFd_, &stopEvent) != 0)) {
+		const int error = errno;
+		closeFd(epollFd_);
+		closeFd(stopFd_);
+		closeFd(listenFd_);
+		throw std::system_error(error, std::system_category());
+	}
+
+	std::cout << "Proxying " << address << ':' << port << " to port " << backendPort_ << std::endl;
+	thread_ = std::thread{&FrontProxy::run, this};
+}
+
+FrontProxy::~FrontProxy() {
+
+	const uint64_t one = 1;
+	if(write(stopFd_, &one, sizeof(one)) == sizeof(one)) {
+		thread_.join();
+	} else {
+		thread_.detach();
+		return;
+	}
+
+	for(auto &entry: connections_) {
+		drop(*entry.second);
+	}
+	closeFd(listenFd_);
+	closeFd(spareFd_);
+	closeFd(stopFd_);
+	closeFd(epollFd_);
+}
+
+std::vector<FrontProxy::ConnectionInfo> FrontProxy::connections() const {
+
+	const auto now = std::chrono::steady_clock::now();
+	std::vector<ConnectionInfo> result;
+	std::lock_guard<std::mutex> lock{mutex_};
+	for(const auto &entry: connections_) {
+		const Connection &connection = *entry.second;
+		tcp_info info;
+		socklen_t length = sizeof(info);
+		std::memset(&info, 0, sizeof(info));
+		getsockopt(connection.fds[CLIENT], IPPROTO_TCP, TCP_INFO, &info, &length);
+		result.push_back(ConnectionInfo{connection.peer, connection.upstream.bytes, connection.downstream.bytes,
+				std::chrono::duration_cast<std::chrono::milliseconds>(now - connection.start),
+				std::chrono::microseconds{info.tcpi_rtt}, connection.state != Connection::State::RELAYING});
+	}
+	return result;
+}
+
+void FrontProxy::run() {
+
+	epoll_event events[MAX_EVENTS];
+	for(;;) {
+		const int count = epoll_wait(epollFd_, events, MAX_EVENTS, parked_.empty() ? -1 : RETRY_INTERVAL);
+		if((count == -1) && (errno != EINTR)) {
+			std::cerr << "Proxy failed: " << std::strerror(errno) << std::endl;
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock{mutex_};
+		for(int i = 0; i < count; ++i) {
+			const uint64_t token = events[i].data.u64;
+			if(token == STOP_TOKEN) {
+				return;
+			} else if(token == LISTEN_TOKEN) {
+				accept();
+				continue;
+			}
+
+			auto connection = connections_.find(token >> 1);
+			if((connection != connections_.end()) && (connection->second->state != Connection::State::CLOSED)) {
+				onEvent(*connection->second, token & 1, events[i].events);
+			}
+		}
+
+		retryParked();
+		for(uint64_t id: closed_) {
+			connections_.erase(id);
+		}
+		closed_.clear();
+	}
+}
+
+void FrontProxy::accept() {
+
+	for(;;) {
+		sockaddr_storage address;
+		socklen_t length = sizeof(address);
+		const int fd = accept4(listenFd_, reinterpret_cast<sockaddr*>(&address), &length,
+				SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd == -1) {
+			if(((errno == EMFILE) || (errno == ENFILE)) && (spareFd_ != -1)) {
+				// Left pending, the client would keep the listening socket readable and this thread spinning, so it is
+				// accepted with the spare descriptor and refused
+				std::cerr << "Proxy refused a connection: " << std::strerror(errno) << std::endl;
+				closeFd(spareFd_);
+				int refused = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+				closeFd(refused);
+				spareFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+				continue;
+			} else if((errno != EAGAIN) && (errno != EINTR) && (errno != ECONNABORTED)) {
+				std::cerr << "Proxy failed to accept a connection: " << std::strerror(errno) << std::endl;
+			}
+			return;
+		}
+
+		// Minecraft's packets are small and latency-sensitive; the server disables Nagle's algorithm too
+		const int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		std::unique_ptr<Connection> connection{new Connection{nextId_++, {fd, -1}, {-1, -1}, formatPeer(address),
+			std::chrono::steady_clock::now(), Connection::State::PARKED, std::string{}, false, false, 0, Direction{},
+			Direction{}}};
+		connectBackend(*connection);
+		if(connection->state == Connection::State::PARKED) {
+			park(*connection);
+		}
+		updateInterest(*connection);
+		connections_[connection->id] = std::move(connection);
+	}
+}
+
+void FrontProxy::connectBackend(Connection &connection) {
+
+	sockaddr_in address;
+	std::memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(backendPort_);
+
+	int &fd = connection.fds[BACKEND];
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd == -1) {
+		return;
+	}
+	const int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+		onBackendConnected(connection);
+	} else if(errno == EINPROGRESS) {
+		connection.state = Connection::State::CONNECTING;
+	} else {
+		closeFd(fd);
+	}
+}
+
+void FrontProxy::onBackendConnected(Connection &connection) {
+
+	if(!connection.input.empty()) {
+		// A handshake and login start fit easily in a new socket's send buffer
+		const ssize_t count = send(connection.fds[BACKEND], connection.input.data(), connection.input.size(),
+				MSG_NOSIGNAL);
+		if((count < 0) || (static_cast<size_t>(count) != connection.input.size())) {
+			drop(connection);
+			return;
+		}
+		connection.upstream.bytes += count;
+		connection.input.clear();
+	}
+
+	for(Direction *direction: {&connection.upstream, &connection.downstream}) {
+		if(pipe2(direction->pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+			std::cerr << "Proxy failed to create a pipe: " << std::strerror(errno) << std::endl;
+			drop(connection);
+			return;
+		}
+	}
+	if(parked_.erase(connection.id) != 0) {
+		std::cout << "Handing connection from " << connection.peer << " over to the server" << std::endl;
+	}
+	connection.state = Connection::State::RELAYING;
+}
+
+void FrontProxy::onEvent(Connection &connection, int side, uint32_t events) {
+
+	if(side == CLIENT && ((connection.state == Connection::State::PARKED)
+				|| (connection.state == Connection::State::CONNECTING))) {
+		onParkedInput(connection);
+	} else if(connection.state == Connection::State::CONNECTING) {
+		int error = 0;
+		socklen_t length = sizeof(error);
+		getsockopt(connection.fds[BACKEND], SOL_SOCKET, SO_ERROR, &error, &length);
+		if((error != 0) || connection.status) {
+			// The server is not up yet (or the client only wanted its status, which has been answered here)
+			epoll_ctl(epollFd_, EPOLL_CTL_DEL, connection.fds[BACKEND], nullptr);
+			connection.registered[BACKEND] = -1;
+			closeFd(connection.fds[BACKEND]);
+			park(connection);
+		} else {
+			onBackendConnected(connection);
+		}
+	} else if(connection.state == Connection::State::RELAYING) {
+		if((events & EPOLLERR) != 0) {
+			drop(connection);
+			return;
+		}
+		if(!connection.upstream.pump(connection.fds[CLIENT], connection.fds[BACKEND])
+				|| !connection.downstream.pump(connection.fds[BACKEND], connection.fds[CLIENT])) {
+			drop(connection);
+			return;
+		}
+
+		// A socket that has hung up will take nothing more, so whatever is still bound for it is discarded
+		if(((events & EPOLLHUP) != 0) && (side == CLIENT ? connection.upstream : connection.downstream).eof) {
+			Direction &towards = (side == CLIENT) ? connection.downstream : connection.upstream;
+			towards.eof = true;
+			towards.pending = 0;
+		}
+		if(connection.upstream.eof && connection.downstream.eof && (connection.upstream.pending == 0)
+				&& (connection.downstream.pending == 0)) {
+			drop(connection);
+			return;
+		}
+	}
+
+	if(connection.state != Connection::State::CLOSED) {
+		updateInterest(connection);
+	}
+}
+
+void FrontProxy::onParkedInput(Connection &connection) {
+
+	char buffer[1024];
+	const ssize_t count = recv(connection.fds[CLIENT], buffer, sizeof(buffer), 0);
+	if((count < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+		return;
+	} else if((count <= 0) || (connection.input.size() + count > MAX_PARKED_INPUT)) {
+		drop(connection);
+		return;
+	}
+	connection.input.append(buffer, count);
+
+	if(!connection.handshakeRead) {
+		// The pre-1.7 server list ping starts with 0xFE; such clients cannot join a current server anyway
+		if(static_cast<unsigned char>(connection.input[0]) == 0xFE) {
+			drop(connection);
+			return;
+		}
+
+		std::string remaining = connection.input;
+		std::string packet;
+		const Parse parse = readPacket(remaining, packet);
+		if(parse == Parse::INCOMPLETE) {
+			return;
+		}
+
+		size_t position = 0;
+		int32_t id, addressLength, nextState;
+		if((parse == Parse::MALFORMED) || (readVarInt(packet, position, id) != Parse::COMPLETE) || (id != 0)
+				|| (readVarInt(packet, position, connection.protocol) != Parse::COMPLETE)
+				|| (readVarInt(packet, position, addressLength) != Parse::COMPLETE) || (addressLength < 0)
+				|| (packet.size() - position < static_cast<size_t>(addressLength) + 2)) {
+			drop(connection);
+			return;
+		}
+		position += addressLength + 2;
+		if(readVarInt(packet, position, nextState) != Parse::COMPLETE) {
+			drop(connection);
+			return;
+		}
+
+		connection.handshakeRead = true;
+		connection.status = (nextState == STATE_STATUS);
+		if(connection.status) {
+			// Status pings are answered here rather than replayed, so the handshake is done with
+			connection.input = remaining;
+		}
+	}
+
+	if(!connection.status) {
+		return;
+	}
+
+	// Status request (0x00) and ping (0x01); the response echoes the client's protocol version so that it shows the
+	// server as compatible
+	std::string packet;
+	while(readPacket(connection.input, packet) == Parse::COMPLETE) {
+		std::string reply;
+		if(packet == std::string(1, '\0')) {
+			const std::string json{"{\"version\":{\"name\":\"starting\",\"protocol\":" +
+				std::to_string(connection.protocol) + "},\"players\":{\"max\":" + std::to_string(maxPlayers_) +
+				",\"online\":0},\"description\":{\"text\":" + jsonString(motd_) + "}}"};
+			reply = makePacket(0, writeVarInt(json.size()) + json);
+		} else if((packet.size() == 9) && (packet[0] == 1)) {
+			reply = makePacket(1, packet.substr(1));
+		} else {
+			drop(connection);
+			return;
+		}
+
+		if(send(connection.fds[CLIENT], reply.data(), reply.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(reply.size())
+				|| (packet[0] == 1)) {
+			drop(connection);
+			return;
+		}
+	}
+}
+
+void FrontProxy::park(Connection &connection) {
+
+	connection.state = Connection::State::PARKED;
+	if(parked_.insert(connection.id).second && !connection.status) {
+		std::cout << "Parking connection from " << connection.peer << " until the server is up" << std::endl;
+	}
+}
+
+void FrontProxy::retryParked() {
+
+	const auto now = std::chrono::steady_clock::now();
+	if(parked_.empty() || (now - lastRetry_ < std::chrono::milliseconds{RETRY_INTERVAL})) {
+		return;
+	}
+	lastRetry_ = now;
+
+	const std::set<uint64_t> parked = parked_;
+	for(uint64_t id: parked) {
+		Connection &connection = *connections_.at(id);
+		if(connection.state != Connection::State::PARKED) {
+			continue;
+		} else if(now - connection.start > PARK_TIMEOUT) {
+			drop(connection);
+		} else if(!connection.status) {
+			connectBackend(connection);
+			if(connection.state != Connection::State::CLOSED) {
+				updateInterest(connection);
+			}
+		}
+	}
+}
+
+void FrontProxy::updateInterest(Connection &connection) {
+
+	int64_t wanted[2] = {0, 0};
+	switch(connection.state) {
+		case Connection::State::PARKED:
+			wanted[CLIENT] = EPOLLIN;
+			wanted[BACKEND] = -1;
+			break;
+		case Connection::State::CONNECTING:
+			wanted[CLIENT] = EPOLLIN;
+			wanted[BACKEND] = EPOLLOUT;
+			break;
+		case Connection::State::RELAYING:
+			for(int side: {CLIENT, BACKEND}) {
+				const Direction &from = (side == CLIENT) ? connection.upstream : connection.downstream;
+				const Direction &to = (side == CLIENT) ? connection.downstream : connection.upstream;
+				wanted[side] = (((from.pending == 0) && !from.eof) ? int64_t{EPOLLIN} : 0)
+					| ((to.pending != 0) ? int64_t{EPOLLOUT} : 0);
+			}
+			break;
+		case Connection::State::CLOSED:
+			return;
+	}
+
+	for(int side: {CLIENT, BACKEND}) {
+		const int fd = connection.fds[side];
+		if((fd == -1) || (wanted[side] == connection.registered[side])) {
+			continue;
+		}
+		epoll_event event{static_cast<uint32_t>(std::max<int64_t>(wanted[side], 0)), {}};
+		event.data.u64 = (connection.id << 1) | side;
+		if(wanted[side] == -1) {
+			epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+		} else {
+			epoll_ctl(epollFd_, (connection.registered[side] == -1) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event);
+		}
+		connection.registered[side] = wanted[side];
+	}
+}
+
+void FrontProxy::drop(Connection &connection) {
+
+	for(int &fd: connection.fds) {
+		closeFd(fd);
+	}
+	for(Direction *direction: {&connection.upstream, &connection.downstream}) {
+		closeFd(direction->pipe[0]);
+		closeFd(direction->pipe[1]);
+	}
+	connection.state = Connection::State::CLOSED;
+	parked_.erase(connection.id);
+	closed_.push_back(connection.id);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace minecraftd {
+
+	/**
+	 * Owns the public game port, and relays each player's connection to the server listening on a loopback port.
+	 * Data is moved between the sockets with splice(), through a pipe per direction, so it is never copied into user
+	 * space; a single epoll loop serves every connection.
+	 *
+	 * While the server is not accepting connections (as while it starts), new connections are parked rather than
+	 * refused: status pings are answered from the MOTD in server.properties, and logins are held until the server is
+	 * up, then handed over with the bytes received so far.
+	 */
+	class FrontProxy {
+		public:
+			struct ConnectionInfo {
+				/** Address and port of the player. */
+				std::string peer;
+				/** Bytes relayed from the player to the server, and from the server to the player. */
+				uint64_t bytesIn;
+				uint64_t bytesOut;
+				std::chrono::milliseconds age;
+				/** The kernel's smoothed round-trip time to the player. */
+				std::chrono::microseconds rtt;
+				/** Whether the connection is waiting for the server to come up. */
+				bool parked;
+			};
+
+			/** Parked logins are dropped after this long; the client will have given up by then anyway. */
+			static const std::chrono::seconds PARK_TIMEOUT;
+
+			/**
+			 * Listens on address and port, relaying connections to backendPort on the loopback interface. Throws
+			 * std::system_error if the port cannot be bound.
+			 */
+			FrontProxy(const std::string &address, unsigned int port, unsigned int backendPort,
+					const std::string &serverDirectory);
+			FrontProxy(const FrontProxy&) = delete;
+			~FrontProxy();
+
+			std::vector<ConnectionInfo> connections() const;
+
+		private:
+			struct Connection;
+			struct Direction;
+
+			void accept();
+			void connectBackend(Connection &connection);
+			/** Closes a connection, which is destroyed once the current batch of events has been handled. */
+			void drop(Connection &connection);
+			void onBackendConnected(Connection &connection);
+			void onEvent(Connection &connection, int side, uint32_t events);
+			/** Reads a parked connection's handshake, answering status pings itself. */
+			void onParkedInput(Connection &connection);
+			void park(Connection &connection);
+			void retryParked();
+			void run();
+			void updateInterest(Connection &connection);
+
+			const unsigned int backendPort_;
+			std::vector<uint64_t> closed_;
+			std::map<uint64_t, std::unique_ptr<Connection>> connections_;
+			int epollFd_;
+			std::chrono::steady_clock::time_point lastRetry_;
+			int listenFd_;
+			const unsigned int maxPlayers_;
+			const std::string motd_;
+			mutable std::mutex mutex_;
+			uint64_t nextId_;
+			/** Connections waiting for the server to come up; only touched by the proxy thread. */
+			std::set<uint64_t> parked_;
+			/** Held in reserve, and given up to accept and refuse a client when the process is out of descriptors. */
+			int spareFd_;
+			int stopFd_;
+			std::thread thread_;
+	};
+}
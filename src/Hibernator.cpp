@@ -0,0 +1,234 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <signal.h>
+
+#include "Hibernator.h"
+
+using namespace minecraftd;
+
+namespace {
+	const unsigned int DEFAULT_PORT = 25565;
+	/** Socket state of a listening socket in /proc/net/tcp. */
+	const std::string TCP_LISTEN{"0A"};
+
+	/** Returns the value of key in server.properties, or fallback if it is not set. */
+	std::string readProperty(const std::string &serverDirectory, const std::string &key, const std::string &fallback) {
+
+		std::ifstream in{serverDirectory + "/server.properties"};
+		std::string line;
+		while(std::getline(in, line)) {
+			if((line.compare(0, key.size(), key) == 0) && (line.size() > key.size()) && (line[key.size()] == '=')) {
+				return line.substr(key.size() + 1);
+			}
+		}
+		return fallback;
+	}
+
+	/** Returns the server-port from server.properties, or the server's default if it is not set. */
+	unsigned int readServerPort(const std::string &serverDirectory) {
+
+		return std::strtoul(readProperty(serverDirectory, "server-port", std::to_string(DEFAULT_PORT)).c_str(),
+				nullptr, 10);
+	}
+
+	/**
+	 * Throws std::runtime_error unless the server's watchdog is disabled (max-tick-time=-1). Once the server is
+	 * resumed, the watchdog thread may run before the tick thread does, and would then take the time spent suspended
+	 * for a single tick and halt the server.
+	 */
+	void checkWatchdogDisabled(const std::string &serverDirectory) {
+
+		const std::string maxTickTime = readProperty(serverDirectory, "max-tick-time", "60000");
+		if(std::strtol(maxTickTime.c_str(), nullptr, 10) != -1) {
+			throw std::runtime_error{"max-tick-time is " + maxTickTime + " in server.properties, and must be -1 for "
+				"the server to survive hibernation"};
+		}
+	}
+
+	/**
+	 * Returns the message of a line of server output ("[12:00:00] [Server thread/INFO]: message"), or an empty
+	 * string if the line was not logged by the server thread. Chat is logged by the server thread too, but its
+	 * messages always begin with the sender's name in angle brackets.
+	 */
+	std::string serverMessage(const std::string &line) {
+
+		const size_t thread = line.find("[Server thread/INFO]: ");
+		if(thread == std::string::npos) {
+			return std::string{};
+		}
+		return line.substr(thread + 22);
+	}
+}
+
+const unsigned int Hibernator::CHECK_INTERVAL;
+const std::chrono::seconds Hibernator::SAVE_TIMEOUT{120};
+
+Hibernator::Hibernator(pid_t pid, const std::string &serverDirectory, std::chrono::seconds idleTime,
+		const ConsoleBuffer &console, CommandQueue &commandQueue, const StartupTracker &startup)
+	: commandQueue_(commandQueue),
+	console_(console),
+	idleTime_{idleTime},
+	idleSince_{std::chrono::steady_clock::now()},
+	listing_{false},
+	pid_{pid},
+	players_{0},
+	port_{readServerPort(serverDirectory)},
+	sequence_{console.sequence()},
+	startup_(startup),
+	state_{State::AWAKE} {
+
+	checkWatchdogDisabled(serverDirectory);
+	timer_ = Glib::signal_timeout().connect(sigc::mem_fun(*this, &Hibernator::onTimer), CHECK_INTERVAL);
+}
+
+Hibernator::~Hibernator() {
+
+	timer_.disconnect();
+}
+
+const char* Hibernator::stateName(State state) {
+
+	switch(state) {
+		case State::AWAKE: return "awake";
+		case State::SAVING: return "saving";
+		case State::HIBERNATING: return "hibernating";
+	}
+	return "unknown";
+}
+
+void Hibernator::wake() {
+
+	if(state_ == State::HIBERNATING) {
+		if(kill(pid_, SIGCONT) != 0) {
+			std::cerr << "Failed to resume process " << pid_ << std::endl;
+		}
+		std::cout << "Server " << pid_ << " woken from hibernation" << std::endl;
+	}
+	state_ = State::AWAKE;
+	listing_ = false;
+	idleSince_ = std::chrono::steady_clock::now();
+}
+
+void Hibernator::childExited() {
+
+	timer_.disconnect();
+	state_ = State::AWAKE;
+	players_ = 0;
+}
+
+bool Hibernator::onTimer() {
+
+	if(state_ == State::HIBERNATING) {
+		if(connectionPending()) {
+			wake();
+		}
+		return true;
+	}
+
+	const uint64_t sequence = console_.sequence();
+	for(const auto &line: console_.since(sequence_, sequence - sequence_)) {
+		onLine(line);
+		if(state_ == State::HIBERNATING) {
+			break;
+		}
+	}
+	sequence_ = sequence;
+
+	const auto now = std::chrono::steady_clock::now();
+	if((state_ == State::SAVING) && (now - saveStart_ > SAVE_TIMEOUT)) {
+		std::cerr << "Server did not confirm its save; not hibernating" << std::endl;
+		wake();
+	} else if((state_ == State::AWAKE) && !listing_ && startup_.ready() && (players_ == 0)
+			&& (now - idleSince_ >= idleTime_)) {
+		// Confirm that the server is empty before saving, in case a join or leave line was missed
+		listing_ = commandQueue_.push("list");
+		saveStart_ = now;
+	} else if(listing_ && (now - saveStart_ > SAVE_TIMEOUT)) {
+		listing_ = false;
+		idleSince_ = now;
+	}
+	return true;
+}
+
+void Hibernator::onLine(const ConsoleBuffer::Line &line) {
+
+	const std::string message = serverMessage(line.text);
+	if(message.empty() || (message[0] == '<')) {
+		return;
+	}
+
+	// Player names never contain spaces, so anything else ending in these phrases is not a join or leave
+	const size_t space = message.find(' ');
+	const std::string event = (space != std::string::npos) ? message.substr(space + 1) : std::string{};
+	if(event == "joined the game") {
+		++players_;
+		wake();
+	} else if(event == "left the game") {
+		players_ = (players_ > 0) ? players_ - 1 : 0;
+		idleSince_ = line.time;
+	} else if(message.compare(0, 10, "There are ") == 0) {
+		players_ = std::strtoul(message.c_str() + 10, nullptr, 10);
+		if(listing_) {
+			listing_ = false;
+			if((players_ == 0) && commandQueue_.push("save-all flush")) {
+				std::cout << "Server idle for " << idleTime_.count() << " s; saving before hibernating" << std::endl;
+				state_ = State::SAVING;
+				saveStart_ = std::chrono::steady_clock::now();
+			} else {
+				idleSince_ = line.time;
+			}
+		}
+	} else if((state_ == State::SAVING) && (message.compare(0, 14, "Saved the game") == 0)) {
+		if(kill(pid_, SIGSTOP) != 0) {
+			std::cerr << "Failed to stop process " << pid_ << std::endl;
+			wake();
+			return;
+		}
+		std::cout << "Server " << pid_ << " hibernating until a connection to port " << port_ << std::endl;
+		state_ = State::HIBERNATING;
+	}
+}
+
+bool Hibernator::connectionPending() const {
+
+	// For listening sockets, the receive queue column holds the number of connections awaiting accept()
+	for(const char *path: {"/proc/net/tcp", "/proc/net/tcp6"}) {
+		std::ifstream in{path};
+		std::string line;
+		std::getline(in, line);
+		while(std::getline(in, line)) {
+			std::istringstream fields{line};
+			std::string slot, local, remote, state, queues;
+			if(!(fields >> slot >> local >> remote >> state >> queues) || (state != TCP_LISTEN)) {
+				continue;
+			}
+			const size_t colon = local.rfind(':');
+			const size_t queueColon = queues.find(':');
+			if((colon == std::string::npos) || (queueColon == std::string::npos)
+					|| (std::strtoul(local.c_str() + colon + 1, nullptr, 16) != port_)) {
+				continue;
+			}
+			if(std::strtoul(queues.c_str() + queueColon + 1, nullptr, 16) != 0) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
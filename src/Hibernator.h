@@ -0,0 +1,85 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+#include <glibmm.h>
+
+#include "CommandQueue.h"
+#include "ConsoleBuffer.h"
+#include "StartupTracker.h"
+
+namespace minecraftd {
+
+	/**
+	 * Suspends an instance's child process while nobody is playing, and resumes it when somebody tries to join.
+	 *
+	 * Players are counted from the join and leave lines on the server's console. Once the server has been empty for
+	 * the idle time, the count is confirmed with "list", the world is saved, and the child is stopped with SIGSTOP, so
+	 * that it burns no CPU and its heap may be swapped out. The stopped server's listening socket stays open, so the
+	 * kernel still completes connections to the game port; the hibernator watches the socket's accept queue and
+	 * resumes the child as soon as a connection is waiting, which the server then accepts as usual.
+	 */
+	class Hibernator {
+		public:
+			enum class State { AWAKE, SAVING, HIBERNATING };
+
+			static const unsigned int CHECK_INTERVAL = 250;
+			/** Hibernation is abandoned if the server does not confirm the save within this time. */
+			static const std::chrono::seconds SAVE_TIMEOUT;
+
+			/**
+			 * Hibernates the child pid running the server in serverDirectory once it has been idle for idleTime.
+			 * Throws std::runtime_error unless the server's watchdog is disabled (max-tick-time=-1 in
+			 * server.properties), as it would halt the server on waking.
+			 */
+			Hibernator(pid_t pid, const std::string &serverDirectory, std::chrono::seconds idleTime,
+					const ConsoleBuffer &console, CommandQueue &commandQueue, const StartupTracker &startup);
+			Hibernator(const Hibernator&) = delete;
+			~Hibernator();
+
+			State state() const { return state_; }
+			static const char* stateName(State state);
+			unsigned int players() const { return players_; }
+
+			/** Resumes the child if it is hibernating, and restarts the idle time. */
+			void wake();
+			/** Stops watching the child, once it has exited. */
+			void childExited();
+
+		private:
+			bool onTimer();
+			void onLine(const ConsoleBuffer::Line &line);
+			/** Returns true if a connection to the game port is waiting to be accepted. */
+			bool connectionPending() const;
+
+			CommandQueue &commandQueue_;
+			const ConsoleBuffer &console_;
+			const std::chrono::seconds idleTime_;
+			std::chrono::steady_clock::time_point idleSince_;
+			bool listing_;
+			const pid_t pid_;
+			unsigned int players_;
+			unsigned int port_;
+			std::chrono::steady_clock::time_point saveStart_;
+			uint64_t sequence_;
+			const StartupTracker &startup_;
+			State state_;
+			sigc::connection timer_;
+	};
+}
@@ -10,72 +10,510 @@
  * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
  * specific language governing permissions and limitations under the License.
  */
-#include <sstream>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
 #include <stdexcept>
+#include <system_error>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glibmm.h>
+#include <zlib.h>
 
 #include "JarReader.h"
 
 using namespace minecraftd;
 
-JarReader::JarReader(const std::string &jarPath) : jarPath_(jarPath) {
+namespace {
+	const char MANIFEST_NAME[] = "META-INF/MANIFEST.MF";
+	const std::string CACHE_HEADER{"minecraftd-manifest-cache 1"};
+
+	const uint32_t LOCAL_HEADER_SIGNATURE = 0x04034b50;
+	const uint32_t CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+	const uint32_t END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06054b50;
+	const uint32_t ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06064b50;
+	const uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+	const size_t END_OF_CENTRAL_DIRECTORY_SIZE = 22;
+	const size_t ZIP64_LOCATOR_SIZE = 20;
+	const size_t CENTRAL_HEADER_SIZE = 46;
+	const size_t LOCAL_HEADER_SIZE = 30;
+	/** Largest manifest accepted; signed JARs list a digest per entry, so this is generous. */
+	const uint64_t MAX_MANIFEST_SIZE = 16 << 20;
+
+	/** Bounds-checked little-endian reader over a region of the mapped archive. */
+	class ZipView {
+		public:
+			ZipView(const void *data, size_t size, const std::string &jarPath)
+				: data_(static_cast<const unsigned char*>(data)), size_(size), jarPath_(jarPath) { }
+
+			const unsigned char *at(uint64_t offset, uint64_t length) const {
+
+				if((offset > size_) || (length > size_ - offset)) {
+					throw std::runtime_error{jarPath_ + " is truncated or corrupt"};
+				}
+				return data_ + offset;
+			}
+
+			uint16_t u16(uint64_t offset) const { uint16_t v; std::memcpy(&v, at(offset, 2), 2); return le16toh(v); }
+			uint32_t u32(uint64_t offset) const { uint32_t v; std::memcpy(&v, at(offset, 4), 4); return le32toh(v); }
+			uint64_t u64(uint64_t offset) const { uint64_t v; std::memcpy(&v, at(offset, 8), 8); return le64toh(v); }
+			size_t size() const { return size_; }
+
+		private:
+			const unsigned char *data_;
+			const size_t size_;
+			const std::string &jarPath_;
+	};
+
+	/**
+	 * Finds the manifest in the central directory, returning a pointer to its (possibly compressed) data along with
+	 * the compression method, sizes and CRC. Returns nullptr if the archive has no manifest.
+	 */
+	const unsigned char *locateManifest(const ZipView &zip, uint16_t &method, uint64_t &compressedSize,
+			uint64_t &size, uint32_t &crc) {
+
+		if(zip.size() < END_OF_CENTRAL_DIRECTORY_SIZE) {
+			throw std::runtime_error{"Not a ZIP archive"};
+		}
+
+		// The end of central directory record is followed only by a comment of at most 65535 bytes
+		uint64_t eocd = zip.size() - END_OF_CENTRAL_DIRECTORY_SIZE;
+		const uint64_t searchLimit = (eocd > 0xffff) ? eocd - 0xffff : 0;
+		while(zip.u32(eocd) != END_OF_CENTRAL_DIRECTORY_SIGNATURE) {
+			if(eocd-- == searchLimit) {
+				throw std::runtime_error{"Not a ZIP archive"};
+			}
+		}
+
+		uint64_t entries = zip.u16(eocd + 10);
+		uint64_t offset = zip.u32(eocd + 16);
+		if(((entries == 0xffff) || (offset == 0xffffffff)) && (eocd >= ZIP64_LOCATOR_SIZE)
+				&& (zip.u32(eocd - ZIP64_LOCATOR_SIZE) == ZIP64_LOCATOR_SIGNATURE)) {
+			uint64_t eocd64 = zip.u64(eocd - ZIP64_LOCATOR_SIZE + 8);
+			if(zip.u32(eocd64) != ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE) {
+				throw std::runtime_error{"Corrupt ZIP64 end of central directory record"};
+			}
+			entries = zip.u64(eocd64 + 32);
+			offset = zip.u64(eocd64 + 48);
+		}
+
+		const size_t nameLength = sizeof(MANIFEST_NAME) - 1;
+		for(uint64_t i = 0; i < entries; ++i) {
+			if(zip.u32(offset) != CENTRAL_HEADER_SIGNATURE) {
+				throw std::runtime_error{"Corrupt ZIP central directory"};
+			}
+
+			const uint16_t entryNameLength = zip.u16(offset + 28), extraLength = zip.u16(offset + 30),
+				  commentLength = zip.u16(offset + 32);
+			const uint64_t next = offset + CENTRAL_HEADER_SIZE + entryNameLength + extraLength + commentLength;
+			const unsigned char *entryName = zip.at(offset + CENTRAL_HEADER_SIZE, entryNameLength);
+			if((entryNameLength != nameLength) || (std::memcmp(entryName, MANIFEST_NAME, nameLength) != 0)) {
+				offset = next;
+				continue;
+			}
+
+			if((zip.u16(offset + 8) & 0x1) != 0) {
+				throw std::runtime_error{"MANIFEST.MF is encrypted"};
+			}
+			method = zip.u16(offset + 10);
+			crc = zip.u32(offset + 16);
+			compressedSize = zip.u32(offset + 20);
+			size = zip.u32(offset + 24);
+			uint64_t localOffset = zip.u32(offset + 42);
+
+			// Sizes and offsets that overflow 32 bits are held in the ZIP64 extended information extra field
+			uint64_t extra = offset + CENTRAL_HEADER_SIZE + entryNameLength;
+			const uint64_t extraEnd = extra + extraLength;
+			while(extra + 4 <= extraEnd) {
+				const uint16_t id = zip.u16(extra), length = zip.u16(extra + 2);
+				if(id == 0x0001) {
+					uint64_t field = extra + 4;
+					if(size == 0xffffffff) { size = zip.u64(field); field += 8; }
+					if(compressedSize == 0xffffffff) { compressedSize = zip.u64(field); field += 8; }
+					if(localOffset == 0xffffffff) { localOffset = zip.u64(field); }
+					break;
+				}
+				extra += 4 + length;
+			}
+
+			if(zip.u32(localOffset) != LOCAL_HEADER_SIGNATURE) {
+				throw std::runtime_error{"Corrupt ZIP local file header for MANIFEST.MF"};
+			}
+			const uint64_t dataOffset = localOffset + LOCAL_HEADER_SIZE + zip.u16(localOffset + 26)
+				+ zip.u16(localOffset + 28);
+			return zip.at(dataOffset, compressedSize);
+		}
+		return nullptr;
+	}
+
+	/**
+	 * Parses the main section of a manifest, joining continuation lines (those starting with a single space, as used
+	 * to wrap values at 72 bytes). Attribute names are case-insensitive, so are returned in lower case.
+	 */
+	std::unordered_map<std::string, std::string> parseMainSection(const char *data, size_t size) {
+
+		std::unordered_map<std::string, std::string> attributes;
+		std::string name, value;
+		bool haveAttribute = false;
+		for(size_t i = 0; i < size;) {
+			size_t end = i;
+			while((end < size) && (data[end] != '\r') && (data[end] != '\n')) {
+				++end;
+			}
+			const std::string line{data + i, end - i};
+			if((end < size) && (data[end] == '\r')) {
+				++end;
+			}
+			if((end < size) && (data[end] == '\n')) {
+				++end;
+			}
+			i = end;
+
+			if(line.empty()) {
+				break;
+			} else if(line[0] == ' ') {
+				if(haveAttribute) {
+					value.append(line, 1, std::string::npos);
+				}
+				continue;
+			}
+
+			if(haveAttribute) {
+				attributes.emplace(name, value);
+			}
+			auto separator = line.find(':');
+			haveAttribute = (separator != std::string::npos);
+			if(haveAttribute) {
+				name = line.substr(0, separator);
+				for(auto &c: name) {
+					c = std::tolower(static_cast<unsigned char>(c));
+				}
+				value = line.substr(std::min(line.find_first_not_of(' ', separator + 1), line.size()));
+			}
+		}
+		if(haveAttribute) {
+			attributes.emplace(name, value);
+		}
+		return attributes;
+	}
+
+	std::string percentDecode(const std::string &url) {
+
+		std::string decoded;
+		for(size_t i = 0; i < url.size(); ++i) {
+			if((url[i] == '%') && (i + 2 < url.size()) && std::isxdigit(static_cast<unsigned char>(url[i + 1]))
+					&& std::isxdigit(static_cast<unsigned char>(url[i + 2]))) {
+				decoded.push_back(static_cast<char>(std::stoi(url.substr(i + 1, 2), nullptr, 16)));
+				i += 2;
+			} else {
+				decoded.push_back(url[i]);
+			}
+		}
+		return decoded;
+	}
+}
+
+ManifestCache::ManifestCache(const std::string &path) : path_(path), dirty_(false) {
+
+	std::ifstream file{path};
+	std::string line;
+	if(!std::getline(file, line) || (line != CACHE_HEADER)) {
+		return;
+	}
+
+	while(std::getline(file, line)) {
+		std::vector<std::string> fields;
+		for(std::string::size_type start = 0, end = 0; end != std::string::npos; start = end + 1) {
+			end = line.find('\t', start);
+			fields.push_back(line.substr(start, end - start));
+		}
+		if(fields.size() != 6) {
+			continue;
+		}
+
+		try {
+			entries_[fields[0]] = Entry{static_cast<off_t>(std::stoll(fields[1])), std::stoll(fields[2]), fields[3],
+				fields[4], fields[5]};
+		} catch(const std::logic_error&) {
+			// Ignore malformed entries; they will be re-read from the JAR
+		}
+	}
+}
+
+ManifestCache::Entry *ManifestCache::find(const std::string &jarPath, off_t size, long long modificationTime) {
+
+	auto entry = entries_.find(jarPath);
+	if((entry == entries_.end()) || (entry->second.size != size)
+			|| (entry->second.modificationTime != modificationTime)) {
+		return nullptr;
+	}
+	return &entry->second;
+}
 
-	int rc;
-	zip_ = zip_open(jarPath.c_str(), 0, &rc);
-	if(zip_ == nullptr) {
+ManifestCache::Entry &ManifestCache::store(const std::string &jarPath, const Entry &entry) {
+
+	dirty_ = true;
+	return entries_[jarPath] = entry;
+}
+
+void ManifestCache::save() {
+
+	if(!dirty_) {
+		return;
+	}
+
+	const std::string temporaryPath{path_ + ".tmp"};
+	{
+		std::ofstream file{temporaryPath, std::ios::trunc};
+		file << CACHE_HEADER << '\n';
+		for(const auto &entry: entries_) {
+			const std::string fields[] = {entry.first, entry.second.mainClass, entry.second.classPath};
+			bool valid = true;
+			for(const auto &field: fields) {
+				valid = valid && (field.find_first_of("\t\n") == std::string::npos);
+			}
+			if(valid) {
+				file << entry.first << '\t' << entry.second.size << '\t' << entry.second.modificationTime << '\t'
+					<< entry.second.mainClass << '\t' << entry.second.classPath << '\t' << entry.second.contentHash
+					<< '\n';
+			}
+		}
+		if(!file.flush()) {
+			std::cerr << "Failed to write manifest cache " << temporaryPath << std::endl;
+			return;
+		}
+	}
+
+	if(std::rename(temporaryPath.c_str(), path_.c_str()) != 0) {
+		std::cerr << "Failed to replace manifest cache " << path_ << std::endl;
+		return;
+	}
+	dirty_ = false;
+}
+
+JarReader::JarReader(const std::string &jarPath, ManifestCache *cache)
+	: cache_(cache), data_(nullptr), jarPath_(jarPath), manifestRead_(false), size_(0) {
+
+	struct stat jarStat;
+	if(stat(jarPath.c_str(), &jarStat) != 0) {
 		throw std::runtime_error{"Failed to open JAR " + jarPath};
 	}
+	size_ = jarStat.st_size;
+	entry_.size = jarStat.st_size;
+	entry_.modificationTime = jarStat.st_mtim.tv_sec * 1000000000LL + jarStat.st_mtim.tv_nsec;
+
+	if(cache_ != nullptr) {
+		ManifestCache::Entry *cached = cache_->find(jarPath_, entry_.size, entry_.modificationTime);
+		if(cached != nullptr) {
+			entry_ = *cached;
+			manifestRead_ = true;
+		}
+	}
 }
 
 JarReader::~JarReader() {
 
-	zip_close(zip_);
+	if(data_ != nullptr) {
+		munmap(const_cast<void*>(data_), size_);
+	}
+}
+
+void JarReader::map() {
+
+	if(data_ != nullptr) {
+		return;
+	} else if(size_ == 0) {
+		throw std::runtime_error{jarPath_ + " is empty"};
+	}
+
+	int fd = open(jarPath_.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd == -1) {
+		throw std::runtime_error{"Failed to open JAR " + jarPath_};
+	}
+
+	// The mapping remains valid once the descriptor is closed
+	void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	int mmapErrno = errno;
+	close(fd);
+	if(data == MAP_FAILED) {
+		throw std::system_error(mmapErrno, std::system_category());
+	}
+	data_ = data;
+}
+
+std::string JarReader::getContentHash() {
+
+	if(entry_.contentHash.empty()) {
+		map();
+		madvise(const_cast<void*>(data_), size_, MADV_SEQUENTIAL);
+
+		Glib::Checksum checksum{Glib::Checksum::CHECKSUM_SHA256};
+		checksum.update(static_cast<const guchar*>(data_), size_);
+		entry_.contentHash = checksum.get_string();
+		if(cache_ != nullptr) {
+			cache_->store(jarPath_, entry_);
+		}
+	}
+	return entry_.contentHash;
 }
 
 std::string JarReader::getMainClassName() {
 
-	zip_int64_t manifestIndex = zip_name_locate(zip_, "META-INF/MANIFEST.MF", 0);
-	if(manifestIndex == -1) {
-		throw std::runtime_error{jarPath_ + " does not contain a JAR manifest"};
+	readManifest();
+	if(entry_.mainClass.empty()) {
+		throw std::runtime_error{"No 'Main-Class' entry found in manifest"};
 	}
+	return entry_.mainClass;
+}
+
+std::vector<std::string> JarReader::getClassPath() {
 
-	struct zip_stat zip_stat;
-	int rc = zip_stat_index(zip_, manifestIndex, 0, &zip_stat);
-	if((rc == -1) || ((zip_stat.valid & ZIP_STAT_SIZE) == 0)) {
-		throw std::runtime_error{"Unable to determine size of MANIFEST.MF"};
+	std::set<std::string> visited;
+	std::vector<std::string> classPath;
+	collectClassPath(jarPath_, cache_, visited, classPath);
+	return classPath;
+}
+
+void JarReader::readManifest() {
+
+	if(manifestRead_) {
+		return;
 	}
 
-	zip_file *manifest = zip_fopen_index(zip_, manifestIndex, 0);
-	if(manifest == nullptr) {
-		throw std::runtime_error{"Unable to open MANIFEST.MF"};
+	map();
+	ZipView zip{data_, size_, jarPath_};
+	uint16_t method;
+	uint64_t compressedSize, size;
+	uint32_t crc;
+	const unsigned char *compressed;
+	try {
+		compressed = locateManifest(zip, method, compressedSize, size, crc);
+	} catch(const std::runtime_error &e) {
+		throw std::runtime_error{"Failed to read " + jarPath_ + ": " + e.what()};
+	}
+	if(compressed == nullptr) {
+		throw std::runtime_error{jarPath_ + " does not contain a JAR manifest"};
+	}
+	if(size > MAX_MANIFEST_SIZE) {
+		throw std::runtime_error{"MANIFEST.MF of " + jarPath_ + " is too large"};
 	}
 
-	std::stringstream manifestBuffer;
-	zip_uint64_t bytesRead = 0;
-	while(bytesRead < zip_stat.size) {
-		const zip_uint64_t bufferSize = 4096;
-		char buffer[bufferSize];
-		int thisBytesRead = zip_fread(manifest, buffer, std::min(bufferSize, zip_stat.size - bytesRead));
-		if(thisBytesRead == -1) {
-			throw std::runtime_error{"Failed to read MANIFEST.MF"};
+	// Stored manifests are parsed in place; only deflated ones need a buffer
+	const char *manifest = reinterpret_cast<const char*>(compressed);
+	std::string inflated;
+	if(method == Z_DEFLATED) {
+		inflated.resize(size);
+		z_stream stream{};
+		if(inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+			throw std::runtime_error{"Failed to initialise decompression of MANIFEST.MF"};
+		}
+		stream.next_in = const_cast<Bytef*>(compressed);
+		stream.avail_in = compressedSize;
+		stream.next_out = reinterpret_cast<Bytef*>(&inflated[0]);
+		stream.avail_out = size;
+		int rc = inflate(&stream, Z_FINISH);
+		inflateEnd(&stream);
+		if((rc != Z_STREAM_END) || (stream.total_out != size)) {
+			throw std::runtime_error{"Failed to decompress MANIFEST.MF"};
 		}
-		manifestBuffer.write(buffer, thisBytesRead);
-		bytesRead += thisBytesRead;
+		manifest = inflated.data();
+	} else if(method != 0) {
+		throw std::runtime_error{"MANIFEST.MF uses unsupported compression method " + std::to_string(method)};
+	} else if(compressedSize != size) {
+		throw std::runtime_error{"Corrupt ZIP entry for MANIFEST.MF"};
 	}
 
-	for(std::string line; std::getline(manifestBuffer, line);) {
-		auto separator = line.find_first_of(':');
-		if(line.substr(0, separator) != "Main-Class") {
+	if(crc32(crc32(0, nullptr, 0), reinterpret_cast<const Bytef*>(manifest), size) != crc) {
+		throw std::runtime_error{"CRC mismatch in MANIFEST.MF of " + jarPath_};
+	}
+
+	auto attributes = parseMainSection(manifest, size);
+	entry_.mainClass = attributes["main-class"];
+	entry_.mainClass.erase(entry_.mainClass.find_last_not_of(" \t") + 1);
+	entry_.classPath = attributes["class-path"];
+	manifestRead_ = true;
+
+	if(cache_ != nullptr) {
+		cache_->store(jarPath_, entry_);
+	}
+}
+
+std::vector<std::string> JarReader::resolveClassPath() {
+
+	readManifest();
+
+	std::vector<std::string> resolved;
+	const std::string baseDirectory{Glib::path_get_dirname(jarPath_)};
+	for(std::string::size_type start = 0, end = 0; end != std::string::npos; start = end + 1) {
+		end = entry_.classPath.find(' ', start);
+		std::string url{entry_.classPath.substr(start, end - start)};
+		if(url.empty()) {
 			continue;
 		}
 
-		auto value = line.find_first_not_of(" \t", separator + 1);
-		auto valueLength = std::string::npos;
-		auto lineEnd = line.find_first_of(" \t\r\n", value);
-		if(lineEnd != std::string::npos) {
-			valueLength = lineEnd - value;
+		if(url.compare(0, 5, "file:") == 0) {
+			url = url.substr(5);
+			if(url.compare(0, 2, "//") == 0) {
+				const std::string::size_type path = url.find('/', 2);
+				if(path == std::string::npos) {
+					std::cerr << "Ignoring Class-Path entry without a path in " << jarPath_ << ": file:" << url
+						<< std::endl;
+					continue;
+				}
+				url = url.substr(path);
+			}
+		} else if(url.find("://") != std::string::npos) {
+			std::cerr << "Ignoring non-local Class-Path entry in " << jarPath_ << ": " << url << std::endl;
+			continue;
 		}
-		return line.substr(value, valueLength);
+
+		url = percentDecode(url);
+		resolved.push_back((url[0] == '/') ? url : Glib::build_filename(baseDirectory, url));
+	}
+	return resolved;
+}
+
+void JarReader::collectClassPath(const std::string &jarPath, ManifestCache *cache, std::set<std::string> &visited,
+		std::vector<std::string> &classPath) {
+
+	char canonical[PATH_MAX];
+	if(realpath(jarPath.c_str(), canonical) == nullptr) {
+		std::cerr << "Ignoring missing class path entry " << jarPath << std::endl;
+		return;
+	} else if(!visited.insert(canonical).second) {
+		return;
 	}
+	classPath.push_back(jarPath);
 
-	throw std::runtime_error{"No 'Main-Class' entry found in manifest"};
+	if(Glib::file_test(jarPath, Glib::FILE_TEST_IS_DIR)) {
+		return;
+	}
+
+	std::vector<std::string> dependencies;
+	try {
+		JarReader jarReader{jarPath, cache};
+		dependencies = jarReader.resolveClassPath();
+	} catch(const std::runtime_error&) {
+		// The JVM tolerates JARs without manifests on the class path; so do we
+		if(visited.size() == 1) {
+			throw;
+		}
+		return;
+	}
+
+	// As with the JVM's URLClassPath, a JAR's Class-Path entries are searched before the JARs following it
+	for(const auto &dependency: dependencies) {
+		collectClassPath(dependency, cache, visited, classPath);
+	}
 }
@@ -12,22 +12,86 @@
  */
 #pragma once
 
+#include <cstddef>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
-#include <zip.h>
+#include <sys/types.h>
 
 namespace minecraftd {
 
+	/**
+	 * Persistent cache of the manifest attributes of JAR files, keyed by path and invalidated when a JAR's size or
+	 * modification time changes. This avoids opening every archive of a large class path on each start.
+	 */
+	class ManifestCache {
+		public:
+			struct Entry {
+				off_t size;
+				long long modificationTime;
+				std::string mainClass;
+				std::string classPath;
+				/** SHA-256 digest of the JAR, or empty if it has not been computed yet. */
+				std::string contentHash;
+			};
+
+			/** Loads the cache from path, if it exists. */
+			explicit ManifestCache(const std::string &path);
+			ManifestCache(const ManifestCache&) = delete;
+
+			/** Returns the cached entry for a JAR, or nullptr if there is none or it is out of date. */
+			Entry *find(const std::string &jarPath, off_t size, long long modificationTime);
+			Entry &store(const std::string &jarPath, const Entry &entry);
+			void markDirty() { dirty_ = true; }
+
+			/** Writes the cache back to its file, if anything has changed since it was loaded. */
+			void save();
+
+		private:
+			std::unordered_map<std::string, Entry> entries_;
+			const std::string path_;
+			bool dirty_;
+	};
+
+	/**
+	 * Reads JAR archives by memory-mapping them and walking the ZIP central directory in place. Only the manifest is
+	 * ever decompressed.
+	 */
 	class JarReader {
 
 		public:
-			JarReader(const std::string &jarPath);
+			JarReader(const std::string &jarPath, ManifestCache *cache = nullptr);
+			JarReader(const JarReader&) = delete;
 			~JarReader();
 
+			/** Returns the hex-encoded SHA-256 digest of the JAR file's contents. */
+			std::string getContentHash();
 			std::string getMainClassName();
 
+			/**
+			 * Returns the JAR itself followed by every JAR (or directory) reachable through Class-Path manifest
+			 * attributes, in the order the JVM would search them. Entries that do not exist are omitted.
+			 */
+			std::vector<std::string> getClassPath();
+
 		private:
+			/** Maps the JAR into memory, if it has not been already. */
+			void map();
+			/** Parses the manifest's main section, filling in (and caching) entry_. */
+			void readManifest();
+			/** Returns the Class-Path entries of the manifest, resolved to file system paths. */
+			std::vector<std::string> resolveClassPath();
+
+			static void collectClassPath(const std::string &path, ManifestCache *cache, std::set<std::string> &visited,
+					std::vector<std::string> &classPath);
+
+			ManifestCache *cache_;
+			const void *data_;
+			ManifestCache::Entry entry_;
 			const std::string jarPath_;
-			::zip *zip_;
+			bool manifestRead_;
+			size_t size_;
 	};
 }
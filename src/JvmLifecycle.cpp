@@ -0,0 +1,68 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "JvmLifecycle.h"
+
+using namespace minecraftd;
+
+JvmLifecycle::JvmLifecycle(const Listener &listener) : eventFd_{eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)},
+	listener_(listener) {
+
+	if(eventFd_ == -1) {
+		throw std::system_error(errno, std::system_category());
+	}
+	wakeupSource_ = Glib::signal_io().connect(sigc::mem_fun(*this, &JvmLifecycle::onWakeup), eventFd_, Glib::IO_IN);
+}
+
+JvmLifecycle::~JvmLifecycle() {
+
+	wakeupSource_.disconnect();
+	close(eventFd_);
+}
+
+void JvmLifecycle::post(Event event, const std::string &detail) {
+
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		events_.emplace_back(event, detail);
+	}
+
+	const uint64_t one = 1;
+	if(write(eventFd_, &one, sizeof(one)) != sizeof(one)) {
+		// Only fails if the counter would overflow, in which case the main loop has a wakeup pending regardless
+	}
+}
+
+bool JvmLifecycle::onWakeup(Glib::IOCondition condition) {
+
+	uint64_t count;
+	while(read(eventFd_, &count, sizeof(count)) > 0) {
+		// Drain the counter; the queue itself says how many events there are
+	}
+
+	std::deque<std::pair<Event, std::string>> events;
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		events.swap(events_);
+	}
+	for(const auto &event: events) {
+		listener_(event.first, event.second);
+	}
+	return true;
+}
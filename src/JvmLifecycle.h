@@ -0,0 +1,57 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <glibmm.h>
+
+namespace minecraftd {
+
+	/**
+	 * Carries events from the thread running the JVM to the GLib main loop. Events are posted through an eventfd that
+	 * the main loop watches, so one posted before the main loop runs is delivered once it does, and none is lost.
+	 */
+	class JvmLifecycle {
+		public:
+			enum class Event {
+				/** The JVM, its metrics and its profiler have been created, and the server's main method is next. */
+				CREATED,
+				/** The JVM could not be created, or the server could not be started; the detail says why. */
+				FAILED
+			};
+
+			/** Called on the main loop with each event, in the order they were posted. */
+			typedef std::function<void(Event event, const std::string &detail)> Listener;
+
+			JvmLifecycle(const Listener &listener);
+			JvmLifecycle(const JvmLifecycle&) = delete;
+			~JvmLifecycle();
+
+			/** Posts an event to the main loop. May be called from any thread. */
+			void post(Event event, const std::string &detail = std::string{});
+
+		private:
+			bool onWakeup(Glib::IOCondition condition);
+
+			int eventFd_;
+			std::deque<std::pair<Event, std::string>> events_;
+			const Listener listener_;
+			std::mutex mutex_;
+			sigc::connection wakeupSource_;
+	};
+}
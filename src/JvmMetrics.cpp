@@ -0,0 +1,524 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <system_error>
+#include <utility>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "JvmMetrics.h"
+#include "jvm.h"
+
+using namespace minecraftd;
+
+namespace {
+	/** Number of samples on which to look for the tick times before giving up; the server starts them late. */
+	const int TICK_TIMES_ATTEMPTS = 12;
+	const jint MODIFIER_STATIC = 0x0008;
+
+	/** Pushes a local reference frame for the lifetime of the object, so that an exception unwinding pops it. */
+	class LocalFrame {
+		public:
+			LocalFrame(JNIEnv *jni, jint capacity) : jni_(jni) {
+				if(jni_->PushLocalFrame(capacity) != 0) {
+					throw JavaException{jni_};
+				}
+			}
+			LocalFrame(const LocalFrame&) = delete;
+			~LocalFrame() { jni_->PopLocalFrame(nullptr); }
+
+		private:
+			JNIEnv *const jni_;
+	};
+
+	void check(JNIEnv *jni) {
+
+		if(jni->ExceptionCheck()) {
+			throw JavaException{jni};
+		}
+	}
+
+	jclass findClass(JNIEnv *jni, const char *name) {
+
+		jclass clazz = jni->FindClass(name);
+		check(jni);
+		return clazz;
+	}
+
+	jmethodID getMethodId(JNIEnv *jni, const char *className, const char *name, const char *signature) {
+
+		jmethodID method = jni->GetMethodID(findClass(jni, className), name, signature);
+		check(jni);
+		return method;
+	}
+
+	jobject getPlatformBean(JNIEnv *jni, const char *name, const char *signature) {
+
+		jclass ManagementFactory = findClass(jni, "java/lang/management/ManagementFactory");
+		jmethodID method = jni->GetStaticMethodID(ManagementFactory, name, signature);
+		check(jni);
+		jobject bean = jni->CallStaticObjectMethod(ManagementFactory, method);
+		check(jni);
+		return jni->NewGlobalRef(bean);
+	}
+
+	std::string toString(JNIEnv *jni, jstring string) {
+
+		const char *chars = jni->GetStringUTFChars(string, nullptr);
+		if(chars == nullptr) {
+			throw JavaException{jni};
+		}
+		std::string result{chars};
+		jni->ReleaseStringUTFChars(string, chars);
+		return result;
+	}
+
+	/**
+	 * Returns true if the object graph should be followed through a field of the named type: application classes and
+	 * the few JDK types that link a thread to what it runs.
+	 */
+	bool isFollowed(const std::string &typeName) {
+
+		static const char *const FOLLOWED[] = {"java.lang.Object", "java.lang.Runnable", "java.lang.Thread$FieldHolder",
+			"java.util.concurrent.atomic.AtomicReference"};
+		if(std::find(std::begin(FOLLOWED), std::end(FOLLOWED), typeName) != std::end(FOLLOWED)) {
+			return true;
+		}
+		for(const char *prefix: {"java.", "javax.", "jdk.", "sun.", "com.sun."}) {
+			if(typeName.compare(0, std::strlen(prefix), prefix) == 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::string escapeLabel(const std::string &value) {
+
+		std::string escaped;
+		for(char c: value) {
+			if((c == '\\') || (c == '"')) {
+				escaped += '\\';
+			} else if(c == '\n') {
+				escaped += "\\n";
+				continue;
+			}
+			escaped += c;
+		}
+		return escaped;
+	}
+
+	void writeMetric(std::ostream &out, const char *name, const char *type, const char *help) {
+
+		out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+	}
+}
+
+const jsize JvmMetrics::TICK_TIMES_LENGTH;
+
+JvmMetrics::JvmMetrics(JavaVM *jvm, std::chrono::seconds interval, const std::string &socketPath)
+	: interval_(interval), jvm_(jvm), latest_(), listenFd_(-1), socketPath_(socketPath), stopFd_(-1), java_() {
+
+	stopFd_ = eventfd(0, EFD_CLOEXEC);
+	if(stopFd_ == -1) {
+		throw std::system_error(errno, std::system_category());
+	}
+
+	if(!socketPath_.empty()) {
+		sockaddr_un address;
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if(socketPath_.size() >= sizeof(address.sun_path)) {
+			std::cerr << "Metrics socket path is too long: " << socketPath_ << std::endl;
+		} else {
+			std::strcpy(address.sun_path, socketPath_.c_str());
+			unlink(socketPath_.c_str());
+			listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if((listenFd_ == -1) || (bind(listenFd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+					|| (listen(listenFd_, 8) != 0)) {
+				std::cerr << "Failed to listen on metrics socket " << socketPath_ << ": " << std::strerror(errno)
+					<< std::endl;
+				if(listenFd_ != -1) {
+					close(listenFd_);
+					listenFd_ = -1;
+				}
+			}
+		}
+	}
+
+	thread_ = std::thread{&JvmMetrics::run, this};
+	if(listenFd_ != -1) {
+		serveThread_ = std::thread{&JvmMetrics::serveClients, this};
+	}
+}
+
+JvmMetrics::~JvmMetrics() {
+
+	const uint64_t one = 1;
+	const bool stopped = write(stopFd_, &one, sizeof(one)) == sizeof(one);
+	for(std::thread *thread: {&thread_, &serveThread_}) {
+		if(thread->joinable() && stopped) {
+			thread->join();
+		} else if(thread->joinable()) {
+			thread->detach();
+		}
+	}
+	close(stopFd_);
+
+	if(listenFd_ != -1) {
+		close(listenFd_);
+		unlink(socketPath_.c_str());
+	}
+}
+
+JvmMetrics::Sample JvmMetrics::latest() const {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	return latest_;
+}
+
+void JvmMetrics::initialize(JNIEnv *jni) {
+
+	java_.memoryBean = getPlatformBean(jni, "getMemoryMXBean", "()Ljava/lang/management/MemoryMXBean;");
+	java_.MemoryMXBean_getHeapMemoryUsage = getMethodId(jni, "java/lang/management/MemoryMXBean",
+			"getHeapMemoryUsage", "()Ljava/lang/management/MemoryUsage;");
+	java_.MemoryMXBean_getNonHeapMemoryUsage = getMethodId(jni, "java/lang/management/MemoryMXBean",
+			"getNonHeapMemoryUsage", "()Ljava/lang/management/MemoryUsage;");
+	java_.MemoryUsage_getUsed = getMethodId(jni, "java/lang/management/MemoryUsage", "getUsed", "()J");
+	java_.MemoryUsage_getCommitted = getMethodId(jni, "java/lang/management/MemoryUsage", "getCommitted", "()J");
+	java_.MemoryUsage_getMax = getMethodId(jni, "java/lang/management/MemoryUsage", "getMax", "()J");
+
+	java_.GarbageCollectorMXBean_getCollectionCount = getMethodId(jni, "java/lang/management/GarbageCollectorMXBean",
+			"getCollectionCount", "()J");
+	java_.GarbageCollectorMXBean_getCollectionTime = getMethodId(jni, "java/lang/management/GarbageCollectorMXBean",
+			"getCollectionTime", "()J");
+	jmethodID MemoryManagerMXBean_getName = getMethodId(jni, "java/lang/management/MemoryManagerMXBean", "getName",
+			"()Ljava/lang/String;");
+	jmethodID List_toArray = getMethodId(jni, "java/util/List", "toArray", "()[Ljava/lang/Object;");
+
+	// The set of collectors is fixed for the life of the JVM, so their names are read just the once
+	jobject collectorList = getPlatformBean(jni, "getGarbageCollectorMXBeans", "()Ljava/util/List;");
+	jobjectArray collectors = static_cast<jobjectArray>(jni->CallObjectMethod(collectorList, List_toArray));
+	check(jni);
+	jni->DeleteGlobalRef(collectorList);
+	std::vector<GarbageCollector> garbageCollectors;
+	for(jsize i = 0; i < jni->GetArrayLength(collectors); ++i) {
+		jobject collector = jni->GetObjectArrayElement(collectors, i);
+		jstring name = static_cast<jstring>(jni->CallObjectMethod(collector, MemoryManagerMXBean_getName));
+		check(jni);
+		java_.garbageCollectorBeans.push_back(jni->NewGlobalRef(collector));
+		garbageCollectors.push_back(GarbageCollector{toString(jni, name), 0, 0});
+		jni->DeleteLocalRef(name);
+		jni->DeleteLocalRef(collector);
+	}
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+		latest_.garbageCollectors = std::move(garbageCollectors);
+	}
+
+	java_.threadBean = getPlatformBean(jni, "getThreadMXBean", "()Ljava/lang/management/ThreadMXBean;");
+	java_.ThreadMXBean_getThreadCount = getMethodId(jni, "java/lang/management/ThreadMXBean", "getThreadCount",
+			"()I");
+	java_.ThreadMXBean_getDaemonThreadCount = getMethodId(jni, "java/lang/management/ThreadMXBean",
+			"getDaemonThreadCount", "()I");
+	java_.ThreadMXBean_getPeakThreadCount = getMethodId(jni, "java/lang/management/ThreadMXBean",
+			"getPeakThreadCount", "()I");
+
+	java_.classLoadingBean = getPlatformBean(jni, "getClassLoadingMXBean",
+			"()Ljava/lang/management/ClassLoadingMXBean;");
+	java_.ClassLoadingMXBean_getLoadedClassCount = getMethodId(jni, "java/lang/management/ClassLoadingMXBean",
+			"getLoadedClassCount", "()I");
+
+	java_.tickTimesAttempts = TICK_TIMES_ATTEMPTS;
+}
+
+bool JvmMetrics::findTickTimes(JNIEnv *jni, jobject &server, jfieldID &tickTimes) {
+
+	jclass Thread = findClass(jni, "java/lang/Thread");
+	jmethodID Thread_getAllStackTraces = jni->GetStaticMethodID(Thread, "getAllStackTraces", "()Ljava/util/Map;");
+	check(jni);
+	jmethodID Thread_getName = getMethodId(jni, "java/lang/Thread", "getName", "()Ljava/lang/String;");
+	jmethodID Map_keySet = getMethodId(jni, "java/util/Map", "keySet", "()Ljava/util/Set;");
+	jmethodID Set_toArray = getMethodId(jni, "java/util/Set", "toArray", "()[Ljava/lang/Object;");
+
+	jobject stackTraces = jni->CallStaticObjectMethod(Thread, Thread_getAllStackTraces);
+	check(jni);
+	jobject threadSet = jni->CallObjectMethod(stackTraces, Map_keySet);
+	check(jni);
+	jobjectArray threads = static_cast<jobjectArray>(jni->CallObjectMethod(threadSet, Set_toArray));
+	check(jni);
+
+	for(jsize i = 0; i < jni->GetArrayLength(threads); ++i) {
+		jobject thread = jni->GetObjectArrayElement(threads, i);
+		jstring name = static_cast<jstring>(jni->CallObjectMethod(thread, Thread_getName));
+		check(jni);
+		if((name != nullptr) && (toString(jni, name) == "Server thread")) {
+			// Thread -> (holder ->) Runnable -> (captured AtomicReference ->) server
+			return findLongArray(jni, thread, 4, server, tickTimes);
+		}
+		jni->DeleteLocalRef(name);
+		jni->DeleteLocalRef(thread);
+	}
+	return false;
+}
+
+bool JvmMetrics::findLongArray(JNIEnv *jni, jobject object, int depth, jobject &server, jfieldID &tickTimes) {
+
+	jclass Class = findClass(jni, "java/lang/Class");
+	jmethodID Class_getDeclaredFields = getMethodId(jni, "java/lang/Class", "getDeclaredFields",
+			"()[Ljava/lang/reflect/Field;");
+	jmethodID Class_getName = getMethodId(jni, "java/lang/Class", "getName", "()Ljava/lang/String;");
+	jmethodID Class_isArray = getMethodId(jni, "java/lang/Class", "isArray", "()Z");
+	jmethodID Class_isPrimitive = getMethodId(jni, "java/lang/Class", "isPrimitive", "()Z");
+	jmethodID Field_getModifiers = getMethodId(jni, "java/lang/reflect/Field", "getModifiers", "()I");
+	jmethodID Field_getType = getMethodId(jni, "java/lang/reflect/Field", "getType", "()Ljava/lang/Class;");
+	jclass longArray = findClass(jni, "[J");
+
+	for(jclass clazz = jni->GetObjectClass(object); clazz != nullptr; clazz = jni->GetSuperclass(clazz)) {
+		jobjectArray fields = static_cast<jobjectArray>(jni->CallObjectMethod(clazz, Class_getDeclaredFields));
+		check(jni);
+
+		for(jsize i = 0; i < jni->GetArrayLength(fields); ++i) {
+			LocalFrame frame{jni, 16};
+			bool found = false;
+			jobject field = jni->GetObjectArrayElement(fields, i);
+			const jint modifiers = jni->CallIntMethod(field, Field_getModifiers);
+			jobject type = jni->CallObjectMethod(field, Field_getType);
+			check(jni);
+			if(!(modifiers & MODIFIER_STATIC)) {
+				jfieldID fieldId = jni->FromReflectedField(field);
+				if(jni->IsSameObject(type, longArray)) {
+					jobject value = jni->GetObjectField(object, fieldId);
+					if((value != nullptr) && (jni->GetArrayLength(static_cast<jarray>(value)) == TICK_TIMES_LENGTH)) {
+						server = jni->NewGlobalRef(object);
+						tickTimes = fieldId;
+						found = true;
+					}
+				} else if((depth > 0) && !jni->CallBooleanMethod(type, Class_isPrimitive)
+						&& !jni->CallBooleanMethod(type, Class_isArray) && isFollowed(toString(jni,
+								static_cast<jstring>(jni->CallObjectMethod(type, Class_getName))))) {
+					jobject value = jni->GetObjectField(object, fieldId);
+					found = (value != nullptr) && !jni->IsInstanceOf(value, Class)
+						&& findLongArray(jni, value, depth - 1, server, tickTimes);
+				}
+			}
+			check(jni);
+			if(found) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void JvmMetrics::sample(JNIEnv *jni) {
+
+	LocalFrame frame{jni, 32};
+	Sample sample = latest();
+	sample.time = std::chrono::system_clock::now();
+
+	jobject heap = jni->CallObjectMethod(java_.memoryBean, java_.MemoryMXBean_getHeapMemoryUsage);
+	check(jni);
+	sample.heapUsed = jni->CallLongMethod(heap, java_.MemoryUsage_getUsed);
+	sample.heapCommitted = jni->CallLongMethod(heap, java_.MemoryUsage_getCommitted);
+	sample.heapMax = std::max<jlong>(jni->CallLongMethod(heap, java_.MemoryUsage_getMax), 0);
+	jobject nonHeap = jni->CallObjectMethod(java_.memoryBean, java_.MemoryMXBean_getNonHeapMemoryUsage);
+	check(jni);
+	sample.nonHeapUsed = jni->CallLongMethod(nonHeap, java_.MemoryUsage_getUsed);
+
+	for(size_t i = 0; i < java_.garbageCollectorBeans.size(); ++i) {
+		// Both return -1 for a collector that does not track the value
+		sample.garbageCollectors[i].collections = std::max<jlong>(jni->CallLongMethod(java_.garbageCollectorBeans[i],
+					java_.GarbageCollectorMXBean_getCollectionCount), 0);
+		sample.garbageCollectors[i].time = std::max<jlong>(jni->CallLongMethod(java_.garbageCollectorBeans[i],
+					java_.GarbageCollectorMXBean_getCollectionTime), 0);
+	}
+
+	sample.threads = jni->CallIntMethod(java_.threadBean, java_.ThreadMXBean_getThreadCount);
+	sample.daemonThreads = jni->CallIntMethod(java_.threadBean, java_.ThreadMXBean_getDaemonThreadCount);
+	sample.peakThreads = jni->CallIntMethod(java_.threadBean, java_.ThreadMXBean_getPeakThreadCount);
+	sample.loadedClasses = jni->CallIntMethod(java_.classLoadingBean, java_.ClassLoadingMXBean_getLoadedClassCount);
+	check(jni);
+
+	if((java_.server == nullptr) && (java_.tickTimesAttempts > 0)) {
+		--java_.tickTimesAttempts;
+		if(findTickTimes(jni, java_.server, java_.tickTimes)) {
+			std::cout << "Found the server's tick times; tick metrics are available" << std::endl;
+		}
+	}
+
+	if(java_.server != nullptr) {
+		jlongArray tickTimes = static_cast<jlongArray>(jni->GetObjectField(java_.server, java_.tickTimes));
+		jlong times[TICK_TIMES_LENGTH];
+		jni->GetLongArrayRegion(tickTimes, 0, TICK_TIMES_LENGTH, times);
+		check(jni);
+
+		// Slots not yet filled by a tick are zero
+		jlong total = 0, longest = 0;
+		int count = 0;
+		for(jlong time: times) {
+			if(time > 0) {
+				total += time;
+				longest = std::max(longest, time);
+				++count;
+			}
+		}
+		sample.tickTimesAvailable = true;
+		sample.meanTickTime = (count > 0) ? total / (count * 1e6) : 0.0;
+		sample.maxTickTime = longest / 1e6;
+	}
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	latest_ = sample;
+}
+
+void JvmMetrics::serve(int clientFd) const {
+
+	// Answer any request; a client that sends nothing still gets the metrics after the timeout
+	timeval timeout{1, 0};
+	setsockopt(clientFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	std::string request;
+	char buffer[1024];
+	while(request.find("\r\n\r\n") == std::string::npos) {
+		ssize_t count = read(clientFd, buffer, sizeof(buffer));
+		if((count <= 0) || (request.size() > 8192)) {
+			break;
+		}
+		request.append(buffer, count);
+	}
+
+	const Sample sample = latest();
+	std::ostringstream body;
+	writeMetric(body, "minecraftd_jvm_heap_used_bytes", "gauge", "Heap memory in use.");
+	body << "minecraftd_jvm_heap_used_bytes " << sample.heapUsed << '\n';
+	writeMetric(body, "minecraftd_jvm_heap_committed_bytes", "gauge", "Heap memory committed by the JVM.");
+	body << "minecraftd_jvm_heap_committed_bytes " << sample.heapCommitted << '\n';
+	writeMetric(body, "minecraftd_jvm_heap_max_bytes", "gauge", "Maximum heap size (0 if undefined).");
+	body << "minecraftd_jvm_heap_max_bytes " << sample.heapMax << '\n';
+	writeMetric(body, "minecraftd_jvm_nonheap_used_bytes", "gauge", "Non-heap memory in use.");
+	body << "minecraftd_jvm_nonheap_used_bytes " << sample.nonHeapUsed << '\n';
+
+	writeMetric(body, "minecraftd_jvm_gc_collections_total", "counter", "Garbage collections performed.");
+	for(const auto &collector: sample.garbageCollectors) {
+		body << "minecraftd_jvm_gc_collections_total{collector=\"" << escapeLabel(collector.name) << "\"} "
+			<< collector.collections << '\n';
+	}
+	writeMetric(body, "minecraftd_jvm_gc_collection_seconds_total", "counter", "Time spent in garbage collection.");
+	for(const auto &collector: sample.garbageCollectors) {
+		body << "minecraftd_jvm_gc_collection_seconds_total{collector=\"" << escapeLabel(collector.name) << "\"} "
+			<< collector.time / 1000.0 << '\n';
+	}
+
+	writeMetric(body, "minecraftd_jvm_threads", "gauge", "Live JVM threads.");
+	body << "minecraftd_jvm_threads " << sample.threads << '\n';
+	writeMetric(body, "minecraftd_jvm_threads_daemon", "gauge", "Live JVM daemon threads.");
+	body << "minecraftd_jvm_threads_daemon " << sample.daemonThreads << '\n';
+	writeMetric(body, "minecraftd_jvm_threads_peak", "gauge", "Peak live JVM threads.");
+	body << "minecraftd_jvm_threads_peak " << sample.peakThreads << '\n';
+	writeMetric(body, "minecraftd_jvm_classes_loaded", "gauge", "Classes currently loaded.");
+	body << "minecraftd_jvm_classes_loaded " << sample.loadedClasses << '\n';
+
+	if(sample.tickTimesAvailable) {
+		writeMetric(body, "minecraftd_tick_duration_seconds", "gauge",
+				"Duration of the server's last 100 ticks, as inferred from its fields rather than measured.");
+		body << "minecraftd_tick_duration_seconds{statistic=\"mean\"} " << sample.meanTickTime / 1000.0 << '\n'
+			<< "minecraftd_tick_duration_seconds{statistic=\"max\"} " << sample.maxTickTime / 1000.0 << '\n';
+	}
+
+	const std::string text{body.str()};
+	const std::string response{"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+		+ std::to_string(text.size()) + "\r\n\r\n" + text};
+	for(size_t written = 0; written < response.size();) {
+		ssize_t count = write(clientFd, response.data() + written, response.size() - written);
+		if(count <= 0) {
+			break;
+		}
+		written += count;
+	}
+}
+
+void JvmMetrics::serveClients() {
+
+	for(;;) {
+		pollfd pollFds[2] = {{stopFd_, POLLIN, 0}, {listenFd_, POLLIN, 0}};
+		if((poll(pollFds, 2, -1) == -1) && (errno != EINTR)) {
+			break;
+		} else if(pollFds[0].revents & POLLIN) {
+			break;
+		} else if(pollFds[1].revents & POLLIN) {
+			const int clientFd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+			if(clientFd != -1) {
+				serve(clientFd);
+				close(clientFd);
+			}
+		}
+	}
+}
+
+void JvmMetrics::run() {
+
+	JNIEnv *jni;
+	JavaVMAttachArgs attachArguments{JNI_VERSION_1_6, const_cast<char*>("minecraftd metrics"), nullptr};
+	if(jvm_->AttachCurrentThreadAsDaemon(reinterpret_cast<void**>(&jni), &attachArguments) != JNI_OK) {
+		std::cerr << "Failed to attach the metrics thread to the JVM" << std::endl;
+		return;
+	}
+
+	bool sampling = true;
+	try {
+		initialize(jni);
+	} catch(const std::exception &e) {
+		std::cerr << "JVM metrics are unavailable: " << e.what() << std::endl;
+		sampling = false;
+	}
+
+	auto next = std::chrono::steady_clock::now();
+	for(;;) {
+		const auto now = std::chrono::steady_clock::now();
+		if(sampling && (now >= next)) {
+			try {
+				sample(jni);
+			} catch(const std::exception &e) {
+				std::cerr << "Failed to sample JVM metrics: " << e.what() << std::endl;
+			}
+			next += interval_;
+			continue;
+		}
+
+		pollfd pollFd{stopFd_, POLLIN, 0};
+		const int timeout = sampling ? std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() : -1;
+		if((poll(&pollFd, 1, timeout) == -1) && (errno != EINTR)) {
+			break;
+		} else if(pollFd.revents & POLLIN) {
+			break;
+		}
+	}
+
+	for(jobject bean: java_.garbageCollectorBeans) {
+		jni->DeleteGlobalRef(bean);
+	}
+	for(jobject reference: {java_.memoryBean, java_.threadBean, java_.classLoadingBean, java_.server}) {
+		if(reference != nullptr) {
+			jni->DeleteGlobalRef(reference);
+		}
+	}
+	jvm_->DetachCurrentThread();
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <jni.h>
+
+namespace minecraftd {
+
+	/**
+	 * Periodically samples the health of the in-process JVM (heap, garbage collection, threads) and of the server
+	 * (recent tick times) on a thread attached to the JVM. Every class, method and field is looked up once; a sample
+	 * is then just a handful of JNI calls. Samples are optionally served as Prometheus text on a Unix socket, from a
+	 * thread of its own so that a slow client does not hold up sampling.
+	 *
+	 * The server has no interface for its tick times, so they are inferred: the array of 100 longs reachable from the
+	 * "Server thread" is taken to be its record of recent tick durations (see findTickTimes). Tick metrics are only as
+	 * good as that guess, which a server version keeping some other such array could defeat.
+	 */
+	class JvmMetrics {
+		public:
+			struct GarbageCollector {
+				std::string name;
+				uint64_t collections;
+				/** Accumulated collection time, in milliseconds. */
+				uint64_t time;
+			};
+
+			struct Sample {
+				/** Time at which the sample was taken, or the epoch if no sample has been taken yet. */
+				std::chrono::system_clock::time_point time;
+				uint64_t heapUsed;
+				uint64_t heapCommitted;
+				/** Maximum heap size, or 0 if the JVM does not define one. */
+				uint64_t heapMax;
+				uint64_t nonHeapUsed;
+				std::vector<GarbageCollector> garbageCollectors;
+				uint32_t threads;
+				uint32_t daemonThreads;
+				uint32_t peakThreads;
+				uint32_t loadedClasses;
+				/** Whether the server's tick times could be found; if not, the tick fields are zero. */
+				bool tickTimesAvailable;
+				/** Mean and longest of the server's recent tick durations, in milliseconds, as inferred. */
+				double meanTickTime;
+				double maxTickTime;
+			};
+
+			/** Length of the server's array of recent tick times, which is how it is recognised. */
+			static const jsize TICK_TIMES_LENGTH = 100;
+
+			/**
+			 * Looks for the server's array of recent tick times, by following the fields of the "Server thread" to the
+			 * server object. Returns true once it has been found, with server set to a new global reference to the
+			 * server object and tickTimes to its field holding the durations of the last 100 ticks in nanoseconds.
+			 */
+			static bool findTickTimes(JNIEnv *jni, jobject &server, jfieldID &tickTimes);
+
+			/**
+			 * Starts sampling jvm every interval. If socketPath is not empty, a Unix socket is created there, and
+			 * each connection to it is answered with the latest sample as a Prometheus text exposition over HTTP.
+			 */
+			JvmMetrics(JavaVM *jvm, std::chrono::seconds interval, const std::string &socketPath);
+			JvmMetrics(const JvmMetrics&) = delete;
+			~JvmMetrics();
+
+			std::chrono::seconds interval() const { return interval_; }
+			Sample latest() const;
+
+		private:
+			/** Looks up the management beans and the identifiers used for sampling. */
+			void initialize(JNIEnv *jni);
+			static bool findLongArray(JNIEnv *jni, jobject object, int depth, jobject &server, jfieldID &tickTimes);
+			void sample(JNIEnv *jni);
+			void serve(int clientFd) const;
+			/** Answers the clients of the metrics socket until stopped. */
+			void serveClients();
+			void run();
+
+			const std::chrono::seconds interval_;
+			JavaVM *const jvm_;
+			Sample latest_;
+			int listenFd_;
+			mutable std::mutex mutex_;
+			const std::string socketPath_;
+			std::thread serveThread_;
+			int stopFd_;
+			std::thread thread_;
+
+			struct {
+				jobject memoryBean;
+				jmethodID MemoryMXBean_getHeapMemoryUsage;
+				jmethodID MemoryMXBean_getNonHeapMemoryUsage;
+				jmethodID MemoryUsage_getUsed;
+				jmethodID MemoryUsage_getCommitted;
+				jmethodID MemoryUsage_getMax;
+				std::vector<jobject> garbageCollectorBeans;
+				jmethodID GarbageCollectorMXBean_getCollectionCount;
+				jmethodID GarbageCollectorMXBean_getCollectionTime;
+				jobject threadBean;
+				jmethodID ThreadMXBean_getThreadCount;
+				jmethodID ThreadMXBean_getDaemonThreadCount;
+				jmethodID ThreadMXBean_getPeakThreadCount;
+				jobject classLoadingBean;
+				jmethodID ClassLoadingMXBean_getLoadedClassCount;
+				/** The server object, and its field holding the durations of the last 100 ticks in nanoseconds. */
+				jobject server;
+				jfieldID tickTimes;
+				/** Number of further samples on which to look for the tick times, if they have not been found yet. */
+				int tickTimesAttempts;
+			} java_;
+	};
+}
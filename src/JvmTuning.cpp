@@ -0,0 +1,261 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#include <sched.h>
+
+#include "JvmTuning.h"
+
+using minecraftd::AutoTuneConfiguration;
+
+namespace {
+
+	const uint64_t MEBIBYTE = 1024 * 1024;
+	/** Heaps are never sized below this, however little memory is available. */
+	const uint64_t MINIMUM_HEAP = 256 * MEBIBYTE;
+	/** Memory left outside the heap for metaspace, code cache, thread stacks and direct buffers. */
+	const uint64_t NON_HEAP_RESERVE = 512 * MEBIBYTE;
+	/** Heaps at least this large, given enough CPUs, are collected with ZGC rather than G1. */
+	const uint64_t ZGC_MINIMUM_HEAP = 16 * 1024 * MEBIBYTE;
+	const unsigned int ZGC_MINIMUM_CPUS = 8;
+
+	const std::string CGROUP_DIRECTORY{"/sys/fs/cgroup"};
+	const std::string NODE_SYSFS_DIRECTORY{"/sys/devices/system/node"};
+	const std::string TRANSPARENT_HUGEPAGE_FILE{"/sys/kernel/mm/transparent_hugepage/enabled"};
+
+	/** Resources available to the process, and what limited each of them. */
+	struct Resources {
+		uint64_t memory;
+		std::string memoryLimit;
+		unsigned int cpus;
+		std::string cpuLimit;
+	};
+
+	/** Returns the first line of path, or an empty string if it cannot be read. */
+	std::string readFirstLine(const std::string &path) {
+
+		std::ifstream in{path};
+		std::string line;
+		std::getline(in, line);
+		return line;
+	}
+
+	/**
+	 * Returns the value of key in a meminfo-style file ("Key: value kB" lines, optionally prefixed as in the per-node
+	 * files), in bytes if it has a unit, or 0 if the key is absent.
+	 */
+	uint64_t readMeminfo(const std::string &path, const std::string &key) {
+
+		std::ifstream in{path};
+		std::string line;
+		while(std::getline(in, line)) {
+			const size_t position = line.find(key + ':');
+			if(position == std::string::npos) {
+				continue;
+			}
+			std::istringstream fields{line.substr(position + key.size() + 1)};
+			uint64_t value = 0;
+			std::string unit;
+			fields >> value >> unit;
+			return (unit == "kB") ? value * 1024 : value;
+		}
+		return 0;
+	}
+
+	/** Returns the cgroup v2 directory of the calling process, or an empty string on a cgroup v1 host. */
+	std::string cgroupDirectory() {
+
+		std::ifstream in{"/proc/self/cgroup"};
+		std::string line;
+		while(std::getline(in, line)) {
+			if(line.compare(0, 3, "0::") == 0) {
+				return CGROUP_DIRECTORY + line.substr(3);
+			}
+		}
+		return std::string{};
+	}
+
+	Resources readResources(int numaNode) {
+
+		Resources resources{readMeminfo("/proc/meminfo", "MemTotal"), "host memory", 0, "CPU affinity"};
+		if(numaNode >= 0) {
+			const uint64_t nodeMemory = readMeminfo(NODE_SYSFS_DIRECTORY + "/node" + std::to_string(numaNode) +
+					"/meminfo", "MemTotal");
+			if((nodeMemory != 0) && (nodeMemory < resources.memory)) {
+				resources.memory = nodeMemory;
+				resources.memoryLimit = "NUMA node " + std::to_string(numaNode);
+			}
+		}
+
+		cpu_set_t allowed;
+		if(sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+			resources.cpus = CPU_COUNT(&allowed);
+		}
+
+		// A limit set on any ancestor applies as well, so take the tightest along the path to the root.
+		const std::string leaf = cgroupDirectory();
+		for(std::string directory = leaf; directory.size() > CGROUP_DIRECTORY.size();
+				directory.erase(directory.rfind('/'))) {
+			const std::string memoryMax = readFirstLine(directory + "/memory.max");
+			if(!memoryMax.empty() && (memoryMax != "max")) {
+				const uint64_t memory = std::stoull(memoryMax);
+				if(memory < resources.memory) {
+					resources.memory = memory;
+					resources.memoryLimit = "cgroup " + directory.substr(CGROUP_DIRECTORY.size());
+				}
+			}
+
+			std::istringstream cpuMax{readFirstLine(directory + "/cpu.max")};
+			std::string quota;
+			uint64_t period = 0;
+			if((cpuMax >> quota >> period) && (quota != "max") && (period != 0)) {
+				const unsigned int cpus = std::max<uint64_t>(1, (std::stoull(quota) + period - 1) / period);
+				if((resources.cpus == 0) || (cpus < resources.cpus)) {
+					resources.cpus = cpus;
+					resources.cpuLimit = "cgroup " + directory.substr(CGROUP_DIRECTORY.size());
+				}
+			}
+		}
+
+		resources.cpus = std::max(resources.cpus, 1u);
+		return resources;
+	}
+
+	/**
+	 * Returns the name of the JVM option an argument sets: "MaxHeapSize" for -Xmx, "InitialHeapSize" for -Xms, and the
+	 * bare flag name for -XX: options (with any +, - or value removed), or an empty string for anything else.
+	 */
+	std::string optionName(const std::string &argument) {
+
+		if(argument.compare(0, 4, "-Xmx") == 0) {
+			return "MaxHeapSize";
+		} else if(argument.compare(0, 4, "-Xms") == 0) {
+			return "InitialHeapSize";
+		} else if(argument.compare(0, 4, "-XX:") != 0) {
+			return std::string{};
+		}
+
+		std::string name = argument.substr(4);
+		if(!name.empty() && ((name[0] == '+') || (name[0] == '-'))) {
+			name.erase(0, 1);
+		}
+		return name.substr(0, name.find('='));
+	}
+
+	bool selectsCollector(const std::string &name) {
+
+		return (name.size() > 5) && (name.compare(0, 3, "Use") == 0) && (name.compare(name.size() - 2, 2, "GC") == 0);
+	}
+
+	/** HotSpot's own formula for ParallelGCThreads: one per CPU up to eight, then five for every eight more. */
+	unsigned int parallelGcThreads(unsigned int cpus) {
+
+		return (cpus <= 8) ? cpus : 8 + (cpus - 8) * 5 / 8;
+	}
+}
+
+std::list<std::string> minecraftd::tuneJvmArguments(const AutoTuneConfiguration &configuration, int numaNode,
+		const std::list<std::string> &explicitArguments) {
+
+	std::set<std::string> explicitOptions;
+	bool explicitCollector = false;
+	for(const auto &argument: explicitArguments) {
+		const std::string name = optionName(argument);
+		explicitOptions.insert(name);
+		explicitCollector = explicitCollector || selectsCollector(name);
+	}
+	const auto isExplicit = [&explicitOptions](const std::string &name) {
+		return explicitOptions.count(name) != 0;
+	};
+
+	const Resources resources = readResources(numaNode);
+	std::cout << "Auto-tuning JVM for " << (resources.memory / MEBIBYTE) << " MiB (limited by " <<
+		resources.memoryLimit << ") and " << resources.cpus << " CPUs (limited by " << resources.cpuLimit << ")" <<
+		std::endl;
+
+	uint64_t heap = resources.memory / 100 * configuration.heapPercent;
+	if(resources.memory > NON_HEAP_RESERVE) {
+		heap = std::min(heap, resources.memory - NON_HEAP_RESERVE);
+	}
+	heap = std::max(heap / MEBIBYTE * MEBIBYTE, MINIMUM_HEAP);
+
+	std::list<std::string> arguments;
+	const bool explicitHeap = isExplicit("MaxHeapSize") || isExplicit("MaxRAM") || isExplicit("MaxRAMPercentage");
+	if(!explicitHeap) {
+		arguments.push_back("-Xmx" + std::to_string(heap / MEBIBYTE) + "M");
+	}
+	if(!isExplicit("InitialHeapSize") && !explicitHeap) {
+		arguments.push_back("-Xms" + std::to_string(heap / MEBIBYTE) + "M");
+	}
+
+	if(!isExplicit("ActiveProcessorCount")) {
+		arguments.push_back("-XX:ActiveProcessorCount=" + std::to_string(resources.cpus));
+	}
+
+	// Serial collection beats paying for coordination on a single CPU; past that, G1 keeps ticks smooth, and only
+	// heaps large enough for G1's pauses to hurt are worth ZGC's extra CPU.
+	bool concurrent = false;
+	if(!explicitCollector) {
+		if(resources.cpus < 2) {
+			arguments.push_back("-XX:+UseSerialGC");
+		} else if((heap >= ZGC_MINIMUM_HEAP) && (resources.cpus >= ZGC_MINIMUM_CPUS)) {
+			arguments.push_back("-XX:+UseZGC");
+			concurrent = true;
+		} else {
+			arguments.push_back("-XX:+UseG1GC");
+			concurrent = true;
+		}
+	}
+	if((resources.cpus >= 2) && !isExplicit("ParallelGCThreads")) {
+		arguments.push_back("-XX:ParallelGCThreads=" + std::to_string(parallelGcThreads(resources.cpus)));
+	}
+	if(concurrent && !isExplicit("ConcGCThreads")) {
+		const unsigned int threads = std::max(1u, (parallelGcThreads(resources.cpus) + 2) / 4);
+		arguments.push_back("-XX:ConcGCThreads=" + std::to_string(threads));
+	}
+
+	if((numaNode < 0) && !isExplicit("UseNUMA") &&
+			(minecraftd::parseCpuList(readFirstLine(NODE_SYSFS_DIRECTORY + "/online")).size() > 1)) {
+		arguments.push_back("-XX:+UseNUMA");
+	}
+
+	if(configuration.preTouch && !isExplicit("AlwaysPreTouch")) {
+		arguments.push_back("-XX:+AlwaysPreTouch");
+	}
+
+	// A reserved huge page pool that can hold the whole heap is used directly; failing that, transparent huge pages
+	// are used if the kernel offers them to processes that ask.
+	if(configuration.largePages && !isExplicit("UseLargePages") && !isExplicit("UseTransparentHugePages")) {
+		const uint64_t hugePages = readMeminfo("/proc/meminfo", "HugePages_Free") *
+			readMeminfo("/proc/meminfo", "Hugepagesize");
+		const std::string transparentHugePages = readFirstLine(TRANSPARENT_HUGEPAGE_FILE);
+		if(hugePages >= heap) {
+			arguments.push_back("-XX:+UseLargePages");
+		} else if((transparentHugePages.find("[always]") != std::string::npos) ||
+				(transparentHugePages.find("[madvise]") != std::string::npos)) {
+			arguments.push_back("-XX:+UseTransparentHugePages");
+		}
+	}
+
+	std::cout << "Auto-tuned JVM arguments:";
+	for(const auto &argument: arguments) {
+		std::cout << ' ' << argument;
+	}
+	std::cout << std::endl;
+	return arguments;
+}
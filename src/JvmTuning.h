@@ -0,0 +1,30 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <list>
+#include <string>
+
+#include "instance.h"
+
+namespace minecraftd {
+
+	/**
+	 * Derives the heap size, garbage collector, GC thread counts and huge page use from the resources actually
+	 * available to the calling process: its cgroup v2 memory and CPU limits, its CPU affinity, the memory of the NUMA
+	 * node it is bound to (numaNode, or -1 if unbound) and the host's huge page configuration. Returns JVM arguments
+	 * for whichever of these explicitArguments does not already set, and logs them.
+	 */
+	std::list<std::string> tuneJvmArguments(const AutoTuneConfiguration &configuration, int numaNode,
+			const std::list<std::string> &explicitArguments);
+}
@@ -0,0 +1,445 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <jvmti.h>
+
+#include "LogAppender.h"
+#include "jvm.h"
+
+using namespace minecraftd;
+
+namespace {
+	const char *const APPENDER_CLASS = "net/za/slyfox/minecraftd/LogStoreAppender";
+	const char *const APPENDER_NAME = "minecraftd";
+	const char *const ABSTRACT_APPENDER_CLASS = "org/apache/logging/log4j/core/appender/AbstractAppender";
+	const char *const APPEND_SIGNATURE = "(Lorg/apache/logging/log4j/core/LogEvent;)V";
+	const char *const LOGGER_CONTEXT_CLASS = "org/apache/logging/log4j/core/LoggerContext";
+	const char *const LOGGER_CONTEXT_SIGNATURE = "Lorg/apache/logging/log4j/core/LoggerContext;";
+	/** How long the appender waits for the server to start its logger context before giving up. */
+	const std::chrono::seconds START_TIMEOUT{60};
+
+	/** The store fed by the appender; only ever set once, and released on exit. */
+	std::atomic<LogStore*> logStore{nullptr};
+	/** The store waiting for log4j to be loaded, when it is not on the class path; taken by the first to see it. */
+	std::atomic<LogStore*> pendingLogStore{nullptr};
+
+	struct {
+		jmethodID LogEvent_getTimeMillis;
+		jmethodID LogEvent_getLevel;
+		jmethodID LogEvent_getThreadName;
+		jmethodID LogEvent_getLoggerName;
+		jmethodID LogEvent_getMessage;
+		jmethodID LogEvent_getThrown;
+		jmethodID Level_intLevel;
+		jmethodID Message_getFormattedMessage;
+		jmethodID Object_toString;
+	} java;
+
+	/** Builds the few parts of the class file format needed for the appender class. */
+	class ClassFileWriter {
+		public:
+			const std::vector<unsigned char>& bytes() const { return bytes_; }
+
+			void u1(unsigned int value) {
+				bytes_.push_back(value);
+			}
+
+			void u2(unsigned int value) {
+				u1(value >> 8);
+				u1(value);
+			}
+
+			void u4(uint32_t value) {
+				u2(value >> 16);
+				u2(value);
+			}
+
+			/** Writes a CONSTANT_Utf8 entry; the strings here are all ASCII. */
+			void utf8(const std::string &value) {
+				u1(1);
+				u2(value.size());
+				bytes_.insert(bytes_.end(), value.begin(), value.end());
+			}
+
+		private:
+			std::vector<unsigned char> bytes_;
+	};
+
+	/**
+	 * Returns the class file of:
+	 *
+	 *     public class LogStoreAppender extends AbstractAppender {
+	 *         public LogStoreAppender(String name) { super(name, null, null); }
+	 *         public native void append(LogEvent event);
+	 *     }
+	 *
+	 * in the Java 6 format, which needs no stack map frames. The three-argument constructor of AbstractAppender is
+	 * deprecated, but is present in every version of log4j 2.
+	 */
+	std::vector<unsigned char> appenderClassFile() {
+
+		ClassFileWriter out;
+		out.u4(0xcafebabe);
+		out.u2(0);
+		out.u2(50);
+
+		out.u2(13);
+		out.utf8(APPENDER_CLASS);                                                   // #1
+		out.u1(7); out.u2(1);                                                       // #2 Class #1
+		out.utf8(ABSTRACT_APPENDER_CLASS);                                          // #3
+		out.u1(7); out.u2(3);                                                       // #4 Class #3
+		out.utf8("<init>");                                                         // #5
+		out.utf8("(Ljava/lang/String;)V");                                          // #6
+		out.utf8("(Ljava/lang/String;Lorg/apache/logging/log4j/core/Filter;"
+				"Lorg/apache/logging/log4j/core/Layout;)V");                        // #7
+		out.u1(12); out.u2(5); out.u2(7);                                           // #8 NameAndType #5 #7
+		out.u1(10); out.u2(4); out.u2(8);                                           // #9 Methodref #4 #8
+		out.utf8("Code");                                                           // #10
+		out.utf8("append");                                                         // #11
+		out.utf8(APPEND_SIGNATURE);                                                 // #12
+
+		out.u2(0x0021);    // ACC_PUBLIC | ACC_SUPER
+		out.u2(2);
+		out.u2(4);
+		out.u2(0);         // Interfaces
+		out.u2(0);         // Fields
+
+		out.u2(2);
+		out.u2(0x0001);    // ACC_PUBLIC
+		out.u2(5);
+		out.u2(6);
+		out.u2(1);
+		out.u2(10);
+		out.u4(20);
+		out.u2(4);         // Maximum stack depth
+		out.u2(2);         // Maximum locals
+		out.u4(8);
+		out.u1(0x2a);      // aload_0
+		out.u1(0x2b);      // aload_1
+		out.u1(0x01);      // aconst_null
+		out.u1(0x01);      // aconst_null
+		out.u1(0xb7);      // invokespecial #9
+		out.u2(9);
+		out.u1(0xb1);      // return
+		out.u2(0);         // Exception table
+		out.u2(0);         // Code attributes
+
+		out.u2(0x0101);    // ACC_PUBLIC | ACC_NATIVE
+		out.u2(11);
+		out.u2(12);
+		out.u2(0);
+
+		out.u2(0);         // Class attributes
+		return out.bytes();
+	}
+
+	/** Loads the class name ("java/lang/Object") through loader, returning null if loader does not find it. */
+	jclass loadClass(JNIEnv *jni, jobject loader, const char *name) {
+
+		std::string binaryName{name};
+		std::replace(binaryName.begin(), binaryName.end(), '/', '.');
+		jclass Class = jni->FindClass("java/lang/Class");
+		jmethodID Class_forName = (Class == nullptr) ? nullptr : jni->GetStaticMethodID(Class, "forName",
+				"(Ljava/lang/String;ZLjava/lang/ClassLoader;)Ljava/lang/Class;");
+		jstring javaName = (Class_forName == nullptr) ? nullptr : jni->NewStringUTF(binaryName.c_str());
+		jobject clazz = (javaName == nullptr) ? nullptr
+			: jni->CallStaticObjectMethod(Class, Class_forName, javaName, JNI_FALSE, loader);
+		jni->ExceptionClear();
+		jni->DeleteLocalRef(javaName);
+		jni->DeleteLocalRef(Class);
+		return static_cast<jclass>(clazz);
+	}
+
+	jclass findClass(JNIEnv *jni, jobject loader, const char *name) {
+
+		jclass clazz = loadClass(jni, loader, name);
+		if(clazz == nullptr) {
+			throw std::runtime_error{std::string{"Could not find "} + name + "; log4j 2 is not on the class path"};
+		}
+		return clazz;
+	}
+
+	jmethodID getMethodId(JNIEnv *jni, jclass clazz, const char *name, const char *signature) {
+
+		jmethodID method = jni->GetMethodID(clazz, name, signature);
+		if(method == nullptr) {
+			throw JavaException{jni};
+		}
+		return method;
+	}
+
+	/** Copies string into value, reusing its storage; leaves value empty if string is null. */
+	void copyString(JNIEnv *jni, jobject string, std::string &value) {
+
+		if(string == nullptr) {
+			value.clear();
+			return;
+		}
+		const jstring javaString = static_cast<jstring>(string);
+		const jsize length = jni->GetStringUTFLength(javaString);
+		value.resize(length + 1);
+		jni->GetStringUTFRegion(javaString, 0, jni->GetStringLength(javaString), &value[0]);
+		value.resize(length);
+		jni->DeleteLocalRef(string);
+	}
+
+	/** Implements LogStoreAppender.append, on whichever thread logged the event. */
+	void JNICALL append(JNIEnv *jni, jobject appender, jobject event) {
+
+		LogStore *store = logStore.load(std::memory_order_acquire);
+		if(store == nullptr) {
+			return;
+		}
+
+		// Kept per thread, so that events are copied into storage that has already grown to fit them
+		static thread_local std::string thread, logger, message, thrown;
+
+		const jlong time = jni->CallLongMethod(event, java.LogEvent_getTimeMillis);
+		jobject level = jni->CallObjectMethod(event, java.LogEvent_getLevel);
+		const jint intLevel = (level != nullptr) ? jni->CallIntMethod(level, java.Level_intLevel) : 400;
+		copyString(jni, jni->CallObjectMethod(event, java.LogEvent_getThreadName), thread);
+		copyString(jni, jni->CallObjectMethod(event, java.LogEvent_getLoggerName), logger);
+		jobject eventMessage = jni->CallObjectMethod(event, java.LogEvent_getMessage);
+		copyString(jni, (eventMessage != nullptr)
+				? jni->CallObjectMethod(eventMessage, java.Message_getFormattedMessage) : nullptr, message);
+		jobject eventThrown = jni->CallObjectMethod(event, java.LogEvent_getThrown);
+		if(eventThrown != nullptr) {
+			copyString(jni, jni->CallObjectMethod(eventThrown, java.Object_toString), thrown);
+			message += '\n';
+			message += thrown;
+		}
+		jni->DeleteLocalRef(level);
+		jni->DeleteLocalRef(eventMessage);
+		jni->DeleteLocalRef(eventThrown);
+
+		// A pending exception is left for log4j, which reports appenders that fail
+		if(!jni->ExceptionCheck()) {
+			store->append(time, LogStore::fromIntLevel(intLevel), thread, logger, message);
+		}
+	}
+
+	void closeLogStore() {
+
+		LogStore *store = logStore.exchange(nullptr);
+		if(store != nullptr) {
+			// Not deleted, as a thread may still be appending to it; only stopped once what it holds is written
+			store->close();
+		}
+	}
+
+	/**
+	 * Installs the appender in loader, which loads log4j 2: defines the appender class in it, and adds an instance to
+	 * the configuration of its logger context, once that has been started.
+	 */
+	void install(JNIEnv *jni, jobject loader, std::unique_ptr<LogStore> store) {
+
+		if(jni->PushLocalFrame(64) != JNI_OK) {
+			throw JavaException{jni};
+		}
+		try {
+			jclass LogEvent = findClass(jni, loader, "org/apache/logging/log4j/core/LogEvent");
+			jclass Level = findClass(jni, loader, "org/apache/logging/log4j/Level");
+			jclass Message = findClass(jni, loader, "org/apache/logging/log4j/message/Message");
+			jclass Object = findClass(jni, loader, "java/lang/Object");
+			java.LogEvent_getTimeMillis = getMethodId(jni, LogEvent, "getTimeMillis", "()J");
+			java.LogEvent_getLevel = getMethodId(jni, LogEvent, "getLevel", "()Lorg/apache/logging/log4j/Level;");
+			java.LogEvent_getThreadName = getMethodId(jni, LogEvent, "getThreadName", "()Ljava/lang/String;");
+			java.LogEvent_getLoggerName = getMethodId(jni, LogEvent, "getLoggerName", "()Ljava/lang/String;");
+			java.LogEvent_getMessage = getMethodId(jni, LogEvent, "getMessage",
+					"()Lorg/apache/logging/log4j/message/Message;");
+			java.LogEvent_getThrown = getMethodId(jni, LogEvent, "getThrown", "()Ljava/lang/Throwable;");
+			java.Level_intLevel = getMethodId(jni, Level, "intLevel", "()I");
+			java.Message_getFormattedMessage = getMethodId(jni, Message, "getFormattedMessage", "()Ljava/lang/String;");
+			java.Object_toString = getMethodId(jni, Object, "toString", "()Ljava/lang/String;");
+
+			const std::vector<unsigned char> classFile = appenderClassFile();
+			jclass Appender = jni->DefineClass(APPENDER_CLASS, loader, reinterpret_cast<const jbyte*>(classFile.data()),
+					classFile.size());
+			if(Appender == nullptr) {
+				throw JavaException{jni};
+			}
+			const JNINativeMethod methods[] = {
+				{const_cast<char*>("append"), const_cast<char*>(APPEND_SIGNATURE), reinterpret_cast<void*>(&append)}
+			};
+			if(jni->RegisterNatives(Appender, methods, 1) != JNI_OK) {
+				throw JavaException{jni};
+			}
+			jobject appender = jni->NewObject(Appender, getMethodId(jni, Appender, "<init>", "(Ljava/lang/String;)V"),
+					jni->NewStringUTF(APPENDER_NAME));
+			if(appender == nullptr) {
+				throw JavaException{jni};
+			}
+			jni->CallVoidMethod(appender, getMethodId(jni, Appender, "start", "()V"));
+
+			// The context is the one of the class loader that loads log4j, which also loads the server's classes
+			jclass LogManager = findClass(jni, loader, "org/apache/logging/log4j/LogManager");
+			jmethodID LogManager_getContext = jni->GetStaticMethodID(LogManager, "getContext",
+					"(Ljava/lang/ClassLoader;Z)Lorg/apache/logging/log4j/spi/LoggerContext;");
+			if(LogManager_getContext == nullptr) {
+				throw JavaException{jni};
+			}
+			jobject context = jni->CallStaticObjectMethod(LogManager, LogManager_getContext, loader, JNI_FALSE);
+			jclass LoggerContext = findClass(jni, loader, LOGGER_CONTEXT_CLASS);
+			if((context == nullptr) || !jni->IsInstanceOf(context, LoggerContext)) {
+				jni->ExceptionClear();
+				throw std::runtime_error{"log4j is not using its own implementation"};
+			}
+
+			// When log4j was only just loaded, the server may still be starting the context; an appender added before
+			// it has started would be lost along with the default configuration, when the server's replaces it
+			jmethodID LoggerContext_isStarted = getMethodId(jni, LoggerContext, "isStarted", "()Z");
+			const auto startDeadline = std::chrono::steady_clock::now() + START_TIMEOUT;
+			while(!jni->CallBooleanMethod(context, LoggerContext_isStarted)) {
+				if(jni->ExceptionCheck()) {
+					throw JavaException{jni};
+				}
+				if(std::chrono::steady_clock::now() >= startDeadline) {
+					throw std::runtime_error{"log4j's logger context was not started"};
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds{10});
+			}
+
+			jclass Configuration = findClass(jni, loader, "org/apache/logging/log4j/core/config/Configuration");
+			jclass LoggerConfig = findClass(jni, loader, "org/apache/logging/log4j/core/config/LoggerConfig");
+			jobject configuration = jni->CallObjectMethod(context, getMethodId(jni, LoggerContext, "getConfiguration",
+						"()Lorg/apache/logging/log4j/core/config/Configuration;"));
+			jni->CallVoidMethod(configuration, getMethodId(jni, Configuration, "addAppender",
+						"(Lorg/apache/logging/log4j/core/Appender;)V"), appender);
+			jobject rootLogger = jni->CallObjectMethod(configuration, getMethodId(jni, Configuration, "getRootLogger",
+						"()Lorg/apache/logging/log4j/core/config/LoggerConfig;"));
+			if(jni->ExceptionCheck()) {
+				throw JavaException{jni};
+			}
+
+			// Events may start arriving as soon as the appender is added to the root logger
+			logStore.store(store.release());
+			std::atexit(closeLogStore);
+			jni->CallVoidMethod(rootLogger, getMethodId(jni, LoggerConfig, "addAppender",
+						"(Lorg/apache/logging/log4j/core/Appender;Lorg/apache/logging/log4j/Level;"
+						"Lorg/apache/logging/log4j/core/Filter;)V"), appender, nullptr, nullptr);
+			jni->CallVoidMethod(context, getMethodId(jni, LoggerContext, "updateLoggers", "()V"));
+			if(jni->ExceptionCheck()) {
+				throw JavaException{jni};
+			}
+		} catch(...) {
+			jni->PopLocalFrame(nullptr);
+			throw;
+		}
+		jni->PopLocalFrame(nullptr);
+	}
+
+	/** Installs the appender on a thread of its own, as it may have to wait for the server to start its context. */
+	void installLater(JavaVM *jvm, jobject loader, std::unique_ptr<LogStore> store) {
+
+		JNIEnv *jni;
+		JavaVMAttachArgs attachArguments{JNI_VERSION_1_6, const_cast<char*>("minecraftd log appender"), nullptr};
+		if(jvm->AttachCurrentThreadAsDaemon(reinterpret_cast<void**>(&jni), &attachArguments) != JNI_OK) {
+			std::cerr << "Log events will not be stored: failed to attach a thread to the JVM" << std::endl;
+			return;
+		}
+		try {
+			install(jni, loader, std::move(store));
+			std::cout << "Storing log events from the server's class loader" << std::endl;
+		} catch(const std::exception &e) {
+			std::cerr << "Log events will not be stored: " << e.what() << std::endl;
+		}
+		jni->DeleteGlobalRef(loader);
+		jvm->DetachCurrentThread();
+	}
+
+	/** Waits for log4j's LoggerContext to be prepared, then installs the appender in the loader that defines it. */
+	void JNICALL onClassPrepare(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jclass clazz) {
+
+		char *signature;
+		if(jvmti->GetClassSignature(clazz, &signature, nullptr) != JVMTI_ERROR_NONE) {
+			return;
+		}
+		const bool loggerContext = std::strcmp(signature, LOGGER_CONTEXT_SIGNATURE) == 0;
+		jvmti->Deallocate(reinterpret_cast<unsigned char*>(signature));
+		if(!loggerContext) {
+			return;
+		}
+		std::unique_ptr<LogStore> store{pendingLogStore.exchange(nullptr)};
+		if(!store) {
+			return;
+		}
+		jvmti->SetEventNotificationMode(JVMTI_DISABLE, JVMTI_EVENT_CLASS_PREPARE, nullptr);
+
+		JavaVM *jvm;
+		jobject loader;
+		if((jni->GetJavaVM(&jvm) != JNI_OK) || (jvmti->GetClassLoader(clazz, &loader) != JVMTI_ERROR_NONE)
+				|| (loader == nullptr)) {
+			std::cerr << "Log events will not be stored: failed to find the class loader of log4j" << std::endl;
+			return;
+		}
+		jobject globalLoader = jni->NewGlobalRef(loader);
+		jni->DeleteLocalRef(loader);
+		std::thread{installLater, jvm, globalLoader, std::move(store)}.detach();
+	}
+}
+
+void minecraftd::installLogAppender(JNIEnv *jni, std::unique_ptr<LogStore> store) {
+
+	jclass ClassLoader = jni->FindClass("java/lang/ClassLoader");
+	jmethodID ClassLoader_getSystemClassLoader = (ClassLoader == nullptr) ? nullptr
+		: jni->GetStaticMethodID(ClassLoader, "getSystemClassLoader", "()Ljava/lang/ClassLoader;");
+	jobject loader = (ClassLoader_getSystemClassLoader == nullptr) ? nullptr
+		: jni->CallStaticObjectMethod(ClassLoader, ClassLoader_getSystemClassLoader);
+	jni->DeleteLocalRef(ClassLoader);
+	if(loader == nullptr) {
+		throw JavaException{jni};
+	}
+	jclass LoggerContext = loadClass(jni, loader, LOGGER_CONTEXT_CLASS);
+	if(LoggerContext != nullptr) {
+		jni->DeleteLocalRef(LoggerContext);
+		try {
+			install(jni, loader, std::move(store));
+		} catch(...) {
+			jni->DeleteLocalRef(loader);
+			throw;
+		}
+		jni->DeleteLocalRef(loader);
+		return;
+	}
+	jni->DeleteLocalRef(loader);
+
+	// Servers since 1.18 are bundles, which load log4j along with the server in a class loader of their own
+	JavaVM *jvm;
+	jvmtiEnv *jvmti;
+	if((jni->GetJavaVM(&jvm) != JNI_OK)
+			|| (jvm->GetEnv(reinterpret_cast<void**>(&jvmti), JVMTI_VERSION_1_2) != JNI_OK)) {
+		throw std::runtime_error{"log4j 2 is not on the class path, and the JVM does not support JVMTI 1.2"};
+	}
+	pendingLogStore.store(store.release());
+	jvmtiEventCallbacks callbacks;
+	std::memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.ClassPrepare = &onClassPrepare;
+	if((jvmti->SetEventCallbacks(&callbacks, sizeof(callbacks)) != JVMTI_ERROR_NONE)
+			|| (jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE, nullptr)
+				!= JVMTI_ERROR_NONE)) {
+		delete pendingLogStore.exchange(nullptr);
+		jvmti->DisposeEnvironment();
+		throw std::runtime_error{"log4j 2 is not on the class path, and JVMTI class events could not be enabled"};
+	}
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <memory>
+
+#include <jni.h>
+
+#include "LogStore.h"
+
+namespace minecraftd {
+
+	/**
+	 * Feeds every event logged through log4j 2's root logger into store, which is kept until the process exits (and
+	 * closed, writing out what it holds, when it does).
+	 *
+	 * The appender is a class defined here rather than shipped in a JAR: a subclass of log4j's AbstractAppender,
+	 * net.za.slyfox.minecraftd.LogStoreAppender, whose append method is native and bound with RegisterNatives. It is
+	 * defined in the class loader that loads log4j, and added to the configuration of that class loader's logger
+	 * context, which is the one the server logs to.
+	 *
+	 * When log4j is on the class path, the appender is installed before this returns. Servers since 1.18 are instead
+	 * bundles, which load log4j along with the server in a class loader of their own once they run; the appender is
+	 * then installed from a thread of its own, when a JVMTI ClassPrepare hook sees log4j's LoggerContext, and misses
+	 * the few events logged while the server starts its logger context. Must be called on a thread attached to the
+	 * JVM, before the server starts; throws std::runtime_error if the appender can neither be installed nor wait for
+	 * log4j to be loaded.
+	 */
+	void installLogAppender(JNIEnv *jni, std::unique_ptr<LogStore> store);
+}
@@ -0,0 +1,532 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+
+#include <dirent.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "LogStore.h"
+
+using namespace minecraftd;
+
+namespace {
+	const char *const SEGMENT_SUFFIX = ".seg";
+	const char *const INDEX_SUFFIX = ".idx";
+	const char *const LEVEL_NAMES[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+
+	/** Describes one block of a segment; index files are arrays of these, in host byte order. */
+	struct IndexEntry {
+		int64_t firstTime;
+		int64_t lastTime;
+		uint64_t offset;
+		uint32_t compressedSize;
+		uint32_t size;
+		uint32_t count;
+		/** Bit n is set if the block holds an event of level n. */
+		uint8_t levels;
+		uint8_t reserved[3];
+	};
+	static_assert(sizeof(IndexEntry) == 40, "IndexEntry must not be padded");
+
+	/** Each event in a block is this header, followed by its thread name, logger name and message. */
+	struct EventHeader {
+		int64_t time;
+		uint32_t messageLength;
+		uint16_t threadLength;
+		uint16_t loggerLength;
+		uint8_t level;
+	} __attribute__((packed));
+
+	struct SegmentFile {
+		int64_t time;
+		std::string path;
+	};
+
+	int64_t now() {
+
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	std::string segmentPath(const std::string &directory, int64_t time, const char *suffix) {
+
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016lld%s", static_cast<long long>(time), suffix);
+		return directory + '/' + name;
+	}
+
+	/** Lists the segments in directory, oldest first, by the paths of their segment files without the suffix. */
+	std::vector<SegmentFile> listSegments(const std::string &directory) {
+
+		std::vector<SegmentFile> segments;
+		DIR *dir = opendir(directory.c_str());
+		if(dir == nullptr) {
+			return segments;
+		}
+		const size_t suffixLength = std::strlen(SEGMENT_SUFFIX);
+		for(dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+			const std::string name{entry->d_name};
+			char *end;
+			const long long time = std::strtoll(name.c_str(), &end, 10);
+			if((name.size() > suffixLength) && (end == name.c_str() + name.size() - suffixLength)
+					&& (name.compare(name.size() - suffixLength, suffixLength, SEGMENT_SUFFIX) == 0)) {
+				segments.push_back(SegmentFile{time, directory + '/' + name.substr(0, name.size() - suffixLength)});
+			}
+		}
+		closedir(dir);
+		std::sort(segments.begin(), segments.end(), [](const SegmentFile &a, const SegmentFile &b) {
+			return a.time < b.time;
+		});
+		return segments;
+	}
+
+	void writeFully(int fd, const void *data, size_t size) {
+
+		for(size_t written = 0; written < size;) {
+			const ssize_t result = write(fd, static_cast<const char*>(data) + written, size - written);
+			if(result == -1) {
+				if(errno == EINTR) {
+					continue;
+				}
+				throw std::system_error(errno, std::system_category());
+			}
+			written += result;
+		}
+	}
+
+	/** Reads the whole of the file at path, returning false if it can not be opened. */
+	bool readFile(const std::string &path, std::vector<char> &contents) {
+
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if(fd == -1) {
+			return false;
+		}
+		contents.clear();
+		char buffer[65536];
+		ssize_t result;
+		while(((result = read(fd, buffer, sizeof(buffer))) > 0) || ((result == -1) && (errno == EINTR))) {
+			contents.insert(contents.end(), buffer, buffer + std::max<ssize_t>(result, 0));
+		}
+		close(fd);
+		return result == 0;
+	}
+}
+
+const size_t LogStore::BLOCK_SIZE;
+const std::chrono::milliseconds LogStore::FLUSH_INTERVAL{1000};
+const size_t LogStore::QUEUE_SIZE;
+const uint64_t LogStore::SEGMENT_SIZE;
+const size_t LogReader::MAX_EVENTS;
+
+const char* LogStore::levelName(Level level) {
+
+	return LEVEL_NAMES[static_cast<int>(level)];
+}
+
+LogStore::Level LogStore::fromIntLevel(int intLevel) {
+
+	if(intLevel <= 100) {
+		return Level::FATAL;
+	} else if(intLevel <= 200) {
+		return Level::ERROR;
+	} else if(intLevel <= 300) {
+		return Level::WARN;
+	} else if(intLevel <= 400) {
+		return Level::INFO;
+	} else if(intLevel <= 500) {
+		return Level::DEBUG;
+	}
+	return Level::TRACE;
+}
+
+LogStore::Level LogStore::parseLevel(const std::string &name) {
+
+	for(int level = 0; level <= static_cast<int>(Level::FATAL); ++level) {
+		if(strcasecmp(name.c_str(), LEVEL_NAMES[level]) == 0) {
+			return static_cast<Level>(level);
+		}
+	}
+	throw std::invalid_argument{"Unknown log level: " + name};
+}
+
+std::vector<LogStore::Event> LogStore::query(const std::string &directory, int64_t from, int64_t to,
+		Level minLevel, const std::function<bool(const std::string &message)> &matches, size_t limit) {
+
+	std::vector<Event> events;
+	const uint8_t levelMask = 0xff << static_cast<int>(minLevel);
+	const std::vector<SegmentFile> segments = listSegments(directory);
+	std::vector<char> index;
+	std::vector<unsigned char> compressed;
+	std::vector<char> block;
+	for(size_t i = 0; (i < segments.size()) && (segments[i].time <= to); ++i) {
+		// A segment ends where the next begins, so only the index entries of segments overlapping the range are read
+		if(((i + 1 < segments.size()) && (segments[i + 1].time < from))
+				|| !readFile(segments[i].path + INDEX_SUFFIX, index)) {
+			continue;
+		}
+		const int segmentFd = open((segments[i].path + SEGMENT_SUFFIX).c_str(), O_RDONLY | O_CLOEXEC);
+		if(segmentFd == -1) {
+			continue;
+		}
+
+		// The writer may be midway through an entry; only whole ones are read
+		const IndexEntry *entries = reinterpret_cast<const IndexEntry*>(index.data());
+		const size_t count = index.size() / sizeof(IndexEntry);
+		for(size_t j = 0; j < count; ++j) {
+			const IndexEntry &entry = entries[j];
+			if((entry.lastTime < from) || (entry.firstTime > to) || ((entry.levels & levelMask) == 0)) {
+				continue;
+			}
+
+			compressed.resize(entry.compressedSize);
+			block.resize(entry.size);
+			uLongf size = entry.size;
+			if((pread(segmentFd, compressed.data(), compressed.size(), entry.offset) != ssize_t(compressed.size()))
+					|| (uncompress(reinterpret_cast<Bytef*>(block.data()), &size, compressed.data(),
+							compressed.size()) != Z_OK) || (size != entry.size)) {
+				std::cerr << "Skipping damaged block at " << entry.offset << " of " << segments[i].path
+					<< SEGMENT_SUFFIX << std::endl;
+				continue;
+			}
+
+			for(size_t offset = 0; offset + sizeof(EventHeader) <= block.size();) {
+				EventHeader header;
+				std::memcpy(&header, block.data() + offset, sizeof(header));
+				const char *text = block.data() + offset + sizeof(header);
+				offset += sizeof(header) + header.threadLength + header.loggerLength + header.messageLength;
+				if(offset > block.size()) {
+					break;
+				} else if((header.time < from) || (header.time > to) || (header.level < uint8_t(minLevel))) {
+					continue;
+				}
+
+				Event event{header.time, static_cast<Level>(header.level), std::string{text, header.threadLength},
+					std::string{text + header.threadLength, header.loggerLength},
+					std::string{text + header.threadLength + header.loggerLength, header.messageLength}};
+				if(!matches || matches(event.message)) {
+					events.push_back(std::move(event));
+					if(events.size() >= limit) {
+						::close(segmentFd);
+						return events;
+					}
+				}
+			}
+		}
+		::close(segmentFd);
+	}
+	return events;
+}
+
+LogStore::LogStore(const std::string &directory, uint64_t maxSize)
+	: blockCount_{0}, blockFirstTime_{0}, blockLastTime_{0}, blockLevels_{0}, dequeuePosition_{0},
+	directory_{directory}, dropped_{0}, enqueuePosition_{0}, failed_{false}, indexFd_{-1}, maxSize_{maxSize},
+	segmentFd_{-1}, sleeping_{false}, slots_{new Slot[QUEUE_SIZE]}, stop_{false}, wakeFd_{-1} {
+
+	if(g_mkdir_with_parents(directory_.c_str(), 0750) != 0) {
+		throw std::system_error(errno, std::system_category(), "Failed to create " + directory_);
+	}
+	for(const auto &segment: listSegments(directory_)) {
+		struct stat status;
+		if(stat((segment.path + SEGMENT_SUFFIX).c_str(), &status) == 0) {
+			segments_.push_back(Segment{segment.time, uint64_t(status.st_size)});
+		}
+	}
+
+	wakeFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(wakeFd_ == -1) {
+		throw std::system_error(errno, std::system_category());
+	}
+	for(size_t i = 0; i < QUEUE_SIZE; ++i) {
+		slots_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	block_.reserve(BLOCK_SIZE + 4096);
+	thread_ = std::thread{&LogStore::run, this};
+}
+
+LogStore::~LogStore() {
+
+	close();
+	::close(wakeFd_);
+}
+
+bool LogStore::append(int64_t time, Level level, const std::string &thread, const std::string &logger,
+		const std::string &message) {
+
+	// A bounded multiple-producer queue: each slot's sequence says whether it is free for the producer claiming the
+	// position, or holds an event for the writer
+	uint64_t position = enqueuePosition_.load(std::memory_order_relaxed);
+	Slot *slot;
+	for(;;) {
+		slot = &slots_[position % QUEUE_SIZE];
+		const int64_t difference = int64_t(slot->sequence.load(std::memory_order_acquire) - position);
+		if(difference == 0) {
+			if(enqueuePosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if(difference < 0) {
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		} else {
+			position = enqueuePosition_.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->time = time;
+	slot->level = level;
+	slot->thread.assign(thread, 0, UINT16_MAX);
+	slot->logger.assign(logger, 0, UINT16_MAX);
+	slot->message = message;
+	slot->sequence.store(position + 1, std::memory_order_release);
+
+	// The writer only sleeps once it has found the queue empty, so it is only woken if it may have missed this event
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false)) {
+		const uint64_t one = 1;
+		if(write(wakeFd_, &one, sizeof(one)) != sizeof(one)) {
+			// The writer still finds the event within FLUSH_INTERVAL
+		}
+	}
+	return true;
+}
+
+void LogStore::close() {
+
+	if(!thread_.joinable()) {
+		return;
+	}
+	stop_ = true;
+	const uint64_t one = 1;
+	if(write(wakeFd_, &one, sizeof(one)) == sizeof(one)) {
+		thread_.join();
+	} else {
+		thread_.detach();
+	}
+}
+
+void LogStore::run() {
+
+	for(;;) {
+		const bool stopping = stop_;
+		for(;;) {
+			Slot &slot = slots_[dequeuePosition_ % QUEUE_SIZE];
+			if(slot.sequence.load(std::memory_order_acquire) != dequeuePosition_ + 1) {
+				break;
+			}
+			encode(slot.time, slot.level, slot.thread, slot.logger, slot.message);
+			slot.sequence.store(dequeuePosition_ + QUEUE_SIZE, std::memory_order_release);
+			++dequeuePosition_;
+			if(block_.size() >= BLOCK_SIZE) {
+				flushBlock();
+			}
+		}
+		const uint64_t dropped = dropped_.exchange(0);
+		if(dropped != 0) {
+			encode(now(), Level::WARN, "minecraftd", "minecraftd", std::to_string(dropped)
+					+ " log events were dropped, as the log store could not keep up");
+		}
+
+		if(stopping) {
+			break;
+		} else if((blockCount_ != 0) && (std::chrono::steady_clock::now() - blockStart_ >= FLUSH_INTERVAL)) {
+			flushBlock();
+		}
+
+		sleeping_ = true;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(slots_[dequeuePosition_ % QUEUE_SIZE].sequence.load(std::memory_order_acquire) == dequeuePosition_ + 1) {
+			sleeping_ = false;
+			continue;
+		}
+		pollfd pollFd{wakeFd_, POLLIN, 0};
+		poll(&pollFd, 1, FLUSH_INTERVAL.count());
+		sleeping_ = false;
+		uint64_t value;
+		if(read(wakeFd_, &value, sizeof(value)) != sizeof(value)) {
+			// Woken by the timeout
+		}
+	}
+
+	if(blockCount_ != 0) {
+		flushBlock();
+	}
+	if(segmentFd_ != -1) {
+		::close(segmentFd_);
+		::close(indexFd_);
+		segmentFd_ = indexFd_ = -1;
+	}
+}
+
+void LogStore::encode(int64_t time, Level level, const std::string &thread, const std::string &logger,
+		const std::string &message) {
+
+	if(blockCount_ == 0) {
+		blockFirstTime_ = blockLastTime_ = time;
+		blockLevels_ = 0;
+		blockStart_ = std::chrono::steady_clock::now();
+	}
+	blockFirstTime_ = std::min(blockFirstTime_, time);
+	blockLastTime_ = std::max(blockLastTime_, time);
+	blockLevels_ |= 1 << static_cast<int>(level);
+	++blockCount_;
+
+	const EventHeader header{time, uint32_t(message.size()), uint16_t(thread.size()), uint16_t(logger.size()),
+		static_cast<uint8_t>(level)};
+	const char *bytes = reinterpret_cast<const char*>(&header);
+	block_.insert(block_.end(), bytes, bytes + sizeof(header));
+	block_.insert(block_.end(), thread.begin(), thread.end());
+	block_.insert(block_.end(), logger.begin(), logger.end());
+	block_.insert(block_.end(), message.begin(), message.end());
+}
+
+void LogStore::flushBlock() {
+
+	compressed_.resize(compressBound(block_.size()));
+	uLongf compressedSize = compressed_.size();
+	try {
+		if(compress2(compressed_.data(), &compressedSize, reinterpret_cast<const Bytef*>(block_.data()),
+					block_.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+			throw std::runtime_error{"Failed to compress a block"};
+		}
+		if((segmentFd_ == -1) || (segments_.back().size >= SEGMENT_SIZE)) {
+			openSegment(blockFirstTime_);
+		}
+
+		// The block is written before its index entry, so that readers never find an entry for a partial block
+		const IndexEntry entry{blockFirstTime_, blockLastTime_, segments_.back().size, uint32_t(compressedSize),
+			uint32_t(block_.size()), blockCount_, blockLevels_, {0, 0, 0}};
+		writeFully(segmentFd_, compressed_.data(), compressedSize);
+		segments_.back().size += compressedSize;
+		writeFully(indexFd_, &entry, sizeof(entry));
+		if(failed_) {
+			std::cerr << "Log store is writing again" << std::endl;
+			failed_ = false;
+		}
+	} catch(const std::exception &e) {
+		if(!failed_) {
+			std::cerr << "Log store failed to write " << blockCount_ << " events: " << e.what() << std::endl;
+			failed_ = true;
+		}
+		// The segment may now end in a partial block, so the next block starts a new one
+		if(segmentFd_ != -1) {
+			::close(segmentFd_);
+			::close(indexFd_);
+			segmentFd_ = indexFd_ = -1;
+		}
+	}
+	block_.clear();
+	blockCount_ = 0;
+}
+
+void LogStore::openSegment(int64_t time) {
+
+	if(segmentFd_ != -1) {
+		::close(segmentFd_);
+		::close(indexFd_);
+		segmentFd_ = indexFd_ = -1;
+	}
+	if(!segments_.empty() && (time <= segments_.back().time)) {
+		time = segments_.back().time + 1;
+	}
+
+	const int segmentFd = open(segmentPath(directory_, time, SEGMENT_SUFFIX).c_str(),
+			O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+	if(segmentFd == -1) {
+		throw std::system_error(errno, std::system_category(), "Failed to create a segment");
+	}
+	const int indexFd = open(segmentPath(directory_, time, INDEX_SUFFIX).c_str(),
+			O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if(indexFd == -1) {
+		const int error = errno;
+		::close(segmentFd);
+		unlink(segmentPath(directory_, time, SEGMENT_SUFFIX).c_str());
+		throw std::system_error(error, std::system_category(), "Failed to create a segment index");
+	}
+	segmentFd_ = segmentFd;
+	indexFd_ = indexFd;
+	segments_.push_back(Segment{time, 0});
+
+	uint64_t total = 0;
+	for(const auto &segment: segments_) {
+		total += segment.size;
+	}
+	while((total > maxSize_) && (segments_.size() > 1)) {
+		unlink(segmentPath(directory_, segments_.front().time, INDEX_SUFFIX).c_str());
+		unlink(segmentPath(directory_, segments_.front().time, SEGMENT_SUFFIX).c_str());
+		total -= segments_.front().size;
+		segments_.pop_front();
+	}
+}
+
+LogReader::LogReader(const std::string &directory) : directory_{directory}, running_{false} {
+
+	dispatcher_.connect(sigc::mem_fun(*this, &LogReader::onDispatch));
+}
+
+LogReader::~LogReader() {
+
+	if(thread_.joinable()) {
+		thread_.join();
+	}
+}
+
+bool LogReader::start(int64_t from, int64_t to, LogStore::Level minLevel, const Glib::RefPtr<Glib::Regex> &pattern,
+		const Callback &callback) {
+
+	if(running_) {
+		return false;
+	}
+
+	callback_ = callback;
+	error_.clear();
+	events_.clear();
+	running_ = true;
+	thread_ = std::thread{[this, from, to, minLevel, pattern] {
+		try {
+			std::function<bool(const std::string&)> matches;
+			if(pattern) {
+				matches = [&pattern](const std::string &message) {
+					return g_regex_match_full(pattern->gobj(), message.data(), message.size(), 0,
+							GRegexMatchFlags(0), nullptr, nullptr);
+				};
+			}
+			events_ = LogStore::query(directory_, from, to, minLevel, matches, MAX_EVENTS);
+		} catch(const std::exception &e) {
+			error_ = e.what();
+		}
+		dispatcher_.emit();
+	}};
+	return true;
+}
+
+void LogReader::onDispatch() {
+
+	thread_.join();
+	running_ = false;
+	Callback callback{std::move(callback_)};
+	callback(error_, events_);
+	events_.clear();
+}
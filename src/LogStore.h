@@ -0,0 +1,168 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glibmm.h>
+
+namespace minecraftd {
+
+	/**
+	 * Keeps the server's log events in compressed, time-indexed files, so that the events of a few minutes can be
+	 * found without decompressing whole days of logs.
+	 *
+	 * Events are appended from the JVM's logging threads through a lock-free queue, and a writer thread packs them
+	 * into blocks of up to BLOCK_SIZE bytes, each compressed on its own with zlib. Blocks are appended to segment
+	 * files named after the time of their first event; beside each segment, an index file holds one fixed-size entry
+	 * per block, with its offset, time range and the levels of the events in it. A query reads only the index entries
+	 * of the segments covering its time range, and decompresses only the blocks whose entries match. The oldest
+	 * segments are deleted once the store grows beyond its maximum size.
+	 */
+	class LogStore {
+		public:
+			/** Severity of an event; log4j's levels, from least to most severe. */
+			enum class Level : uint8_t {TRACE, DEBUG, INFO, WARN, ERROR, FATAL};
+
+			struct Event {
+				/** Milliseconds since the epoch. */
+				int64_t time;
+				Level level;
+				std::string thread;
+				std::string logger;
+				std::string message;
+			};
+
+			/** Uncompressed size at which a block is compressed and written. */
+			static const size_t BLOCK_SIZE = 64 * 1024;
+			static const std::chrono::milliseconds FLUSH_INTERVAL;
+			/** Number of events the queue holds; events that find it full are dropped, and the drop logged. */
+			static const size_t QUEUE_SIZE = 8192;
+			/** Compressed size at which a segment is closed, and the next block starts a new one. */
+			static const uint64_t SEGMENT_SIZE = 16 * 1024 * 1024;
+
+			static const char* levelName(Level level);
+			/** Maps one of log4j's integer levels (FATAL = 100 to TRACE = 600) to a level. */
+			static Level fromIntLevel(int intLevel);
+			/** Parses a level name, case-insensitively, throwing std::invalid_argument if it is not one. */
+			static Level parseLevel(const std::string &name);
+
+			/**
+			 * Returns the events in the store in directory from from to to (inclusive, in milliseconds since the
+			 * epoch) of at least minLevel whose message matches, in the order they were logged, up to limit events.
+			 * Events still queued, or in the block being filled, are not found. May be called from any thread,
+			 * including while another process writes to the store.
+			 */
+			static std::vector<Event> query(const std::string &directory, int64_t from, int64_t to, Level minLevel,
+					const std::function<bool(const std::string &message)> &matches, size_t limit);
+
+			/** Starts writing to directory, which is created if need be, keeping at most maxSize bytes of segments. */
+			LogStore(const std::string &directory, uint64_t maxSize);
+			LogStore(const LogStore&) = delete;
+			~LogStore();
+
+			/**
+			 * Queues an event, returning false if it had to be dropped. Never blocks, and only allocates while an
+			 * event is longer than any previously queued in the same slot. May be called from any thread.
+			 */
+			bool append(int64_t time, Level level, const std::string &thread, const std::string &logger,
+					const std::string &message);
+			/** Writes the events queued so far, and stops the writer. Called by the destructor. */
+			void close();
+
+		private:
+			struct Slot {
+				std::atomic<uint64_t> sequence;
+				int64_t time;
+				Level level;
+				std::string thread;
+				std::string logger;
+				std::string message;
+			};
+
+			struct Segment {
+				int64_t time;
+				uint64_t size;
+			};
+
+			void encode(int64_t time, Level level, const std::string &thread, const std::string &logger,
+					const std::string &message);
+			void flushBlock();
+			void openSegment(int64_t time);
+			void run();
+
+			std::vector<char> block_;
+			uint32_t blockCount_;
+			int64_t blockFirstTime_;
+			int64_t blockLastTime_;
+			uint8_t blockLevels_;
+			std::chrono::steady_clock::time_point blockStart_;
+			std::vector<unsigned char> compressed_;
+			uint64_t dequeuePosition_;
+			const std::string directory_;
+			std::atomic<uint64_t> dropped_;
+			std::atomic<uint64_t> enqueuePosition_;
+			bool failed_;
+			int indexFd_;
+			const uint64_t maxSize_;
+			int segmentFd_;
+			/** The segments in the store, oldest first; the last is the one being written, if it is open. */
+			std::deque<Segment> segments_;
+			std::atomic<bool> sleeping_;
+			std::unique_ptr<Slot[]> slots_;
+			std::atomic<bool> stop_;
+			std::thread thread_;
+			int wakeFd_;
+	};
+
+	/** Runs queries against a log store on a thread of its own, one at a time, replying on the main loop. */
+	class LogReader {
+		public:
+			typedef std::function<void(const std::string &error, const std::vector<LogStore::Event> &events)>
+				Callback;
+
+			/** Most events a query returns; a query over more finds only the earliest. */
+			static const size_t MAX_EVENTS = 10000;
+
+			LogReader(const std::string &directory);
+			LogReader(const LogReader&) = delete;
+			~LogReader();
+
+			/**
+			 * Starts a query for the events from from to to of at least minLevel whose message matches pattern (if
+			 * not null), calling callback on the main loop with its result. Returns false if a query is already
+			 * running.
+			 */
+			bool start(int64_t from, int64_t to, LogStore::Level minLevel, const Glib::RefPtr<Glib::Regex> &pattern,
+					const Callback &callback);
+
+		private:
+			void onDispatch();
+
+			Callback callback_;
+			const std::string directory_;
+			Glib::Dispatcher dispatcher_;
+			std::string error_;
+			std::vector<LogStore::Event> events_;
+			bool running_;
+			std::thread thread_;
+	};
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "MemoryGovernor.h"
+
+using namespace minecraftd;
+
+namespace {
+	const std::string SYSTEM_PRESSURE_PATH{"/proc/pressure/memory"};
+
+	/** Returns the memory.pressure file of the cgroup this process belongs to, on the unified hierarchy. */
+	std::string cgroupPressurePath() {
+
+		std::ifstream cgroups{"/proc/self/cgroup"};
+		std::string line;
+		while(std::getline(cgroups, line)) {
+			if(line.compare(0, 3, "0::") == 0) {
+				return "/sys/fs/cgroup" + line.substr(3) + "/memory.pressure";
+			}
+		}
+		return std::string{};
+	}
+
+	/** Reads the pressure file's averages as a single line, for the record. */
+	std::string readPressure(const std::string &path) {
+
+		std::ifstream file{path};
+		std::string line;
+		std::string pressure;
+		while(std::getline(file, line)) {
+			pressure += (pressure.empty() ? "" : "; ") + line;
+		}
+		return pressure;
+	}
+}
+
+const std::chrono::seconds MemoryGovernor::COOLDOWN{60};
+
+MemoryGovernor::MemoryGovernor(const MemoryPressureConfiguration &configuration, CommandQueue &commandQueue)
+	: collecting_{false}, commandQueue_(commandQueue), jvm_{nullptr}, pressurePath_{cgroupPressurePath()},
+	stopped_{false}, warning_{configuration.warning} {
+
+	if(pressurePath_.empty() || (access(pressurePath_.c_str(), W_OK) != 0)) {
+		pressurePath_ = SYSTEM_PRESSURE_PATH;
+	}
+
+	const std::pair<Action, int> thresholds[] = {{Action::COLLECT, configuration.collect},
+		{Action::WARN, configuration.warn}, {Action::SAVE, configuration.save}, {Action::STOP, configuration.stop}};
+	const long window = configuration.window * 1000000L;
+	// Triggers are bound by address, so the vector must never reallocate
+	triggers_.reserve(sizeof(thresholds) / sizeof(thresholds[0]));
+	for(const auto &threshold: thresholds) {
+		if(threshold.second == 0) {
+			continue;
+		}
+
+		// Each trigger needs a file descriptor of its own
+		const int fd = open(pressurePath_.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		const std::string trigger{"some " + std::to_string(window * threshold.second / 100) + ' '
+			+ std::to_string(window)};
+		if((fd == -1) || (write(fd, trigger.c_str(), trigger.size() + 1) == -1)) {
+			const int error = errno;
+			if(fd != -1) {
+				close(fd);
+			}
+			throw std::system_error(error, std::system_category(), "Failed to register PSI trigger on "
+					+ pressurePath_);
+		}
+
+		triggers_.push_back(Trigger{threshold.first, fd, sigc::connection{}, std::chrono::steady_clock::time_point{}});
+		triggers_.back().source = Glib::signal_io().connect(sigc::bind(sigc::mem_fun(*this,
+						&MemoryGovernor::onTrigger), &triggers_.back()), fd, Glib::IO_PRI);
+		std::cout << "Memory pressure: " << actionName(threshold.first) << " at " << threshold.second
+			<< "% of " << configuration.window << " s stalled (" << pressurePath_ << ')' << std::endl;
+	}
+}
+
+MemoryGovernor::~MemoryGovernor() {
+
+	for(auto &trigger: triggers_) {
+		trigger.source.disconnect();
+		close(trigger.fd);
+	}
+	if(collector_.joinable()) {
+		collector_.join();
+	}
+}
+
+const char* MemoryGovernor::actionName(Action action) {
+
+	switch(action) {
+		case Action::COLLECT: return "collect";
+		case Action::WARN: return "warn";
+		case Action::SAVE: return "save";
+		case Action::STOP: return "stop";
+	}
+	return "unknown";
+}
+
+void MemoryGovernor::attachJvm(JavaVM *jvm) {
+
+	jvm_ = jvm;
+}
+
+bool MemoryGovernor::onTrigger(Glib::IOCondition condition, Trigger *trigger) {
+
+	if((condition & (Glib::IO_ERR | Glib::IO_HUP)) != 0) {
+		// The cgroup has gone away; nothing more will be reported through this trigger
+		std::cerr << "Memory pressure: lost " << actionName(trigger->action) << " trigger" << std::endl;
+		return false;
+	}
+
+	const auto now = std::chrono::steady_clock::now();
+	if(((trigger->lastTaken != std::chrono::steady_clock::time_point{}) && (now - trigger->lastTaken < COOLDOWN))
+			|| stopped_) {
+		return true;
+	}
+	trigger->lastTaken = now;
+
+	bool taken = true;
+	switch(trigger->action) {
+		case Action::COLLECT:
+			if(collecting_) {
+				taken = false;
+			} else {
+				if(collector_.joinable()) {
+					collector_.join();
+				}
+				collecting_ = true;
+				collector_ = std::thread{&MemoryGovernor::collect, this};
+			}
+			break;
+		case Action::WARN:
+			taken = commandQueue_.push("say " + warning_);
+			break;
+		case Action::SAVE:
+			taken = commandQueue_.push("save-all flush");
+			break;
+		case Action::STOP:
+			taken = stopped_ = commandQueue_.push("stop");
+			break;
+	}
+
+	if(taken) {
+		records_.push_back(Record{std::chrono::system_clock::now(), trigger->action, readPressure(pressurePath_)});
+		std::cout << "Memory pressure: " << actionName(trigger->action) << " (" << records_.back().pressure << ')'
+			<< std::endl;
+	}
+	return true;
+}
+
+void MemoryGovernor::collect() {
+
+	const auto start = std::chrono::steady_clock::now();
+	JavaVM *jvm = jvm_;
+	JNIEnv *jni;
+	JavaVMAttachArgs attachArguments{JNI_VERSION_1_6, const_cast<char*>("minecraftd memory governor"), nullptr};
+	if((jvm != nullptr) && (jvm->AttachCurrentThreadAsDaemon(reinterpret_cast<void**>(&jni), &attachArguments)
+				== JNI_OK)) {
+		jclass System = jni->FindClass("java/lang/System");
+		jmethodID System_gc = (System != nullptr) ? jni->GetStaticMethodID(System, "gc", "()V") : nullptr;
+		if(System_gc != nullptr) {
+			jni->CallStaticVoidMethod(System, System_gc);
+		}
+		if(jni->ExceptionCheck()) {
+			jni->ExceptionClear();
+		}
+		jvm->DetachCurrentThread();
+	}
+
+	// The JVM lives in this process, so whatever glibc holds on to beyond the Java heap can be returned as well
+	malloc_trim(0);
+
+	std::cout << "Memory pressure: collection took " << std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+	collecting_ = false;
+}
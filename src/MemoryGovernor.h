@@ -0,0 +1,86 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glibmm.h>
+#include <jni.h>
+
+#include "CommandQueue.h"
+#include "instance.h"
+
+namespace minecraftd {
+
+	/**
+	 * Acts on the server before memory pressure builds to the point where the OOM killer takes out the whole process.
+	 *
+	 * Pressure is watched through PSI triggers on the daemon's cgroup memory.pressure (or the system-wide
+	 * /proc/pressure/memory), one for each configured threshold, polled by the GLib main loop. As pressure rises
+	 * through the thresholds, the governor collects garbage in the hosted JVM and trims the native heap, warns the
+	 * players, saves the world, and finally stops the server cleanly. Each action is recorded with the time it was
+	 * taken and the pressure that prompted it.
+	 */
+	class MemoryGovernor {
+		public:
+			enum class Action { COLLECT, WARN, SAVE, STOP };
+
+			struct Record {
+				std::chrono::system_clock::time_point time;
+				Action action;
+				/** The pressure averages at the time, as read from the pressure file. */
+				std::string pressure;
+			};
+
+			/** Each action is taken at most once in this time, however often its trigger fires. */
+			static const std::chrono::seconds COOLDOWN;
+
+			/** Registers a trigger for each non-zero threshold. Throws std::system_error if PSI is unavailable. */
+			MemoryGovernor(const MemoryPressureConfiguration &configuration, CommandQueue &commandQueue);
+			MemoryGovernor(const MemoryGovernor&) = delete;
+			~MemoryGovernor();
+
+			static const char* actionName(Action action);
+
+			/** Sets the JVM in which garbage is collected; until then, COLLECT only trims the native heap. */
+			void attachJvm(JavaVM *jvm);
+			const std::vector<Record>& records() const { return records_; }
+
+		private:
+			struct Trigger {
+				Action action;
+				int fd;
+				sigc::connection source;
+				std::chrono::steady_clock::time_point lastTaken;
+			};
+
+			/** Collects garbage and trims the native heap, on a thread of its own as a full GC may take seconds. */
+			void collect();
+			bool onTrigger(Glib::IOCondition condition, Trigger *trigger);
+
+			/** Set while the collector thread runs. */
+			std::atomic<bool> collecting_;
+			std::thread collector_;
+			CommandQueue &commandQueue_;
+			JavaVM *jvm_;
+			std::string pressurePath_;
+			std::vector<Record> records_;
+			bool stopped_;
+			std::vector<Trigger> triggers_;
+			const std::string warning_;
+	};
+}
@@ -0,0 +1,396 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+
+#include <dlfcn.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <glibmm.h>
+
+#include "Profiler.h"
+
+using namespace minecraftd;
+
+namespace {
+	/** Layout of HotSpot's ASGCT_CallFrame and ASGCT_CallTrace, which no JDK header declares. */
+	struct CallFrame {
+		jint lineNumber;
+		jmethodID method;
+	};
+
+	struct CallTrace {
+		JNIEnv *jni;
+		/** Number of frames recorded, or if not positive, the reason none could be. */
+		jint frameCount;
+		CallFrame *frames;
+	};
+
+	enum SlotState { FREE, WRITING, READY };
+
+	/** Recorded in place of a frame count for signals that land on a thread the JVM does not know about. */
+	const jint NOT_JAVA_THREAD = -100;
+
+	/** Interval at which the ring is drained; at 1 kHz on 16 threads, it fills in a quarter of a second. */
+	const std::chrono::milliseconds DRAIN_INTERVAL{20};
+
+	std::string describeError(intptr_t frameCount) {
+
+		switch(frameCount) {
+			case 0: return "[no Java frames]";
+			case -1: return "[no class load]";
+			case -2: return "[GC active]";
+			case -3: return "[unknown, not Java]";
+			case -4: return "[not walkable, not Java]";
+			case -5: return "[unknown Java]";
+			case -6: return "[not walkable Java]";
+			case -7: return "[unknown state]";
+			case -8: return "[thread exit]";
+			case -9: return "[deoptimization]";
+			case -10: return "[safepoint]";
+			case NOT_JAVA_THREAD: return "[non-Java thread]";
+			default: return "[error " + std::to_string(frameCount) + "]";
+		}
+	}
+
+	/** Forces the creation of the class' jmethodIDs, which AsyncGetCallTrace can not create itself. */
+	void createMethodIds(jvmtiEnv *jvmti, jclass clazz) {
+
+		jint count;
+		jmethodID *methods;
+		if(jvmti->GetClassMethods(clazz, &count, &methods) == JVMTI_ERROR_NONE) {
+			jvmti->Deallocate(reinterpret_cast<unsigned char*>(methods));
+		}
+	}
+}
+
+struct Profiler::Slot {
+
+	Slot() : state{FREE}, frameCount{0} { }
+
+	std::atomic<int> state;
+	jint frameCount;
+	CallFrame frames[MAX_FRAMES];
+};
+
+const std::chrono::microseconds Profiler::DEFAULT_INTERVAL{10000};
+const std::chrono::microseconds Profiler::MIN_INTERVAL{100};
+const std::chrono::microseconds Profiler::MAX_INTERVAL{1000000};
+const int Profiler::MAX_FRAMES;
+const size_t Profiler::RING_SIZE;
+std::atomic<Profiler*> Profiler::active_{nullptr};
+std::atomic<unsigned int> Profiler::inHandler_{0};
+
+Profiler::Profiler(JavaVM *jvm, void *libjvm, const std::string &outputDirectory)
+	: dropped_{0}, jvm_(jvm), outputDirectory_(outputDirectory), running_{false}, stop_{false}, writeIndex_{0} {
+
+	asyncGetCallTrace_ = reinterpret_cast<AsyncGetCallTrace>(dlsym(libjvm, "AsyncGetCallTrace"));
+	if(asyncGetCallTrace_ == nullptr) {
+		throw std::runtime_error{"JVM does not export AsyncGetCallTrace"};
+	}
+
+	if(jvm->GetEnv(reinterpret_cast<void**>(&jvmti_), JVMTI_VERSION_1_2) != JNI_OK) {
+		throw std::runtime_error{"JVM does not support JVMTI 1.2"};
+	}
+
+	// AsyncGetCallTrace refuses to walk stacks unless class load events are enabled
+	jvmtiEventCallbacks callbacks;
+	std::memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.ClassLoad = &Profiler::onClassLoad;
+	callbacks.ClassPrepare = &Profiler::onClassPrepare;
+	if((jvmti_->SetEventCallbacks(&callbacks, sizeof(callbacks)) != JVMTI_ERROR_NONE)
+			|| (jvmti_->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_CLASS_LOAD, nullptr) != JVMTI_ERROR_NONE)
+			|| (jvmti_->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE, nullptr)
+				!= JVMTI_ERROR_NONE)) {
+		jvmti_->DisposeEnvironment();
+		throw std::runtime_error{"Failed to enable JVMTI class events"};
+	}
+
+	// Classes prepared from here on are handled by onClassPrepare
+	jint count;
+	jclass *classes;
+	if(jvmti_->GetLoadedClasses(&count, &classes) == JVMTI_ERROR_NONE) {
+		for(jint i = 0; i < count; ++i) {
+			createMethodIds(jvmti_, classes[i]);
+		}
+		jvmti_->Deallocate(reinterpret_cast<unsigned char*>(classes));
+	}
+}
+
+Profiler::~Profiler() {
+
+	if(running_) {
+		try {
+			stop();
+		} catch(const std::exception &e) {
+			std::cerr << "Failed to stop profiling: " << e.what() << std::endl;
+		}
+	}
+}
+
+bool Profiler::start(std::chrono::microseconds interval) {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	if(running_ || (interval < MIN_INTERVAL) || (interval > MAX_INTERVAL)) {
+		return false;
+	}
+
+	static std::once_flag handlerFlag;
+	std::call_once(handlerFlag, []{
+		struct sigaction action;
+		std::memset(&action, 0, sizeof(action));
+		action.sa_sigaction = &Profiler::onSignal;
+		action.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		if(sigaction(SIGPROF, &action, nullptr) != 0) {
+			throw std::system_error(errno, std::system_category());
+		}
+	});
+
+	slots_.reset(new Slot[RING_SIZE]);
+	dropped_ = 0;
+	error_.clear();
+	path_.clear();
+	stop_ = false;
+	traces_.clear();
+	writeIndex_ = 0;
+	thread_ = std::thread{&Profiler::run, this};
+
+	active_ = this;
+	const timeval period{static_cast<time_t>(interval.count() / 1000000),
+		static_cast<suseconds_t>(interval.count() % 1000000)};
+	const itimerval timer{period, period};
+	if(setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+		const int error = errno;
+		active_ = nullptr;
+		stop_ = true;
+		thread_.join();
+		slots_.reset();
+		throw std::system_error(error, std::system_category());
+	}
+
+	running_ = true;
+	std::cout << "Started profiling every " << interval.count() << " us of CPU time" << std::endl;
+	return true;
+}
+
+std::string Profiler::stop() {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	if(!running_) {
+		throw std::runtime_error{"Profiling is not running"};
+	}
+
+	const itimerval disarm{{0, 0}, {0, 0}};
+	setitimer(ITIMER_PROF, &disarm, nullptr);
+
+	// A signal already being delivered may still be recording; wait for it before the ring goes away
+	active_ = nullptr;
+	while(inHandler_ > 0) {
+		std::this_thread::yield();
+	}
+
+	stop_ = true;
+	thread_.join();
+	slots_.reset();
+	running_ = false;
+
+	if(!error_.empty()) {
+		throw std::runtime_error{error_};
+	}
+	return path_;
+}
+
+size_t Profiler::TraceHash::operator()(const std::vector<intptr_t> &trace) const {
+
+	size_t hash = 31;
+	for(auto frame: trace) {
+		hash = 31 * hash + std::hash<intptr_t>{}(frame);
+	}
+	return hash;
+}
+
+void JNICALL Profiler::onClassLoad(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jclass clazz) {
+}
+
+void JNICALL Profiler::onClassPrepare(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jclass clazz) {
+
+	createMethodIds(jvmti, clazz);
+}
+
+void Profiler::onSignal(int signal, siginfo_t *info, void *context) {
+
+	const int savedErrno = errno;
+	++inHandler_;
+	Profiler *profiler = active_;
+	if(profiler != nullptr) {
+		profiler->record(context);
+	}
+	--inHandler_;
+	errno = savedErrno;
+}
+
+void Profiler::record(void *context) {
+
+	// Runs in a signal handler: no allocation, no locks
+	Slot &slot = slots_[writeIndex_.fetch_add(1) % RING_SIZE];
+	int expected = FREE;
+	if(!slot.state.compare_exchange_strong(expected, WRITING)) {
+		++dropped_;
+		return;
+	}
+
+	JNIEnv *jni;
+	if(jvm_->GetEnv(reinterpret_cast<void**>(&jni), JNI_VERSION_1_6) != JNI_OK) {
+		slot.frameCount = NOT_JAVA_THREAD;
+	} else {
+		CallTrace trace{jni, 0, slot.frames};
+		asyncGetCallTrace_(&trace, MAX_FRAMES, context);
+		slot.frameCount = trace.frameCount;
+	}
+	slot.state.store(READY, std::memory_order_release);
+}
+
+void Profiler::drain() {
+
+	// Traces are keyed root first by jmethodID, which are positive as addresses; a failed walk becomes a single
+	// non-positive frame holding the reason
+	std::vector<intptr_t> trace;
+	for(size_t i = 0; i < RING_SIZE; ++i) {
+		Slot &slot = slots_[i];
+		if(slot.state.load(std::memory_order_acquire) != READY) {
+			continue;
+		}
+
+		trace.clear();
+		if(slot.frameCount <= 0) {
+			trace.push_back(slot.frameCount);
+		} else {
+			for(jint frame = slot.frameCount - 1; frame >= 0; --frame) {
+				trace.push_back(reinterpret_cast<intptr_t>(slot.frames[frame].method));
+			}
+		}
+		slot.state.store(FREE, std::memory_order_release);
+		++traces_[trace];
+	}
+}
+
+std::string Profiler::frameName(JNIEnv *jni, intptr_t frame) const {
+
+	if(frame <= 0) {
+		return describeError(frame);
+	}
+
+	jmethodID method = reinterpret_cast<jmethodID>(frame);
+	jclass clazz;
+	char *classSignature;
+	char *methodName;
+	if(jvmti_->GetMethodDeclaringClass(method, &clazz) != JVMTI_ERROR_NONE) {
+		return "[unknown method]";
+	}
+	// This thread never returns to Java, so local references are only ever freed by deleting them
+	const jvmtiError classError = jvmti_->GetClassSignature(clazz, &classSignature, nullptr);
+	jni->DeleteLocalRef(clazz);
+	if(classError != JVMTI_ERROR_NONE) {
+		return "[unknown class]";
+	} else if(jvmti_->GetMethodName(method, &methodName, nullptr, nullptr) != JVMTI_ERROR_NONE) {
+		jvmti_->Deallocate(reinterpret_cast<unsigned char*>(classSignature));
+		return "[unknown method]";
+	}
+
+	// Lnet/minecraft/server/MinecraftServer; -> net.minecraft.server.MinecraftServer
+	std::string name{classSignature};
+	if((name.size() > 2) && (name.front() == 'L') && (name.back() == ';')) {
+		name = name.substr(1, name.size() - 2);
+	}
+	for(auto &c: name) {
+		if(c == '/') {
+			c = '.';
+		}
+	}
+	name += '.';
+	name += methodName;
+
+	jvmti_->Deallocate(reinterpret_cast<unsigned char*>(classSignature));
+	jvmti_->Deallocate(reinterpret_cast<unsigned char*>(methodName));
+	return name;
+}
+
+void Profiler::run() {
+
+	JNIEnv *jni;
+	JavaVMAttachArgs attachArguments{JNI_VERSION_1_6, const_cast<char*>("minecraftd profiler"), nullptr};
+	if(jvm_->AttachCurrentThreadAsDaemon(reinterpret_cast<void**>(&jni), &attachArguments) != JNI_OK) {
+		error_ = "Failed to attach the profiler thread to the JVM";
+		return;
+	}
+
+	while(!stop_) {
+		drain();
+		std::this_thread::sleep_for(DRAIN_INTERVAL);
+	}
+	drain();
+
+	try {
+		path_ = write(jni);
+	} catch(const std::exception &e) {
+		error_ = e.what();
+	}
+	jvm_->DetachCurrentThread();
+}
+
+std::string Profiler::write(JNIEnv *jni) {
+
+	if(g_mkdir_with_parents(outputDirectory_.c_str(), 0755) != 0) {
+		throw std::system_error(errno, std::system_category());
+	}
+
+	char timestamp[32];
+	const std::time_t now = std::time(nullptr);
+	std::strftime(timestamp, sizeof(timestamp), "%Y%m%dT%H%M%SZ", std::gmtime(&now));
+	std::string path{outputDirectory_ + "/profile-" + timestamp + ".collapsed"};
+	for(int i = 1; access(path.c_str(), F_OK) == 0; ++i) {
+		path = outputDirectory_ + "/profile-" + timestamp + '-' + std::to_string(i) + ".collapsed";
+	}
+
+	std::unordered_map<intptr_t, std::string> names;
+	std::ofstream out{path};
+	uint64_t samples = 0;
+	for(const auto &trace: traces_) {
+		for(auto frame = trace.first.cbegin(); frame != trace.first.cend(); ++frame) {
+			auto name = names.find(*frame);
+			if(name == names.end()) {
+				name = names.emplace(*frame, frameName(jni, *frame)).first;
+			}
+			out << ((frame == trace.first.cbegin()) ? "" : ";") << name->second;
+		}
+		out << ' ' << trace.second << '\n';
+		samples += trace.second;
+	}
+	if(dropped_ > 0) {
+		out << "[dropped] " << dropped_ << '\n';
+	}
+
+	out.close();
+	if(!out) {
+		throw std::runtime_error{"Failed to write profile to " + path};
+	}
+	std::cout << "Wrote profile of " << samples << " samples (" << dropped_ << " dropped) to " << path << std::endl;
+	return path;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <signal.h>
+
+#include <jni.h>
+#include <jvmti.h>
+
+namespace minecraftd {
+
+	/**
+	 * Samples the Java stacks of the in-process JVM on demand, for flame graphs of production tick spikes.
+	 *
+	 * A CPU-time interval timer raises SIGPROF on whichever thread is running, and the handler records that thread's
+	 * Java stack with HotSpot's AsyncGetCallTrace into a preallocated ring of slots; it neither allocates nor locks.
+	 * A thread attached to the JVM drains the ring into a table of distinct stacks, and on stop writes them out as
+	 * collapsed stacks ("frame;frame;frame count" lines), as read by flamegraph.pl and speedscope.
+	 */
+	class Profiler {
+		public:
+			static const std::chrono::microseconds DEFAULT_INTERVAL;
+			/** Shortest interval sampled at; shorter ones would spend more of the JVM's time sampling than running. */
+			static const std::chrono::microseconds MIN_INTERVAL;
+			/** Longest interval sampled at; longer ones would hardly sample at all. */
+			static const std::chrono::microseconds MAX_INTERVAL;
+			/** Deepest stack recorded; deeper stacks are truncated at the root end. */
+			static const int MAX_FRAMES = 128;
+			/** Number of samples the ring holds between drains; samples that find it full are dropped. */
+			static const size_t RING_SIZE = 4096;
+
+			/**
+			 * Registers a JVMTI environment with jvm, which must be created from libjvm (a handle from dlopen), and
+			 * must have been created on the calling thread. Profiles are written to outputDirectory. Throws
+			 * std::runtime_error if the JVM does not support profiling.
+			 */
+			Profiler(JavaVM *jvm, void *libjvm, const std::string &outputDirectory);
+			Profiler(const Profiler&) = delete;
+			~Profiler();
+
+			/**
+			 * Starts sampling every interval of CPU time, returning false if profiling is already running or if
+			 * interval is outside MIN_INTERVAL to MAX_INTERVAL.
+			 */
+			bool start(std::chrono::microseconds interval);
+			/** Stops sampling and writes the profile, returning its path. Throws std::runtime_error on failure. */
+			std::string stop();
+
+		private:
+			struct Slot;
+
+			struct TraceHash {
+				size_t operator()(const std::vector<intptr_t> &trace) const;
+			};
+
+			static void JNICALL onClassLoad(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jclass clazz);
+			static void JNICALL onClassPrepare(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jclass clazz);
+			static void onSignal(int signal, siginfo_t *info, void *context);
+
+			void drain();
+			std::string frameName(JNIEnv *jni, intptr_t frame) const;
+			void record(void *context);
+			void run();
+			std::string write(JNIEnv *jni);
+
+			/** Signature of HotSpot's AsyncGetCallTrace; the frame and trace types are private to Profiler.cpp. */
+			typedef void (*AsyncGetCallTrace)(void *trace, jint depth, void *context);
+
+			/** The running profiler, and the number of signal handlers that may be using it. */
+			static std::atomic<Profiler*> active_;
+			static std::atomic<unsigned int> inHandler_;
+
+			AsyncGetCallTrace asyncGetCallTrace_;
+			std::atomic<uint64_t> dropped_;
+			std::string error_;
+			JavaVM *const jvm_;
+			jvmtiEnv *jvmti_;
+			std::mutex mutex_;
+			const std::string outputDirectory_;
+			std::string path_;
+			bool running_;
+			std::unique_ptr<Slot[]> slots_;
+			std::atomic<bool> stop_;
+			std::thread thread_;
+			std::unordered_map<std::vector<intptr_t>, uint64_t, TraceHash> traces_;
+			std::atomic<uint64_t> writeIndex_;
+	};
+}
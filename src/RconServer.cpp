@@ -0,0 +1,435 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "RconServer.h"
+
+using minecraftd::RconServer;
+
+namespace {
+	const int32_t TYPE_RESPONSE = 0;
+	const int32_t TYPE_COMMAND = 2;
+	const int32_t TYPE_AUTH_RESPONSE = 2;
+	const int32_t TYPE_LOGIN = 3;
+	/** Request ID returned in the response to a failed login. */
+	const int32_t AUTH_FAILED = -1;
+	/** Bytes of a packet beyond its body: request ID, type and two terminating nulls (the length is not counted). */
+	const size_t PACKET_OVERHEAD = 10;
+	/** A client is not read from while this much output to it is unsent. */
+	const size_t MAX_UNSENT = 1024 * 1024;
+	/** How often throttled clients are reconsidered, in milliseconds. */
+	const unsigned int THROTTLE_INTERVAL = 50;
+	const uint64_t LISTEN_TOKEN = uint64_t{1} << 63;
+
+	int32_t readInt32(const char *data) {
+
+		const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+		return static_cast<int32_t>(uint32_t{bytes[0]} | (uint32_t{bytes[1]} << 8) | (uint32_t{bytes[2]} << 16)
+				| (uint32_t{bytes[3]} << 24));
+	}
+
+	void writeInt32(std::string &out, int32_t value) {
+
+		const uint32_t bits = static_cast<uint32_t>(value);
+		for(int shift = 0; shift < 32; shift += 8) {
+			out += static_cast<char>((bits >> shift) & 0xFF);
+		}
+	}
+
+	/** Removes the "[time] [thread/level]: " prefix the server logs each line with, as RCON replies carry none. */
+	std::string stripLogPrefix(const std::string &line) {
+
+		const size_t prefix = line.find("]: ");
+		return ((line[0] == '[') && (prefix != std::string::npos)) ? line.substr(prefix + 3) : line;
+	}
+}
+
+struct RconServer::Client {
+	uint64_t id;
+	int fd;
+	bool local;
+	bool authenticated;
+	std::string input;
+	std::string output;
+	/** Commands received and not yet handed to the executor, with their request IDs. */
+	std::deque<std::pair<int32_t, std::string>> requests;
+	/** Commands handed to the executor and not yet answered. */
+	size_t outstanding;
+	/** Events the socket is registered for with epoll. */
+	uint32_t events;
+	/** Commands the client may send before it is throttled, refilled at the rate limit. */
+	double tokens;
+	std::chrono::steady_clock::time_point refilled;
+};
+
+const size_t RconServer::MAX_BODY;
+const size_t RconServer::MAX_PIPELINED;
+const size_t RconServer::MAX_IN_FLIGHT;
+
+RconServer::RconServer(CommandExecutor &executor, const std::string &socketPath, unsigned int port,
+		const std::string &password, unsigned int rateLimit, const std::function<void()> &beforeCommand)
+	: beforeCommand_{beforeCommand},
+	epollFd_{epoll_create1(EPOLL_CLOEXEC)},
+	executor_(executor),
+	inFlight_{0},
+	lastServed_{0},
+	nextId_{1},
+	password_{password},
+	rateLimit_{static_cast<double>(std::max(rateLimit, 1u))},
+	socketPath_{socketPath} {
+
+	if(epollFd_ == -1) {
+		throw std::system_error(errno, std::system_category());
+	}
+
+	if(!socketPath_.empty()) {
+		sockaddr_un address;
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(socketPath_.size() >= sizeof(address.sun_path)) {
+			std::cerr << "RCON socket path is too long: " << socketPath_ << std::endl;
+		} else {
+			std::strcpy(address.sun_path, socketPath_.c_str());
+			unlink(socketPath_.c_str());
+			// Access to the socket is access to the console, so it is limited to the daemon's user and group
+			if((fd != -1) && (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+					&& (chmod(socketPath_.c_str(), 0660) == 0) && (listen(fd, SOMAXCONN) == 0)) {
+				listeners_.emplace_back(fd, true);
+			} else {
+				std::cerr << "Failed to listen on RCON socket " << socketPath_ << ": " << std::strerror(errno)
+					<< std::endl;
+			}
+		}
+		if((fd != -1) && (listeners_.empty())) {
+			close(fd);
+		}
+	}
+
+	if((port != 0) && password_.empty()) {
+		std::cerr << "Not opening RCON port " << port << " without a password" << std::endl;
+	} else if(port != 0) {
+		sockaddr_in address;
+		std::memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(port);
+		const int one = 1;
+		const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if((fd != -1) && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0)
+				&& (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+				&& (listen(fd, SOMAXCONN) == 0)) {
+			listeners_.emplace_back(fd, false);
+		} else {
+			std::cerr << "Failed to listen on RCON port " << port << ": " << std::strerror(errno) << std::endl;
+			if(fd != -1) {
+				close(fd);
+			}
+		}
+	}
+
+	for(size_t i = 0; i < listeners_.size(); ++i) {
+		epoll_event event{EPOLLIN, {}};
+		event.data.u64 = LISTEN_TOKEN | i;
+		epoll_ctl(epollFd_, EPOLL_CTL_ADD, listeners_[i].first, &event);
+	}
+	eventSource_ = Glib::signal_io().connect(sigc::mem_fun(*this, &RconServer::onEvents), epollFd_, Glib::IO_IN);
+}
+
+RconServer::~RconServer() {
+
+	eventSource_.disconnect();
+	dispatchSource_.disconnect();
+	for(auto &entry: clients_) {
+		close(entry.second->fd);
+	}
+	for(const auto &listener: listeners_) {
+		close(listener.first);
+		if(listener.second) {
+			unlink(socketPath_.c_str());
+		}
+	}
+	close(epollFd_);
+}
+
+bool RconServer::onEvents(Glib::IOCondition) {
+
+	epoll_event events[64];
+	const int count = epoll_wait(epollFd_, events, 64, 0);
+	for(int i = 0; i < count; ++i) {
+		const uint64_t token = events[i].data.u64;
+		if((token & LISTEN_TOKEN) != 0) {
+			const auto &listener = listeners_[token & ~LISTEN_TOKEN];
+			accept(listener.first, listener.second);
+			continue;
+		}
+
+		auto entry = clients_.find(token);
+		if(entry == clients_.end()) {
+			continue;
+		}
+		Client &client = *entry->second;
+		if((events[i].events & (EPOLLERR | EPOLLHUP)) != 0) {
+			disconnect(client);
+			continue;
+		}
+		if((events[i].events & EPOLLOUT) != 0) {
+			flush(client);
+		}
+		if(((events[i].events & EPOLLIN) != 0) && !onReadable(client)) {
+			continue;
+		}
+		updateInterest(client);
+	}
+
+	dispatch();
+	return true;
+}
+
+void RconServer::accept(int listenFd, bool local) {
+
+	for(;;) {
+		const int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd == -1) {
+			return;
+		}
+
+		std::unique_ptr<Client> client{new Client{nextId_++, fd, local, false, std::string{}, std::string{}, {}, 0,
+			EPOLLIN, rateLimit_, std::chrono::steady_clock::now()}};
+		epoll_event event{EPOLLIN, {}};
+		event.data.u64 = client->id;
+		if(epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+			close(fd);
+			continue;
+		}
+		clients_[client->id] = std::move(client);
+	}
+}
+
+void RconServer::disconnect(Client &client) {
+
+	close(client.fd);
+	clients_.erase(client.id);
+}
+
+bool RconServer::onReadable(Client &client) {
+
+	char buffer[4096];
+	for(;;) {
+		const ssize_t count = read(client.fd, buffer, sizeof(buffer));
+		if(count == 0) {
+			disconnect(client);
+			return false;
+		} else if(count < 0) {
+			if((errno != EAGAIN) && (errno != EINTR)) {
+				disconnect(client);
+				return false;
+			} else if(errno == EAGAIN) {
+				break;
+			}
+			continue;
+		}
+		client.input.append(buffer, count);
+		if(client.output.size() > MAX_UNSENT) {
+			break;
+		}
+	}
+
+	while(client.input.size() >= 4) {
+		const int32_t length = readInt32(client.input.data());
+		if((length < static_cast<int32_t>(PACKET_OVERHEAD))
+				|| (length > static_cast<int32_t>(MAX_BODY + PACKET_OVERHEAD))) {
+			disconnect(client);
+			return false;
+		} else if(client.input.size() < static_cast<size_t>(length) + 4) {
+			break;
+		}
+
+		const int32_t requestId = readInt32(client.input.data() + 4);
+		const int32_t type = readInt32(client.input.data() + 8);
+		std::string body{client.input.c_str() + 12};
+		body.resize(std::min<size_t>(body.size(), length - PACKET_OVERHEAD));
+		client.input.erase(0, length + 4);
+
+		if(type == TYPE_LOGIN) {
+			client.authenticated = (body == password_) || (client.local && password_.empty());
+			send(client, client.authenticated ? requestId : AUTH_FAILED, TYPE_AUTH_RESPONSE, std::string{});
+		} else if(type != TYPE_COMMAND) {
+			char unknown[32];
+			std::snprintf(unknown, sizeof(unknown), "Unknown request %x", static_cast<unsigned int>(type));
+			send(client, requestId, TYPE_RESPONSE, unknown);
+		} else if(!client.authenticated) {
+			send(client, AUTH_FAILED, TYPE_RESPONSE, std::string{});
+		} else if(client.requests.size() + client.outstanding >= MAX_PIPELINED) {
+			std::cerr << "RCON client sent more than " << MAX_PIPELINED << " commands at once; disconnecting"
+				<< std::endl;
+			disconnect(client);
+			return false;
+		} else {
+			client.requests.emplace_back(requestId, body);
+		}
+	}
+	return true;
+}
+
+void RconServer::dispatch() {
+
+	// One command per client per round, starting after the client served last time
+	std::vector<Client*> order;
+	for(auto entry = clients_.upper_bound(lastServed_); entry != clients_.end(); ++entry) {
+		order.push_back(entry->second.get());
+	}
+	for(auto entry = clients_.begin(); (entry != clients_.end()) && (entry->first <= lastServed_); ++entry) {
+		order.push_back(entry->second.get());
+	}
+
+	const auto now = std::chrono::steady_clock::now();
+	bool throttled = false;
+	bool progress = true;
+	while(progress && (inFlight_ < MAX_IN_FLIGHT)) {
+		progress = false;
+		for(Client *client: order) {
+			if(client->requests.empty() || (inFlight_ >= MAX_IN_FLIGHT)) {
+				continue;
+			}
+
+			// Each line would reach the console as a command of its own; refused in turn, to keep responses in order
+			if(client->requests.front().second.find_first_of("\r\n") != std::string::npos) {
+				if(client->outstanding == 0) {
+					send(*client, client->requests.front().first, TYPE_RESPONSE, "Command must be a single line");
+					updateInterest(*client);
+					client->requests.pop_front();
+					progress = true;
+				}
+				continue;
+			}
+
+			const std::chrono::duration<double> elapsed = now - client->refilled;
+			client->tokens = std::min(rateLimit_, client->tokens + elapsed.count() * rateLimit_);
+			client->refilled = now;
+			if(client->tokens < 1) {
+				throttled = true;
+				continue;
+			}
+
+			if(beforeCommand_) {
+				beforeCommand_();
+			}
+			const uint64_t clientId = client->id;
+			const int32_t requestId = client->requests.front().first;
+			const bool queued = executor_.execute(client->requests.front().second, [this, clientId, requestId](
+						bool written, const std::vector<std::string> &output) {
+				onResponse(clientId, requestId, written, output);
+			});
+			if(!queued) {
+				// The executor is busy with D-Bus callers too; try again shortly
+				throttled = true;
+				progress = false;
+				break;
+			}
+
+			client->requests.pop_front();
+			client->tokens -= 1;
+			++client->outstanding;
+			++inFlight_;
+			lastServed_ = clientId;
+			progress = true;
+		}
+	}
+
+	if(throttled && !dispatchSource_.connected()) {
+		dispatchSource_ = Glib::signal_timeout().connect(sigc::mem_fun(*this, &RconServer::onDispatchTimer),
+				THROTTLE_INTERVAL);
+	}
+}
+
+bool RconServer::onDispatchTimer() {
+
+	dispatchSource_.disconnect();
+	dispatch();
+	return false;
+}
+
+void RconServer::onResponse(uint64_t clientId, int32_t requestId, bool written,
+		const std::vector<std::string> &output) {
+
+	--inFlight_;
+	auto entry = clients_.find(clientId);
+	if(entry != clients_.end()) {
+		Client &client = *entry->second;
+		--client.outstanding;
+
+		std::string body;
+		if(!written) {
+			body = "Console command queue is full";
+		}
+		for(const auto &line: output) {
+			body += (body.empty() ? "" : "\n") + stripLogPrefix(line);
+		}
+
+		// Long responses are split across packets, as the server itself does
+		size_t offset = 0;
+		do {
+			send(client, requestId, TYPE_RESPONSE, body.substr(offset, MAX_BODY));
+			offset += MAX_BODY;
+		} while(offset < body.size());
+		updateInterest(client);
+	}
+	dispatch();
+}
+
+void RconServer::send(Client &client, int32_t requestId, int32_t type, const std::string &body) {
+
+	writeInt32(client.output, body.size() + PACKET_OVERHEAD);
+	writeInt32(client.output, requestId);
+	writeInt32(client.output, type);
+	client.output += body;
+	client.output.append(2, '\0');
+	flush(client);
+}
+
+void RconServer::flush(Client &client) {
+
+	while(!client.output.empty()) {
+		const ssize_t count = ::send(client.fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+		if(count < 0) {
+			// Errors other than a full socket surface as EPOLLERR or EPOLLHUP, and disconnect the client there
+			return;
+		}
+		client.output.erase(0, count);
+	}
+}
+
+void RconServer::updateInterest(Client &client) {
+
+	const uint32_t events = ((client.output.size() <= MAX_UNSENT) ? uint32_t{EPOLLIN} : 0)
+		| (client.output.empty() ? 0 : uint32_t{EPOLLOUT});
+	if(events != client.events) {
+		epoll_event event{events, {}};
+		event.data.u64 = client.id;
+		epoll_ctl(epollFd_, EPOLL_CTL_MOD, client.fd, &event);
+		client.events = events;
+	}
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glibmm.h>
+
+#include "CommandExecutor.h"
+
+namespace minecraftd {
+
+	/**
+	 * Serves the Source RCON protocol spoken by Minecraft admin tools, on a Unix socket and/or a TCP port bound to
+	 * localhost, so that the server's own one-thread-per-client RCON listener need not be enabled.
+	 *
+	 * Connections are multiplexed by an epoll set watched from the GLib main loop. Each client may pipeline requests;
+	 * they are answered in order, with the request IDs they were sent with. Commands reach the console through the
+	 * same CommandExecutor as ExecuteCommand on D-Bus, fed from the clients in turn so that a client with a deep
+	 * pipeline cannot starve the others, and each client is held to a rate limit. Commands are run one at a time, so
+	 * share the executor's throughput (see CommandExecutor), and a command spanning several lines is refused.
+	 */
+	class RconServer {
+		public:
+			/** Longest request body accepted, and longest response body sent in a single packet. */
+			static const size_t MAX_BODY = 4096;
+			/** Requests a client may have outstanding before it is disconnected. */
+			static const size_t MAX_PIPELINED = 64;
+			/**
+			 * Commands handed to the executor at once, across all clients. The executor runs one command at a time, so
+			 * handing it more would not run them any sooner; it would only move them from the round robin across
+			 * clients to the executor's own queue, ahead of D-Bus callers and of other clients' later commands.
+			 */
+			static const size_t MAX_IN_FLIGHT = 1;
+
+			/**
+			 * Listens on socketPath and on port on the loopback interface, either of which may be empty or zero.
+			 * Clients must log in with password; over the Unix socket, whose access is governed by its permissions,
+			 * any password is accepted if password is empty. The TCP port is not opened without a password. Each client
+			 * may run rateLimit commands per second. beforeCommand, if set, is called before each command is handed to
+			 * the executor.
+			 */
+			RconServer(CommandExecutor &executor, const std::string &socketPath, unsigned int port,
+					const std::string &password, unsigned int rateLimit, const std::function<void()> &beforeCommand);
+			RconServer(const RconServer&) = delete;
+			~RconServer();
+
+		private:
+			struct Client;
+
+			void accept(int listenFd, bool local);
+			void disconnect(Client &client);
+			/** Hands commands to the executor, taking one from each client in turn. */
+			void dispatch();
+			/** Writes as much of the client's pending output as the socket will take. */
+			void flush(Client &client);
+			bool onDispatchTimer();
+			bool onEvents(Glib::IOCondition condition);
+			/** Reads and handles the client's requests; returns false if the client has been disconnected. */
+			bool onReadable(Client &client);
+			void onResponse(uint64_t clientId, int32_t requestId, bool written, const std::vector<std::string> &output);
+			void send(Client &client, int32_t requestId, int32_t type, const std::string &body);
+			void updateInterest(Client &client);
+
+			const std::function<void()> beforeCommand_;
+			std::map<uint64_t, std::unique_ptr<Client>> clients_;
+			sigc::connection dispatchSource_;
+			int epollFd_;
+			CommandExecutor &executor_;
+			sigc::connection eventSource_;
+			size_t inFlight_;
+			/** Client served last by dispatch(), where the next round starts from. */
+			uint64_t lastServed_;
+			/** Listening sockets, and whether each is the Unix socket. */
+			std::vector<std::pair<int, bool>> listeners_;
+			uint64_t nextId_;
+			const std::string password_;
+			const double rateLimit_;
+			const std::string socketPath_;
+	};
+}
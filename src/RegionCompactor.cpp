@@ -0,0 +1,521 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "RegionCompactor.h"
+#include "parallel.h"
+
+using namespace minecraftd;
+
+namespace {
+	const size_t SECTOR_SIZE = 4096;
+	const size_t HEADER_SIZE = 2 * SECTOR_SIZE;
+	const unsigned int CHUNKS_PER_REGION = 1024;
+	const unsigned int MAX_CHUNK_SECTORS = 255;
+
+	const unsigned char COMPRESSION_GZIP = 1;
+	const unsigned char COMPRESSION_ZLIB = 2;
+	const unsigned char COMPRESSION_NONE = 3;
+	/** Set in the compression type of chunks too large for the region file, which are stored in a .mcc file. */
+	const unsigned char COMPRESSION_EXTERNAL = 0x80;
+
+	const unsigned char TAG_END = 0;
+	const unsigned char TAG_LONG = 4;
+	const unsigned char TAG_COMPOUND = 10;
+
+	/** A chunk's entry in the region file: its compression type followed by its (compressed) data. */
+	struct Chunk {
+		const unsigned char *data;
+		uint32_t length;
+		uint32_t timestamp;
+	};
+
+	uint32_t readBigEndian(const unsigned char *data) {
+
+		return (uint32_t{data[0]} << 24) | (uint32_t{data[1]} << 16) | (uint32_t{data[2]} << 8) | data[3];
+	}
+
+	void writeBigEndian(unsigned char *data, uint32_t value) {
+
+		data[0] = value >> 24;
+		data[1] = value >> 16;
+		data[2] = value >> 8;
+		data[3] = value;
+	}
+
+	/** Parses the chunk table of a region file, returning false (and setting error) if it is malformed. */
+	bool parseRegion(const unsigned char *data, size_t size, std::vector<Chunk> &chunks, std::string &error) {
+
+		if(size < HEADER_SIZE) {
+			error = "file is shorter than the region header";
+			return false;
+		}
+
+		chunks.assign(CHUNKS_PER_REGION, Chunk{nullptr, 0, 0});
+		for(unsigned int i = 0; i < CHUNKS_PER_REGION; ++i) {
+			const uint32_t location = readBigEndian(data + 4 * i);
+			if(location == 0) {
+				continue;
+			}
+
+			const size_t offset = size_t{location >> 8} * SECTOR_SIZE;
+			const size_t sectors = location & 0xFF;
+			if((offset < HEADER_SIZE) || (offset + 5 > size)) {
+				error = "chunk " + std::to_string(i) + " lies outside the file";
+				return false;
+			}
+
+			const uint32_t length = readBigEndian(data + offset);
+			if((length == 0) || (length + 4 > sectors * SECTOR_SIZE) || (offset + 4 + length > size)) {
+				error = "chunk " + std::to_string(i) + " has an invalid length";
+				return false;
+			}
+			chunks[i] = Chunk{data + offset + 4, length, readBigEndian(data + SECTOR_SIZE + 4 * i)};
+		}
+		return true;
+	}
+
+	/** Decompresses a chunk's NBT data, returning false if it is stored externally or is corrupt. */
+	bool decompressChunk(const Chunk &chunk, std::string &nbt) {
+
+		const unsigned char type = chunk.data[0];
+		if(type == COMPRESSION_NONE) {
+			nbt.assign(reinterpret_cast<const char*>(chunk.data + 1), chunk.length - 1);
+			return true;
+		} else if((type != COMPRESSION_GZIP) && (type != COMPRESSION_ZLIB)) {
+			return false;
+		}
+
+		z_stream stream;
+		std::memset(&stream, 0, sizeof(stream));
+		// Automatically detect a gzip or zlib header
+		if(inflateInit2(&stream, MAX_WBITS + 32) != Z_OK) {
+			return false;
+		}
+		stream.next_in = const_cast<Bytef*>(chunk.data + 1);
+		stream.avail_in = chunk.length - 1;
+
+		nbt.resize(std::max<size_t>(4 * chunk.length, 65536));
+		int rc;
+		do {
+			if(stream.total_out == nbt.size()) {
+				nbt.resize(2 * nbt.size());
+			}
+			stream.next_out = reinterpret_cast<Bytef*>(&nbt[stream.total_out]);
+			stream.avail_out = nbt.size() - stream.total_out;
+			rc = inflate(&stream, Z_NO_FLUSH);
+		} while(rc == Z_OK);
+		nbt.resize(stream.total_out);
+		inflateEnd(&stream);
+		return rc == Z_STREAM_END;
+	}
+
+	bool compressChunk(const std::string &nbt, std::string &compressed) {
+
+		uLongf length = compressBound(nbt.size());
+		compressed.resize(length + 1);
+		compressed[0] = COMPRESSION_ZLIB;
+		if(compress2(reinterpret_cast<Bytef*>(&compressed[1]), &length, reinterpret_cast<const Bytef*>(nbt.data()),
+					nbt.size(), Z_BEST_COMPRESSION) != Z_OK) {
+			return false;
+		}
+		compressed.resize(length + 1);
+		return true;
+	}
+
+	/** Minimal NBT reader, sufficient to find a chunk's InhabitedTime. */
+	class NbtReader {
+		public:
+			NbtReader(const std::string &nbt) : data_{reinterpret_cast<const unsigned char*>(nbt.data())},
+				end_{data_ + nbt.size()} {
+			}
+
+			/**
+			 * Returns the chunk's InhabitedTime, found either at the root (current chunk format) or beneath the Level
+			 * compound (chunks written before 1.18), or -1 if it cannot be found.
+			 */
+			long long inhabitedTime() {
+
+				std::string name;
+				if((readByte() != TAG_COMPOUND) || !readName(name)) {
+					return -1;
+				}
+				return findInhabitedTime(0);
+			}
+
+		private:
+			long long findInhabitedTime(int depth) {
+
+				for(;;) {
+					const int type = readByte();
+					std::string name;
+					if((type <= TAG_END) || !readName(name)) {
+						return -1;
+					}
+
+					if((type == TAG_LONG) && (name == "InhabitedTime")) {
+						return available(8) ? static_cast<long long>((uint64_t{readBigEndian(data_)} << 32)
+								| readBigEndian(data_ + 4)) : -1;
+					} else if((type == TAG_COMPOUND) && (name == "Level") && (depth == 0)) {
+						return findInhabitedTime(depth + 1);
+					} else if(!skip(type, 0)) {
+						return -1;
+					}
+				}
+			}
+
+			bool available(size_t count) const { return static_cast<size_t>(end_ - data_) >= count; }
+
+			int readByte() { return available(1) ? *data_++ : -1; }
+
+			bool readInt(int32_t &value) {
+
+				if(!available(4)) {
+					return false;
+				}
+				value = static_cast<int32_t>(readBigEndian(data_));
+				data_ += 4;
+				return true;
+			}
+
+			bool readName(std::string &name) {
+
+				if(!available(2)) {
+					return false;
+				}
+				const size_t length = (size_t{data_[0]} << 8) | data_[1];
+				data_ += 2;
+				if(!available(length)) {
+					return false;
+				}
+				name.assign(reinterpret_cast<const char*>(data_), length);
+				data_ += length;
+				return true;
+			}
+
+			bool skipBytes(size_t count) {
+
+				if(!available(count)) {
+					return false;
+				}
+				data_ += count;
+				return true;
+			}
+
+			bool skip(int type, int depth) {
+
+				// Guard against maliciously deep nesting
+				if(depth > 512) {
+					return false;
+				}
+
+				int32_t count;
+				std::string name;
+				switch(type) {
+					case 1: return skipBytes(1);
+					case 2: return skipBytes(2);
+					case 3: return skipBytes(4);
+					case 4: return skipBytes(8);
+					case 5: return skipBytes(4);
+					case 6: return skipBytes(8);
+					case 7: return readInt(count) && (count >= 0) && skipBytes(count);
+					case 8: return readName(name);
+					case 9: {
+						const int elementType = readByte();
+						if((elementType < 0) || !readInt(count)) {
+							return false;
+						}
+						for(int32_t i = 0; i < count; ++i) {
+							if(!skip(elementType, depth + 1)) {
+								return false;
+							}
+						}
+						return true;
+					}
+					case 10:
+						for(;;) {
+							const int memberType = readByte();
+							if(memberType == TAG_END) {
+								return true;
+							} else if((memberType < 0) || !readName(name) || !skip(memberType, depth + 1)) {
+								return false;
+							}
+						}
+					case 11: return readInt(count) && (count >= 0) && skipBytes(4 * size_t(count));
+					case 12: return readInt(count) && (count >= 0) && skipBytes(8 * size_t(count));
+					default: return false;
+				}
+			}
+
+			const unsigned char *data_;
+			const unsigned char *const end_;
+	};
+
+	void writeFile(const std::string &path, const std::vector<unsigned char> &contents, mode_t mode) {
+
+		const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+		if(fd == -1) {
+			throw std::system_error(errno, std::system_category(), path);
+		}
+		// Not subject to the umask, unlike the mode given to open
+		fchmod(fd, mode);
+
+		size_t written = 0;
+		while(written < contents.size()) {
+			ssize_t count = write(fd, contents.data() + written, contents.size() - written);
+			if((count == -1) && (errno != EINTR)) {
+				const int error = errno;
+				close(fd);
+				throw std::system_error(error, std::system_category(), path);
+			}
+			written += (count > 0) ? count : 0;
+		}
+
+		if((fsync(fd) != 0) || (close(fd) != 0)) {
+			throw std::system_error(errno, std::system_category(), path);
+		}
+	}
+
+	/**
+	 * Collects the region files beneath directory, skipping hidden directories (such as minecraftd's own backup and
+	 * class-data sharing directories). Returns false if a world in it is locked by a running server.
+	 */
+	bool findRegionFiles(const std::string &directory, std::vector<std::string> &regionFiles) {
+
+		DIR *dir = opendir(directory.c_str());
+		if(dir == nullptr) {
+			std::cerr << "Cannot read " << directory << ": " << std::strerror(errno) << std::endl;
+			return true;
+		}
+
+		bool unlocked = true;
+		std::vector<std::string> subdirectories;
+		for(dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+			const std::string name{entry->d_name};
+			const std::string path{directory + '/' + name};
+			if(name[0] == '.') {
+				continue;
+			}
+
+			struct stat entryStat;
+			if(lstat(path.c_str(), &entryStat) != 0) {
+				continue;
+			} else if(S_ISDIR(entryStat.st_mode)) {
+				subdirectories.push_back(path);
+			} else if(S_ISREG(entryStat.st_mode) && (name.size() > 4)
+					&& (name.compare(name.size() - 4, 4, ".mca") == 0)) {
+				regionFiles.push_back(path);
+			} else if(name == "session.lock") {
+				// The server holds a POSIX lock on this file for as long as the world is open
+				const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+				struct flock lock;
+				std::memset(&lock, 0, sizeof(lock));
+				lock.l_type = F_WRLCK;
+				lock.l_whence = SEEK_SET;
+				if((fd != -1) && (fcntl(fd, F_GETLK, &lock) == 0) && (lock.l_type != F_UNLCK)) {
+					std::cerr << "The world in " << directory << " is in use by process " << lock.l_pid
+						<< "; stop the server first" << std::endl;
+					unlocked = false;
+				}
+				if(fd != -1) {
+					close(fd);
+				}
+			}
+		}
+		closedir(dir);
+
+		for(const auto &subdirectory: subdirectories) {
+			unlocked = findRegionFiles(subdirectory, regionFiles) && unlocked;
+		}
+		return unlocked;
+	}
+}
+
+RegionStatistics minecraftd::compactRegionFile(const std::string &path, const CompactionOptions &options) {
+
+	RegionStatistics statistics;
+	statistics.path = path;
+
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat fileStat;
+	if((fd == -1) || (fstat(fd, &fileStat) != 0)) {
+		statistics.error = std::strerror(errno);
+		if(fd != -1) {
+			close(fd);
+		}
+		return statistics;
+	}
+
+	statistics.sizeBefore = statistics.sizeAfter = fileStat.st_size;
+	if(fileStat.st_size == 0) {
+		// Created but never written to by the server
+		close(fd);
+		return statistics;
+	}
+
+	void *mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED) {
+		statistics.error = std::strerror(errno);
+		return statistics;
+	}
+	madvise(mapping, fileStat.st_size, MADV_SEQUENTIAL);
+	const unsigned char *data = static_cast<const unsigned char*>(mapping);
+
+	std::vector<Chunk> chunks;
+	if(!parseRegion(data, fileStat.st_size, chunks, statistics.error)) {
+		munmap(mapping, fileStat.st_size);
+		return statistics;
+	}
+
+	std::vector<unsigned char> compacted(HEADER_SIZE);
+	std::vector<std::string> recompressed(CHUNKS_PER_REGION);
+	for(unsigned int i = 0; i < CHUNKS_PER_REGION; ++i) {
+		const Chunk &chunk = chunks[i];
+		if(chunk.data == nullptr) {
+			continue;
+		}
+		++statistics.chunks;
+
+		std::string nbt;
+		const bool decompressed = !(chunk.data[0] & COMPRESSION_EXTERNAL) && (options.dropUninhabited
+				|| options.recompress) && decompressChunk(chunk, nbt);
+		if(decompressed && options.dropUninhabited && (NbtReader{nbt}.inhabitedTime() == 0)) {
+			++statistics.droppedChunks;
+			continue;
+		}
+
+		const unsigned char *payload = chunk.data;
+		uint32_t length = chunk.length;
+		if(decompressed && options.recompress && compressChunk(nbt, recompressed[i])
+				&& (recompressed[i].size() < length)) {
+			payload = reinterpret_cast<const unsigned char*>(recompressed[i].data());
+			length = recompressed[i].size();
+			++statistics.recompressedChunks;
+		} else {
+			recompressed[i].clear();
+		}
+
+		const size_t offset = compacted.size();
+		const size_t sectors = (length + 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+		compacted.resize(offset + sectors * SECTOR_SIZE);
+		writeBigEndian(&compacted[offset], length);
+		std::memcpy(&compacted[offset + 4], payload, length);
+		writeBigEndian(&compacted[4 * i], ((offset / SECTOR_SIZE) << 8) | std::min<size_t>(sectors, MAX_CHUNK_SECTORS));
+		writeBigEndian(&compacted[SECTOR_SIZE + 4 * i], chunk.timestamp);
+	}
+
+	// Verify the rewrite before it replaces anything: every chunk kept must read back exactly as it was written
+	std::vector<Chunk> verified;
+	std::string error;
+	bool valid = parseRegion(compacted.data(), compacted.size(), verified, error);
+	for(unsigned int i = 0; valid && (i < CHUNKS_PER_REGION); ++i) {
+		if(verified[i].data == nullptr) {
+			continue;
+		} else if(recompressed[i].empty()) {
+			valid = (verified[i].length == chunks[i].length)
+				&& (std::memcmp(verified[i].data, chunks[i].data, chunks[i].length) == 0);
+		} else {
+			std::string before, after;
+			valid = decompressChunk(chunks[i], before) && decompressChunk(verified[i], after) && (before == after);
+		}
+	}
+	munmap(mapping, fileStat.st_size);
+
+	if(!valid) {
+		statistics.error = "rewrite failed verification" + (error.empty() ? std::string{} : ": " + error);
+		return statistics;
+	} else if((compacted.size() >= statistics.sizeBefore) && (statistics.droppedChunks == 0)
+			&& (statistics.recompressedChunks == 0)) {
+		return statistics;
+	}
+
+	const std::string temporaryPath{path + ".compact"};
+	try {
+		writeFile(temporaryPath, compacted, fileStat.st_mode & 07777);
+	} catch(const std::system_error &e) {
+		std::remove(temporaryPath.c_str());
+		statistics.error = e.what();
+		return statistics;
+	}
+	if(std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+		statistics.error = std::strerror(errno);
+		std::remove(temporaryPath.c_str());
+		return statistics;
+	}
+
+	statistics.sizeAfter = compacted.size();
+	statistics.rewritten = true;
+	return statistics;
+}
+
+int minecraftd::compactWorlds(const std::vector<std::string> &serverDirectories, const CompactionOptions &options) {
+
+	std::vector<std::string> regionFiles;
+	bool unlocked = true;
+	for(const auto &serverDirectory: serverDirectories) {
+		unlocked = findRegionFiles(serverDirectory, regionFiles) && unlocked;
+	}
+	if(!unlocked) {
+		return 1;
+	}
+
+	std::vector<RegionStatistics> results(regionFiles.size());
+	parallelFor(regionFiles.size(), [&](size_t i) {
+		results[i] = compactRegionFile(regionFiles[i], options);
+	});
+
+	size_t sizeBefore = 0, sizeAfter = 0;
+	unsigned int rewritten = 0, failed = 0;
+	for(const auto &result: results) {
+		std::cout << result.path << ": ";
+		if(!result.error.empty()) {
+			std::cout << "left untouched (" << result.error << ')';
+			++failed;
+		} else {
+			std::cout << result.chunks << " chunks";
+			if(result.droppedChunks > 0) {
+				std::cout << ", " << result.droppedChunks << " uninhabited dropped";
+			}
+			if(result.recompressedChunks > 0) {
+				std::cout << ", " << result.recompressedChunks << " recompressed";
+			}
+			if(result.rewritten) {
+				std::cout << ", " << result.sizeBefore << " -> " << result.sizeAfter << " bytes";
+				++rewritten;
+			} else {
+				std::cout << ", already compact";
+			}
+		}
+		std::cout << std::endl;
+		sizeBefore += result.sizeBefore;
+		sizeAfter += result.sizeAfter;
+	}
+
+	std::cout << results.size() << " region files, " << rewritten << " rewritten, " << failed << " left untouched; "
+		<< sizeBefore << " -> " << sizeAfter << " bytes" << std::endl;
+	return (failed == 0) ? 0 : 1;
+}
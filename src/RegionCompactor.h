@@ -0,0 +1,52 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace minecraftd {
+
+	struct CompactionOptions {
+		/** Recompresses every chunk with zlib at the highest level, keeping the result only where it is smaller. */
+		bool recompress = false;
+		/** Drops chunks that no player has ever spent time in (InhabitedTime of zero); the server regenerates them. */
+		bool dropUninhabited = false;
+	};
+
+	struct RegionStatistics {
+		std::string path;
+		unsigned int chunks = 0;
+		unsigned int droppedChunks = 0;
+		unsigned int recompressedChunks = 0;
+		size_t sizeBefore = 0;
+		size_t sizeAfter = 0;
+		bool rewritten = false;
+		/** Reason the file was left untouched, if it could not be compacted. */
+		std::string error;
+	};
+
+	/**
+	 * Rewrites an Anvil region (.mca) file with its chunks packed end to end, dropping the unused sectors left behind
+	 * as chunks grow and move. The new file is verified before it replaces the old one, and the old one is left
+	 * untouched if nothing would be gained.
+	 */
+	RegionStatistics compactRegionFile(const std::string &path, const CompactionOptions &options);
+
+	/**
+	 * Compacts every region file beneath the given server directories in parallel, printing statistics for each.
+	 * Refuses to touch a world that a running server has locked. Returns the process exit status.
+	 */
+	int compactWorlds(const std::vector<std::string> &serverDirectories, const CompactionOptions &options);
+}
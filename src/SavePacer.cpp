@@ -0,0 +1,285 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "SavePacer.h"
+
+#ifndef SYS_cachestat
+#define SYS_cachestat 451
+#endif
+
+using namespace minecraftd;
+
+namespace {
+	const int IOPRIO_CLASS_SHIFT = 13;
+	const int IOPRIO_WHO_PROCESS = 1;
+
+	/** Directories of a dimension holding region files: blocks, then entities and points of interest (1.14+). */
+	const char *const REGION_DIRECTORIES[] = {"region", "entities", "poi"};
+
+	/** The arguments and result of cachestat(2), as declared in linux/mman.h from Linux 6.5. */
+	struct CacheStatRange {
+		uint64_t offset;
+		uint64_t length;
+	};
+
+	struct CacheStat {
+		uint64_t cache;
+		uint64_t dirty;
+		uint64_t writeback;
+		uint64_t evicted;
+		uint64_t recentlyEvicted;
+	};
+
+	/** Returns the bytes of fd's page cache that are dirty and being written back, or zeroes if it can not tell. */
+	std::pair<uint64_t, uint64_t> dirtyBytes(int fd) {
+
+		static const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+		CacheStatRange range{0, 0};
+		CacheStat stat;
+		if(syscall(SYS_cachestat, fd, &range, &stat, 0) != 0) {
+			return {0, 0};
+		}
+		return {stat.dirty * pageSize, stat.writeback * pageSize};
+	}
+
+	/** Returns the level-name from server.properties, or the server's default if it is not set. */
+	std::string readLevelName(const std::string &serverDirectory) {
+
+		std::ifstream in{serverDirectory + "/server.properties"};
+		std::string line;
+		while(std::getline(in, line)) {
+			if(line.compare(0, 11, "level-name=") == 0) {
+				return line.substr(11);
+			}
+		}
+		return "world";
+	}
+
+	/** Collects the region directories of every dimension beneath directory, skipping hidden directories. */
+	void findRegionDirectories(const std::string &directory, std::vector<std::string> &regionDirectories) {
+
+		DIR *dir = opendir(directory.c_str());
+		if(dir == nullptr) {
+			return;
+		}
+
+		std::vector<std::string> subdirectories;
+		for(dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+			const std::string name{entry->d_name};
+			if((name[0] != '.') && ((entry->d_type == DT_DIR) || (entry->d_type == DT_UNKNOWN))) {
+				subdirectories.push_back(directory + '/' + name);
+				if(std::find(std::begin(REGION_DIRECTORIES), std::end(REGION_DIRECTORIES), name)
+						!= std::end(REGION_DIRECTORIES)) {
+					regionDirectories.push_back(subdirectories.back());
+				}
+			}
+		}
+		closedir(dir);
+
+		for(const auto &subdirectory: subdirectories) {
+			findRegionDirectories(subdirectory, regionDirectories);
+		}
+	}
+}
+
+const size_t SavePacer::MAX_HISTORY;
+const std::chrono::seconds SavePacer::QUIET_TIME{2};
+const std::chrono::seconds SavePacer::RESCAN_INTERVAL{30};
+
+SavePacer::SavePacer(const std::string &serverDirectory, const SaveConfiguration &configuration)
+	: configuration_(configuration), current_{}, inotifyFd_{inotify_init1(IN_CLOEXEC | IN_NONBLOCK)}, saving_{false},
+	serverDirectory_{serverDirectory}, stopFd_{eventfd(0, EFD_CLOEXEC)} {
+
+	if((inotifyFd_ == -1) || (stopFd_ == -1)) {
+		const int error = errno;
+		close(inotifyFd_);
+		close(stopFd_);
+		throw std::system_error(error, std::system_category());
+	}
+	thread_ = std::thread{&SavePacer::run, this};
+}
+
+SavePacer::~SavePacer() {
+
+	const uint64_t one = 1;
+	if(write(stopFd_, &one, sizeof(one)) == sizeof(one)) {
+		thread_.join();
+	} else {
+		thread_.detach();
+	}
+	close(stopFd_);
+	close(inotifyFd_);
+}
+
+bool SavePacer::current(Save &save) const {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	save = current_;
+	return saving_;
+}
+
+std::deque<SavePacer::Save> SavePacer::history() const {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	return history_;
+}
+
+void SavePacer::run() {
+
+	// Writeback started by sync_file_range is issued from, and so prioritised as, the calling thread
+	if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+				(configuration_.ioClass << IOPRIO_CLASS_SHIFT) | configuration_.ioPriority) != 0) {
+		std::cerr << "Failed to set the I/O priority of world saves: " << std::strerror(errno) << std::endl;
+	}
+
+	watchRegionDirectories();
+	auto lastScan = std::chrono::steady_clock::now();
+	auto nextFlush = lastScan + configuration_.flushInterval;
+	pollfd pollFds[2]{{stopFd_, POLLIN, 0}, {inotifyFd_, POLLIN, 0}};
+	alignas(inotify_event) char buffer[16 * 1024];
+	for(;;) {
+		const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(nextFlush
+				- std::chrono::steady_clock::now());
+		if((poll(pollFds, 2, std::max<int>(timeout.count(), 0)) == -1) && (errno != EINTR)) {
+			std::cerr << "Failed to wait for world saves: " << std::strerror(errno) << std::endl;
+			return;
+		} else if(pollFds[0].revents != 0) {
+			return;
+		}
+
+		for(ssize_t length; (length = read(inotifyFd_, buffer, sizeof(buffer))) > 0;) {
+			for(char *next = buffer; next < buffer + length;) {
+				const inotify_event *event = reinterpret_cast<const inotify_event*>(next);
+				next += sizeof(inotify_event) + event->len;
+				if(event->mask & IN_IGNORED) {
+					watches_.erase(event->wd);
+					continue;
+				}
+				const auto watch = watches_.find(event->wd);
+				const size_t nameLength = (event->len > 0) ? std::strlen(event->name) : 0;
+				if((watch != watches_.end()) && (nameLength > 4)
+						&& (std::strcmp(event->name + nameLength - 4, ".mca") == 0)) {
+					written_.insert(watch->second + '/' + event->name);
+				}
+			}
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		if(now >= nextFlush) {
+			flush();
+			nextFlush = std::chrono::steady_clock::now() + configuration_.flushInterval;
+		}
+		if(!saving_ && (now - lastScan >= RESCAN_INTERVAL)) {
+			watchRegionDirectories();
+			lastScan = now;
+		}
+	}
+}
+
+void SavePacer::flush() {
+
+	const auto now = std::chrono::steady_clock::now();
+	const bool wrote = !written_.empty();
+	if(wrote) {
+		if(!saving_) {
+			std::lock_guard<std::mutex> lock{mutex_};
+			current_ = Save{std::chrono::system_clock::now(), {}, 0, 0, 0, {}};
+			saveStart_ = now;
+			saving_ = true;
+		}
+	} else if(!saving_) {
+		return;
+	}
+
+	uint64_t written = 0;
+	uint64_t pending = 0;
+	std::chrono::microseconds peakLatency{0};
+	for(auto &file: files_) {
+		if(file.second != 0) {
+			written_.insert(file.first);
+		}
+	}
+	for(const auto &path: written_) {
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if(fd == -1) {
+			files_.erase(path);
+			continue;
+		}
+
+		// Waits for the increment started last time to be written back, then starts writing back this one
+		written += dirtyBytes(fd).first;
+		const auto flushStart = std::chrono::steady_clock::now();
+		if(sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE) != 0) {
+			std::cerr << "Failed to flush " << path << ": " << std::strerror(errno) << std::endl;
+		}
+		peakLatency = std::max(peakLatency, std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::steady_clock::now() - flushStart));
+		const auto dirty = dirtyBytes(fd);
+		close(fd);
+		files_[path] = dirty.first + dirty.second;
+		pending += dirty.first + dirty.second;
+	}
+
+	if(wrote || (pending != 0)) {
+		lastBusy_ = now;
+	}
+	written_.clear();
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	current_.duration = std::chrono::duration_cast<std::chrono::milliseconds>(lastBusy_ - saveStart_);
+	current_.regions = files_.size();
+	current_.bytesWritten += written;
+	current_.bytesPending = pending;
+	current_.peakLatency = std::max(current_.peakLatency, peakLatency);
+	if(now - lastBusy_ >= QUIET_TIME) {
+		history_.push_back(current_);
+		if(history_.size() > MAX_HISTORY) {
+			history_.pop_front();
+		}
+		files_.clear();
+		saving_ = false;
+	}
+}
+
+void SavePacer::watchRegionDirectories() {
+
+	if(levelDirectory_.empty()) {
+		levelDirectory_ = serverDirectory_ + '/' + readLevelName(serverDirectory_);
+	}
+
+	std::vector<std::string> regionDirectories;
+	findRegionDirectories(levelDirectory_, regionDirectories);
+	for(const auto &directory: regionDirectories) {
+		const int wd = inotify_add_watch(inotifyFd_, directory.c_str(), IN_MODIFY);
+		if(wd == -1) {
+			std::cerr << "Failed to watch " << directory << ": " << std::strerror(errno) << std::endl;
+		} else {
+			watches_[wd] = directory;
+		}
+	}
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "instance.h"
+
+namespace minecraftd {
+
+	/**
+	 * Paces the writeback of world saves, so that a save does not leave gigabytes of dirty pages to be written at once,
+	 * stalling the tick thread's own I/O behind them for seconds.
+	 *
+	 * The region files of the world are watched with inotify. Every flush interval, writeback of the files written
+	 * since the last is started with sync_file_range, after waiting for that started the interval before to finish, so
+	 * that the world is written in steady increments no larger than the disk keeps up with. The flushes are issued at
+	 * the save I/O priority, which the server's own save threads are also given (see createJvmMainArguments).
+	 *
+	 * A save is the span from the first region file being written after a quiet period to the last of its data having
+	 * been written back; SaveAll and the server's autosaves alike are recorded. Progress is measured with cachestat(2)
+	 * where the kernel supports it (Linux 6.5 and later); on older kernels, bytes are reported as zero.
+	 */
+	class SavePacer {
+		public:
+			/** Progress of a save in progress, or the outcome of a finished one. */
+			struct Save {
+
+				std::chrono::system_clock::time_point start;
+				std::chrono::milliseconds duration;
+				/** Region files written. */
+				unsigned int regions;
+				/** Bytes written back through the flushes. */
+				uint64_t bytesWritten;
+				/** Bytes still dirty or being written back, in the files written. */
+				uint64_t bytesPending;
+				/** Longest a flush waited for the previous increment of a file to be written back. */
+				std::chrono::microseconds peakLatency;
+			};
+
+			static const size_t MAX_HISTORY = 16;
+			/** A save ends once no region file has been written, nor had data to write back, for this long. */
+			static const std::chrono::seconds QUIET_TIME;
+			/** Region directories are looked for again this often, outside saves, to pick up new dimensions. */
+			static const std::chrono::seconds RESCAN_INTERVAL;
+
+			/** Starts pacing the saves of the world named in server.properties beneath serverDirectory. */
+			SavePacer(const std::string &serverDirectory, const SaveConfiguration &configuration);
+			SavePacer(const SavePacer&) = delete;
+			~SavePacer();
+
+			/** Returns the save in progress, if there is one. */
+			bool current(Save &save) const;
+			/** Returns the last MAX_HISTORY saves, oldest first. */
+			std::deque<Save> history() const;
+
+		private:
+			void run();
+			/** Flushes the files written since the last call, updating the save in progress. */
+			void flush();
+			/** Watches every region directory of the world that is not watched yet. */
+			void watchRegionDirectories();
+
+			const SaveConfiguration configuration_;
+			Save current_;
+			/** Files written in the save in progress, with the bytes of each still to be written back. */
+			std::map<std::string, uint64_t> files_;
+			std::deque<Save> history_;
+			int inotifyFd_;
+			/** When a file was last written, or last found to have data to be written back. */
+			std::chrono::steady_clock::time_point lastBusy_;
+			std::string levelDirectory_;
+			mutable std::mutex mutex_;
+			std::chrono::steady_clock::time_point saveStart_;
+			bool saving_;
+			const std::string serverDirectory_;
+			int stopFd_;
+			std::thread thread_;
+			/** Watched region directories, by watch descriptor. */
+			std::map<int, std::string> watches_;
+			/** Files written since the last flush. */
+			std::set<std::string> written_;
+	};
+}
@@ -0,0 +1,273 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glibmm.h>
+
+#include "SharedArchive.h"
+
+extern char **environ;
+
+using namespace minecraftd;
+
+namespace {
+	/** Priority at which the background archive dump runs, so that it does not compete with the server. */
+	const int DUMP_NICE_VALUE = 10;
+	/** Heap the archive dump runs with, whatever heap the server is given; it only loads the listed classes. */
+	const char *const DUMP_HEAP_ARGUMENT = "-Xmx512M";
+	/** Smallest maximum heap for which the JVM turns compressed oops off, which the archive has to match. */
+	const unsigned long long COMPRESSED_OOPS_MAX_HEAP = 32ULL << 30;
+
+	/** Parses a size as -Xmx takes it (a number with an optional k, m, g or t suffix); returns 0 if invalid. */
+	unsigned long long parseSize(const std::string &value) {
+
+		char *end;
+		const unsigned long long size = std::strtoull(value.c_str(), &end, 10);
+		switch(*end) {
+			case 't': case 'T': return size << 40;
+			case 'g': case 'G': return size << 30;
+			case 'm': case 'M': return size << 20;
+			case 'k': case 'K': return size << 10;
+			case '\0': return size;
+			default: return 0;
+		}
+	}
+
+	/**
+	 * Returns those of the server's JVM arguments that decide whether an archive can be mapped: the garbage collector,
+	 * the options unlocking it, and the use of compressed oops and class pointers, turned off explicitly if the
+	 * server's heap is too large for them. Heap sizes, pre-touching and large pages are left out, so that the dump
+	 * neither depends on them nor commits a second server-sized heap alongside the server.
+	 */
+	std::list<std::string> compatibilityArguments(const std::list<std::string> &jvmArguments) {
+
+		std::list<std::string> compatibility;
+		unsigned long long maxHeap = 0;
+		bool explicitCompressedOops = false;
+		for(const auto &argument: jvmArguments) {
+			if(argument.compare(0, 4, "-Xmx") == 0) {
+				maxHeap = parseSize(argument.substr(4));
+				continue;
+			} else if(argument.compare(0, 4, "-XX:") != 0) {
+				continue;
+			}
+
+			std::string name = argument.substr(4);
+			if(!name.empty() && ((name[0] == '+') || (name[0] == '-'))) {
+				name.erase(0, 1);
+			}
+			const std::string value = (name.find('=') != std::string::npos) ? name.substr(name.find('=') + 1) : "";
+			name = name.substr(0, name.find('='));
+			if(name == "MaxHeapSize") {
+				maxHeap = parseSize(value);
+			} else if(((name.size() > 5) && (name.compare(0, 3, "Use") == 0)
+						&& (name.compare(name.size() - 2, 2, "GC") == 0))
+					|| (name == "UnlockExperimentalVMOptions") || (name == "UnlockDiagnosticVMOptions")
+					|| (name == "UseCompressedOops") || (name == "UseCompressedClassPointers")
+					|| (name == "ObjectAlignmentInBytes")) {
+				compatibility.push_back(argument);
+				explicitCompressedOops = explicitCompressedOops || (name == "UseCompressedOops");
+			}
+		}
+		if(!explicitCompressedOops && (maxHeap >= COMPRESSED_OOPS_MAX_HEAP)) {
+			compatibility.push_back("-XX:-UseCompressedOops");
+		}
+		return compatibility;
+	}
+
+	/**
+	 * Locates the java launcher belonging to the JVM library, by walking up from the library's directory (e.g.
+	 * lib/server/libjvm.so) to the Java home directory. Returns an empty string unless the Java home reports a version
+	 * supporting application class-data sharing (Java 10 or later).
+	 */
+	std::string findJavaLauncher(const std::string &jvmLibPath) {
+
+		std::string javaHome = Glib::path_get_dirname(jvmLibPath);
+		for(int i = 0; i < 4; ++i) {
+			javaHome = Glib::path_get_dirname(javaHome);
+			if(Glib::file_test(Glib::build_filename(javaHome, "bin", "java"), Glib::FILE_TEST_IS_EXECUTABLE)) {
+				break;
+			}
+		}
+
+		std::ifstream release{Glib::build_filename(javaHome, "release")};
+		for(std::string line; std::getline(release, line);) {
+			const std::string prefix{"JAVA_VERSION=\""};
+			if(line.compare(0, prefix.size(), prefix) != 0) {
+				continue;
+			}
+
+			int major = std::atoi(line.c_str() + prefix.size());
+			if(major == 1) {
+				// Legacy 1.x version numbering (Java 8 and earlier)
+				major = std::atoi(line.c_str() + prefix.size() + 2);
+			}
+			if(major >= 10) {
+				return Glib::build_filename(javaHome, "bin", "java");
+			}
+			break;
+		}
+		return std::string{};
+	}
+
+	long readMilliseconds(const std::string &path) {
+
+		std::ifstream file{path};
+		long milliseconds = -1;
+		file >> milliseconds;
+		return file ? milliseconds : -1;
+	}
+}
+
+SharedArchive::SharedArchive(const std::string &directory, const std::string &jvmLibPath,
+		const std::vector<std::string> &classPath, const std::string &jarHash,
+		const std::list<std::string> &jvmArguments)
+	: javaPath_{findJavaLauncher(jvmLibPath)}, jvmArguments_(compatibilityArguments(jvmArguments)), warm_{false} {
+
+	for(const auto &entry: classPath) {
+		classPath_ += (classPath_.empty() ? "" : ":") + entry;
+	}
+
+	if(javaPath_.empty()) {
+		std::cout << "Class data sharing disabled: " << jvmLibPath << " does not support it" << std::endl;
+		return;
+	}
+
+	struct stat jvmLibStat;
+	if(stat(jvmLibPath.c_str(), &jvmLibStat) != 0) {
+		throw std::system_error(errno, std::system_category());
+	}
+
+	// Options such as the garbage collector affect archive compatibility, so form part of the key
+	std::string identity{jarHash + '\n' + jvmLibPath + '\n' + std::to_string(jvmLibStat.st_size) + '\n'
+		+ std::to_string(jvmLibStat.st_mtime) + '\n'};
+	for(const auto &entry: classPath) {
+		struct stat entryStat;
+		if(stat(entry.c_str(), &entryStat) == 0) {
+			identity += entry + '\n' + std::to_string(entryStat.st_size) + '\n' + std::to_string(entryStat.st_mtime)
+				+ '\n';
+		}
+	}
+	for(const auto &argument: jvmArguments_) {
+		identity += argument + '\n';
+	}
+	key_ = Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_SHA256, identity).substr(0, 16);
+
+	if(g_mkdir_with_parents(directory.c_str(), 0755) != 0) {
+		throw std::system_error(errno, std::system_category());
+	}
+
+	const std::string prefix{Glib::build_filename(directory, "minecraftd-" + key_)};
+	archivePath_ = prefix + ".jsa";
+	classListPath_ = prefix + ".classlist";
+	timingPathPrefix_ = prefix;
+	warm_ = Glib::file_test(archivePath_, Glib::FILE_TEST_IS_REGULAR);
+}
+
+std::list<std::string> SharedArchive::jvmOptions() const {
+
+	if(!supported()) {
+		return {};
+	} else if(warm_) {
+		return {"-XX:SharedArchiveFile=" + archivePath_, "-Xshare:auto"};
+	} else if(!Glib::file_test(classListPath_, Glib::FILE_TEST_IS_REGULAR)) {
+		return {"-XX:DumpLoadedClassList=" + classListPath_};
+	}
+	return {};
+}
+
+void SharedArchive::buildInBackground() const {
+
+	if(!supported() || warm_ || !Glib::file_test(classListPath_, Glib::FILE_TEST_IS_REGULAR)) {
+		return;
+	}
+
+	const std::string temporaryPath{archivePath_ + ".tmp"};
+	std::vector<std::string> arguments{javaPath_, "-Xshare:dump", "-XX:SharedClassListFile=" + classListPath_,
+		"-XX:SharedArchiveFile=" + temporaryPath, "-cp", classPath_, DUMP_HEAP_ARGUMENT};
+	arguments.insert(arguments.end(), jvmArguments_.cbegin(), jvmArguments_.cend());
+
+	std::cout << "Building class data sharing archive " << archivePath_ << " in the background" << std::endl;
+	const std::string archivePath{archivePath_}, classListPath{classListPath_};
+	std::thread([arguments, archivePath, classListPath, temporaryPath]() {
+
+		std::vector<char*> argv;
+		for(const auto &argument: arguments) {
+			argv.push_back(const_cast<char*>(argument.c_str()));
+		}
+		argv.push_back(nullptr);
+
+		const auto start = std::chrono::steady_clock::now();
+		pid_t pid;
+		int rc = posix_spawn(&pid, argv[0], nullptr, nullptr, argv.data(), environ);
+		if(rc != 0) {
+			std::cerr << "Failed to start class data sharing archive dump: " << std::system_category().message(rc)
+				<< std::endl;
+			return;
+		}
+		setpriority(PRIO_PROCESS, pid, DUMP_NICE_VALUE);
+
+		int status;
+		while(waitpid(pid, &status, 0) == -1) {
+			if(errno != EINTR) {
+				std::cerr << "Failed to wait for class data sharing archive dump" << std::endl;
+				return;
+			}
+		}
+
+		if(!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+			std::cerr << "Class data sharing archive dump failed; it will be retried on the next start" << std::endl;
+			std::remove(temporaryPath.c_str());
+			std::remove(classListPath.c_str());
+		} else if(std::rename(temporaryPath.c_str(), archivePath.c_str()) != 0) {
+			std::cerr << "Failed to install class data sharing archive " << archivePath << std::endl;
+		} else {
+			const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+					std::chrono::steady_clock::now() - start);
+			std::cout << "Built class data sharing archive in " << elapsed.count() << " ms; it will be used from the "
+				"next start" << std::endl;
+		}
+	}).detach();
+}
+
+void SharedArchive::recordStartupTime(std::chrono::milliseconds startupTime) const {
+
+	if(!supported()) {
+		return;
+	}
+
+	const std::string thisKind{warm_ ? "warm" : "cold"}, otherKind{warm_ ? "cold" : "warm"};
+	std::ofstream timing{timingPathPrefix_ + '.' + thisKind};
+	timing << startupTime.count() << std::endl;
+
+	std::cout << "JVM " << thisKind << " start took " << startupTime.count() << " ms";
+	long other = readMilliseconds(timingPathPrefix_ + '.' + otherKind);
+	if(other >= 0) {
+		std::cout << " (last " << otherKind << " start took " << other << " ms)";
+	}
+	std::cout << std::endl;
+}
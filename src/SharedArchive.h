@@ -0,0 +1,65 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <list>
+#include <string>
+#include <vector>
+
+namespace minecraftd {
+
+	/**
+	 * Manages an application class-data sharing (AppCDS) archive for a server JAR. Archives are keyed by the JAR's
+	 * content hash, the size and modification time of the rest of the class path, the identity of the JVM library and
+	 * the JVM arguments that affect compatibility (the garbage collector and compressed oops), so that a change to any
+	 * of them results in a new archive rather than one the JVM would reject.
+	 *
+	 * A start without an archive records the classes it loads. The next start builds the archive from that list in a
+	 * background process, and starts after that map the archive with -XX:SharedArchiveFile. The dump is given only
+	 * the arguments that affect compatibility, and a small heap of its own.
+	 */
+	class SharedArchive {
+		public:
+			SharedArchive(const std::string &directory, const std::string &jvmLibPath,
+					const std::vector<std::string> &classPath, const std::string &jarHash,
+					const std::list<std::string> &jvmArguments);
+
+			/** Returns true if the JVM in use supports application class-data sharing. */
+			bool supported() const { return !javaPath_.empty(); }
+			/** Returns true if an archive exists for this JAR and JVM, and will be used. */
+			bool warm() const { return warm_; }
+
+			/** Returns the JVM options that use (or prepare) the archive. */
+			std::list<std::string> jvmOptions() const;
+
+			/**
+			 * Builds the archive from a previously recorded class list in a background process, if the archive does
+			 * not yet exist.
+			 */
+			void buildInBackground() const;
+
+			/** Logs the time taken to start the JVM, comparing it to the last start of the other kind. */
+			void recordStartupTime(std::chrono::milliseconds startupTime) const;
+
+		private:
+			std::string archivePath_;
+			std::string classListPath_;
+			std::string classPath_;
+			std::string javaPath_;
+			std::list<std::string> jvmArguments_;
+			std::string key_;
+			std::string timingPathPrefix_;
+			bool warm_;
+	};
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <iostream>
+
+#include "StartupTracker.h"
+
+using namespace minecraftd;
+
+namespace {
+	const char *const PHASES[] = {"JVM create", "class load", "world load", "spawn prep"};
+	const size_t READY = sizeof(PHASES) / sizeof(PHASES[0]);
+
+	/** Console lines marking the start of each phase; the JVM line is printed by jvmMain just before main() runs. */
+	const struct {
+		const char *text;
+		size_t phase;
+	} MARKERS[] = {
+		{"JVM startup phases:", 1},
+		{"Preparing level", 2},
+		{"Preparing start region", 3},
+		{"Preparing spawn area", 3},
+		{"Done (", READY}
+	};
+
+	std::chrono::milliseconds toMilliseconds(std::chrono::steady_clock::duration duration) {
+
+		return std::chrono::duration_cast<std::chrono::milliseconds>(duration);
+	}
+}
+
+const unsigned int StartupTracker::CHECK_INTERVAL;
+
+StartupTracker::StartupTracker(const ConsoleBuffer &console, const Listener &listener)
+	: console_(console),
+	current_{0},
+	ready_{false},
+	sequence_{console.sequence()},
+	startTime_{std::chrono::steady_clock::now()},
+	startupTime_{0} {
+
+	if(listener) {
+		listeners_.push_back(listener);
+	}
+	timeline_.push_back(Phase{PHASES[0], std::chrono::milliseconds{0}, std::chrono::milliseconds{0}});
+	timer_ = Glib::signal_timeout().connect(sigc::mem_fun(*this, &StartupTracker::onTimer), CHECK_INTERVAL);
+}
+
+StartupTracker::~StartupTracker() {
+
+	timer_.disconnect();
+}
+
+bool StartupTracker::onTimer() {
+
+	const uint64_t sequence = console_.sequence();
+	for(const auto &line: console_.since(sequence_, sequence - sequence_)) {
+		for(const auto &marker: MARKERS) {
+			if((marker.phase > current_) && (line.text.find(marker.text) != std::string::npos)) {
+				enter(marker.phase, line.time);
+				break;
+			}
+		}
+		if(ready_) {
+			return false;
+		}
+	}
+	sequence_ = sequence;
+	return true;
+}
+
+void StartupTracker::enter(size_t phase, std::chrono::steady_clock::time_point time) {
+
+	Phase &previous = timeline_.back();
+	previous.duration = toMilliseconds(time - startTime_) - previous.start;
+	std::cout << "Startup phase '" << previous.name << "' took " << previous.duration.count() << " ms" << std::endl;
+
+	current_ = phase;
+	if(phase == READY) {
+		ready_ = true;
+		startupTime_ = toMilliseconds(time - startTime_);
+		std::cout << "Server ready after " << startupTime_.count() << " ms" << std::endl;
+	} else {
+		timeline_.push_back(Phase{PHASES[phase], toMilliseconds(time - startTime_), std::chrono::milliseconds{0}});
+	}
+
+	for(const auto &listener: listeners_) {
+		listener(ready_ ? std::string{} : timeline_.back().name, ready_);
+	}
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <glibmm.h>
+
+#include "ConsoleBuffer.h"
+
+namespace minecraftd {
+
+	/**
+	 * Follows a server through its startup phases (JVM create, class load, world load, spawn prep) by watching its
+	 * console for the lines that begin each of them, up to the "Done" line that the server prints once it accepts
+	 * players. Console lines carry the time they were read, so the timeline is exact even though the console is only
+	 * checked periodically.
+	 */
+	class StartupTracker {
+		public:
+			struct Phase {
+				std::string name;
+				/** Time from the start of tracking to the start of the phase. */
+				std::chrono::milliseconds start;
+				/** Duration of the phase, or zero if it is still in progress. */
+				std::chrono::milliseconds duration;
+			};
+
+			/** Called on the main loop as each phase begins, and with ready set once the server has started. */
+			typedef std::function<void(const std::string &phase, bool ready)> Listener;
+
+			static const unsigned int CHECK_INTERVAL = 100;
+
+			/** Starts tracking from now, when the JVM is about to be created. */
+			StartupTracker(const ConsoleBuffer &console, const Listener &listener = Listener{});
+			StartupTracker(const StartupTracker&) = delete;
+			~StartupTracker();
+
+			/** Adds a listener, called after those added before it. */
+			void addListener(const Listener &listener) { listeners_.push_back(listener); }
+			bool ready() const { return ready_; }
+			const std::vector<Phase>& timeline() const { return timeline_; }
+			/** Time from the start of tracking until the server was ready, or zero if it is not yet. */
+			std::chrono::milliseconds startupTime() const { return startupTime_; }
+
+		private:
+			bool onTimer();
+			void enter(size_t phase, std::chrono::steady_clock::time_point time);
+
+			const ConsoleBuffer &console_;
+			size_t current_;
+			std::vector<Listener> listeners_;
+			bool ready_;
+			uint64_t sequence_;
+			const std::chrono::steady_clock::time_point startTime_;
+			std::chrono::milliseconds startupTime_;
+			std::vector<Phase> timeline_;
+			sigc::connection timer_;
+	};
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <system_error>
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ThreadClassifier.h"
+
+using namespace minecraftd;
+
+namespace {
+	const int IOPRIO_CLASS_SHIFT = 13;
+	const int IOPRIO_WHO_PROCESS = 1;
+
+	/** Threads started by GLib in minecraftd's process, which are not the JVM's. */
+	const char *const GLIB_THREAD_PREFIXES[] = {"gmain", "gdbus", "pool-"};
+
+	const char *policyName(int policy) {
+
+		switch(policy) {
+			case SCHED_OTHER: return "other";
+			case SCHED_BATCH: return "batch";
+			case SCHED_IDLE: return "idle";
+			case SCHED_FIFO: return "fifo";
+			case SCHED_RR: return "rr";
+		}
+		return "unknown";
+	}
+
+	const char *ioClassName(int ioClass) {
+
+		switch(ioClass) {
+			case 1: return "realtime";
+			case 2: return "best-effort";
+			case 3: return "idle";
+		}
+		return "none";
+	}
+
+	std::string readComm(const std::string &path) {
+
+		std::ifstream file{path};
+		std::string name;
+		std::getline(file, name);
+		return name;
+	}
+}
+
+const std::chrono::seconds ThreadClassifier::SCAN_INTERVAL{5};
+
+ThreadClassifier::ThreadClassifier(const std::vector<ThreadRule> &rules)
+	: jvmti_{nullptr}, processName_{readComm("/proc/self/comm")}, stopFd_{-1} {
+
+	cpu_set_t &allowed = baseline_.cpus;
+	sched_param parameters;
+	errno = 0;
+	baseline_.configuration.nice = getpriority(PRIO_PROCESS, 0);
+	baseline_.configuration.policy = sched_getscheduler(0);
+	const long ioPriority = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+	if((sched_getaffinity(0, sizeof(allowed), &allowed) != 0) || (errno != 0)
+			|| (sched_getparam(0, &parameters) != 0) || (ioPriority == -1)) {
+		throw std::system_error(errno, std::system_category());
+	}
+	for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if(CPU_ISSET(cpu, &allowed)) {
+			baseline_.configuration.cpus.push_back(cpu);
+		}
+	}
+	baseline_.configuration.renice = true;
+	baseline_.configuration.priority = parameters.sched_priority;
+	// A process without an I/O priority of its own is given the best-effort level matching its nice value
+	baseline_.configuration.ioClass = ioPriority >> IOPRIO_CLASS_SHIFT;
+	baseline_.configuration.ioPriority = ioPriority & ((1 << IOPRIO_CLASS_SHIFT) - 1);
+	if(baseline_.configuration.ioClass == 0) {
+		baseline_.configuration.ioClass = 2;
+		baseline_.configuration.ioPriority = (baseline_.configuration.nice + 20) / 5;
+	}
+	baseline_.failed = false;
+
+	for(const auto &configuration: rules) {
+		Rule rule{configuration, {}, {}, {}, false};
+		try {
+			rule.regex = Glib::Regex::create(configuration.pattern, Glib::REGEX_OPTIMIZE);
+		} catch(const Glib::RegexError &e) {
+			throw std::runtime_error{"Invalid pattern for thread role " + configuration.role + ": " + e.what()};
+		}
+
+		CPU_ZERO(&rule.cpus);
+		std::vector<int> cpus;
+		for(int cpu: configuration.cpus) {
+			if((cpu < CPU_SETSIZE) && CPU_ISSET(cpu, &allowed)) {
+				CPU_SET(cpu, &rule.cpus);
+				cpus.push_back(cpu);
+			}
+		}
+		if(!configuration.cpus.empty()) {
+			if(cpus.empty()) {
+				throw std::runtime_error{"None of the CPUs of thread role " + configuration.role
+					+ " are available to the server"};
+			}
+			rule.settings += " cpus=" + formatCpuList(cpus);
+		}
+		if(configuration.policy != -1) {
+			rule.settings += std::string{" policy="} + policyName(configuration.policy);
+			if(configuration.priority != 0) {
+				rule.settings += ':' + std::to_string(configuration.priority);
+			}
+		}
+		if(configuration.renice) {
+			rule.settings += " nice=" + std::to_string(configuration.nice);
+		}
+		if(configuration.ioClass != 0) {
+			rule.settings += std::string{" io="} + ioClassName(configuration.ioClass) + ':'
+				+ std::to_string(configuration.ioPriority);
+		}
+		rule.settings.erase(0, 1);
+		rules_.push_back(rule);
+	}
+}
+
+ThreadClassifier::~ThreadClassifier() {
+
+	if(stopFd_ != -1) {
+		const uint64_t one = 1;
+		if(write(stopFd_, &one, sizeof(one)) == sizeof(one)) {
+			thread_.join();
+		} else {
+			thread_.detach();
+		}
+		close(stopFd_);
+	}
+}
+
+void ThreadClassifier::attach(JavaVM *jvm) {
+
+	if(jvm->GetEnv(reinterpret_cast<void**>(&jvmti_), JVMTI_VERSION_1_2) != JNI_OK) {
+		throw std::runtime_error{"JVM does not support JVMTI 1.2"};
+	}
+	jvmtiEventCallbacks callbacks;
+	std::memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.ThreadStart = &ThreadClassifier::onThreadStart;
+	if((jvmti_->SetEnvironmentLocalStorage(this) != JVMTI_ERROR_NONE)
+			|| (jvmti_->SetEventCallbacks(&callbacks, sizeof(callbacks)) != JVMTI_ERROR_NONE)
+			|| (jvmti_->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_THREAD_START, nullptr)
+				!= JVMTI_ERROR_NONE)) {
+		throw std::runtime_error{"Failed to enable JVMTI thread events"};
+	}
+
+	stopFd_ = eventfd(0, EFD_CLOEXEC);
+	if(stopFd_ == -1) {
+		throw std::system_error(errno, std::system_category());
+	}
+	std::cout << "Classifying JVM threads by " << rules_.size() << " rules" << std::endl;
+	thread_ = std::thread{&ThreadClassifier::scan, this};
+}
+
+std::vector<ThreadClassifier::Assignment> ThreadClassifier::assignments() const {
+
+	std::lock_guard<std::mutex> lock{mutex_};
+	std::vector<Assignment> assignments;
+	for(const auto &entry: assignments_) {
+		assignments.push_back(entry.second);
+	}
+	return assignments;
+}
+
+void JNICALL ThreadClassifier::onThreadStart(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread) {
+
+	ThreadClassifier *classifier;
+	jvmtiThreadInfo info;
+	if((jvmti->GetEnvironmentLocalStorage(reinterpret_cast<void**>(&classifier)) != JVMTI_ERROR_NONE)
+			|| (classifier == nullptr) || (jvmti->GetThreadInfo(thread, &info) != JVMTI_ERROR_NONE)) {
+		return;
+	}
+	jni->DeleteLocalRef(info.thread_group);
+	jni->DeleteLocalRef(info.context_class_loader);
+
+	// The event is posted on the thread that has started, before it runs any Java code
+	const std::string name{(info.name != nullptr) ? info.name : ""};
+	jvmti->Deallocate(reinterpret_cast<unsigned char*>(info.name));
+	std::lock_guard<std::mutex> lock{classifier->mutex_};
+	classifier->classify(syscall(SYS_gettid), name, true);
+}
+
+void ThreadClassifier::classify(pid_t tid, const std::string &name, bool reset) {
+
+	for(auto &rule: rules_) {
+		if(rule.regex->match(name)) {
+			apply(tid, name, rule);
+			assignments_[tid] = Assignment{tid, name, rule.configuration.role, rule.settings};
+			return;
+		}
+	}
+
+	if(reset) {
+		apply(tid, name, baseline_);
+		assignments_.erase(tid);
+	}
+}
+
+void ThreadClassifier::apply(pid_t tid, const std::string &name, Rule &rule) {
+
+	const ThreadRule &configuration = rule.configuration;
+	std::string failure;
+	if(!configuration.cpus.empty() && (sched_setaffinity(tid, sizeof(rule.cpus), &rule.cpus) != 0)) {
+		failure = std::string{"CPU affinity: "} + std::strerror(errno);
+	}
+	sched_param parameters{};
+	parameters.sched_priority = configuration.priority;
+	if((configuration.policy != -1) && (sched_setscheduler(tid, configuration.policy, &parameters) != 0)) {
+		failure = std::string{"scheduling policy: "} + std::strerror(errno);
+	}
+	if(configuration.renice && (setpriority(PRIO_PROCESS, tid, configuration.nice) != 0)) {
+		failure = std::string{"nice value: "} + std::strerror(errno);
+	}
+	if((configuration.ioClass != 0) && (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+					(configuration.ioClass << IOPRIO_CLASS_SHIFT) | configuration.ioPriority) != 0)) {
+		failure = std::string{"I/O priority: "} + std::strerror(errno);
+	}
+	if(!failure.empty() && !rule.failed) {
+		// Raising priorities needs CAP_SYS_NICE, or LimitNICE= and LimitRTPRIO= in the service's unit
+		std::cerr << "Failed to set the " << failure << " of thread " << name << " (" << tid << ")"
+			<< (configuration.role.empty() ? "" : ", in role " + configuration.role)
+			<< "; further failures are not logged" << std::endl;
+		rule.failed = true;
+	}
+}
+
+void ThreadClassifier::scan() {
+
+	pollfd pollFd{stopFd_, POLLIN, 0};
+	const int timeout = std::chrono::duration_cast<std::chrono::milliseconds>(SCAN_INTERVAL).count();
+	do {
+		DIR *directory = opendir("/proc/self/task");
+		if(directory == nullptr) {
+			std::cerr << "Failed to list the server's threads: " << std::strerror(errno) << std::endl;
+			return;
+		}
+		std::set<pid_t> live;
+		for(dirent *entry = readdir(directory); entry != nullptr; entry = readdir(directory)) {
+			const pid_t tid = std::atoi(entry->d_name);
+			if(tid > 0) {
+				live.insert(tid);
+			}
+		}
+		closedir(directory);
+
+		std::lock_guard<std::mutex> lock{mutex_};
+		for(auto i = assignments_.begin(); i != assignments_.end();) {
+			i = (live.count(i->first) == 0) ? assignments_.erase(i) : std::next(i);
+		}
+		for(pid_t tid: live) {
+			if(assignments_.count(tid) != 0) {
+				continue;
+			}
+			const std::string name = readComm("/proc/self/task/" + std::to_string(tid) + "/comm");
+			bool own = name.empty() || (name == processName_);
+			for(const char *prefix: GLIB_THREAD_PREFIXES) {
+				own = own || (name.compare(0, std::strlen(prefix), prefix) == 0);
+			}
+			if(!own) {
+				classify(tid, name, false);
+			}
+		}
+	} while(poll(&pollFd, 1, timeout) == 0);
+}
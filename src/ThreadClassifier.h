@@ -0,0 +1,104 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+#include <sys/types.h>
+
+#include <glibmm.h>
+#include <jni.h>
+#include <jvmti.h>
+
+#include "instance.h"
+
+namespace minecraftd {
+
+	/**
+	 * Schedules the JVM's threads by role, so that the server's tick thread need not compete for its CPUs with garbage
+	 * collection, JIT compilation and the like. Each thread is classified by the first rule whose pattern matches its
+	 * name, and given the rule's CPUs, nice value or scheduling policy, and I/O priority.
+	 *
+	 * Java threads are classified as they start, through a JVMTI ThreadStart hook, by their full names. The JVM's own
+	 * threads (garbage collection, compilers, the VM thread) are never reported to JVMTI, so the process' threads are
+	 * also scanned every SCAN_INTERVAL, and those not yet classified are matched by the name the kernel knows them by,
+	 * truncated to 15 characters (for example "C2 CompilerThre").
+	 */
+	class ThreadClassifier {
+		public:
+			/** A thread and the role it was given. */
+			struct Assignment {
+
+				pid_t tid;
+				std::string name;
+				std::string role;
+				/** The settings applied, such as "cpus=2-3 nice=5 io=idle". */
+				std::string settings;
+			};
+
+			static const std::chrono::seconds SCAN_INTERVAL;
+
+			/** Compiles rules' patterns, throwing std::runtime_error if any is invalid. */
+			ThreadClassifier(const std::vector<ThreadRule> &rules);
+			ThreadClassifier(const ThreadClassifier&) = delete;
+			~ThreadClassifier();
+
+			/**
+			 * Starts classifying the threads of jvm, which must have just been created. Throws std::runtime_error if
+			 * the JVM does not support JVMTI.
+			 */
+			void attach(JavaVM *jvm);
+			/** Returns the live threads that have been classified, in order of thread ID. */
+			std::vector<Assignment> assignments() const;
+
+		private:
+			struct Rule {
+
+				ThreadRule configuration;
+				Glib::RefPtr<Glib::Regex> regex;
+				/** The CPUs of the configuration that the process may run on. */
+				cpu_set_t cpus;
+				std::string settings;
+				/** Set once a failure to apply the rule has been logged, so that it is logged once per rule. */
+				bool failed;
+			};
+
+			static void JNICALL onThreadStart(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread);
+
+			/**
+			 * Applies the first rule matching name to tid. Threads inherit the scheduling of the thread that started
+			 * them, so if no rule matches and reset is set, tid is given the settings the process started with
+			 * instead. mutex_ must be held.
+			 */
+			void classify(pid_t tid, const std::string &name, bool reset);
+			void apply(pid_t tid, const std::string &name, Rule &rule);
+			void scan();
+
+			std::map<pid_t, Assignment> assignments_;
+			/** Every setting, as the process started with it. */
+			Rule baseline_;
+			jvmtiEnv *jvmti_;
+			mutable std::mutex mutex_;
+			/** The name the process' own threads go by, which are left alone. */
+			std::string processName_;
+			std::vector<Rule> rules_;
+			int stopFd_;
+			std::thread thread_;
+	};
+}
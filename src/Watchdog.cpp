@@ -0,0 +1,349 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <glibmm.h>
+
+#include "JvmMetrics.h"
+#include "Watchdog.h"
+
+using namespace minecraftd;
+
+namespace {
+	/** How often the server's tick times are looked for until they are found, in checks. */
+	const int FIND_INTERVAL = 5;
+
+	const char* threadState(jint state) {
+
+		if((state & JVMTI_THREAD_STATE_ALIVE) == 0) {
+			return "TERMINATED";
+		} else if(state & JVMTI_THREAD_STATE_BLOCKED_ON_MONITOR_ENTER) {
+			return "BLOCKED";
+		} else if(state & JVMTI_THREAD_STATE_WAITING_WITH_TIMEOUT) {
+			return "TIMED_WAITING";
+		} else if(state & JVMTI_THREAD_STATE_WAITING) {
+			return "WAITING";
+		}
+		return "RUNNABLE";
+	}
+}
+
+const std::chrono::seconds Watchdog::CHECK_INTERVAL{1};
+const size_t Watchdog::DUMP_BUFFER_SIZE;
+const jint Watchdog::MAX_FRAMES;
+
+Watchdog::Watchdog(JavaVM *jvm, std::chrono::seconds stallTime, const std::string &dumpDirectory)
+	: buffer_{new char[DUMP_BUFFER_SIZE]}, bufferLength_{0}, capabilities_(), dumpDirectory_{dumpDirectory},
+	healthy_{true}, jvm_{jvm}, jvmti_{nullptr}, stallTime_{stallTime}, stopFd_{eventfd(0, EFD_CLOEXEC)} {
+
+	if(stopFd_ == -1) {
+		throw std::system_error(errno, std::system_category());
+	}
+
+	// Touch the buffer now, so that a dump taken while the host is short of memory does not fault it in
+	std::memset(buffer_.get(), 0, DUMP_BUFFER_SIZE);
+	thread_ = std::thread{&Watchdog::run, this};
+}
+
+Watchdog::~Watchdog() {
+
+	const uint64_t one = 1;
+	if(write(stopFd_, &one, sizeof(one)) == sizeof(one)) {
+		thread_.join();
+	} else {
+		thread_.detach();
+	}
+	close(stopFd_);
+}
+
+void Watchdog::run() {
+
+	JNIEnv *jni;
+	JavaVMAttachArgs attachArguments{JNI_VERSION_1_6, const_cast<char*>("minecraftd watchdog"), nullptr};
+	if(jvm_->AttachCurrentThreadAsDaemon(reinterpret_cast<void**>(&jni), &attachArguments) != JNI_OK) {
+		std::cerr << "Failed to attach the watchdog thread to the JVM" << std::endl;
+		return;
+	}
+
+	// Lock information is optional; the dump leaves out whatever this JVM can not provide
+	jvmtiCapabilities potential;
+	if((jvm_->GetEnv(reinterpret_cast<void**>(&jvmti_), JVMTI_VERSION_1_2) == JNI_OK)
+			&& (jvmti_->GetPotentialCapabilities(&potential) == JVMTI_ERROR_NONE)) {
+		capabilities_.can_get_owned_monitor_stack_depth_info = potential.can_get_owned_monitor_stack_depth_info;
+		capabilities_.can_get_current_contended_monitor = potential.can_get_current_contended_monitor;
+		capabilities_.can_get_monitor_info = potential.can_get_monitor_info;
+		capabilities_.can_get_line_numbers = potential.can_get_line_numbers;
+		if(jvmti_->AddCapabilities(&capabilities_) != JVMTI_ERROR_NONE) {
+			capabilities_ = jvmtiCapabilities();
+		}
+	} else {
+		jvmti_ = nullptr;
+		std::cerr << "JVMTI is unavailable; the watchdog will not dump threads" << std::endl;
+	}
+
+	jobject server = nullptr;
+	jfieldID tickTimes = nullptr;
+	jlong previous[JvmMetrics::TICK_TIMES_LENGTH] = {};
+	auto lastTick = std::chrono::steady_clock::now();
+	bool dumped = false;
+	for(int check = 0;; ++check) {
+		pollfd pollFd{stopFd_, POLLIN, 0};
+		const int rc = poll(&pollFd, 1, std::chrono::duration_cast<std::chrono::milliseconds>(CHECK_INTERVAL).count());
+		if(((rc == -1) && (errno != EINTR)) || (pollFd.revents & POLLIN)) {
+			break;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		if(server == nullptr) {
+			// Until the server has started ticking, there is nothing to watch
+			lastTick = now;
+			if(check % FIND_INTERVAL == 0) {
+				jni->PushLocalFrame(64);
+				try {
+					if(JvmMetrics::findTickTimes(jni, server, tickTimes)) {
+						std::cout << "Watchdog: watching the server's ticks" << std::endl;
+					}
+				} catch(const std::exception &e) {
+					std::cerr << "Watchdog: failed to find the server's tick times: " << e.what() << std::endl;
+				}
+				jni->PopLocalFrame(nullptr);
+			}
+			continue;
+		}
+
+		jlong times[JvmMetrics::TICK_TIMES_LENGTH];
+		jlongArray array = static_cast<jlongArray>(jni->GetObjectField(server, tickTimes));
+		jni->GetLongArrayRegion(array, 0, JvmMetrics::TICK_TIMES_LENGTH, times);
+		jni->DeleteLocalRef(array);
+		if(jni->ExceptionCheck()) {
+			jni->ExceptionClear();
+			continue;
+		}
+
+		if(!std::equal(std::begin(times), std::end(times), std::begin(previous))) {
+			std::copy(std::begin(times), std::end(times), std::begin(previous));
+			if(dumped) {
+				std::cout << "Watchdog: the server is ticking again after " << std::chrono::duration_cast<
+					std::chrono::seconds>(now - lastTick).count() << " s" << std::endl;
+				dumped = false;
+			}
+			lastTick = now;
+		}
+
+		const auto stalledFor = std::chrono::duration_cast<std::chrono::seconds>(now - lastTick);
+		healthy_ = stalledFor < stallTime_;
+		if(!healthy_ && !dumped) {
+			std::cerr << "Watchdog: no tick has completed for " << stalledFor.count() << " s" << std::endl;
+			dump(jni, stalledFor);
+			dumped = true;
+		}
+	}
+
+	if(server != nullptr) {
+		jni->DeleteGlobalRef(server);
+	}
+	if(jvmti_ != nullptr) {
+		jvmti_->DisposeEnvironment();
+	}
+	jvm_->DetachCurrentThread();
+}
+
+void Watchdog::dump(JNIEnv *jni, std::chrono::seconds stalledFor) {
+
+	if((jvmti_ == nullptr) || dumpDirectory_.empty()) {
+		return;
+	}
+
+	char timestamp[32];
+	const std::time_t now = std::time(nullptr);
+	std::strftime(timestamp, sizeof(timestamp), "%Y%m%dT%H%M%SZ", std::gmtime(&now));
+	bufferLength_ = 0;
+	append("Thread dump taken %s, after no tick completed for %lld s\n", timestamp,
+			static_cast<long long>(stalledFor.count()));
+
+	jvmtiStackInfo *stacks;
+	jint count;
+	if(jvmti_->GetAllStackTraces(MAX_FRAMES, &stacks, &count) != JVMTI_ERROR_NONE) {
+		std::cerr << "Watchdog: failed to take a thread dump" << std::endl;
+		return;
+	}
+
+	jni->PushLocalFrame(count + 16);
+	for(jint i = 0; i < count; ++i) {
+		const jvmtiStackInfo &stack = stacks[i];
+		jvmtiThreadInfo info;
+		if(jvmti_->GetThreadInfo(stack.thread, &info) == JVMTI_ERROR_NONE) {
+			append("\n\"%s\"%s priority=%d state=%s\n", info.name, info.is_daemon ? " daemon" : "", info.priority,
+					threadState(stack.state));
+			jvmti_->Deallocate(reinterpret_cast<unsigned char*>(info.name));
+		}
+
+		jobject contended = nullptr;
+		if(capabilities_.can_get_current_contended_monitor) {
+			jvmti_->GetCurrentContendedMonitor(stack.thread, &contended);
+		}
+		jint ownedCount = 0;
+		jvmtiMonitorStackDepthInfo *owned = nullptr;
+		if(capabilities_.can_get_owned_monitor_stack_depth_info
+				&& (jvmti_->GetOwnedMonitorStackDepthInfo(stack.thread, &ownedCount, &owned) != JVMTI_ERROR_NONE)) {
+			ownedCount = 0;
+		}
+
+		for(jint frame = 0; frame < stack.frame_count; ++frame) {
+			appendFrame(stack.frame_buffer[frame]);
+			if((frame == 0) && (contended != nullptr)) {
+				appendMonitor((stack.state & JVMTI_THREAD_STATE_BLOCKED_ON_MONITOR_ENTER) ? "waiting to lock"
+						: "waiting on", contended, true);
+			}
+			for(jint j = 0; j < ownedCount; ++j) {
+				if(owned[j].stack_depth == frame) {
+					appendMonitor("locked", owned[j].monitor, false);
+				}
+			}
+		}
+		for(jint j = 0; j < ownedCount; ++j) {
+			if(owned[j].stack_depth == -1) {
+				appendMonitor("locked through JNI", owned[j].monitor, false);
+			}
+		}
+		if(owned != nullptr) {
+			jvmti_->Deallocate(reinterpret_cast<unsigned char*>(owned));
+		}
+	}
+	jni->PopLocalFrame(nullptr);
+	jvmti_->Deallocate(reinterpret_cast<unsigned char*>(stacks));
+
+	if(g_mkdir_with_parents(dumpDirectory_.c_str(), 0755) != 0) {
+		std::cerr << "Watchdog: failed to create " << dumpDirectory_ << ": " << std::strerror(errno) << std::endl;
+		return;
+	}
+	const std::string path{dumpDirectory_ + "/threads-" + timestamp + ".txt"};
+	const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	size_t written = 0;
+	while(fd != -1) {
+		const ssize_t result = write(fd, buffer_.get() + written, bufferLength_ - written);
+		if((result <= 0) || ((written += result) == bufferLength_)) {
+			break;
+		}
+	}
+	if(fd != -1) {
+		close(fd);
+	}
+	if(written == bufferLength_) {
+		std::cerr << "Watchdog: wrote a thread dump to " << path << std::endl;
+	} else {
+		std::cerr << "Watchdog: failed to write a thread dump to " << path << std::endl;
+	}
+}
+
+void Watchdog::append(const char *format, ...) {
+
+	// Keep the last byte for the terminator vsnprintf always writes
+	if(bufferLength_ + 1 >= DUMP_BUFFER_SIZE) {
+		return;
+	}
+
+	va_list arguments;
+	va_start(arguments, format);
+	const int length = std::vsnprintf(buffer_.get() + bufferLength_, DUMP_BUFFER_SIZE - bufferLength_, format,
+			arguments);
+	va_end(arguments);
+	if(length > 0) {
+		bufferLength_ = std::min(bufferLength_ + length, DUMP_BUFFER_SIZE - 1);
+	}
+}
+
+void Watchdog::appendClassName(const char *signature) {
+
+	// "Lnet/minecraft/server/MinecraftServer;" becomes "net.minecraft.server.MinecraftServer"
+	const size_t length = std::strlen(signature);
+	const bool object = (length >= 2) && (signature[0] == 'L') && (signature[length - 1] == ';');
+	for(size_t i = object ? 1 : 0; (i < length - (object ? 1 : 0)) && (bufferLength_ + 1 < DUMP_BUFFER_SIZE); ++i) {
+		buffer_[bufferLength_++] = (signature[i] == '/') ? '.' : signature[i];
+	}
+}
+
+void Watchdog::appendFrame(const jvmtiFrameInfo &frame) {
+
+	jclass clazz;
+	char *classSignature = nullptr;
+	char *name = nullptr;
+	append("\tat ");
+	if((jvmti_->GetMethodDeclaringClass(frame.method, &clazz) == JVMTI_ERROR_NONE)
+			&& (jvmti_->GetClassSignature(clazz, &classSignature, nullptr) == JVMTI_ERROR_NONE)) {
+		appendClassName(classSignature);
+		jvmti_->Deallocate(reinterpret_cast<unsigned char*>(classSignature));
+	}
+	if(jvmti_->GetMethodName(frame.method, &name, nullptr, nullptr) == JVMTI_ERROR_NONE) {
+		append(".%s", name);
+		jvmti_->Deallocate(reinterpret_cast<unsigned char*>(name));
+	}
+
+	jint lineCount;
+	jvmtiLineNumberEntry *lines;
+	if(frame.location == -1) {
+		append("(Native Method)\n");
+	} else if(capabilities_.can_get_line_numbers
+			&& (jvmti_->GetLineNumberTable(frame.method, &lineCount, &lines) == JVMTI_ERROR_NONE)) {
+		jint line = -1;
+		for(jint i = 0; (i < lineCount) && (lines[i].start_location <= frame.location); ++i) {
+			line = lines[i].line_number;
+		}
+		append("(line %d)\n", static_cast<int>(line));
+		jvmti_->Deallocate(reinterpret_cast<unsigned char*>(lines));
+	} else {
+		append("(bci %lld)\n", static_cast<long long>(frame.location));
+	}
+}
+
+void Watchdog::appendMonitor(const char *prefix, jobject monitor, bool withOwner) {
+
+	jint hash = 0;
+	jvmti_->GetObjectHashCode(monitor, &hash);
+	append("\t- %s <", prefix);
+	jclass clazz;
+	char *signature = nullptr;
+	JNIEnv *jni;
+	if((jvm_->GetEnv(reinterpret_cast<void**>(&jni), JNI_VERSION_1_6) == JNI_OK)
+			&& ((clazz = jni->GetObjectClass(monitor)) != nullptr)
+			&& (jvmti_->GetClassSignature(clazz, &signature, nullptr) == JVMTI_ERROR_NONE)) {
+		appendClassName(signature);
+		jvmti_->Deallocate(reinterpret_cast<unsigned char*>(signature));
+	}
+	append("@%08x>", static_cast<unsigned int>(hash));
+
+	jvmtiMonitorUsage usage;
+	if(withOwner && capabilities_.can_get_monitor_info
+			&& (jvmti_->GetObjectMonitorUsage(monitor, &usage) == JVMTI_ERROR_NONE)) {
+		jvmtiThreadInfo owner;
+		if((usage.owner != nullptr) && (jvmti_->GetThreadInfo(usage.owner, &owner) == JVMTI_ERROR_NONE)) {
+			append(" owned by \"%s\"", owner.name);
+			jvmti_->Deallocate(reinterpret_cast<unsigned char*>(owner.name));
+		}
+		jvmti_->Deallocate(reinterpret_cast<unsigned char*>(usage.waiters));
+		jvmti_->Deallocate(reinterpret_cast<unsigned char*>(usage.notify_waiters));
+	}
+	append("\n");
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <jni.h>
+#include <jvmti.h>
+
+namespace minecraftd {
+
+	/**
+	 * Notices when the server stops ticking: deadlocked, or stuck for a long time on a single tick.
+	 *
+	 * A native thread attached to the JVM checks the server's array of recent tick times (the same one JvmMetrics
+	 * reports) every CHECK_INTERVAL; the server writes a slot of it on every tick, so an unchanged array means no tick
+	 * has completed. Once no tick has completed for the stall time, every thread's stack, along with the monitors it
+	 * holds and the one it is waiting for, is formatted through JVMTI into a buffer allocated up front, and written to
+	 * the dump directory. healthy() reports whether the server is ticking, so that the service manager's watchdog is
+	 * only fed while it is.
+	 */
+	class Watchdog {
+		public:
+			static const std::chrono::seconds CHECK_INTERVAL;
+			/** Size of the thread dump buffer; longer dumps are truncated. */
+			static const size_t DUMP_BUFFER_SIZE = 4 * 1024 * 1024;
+			/** Deepest stack dumped for each thread. */
+			static const jint MAX_FRAMES = 256;
+
+			/** Watches the server running in jvm, dumping its threads to dumpDirectory (unless empty) on a stall. */
+			Watchdog(JavaVM *jvm, std::chrono::seconds stallTime, const std::string &dumpDirectory);
+			Watchdog(const Watchdog&) = delete;
+			~Watchdog();
+
+			/** Returns false while the server is stalled; true while it ticks, or has yet to start. Thread-safe. */
+			bool healthy() const { return healthy_; }
+
+		private:
+			void append(const char *format, ...) __attribute__((format(printf, 2, 3)));
+			void appendClassName(const char *signature);
+			void appendFrame(const jvmtiFrameInfo &frame);
+			/** Appends a line naming monitor, and with withOwner, the thread holding it. */
+			void appendMonitor(const char *prefix, jobject monitor, bool withOwner);
+			/** Formats every thread's stack into the buffer, and writes it to the dump directory. */
+			void dump(JNIEnv *jni, std::chrono::seconds stalledFor);
+			void run();
+
+			std::unique_ptr<char[]> buffer_;
+			size_t bufferLength_;
+			jvmtiCapabilities capabilities_;
+			const std::string dumpDirectory_;
+			std::atomic<bool> healthy_;
+			JavaVM *const jvm_;
+			jvmtiEnv *jvmti_;
+			const std::chrono::seconds stallTime_;
+			int stopFd_;
+			std::thread thread_;
+	};
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "WorldWarmup.h"
+#include "parallel.h"
+
+using minecraftd::WorldWarmup;
+
+namespace {
+	/** Width of a region, in blocks (32 chunks of 16 blocks). */
+	const int REGION_BLOCKS = 512;
+	/** Upper bound on the decompressed size of level.dat, which is normally a few kilobytes. */
+	const size_t MAX_LEVEL_DAT_SIZE = 16 * 1024 * 1024;
+	/** Directories of a dimension holding region files: blocks, then entities and points of interest (1.14+). */
+	const char *const REGION_DIRECTORIES[] = {"region", "entities", "poi"};
+
+	struct RegionFile {
+		std::string path;
+		size_t size;
+		time_t modified;
+	};
+
+	/** Returns the level-name from server.properties, or the server's default if it is not set. */
+	std::string readLevelName(const std::string &serverDirectory) {
+
+		std::ifstream in{serverDirectory + "/server.properties"};
+		std::string line;
+		while(std::getline(in, line)) {
+			if(line.compare(0, 11, "level-name=") == 0) {
+				return line.substr(11);
+			}
+		}
+		return "world";
+	}
+
+	/**
+	 * Finds the value of an integer tag named name in level.dat. Rather than parsing the NBT, this looks for the tag's
+	 * encoding (type, name length, name), which is unambiguous for the spawn coordinates.
+	 */
+	bool findIntTag(const std::string &nbt, const std::string &name, int32_t &value) {
+
+		std::string tag{'\x03', '\x00', static_cast<char>(name.size())};
+		tag += name;
+		const size_t position = nbt.find(tag);
+		if((position == std::string::npos) || (nbt.size() - position - tag.size() < 4)) {
+			return false;
+		}
+		const unsigned char *data = reinterpret_cast<const unsigned char*>(nbt.data() + position + tag.size());
+		value = static_cast<int32_t>((uint32_t{data[0]} << 24) | (uint32_t{data[1]} << 16) | (uint32_t{data[2]} << 8)
+				| data[3]);
+		return true;
+	}
+
+	/** Reads the spawn point from the world's level.dat, leaving x and z at zero if it cannot be found. */
+	void readSpawn(const std::string &levelDirectory, int32_t &x, int32_t &z) {
+
+		x = z = 0;
+		gzFile file = gzopen((levelDirectory + "/level.dat").c_str(), "rb");
+		if(file == nullptr) {
+			return;
+		}
+
+		std::string nbt;
+		char buffer[8192];
+		int count;
+		while(((count = gzread(file, buffer, sizeof(buffer))) > 0) && (nbt.size() < MAX_LEVEL_DAT_SIZE)) {
+			nbt.append(buffer, count);
+		}
+		gzclose(file);
+
+		int32_t spawnX, spawnZ;
+		if(findIntTag(nbt, "SpawnX", spawnX) && findIntTag(nbt, "SpawnZ", spawnZ)) {
+			x = spawnX;
+			z = spawnZ;
+		}
+	}
+
+	int regionOf(int32_t block) {
+
+		// Rounds towards negative infinity, as the server does
+		return (block >= 0) ? block / REGION_BLOCKS : -((-block + REGION_BLOCKS - 1) / REGION_BLOCKS);
+	}
+
+	bool statRegionFile(const std::string &path, RegionFile &region) {
+
+		struct stat fileStat;
+		if((stat(path.c_str(), &fileStat) != 0) || !S_ISREG(fileStat.st_mode)) {
+			return false;
+		}
+		region = RegionFile{path, static_cast<size_t>(fileStat.st_size), fileStat.st_mtime};
+		return true;
+	}
+
+	/** Collects the region files of every dimension beneath directory, skipping hidden directories. */
+	void findRegionFiles(const std::string &directory, std::vector<RegionFile> &regions) {
+
+		DIR *dir = opendir(directory.c_str());
+		if(dir == nullptr) {
+			return;
+		}
+
+		std::vector<std::string> subdirectories;
+		for(dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+			const std::string name{entry->d_name};
+			const std::string path{directory + '/' + name};
+			RegionFile region;
+			if(name[0] == '.') {
+				continue;
+			} else if((name.size() > 4) && (name.compare(name.size() - 4, 4, ".mca") == 0)) {
+				if(statRegionFile(path, region)) {
+					regions.push_back(region);
+				}
+			} else if((entry->d_type == DT_DIR) || (entry->d_type == DT_UNKNOWN)) {
+				subdirectories.push_back(path);
+			}
+		}
+		closedir(dir);
+
+		for(const auto &subdirectory: subdirectories) {
+			findRegionFiles(subdirectory, regions);
+		}
+	}
+
+	/** Reads length bytes of path into the page cache, returning the number of bytes requested of the kernel. */
+	size_t prefetch(const std::string &path, size_t length) {
+
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if(fd == -1) {
+			return 0;
+		}
+
+		// readahead waits for the reads to be issued, so the elapsed time reflects the I/O done; file systems that
+		// do not support it get the equivalent hint instead
+		if((readahead(fd, 0, length) != 0) && (posix_fadvise(fd, 0, length, POSIX_FADV_WILLNEED) != 0)) {
+			length = 0;
+		}
+		close(fd);
+		return length;
+	}
+}
+
+WorldWarmup::WorldWarmup(const std::string &serverDirectory, size_t budget, int spawnRadius) {
+
+	thread_ = std::thread{&WorldWarmup::run, this, serverDirectory, budget, spawnRadius};
+}
+
+WorldWarmup::~WorldWarmup() {
+
+	thread_.join();
+}
+
+void WorldWarmup::run(const std::string &serverDirectory, size_t budget, int spawnRadius) {
+
+	const auto startTime = std::chrono::steady_clock::now();
+	const std::string levelDirectory{serverDirectory + '/' + readLevelName(serverDirectory)};
+
+	// Spawn regions come first, nearest first, then everything else from the most recently modified
+	std::vector<RegionFile> selected;
+	std::set<std::string> seen;
+	int32_t spawnX, spawnZ;
+	readSpawn(levelDirectory, spawnX, spawnZ);
+	for(int distance = 0; distance <= spawnRadius; ++distance) {
+		for(int dx = -distance; dx <= distance; ++dx) {
+			for(int dz = -distance; dz <= distance; ++dz) {
+				if(std::max(std::abs(dx), std::abs(dz)) != distance) {
+					continue;
+				}
+				const std::string name{"/r." + std::to_string(regionOf(spawnX) + dx) + '.' +
+					std::to_string(regionOf(spawnZ) + dz) + ".mca"};
+				for(const char *directory: REGION_DIRECTORIES) {
+					RegionFile region;
+					if(statRegionFile(levelDirectory + '/' + directory + name, region)) {
+						selected.push_back(region);
+						seen.insert(region.path);
+					}
+				}
+			}
+		}
+	}
+
+	std::vector<RegionFile> recent;
+	findRegionFiles(levelDirectory, recent);
+	std::sort(recent.begin(), recent.end(), [](const RegionFile &a, const RegionFile &b) {
+		return a.modified > b.modified;
+	});
+	for(const auto &region: recent) {
+		if(seen.count(region.path) == 0) {
+			selected.push_back(region);
+		}
+	}
+
+	// The file that crosses the budget is prefetched only up to it
+	std::vector<size_t> lengths;
+	size_t remaining = budget;
+	for(const auto &region: selected) {
+		if(remaining == 0) {
+			break;
+		}
+		lengths.push_back(std::min(region.size, remaining));
+		remaining -= lengths.back();
+	}
+
+	std::atomic<size_t> prefetched{0};
+	try {
+		minecraftd::parallelFor(lengths.size(), [&](size_t i) {
+			prefetched += prefetch(selected[i].path, lengths[i]);
+		});
+	} catch(const std::exception &e) {
+		std::cerr << "World warm-up failed: " << e.what() << std::endl;
+	}
+
+	const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+			startTime);
+	std::cout << "World warm-up prefetched " << (prefetched / 1024) << " KiB from " << lengths.size() << " of " <<
+		(selected.size()) << " region files in " << elapsed.count() << " ms" << std::endl;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <thread>
+
+namespace minecraftd {
+
+	/**
+	 * Prefetches a world's region files into the page cache on a background thread while the JVM boots, so that the
+	 * first players to join are not kept waiting while the server faults chunks in from disk one at a time. Regions
+	 * around the world spawn are prefetched first, then the most recently modified regions, until budget bytes have
+	 * been read.
+	 */
+	class WorldWarmup {
+		public:
+			/**
+			 * Starts prefetching the world named in server.properties beneath serverDirectory, covering regions up to
+			 * spawnRadius regions away from the one holding the spawn point.
+			 */
+			WorldWarmup(const std::string &serverDirectory, size_t budget, int spawnRadius);
+			WorldWarmup(const WorldWarmup&) = delete;
+			~WorldWarmup();
+
+		private:
+			void run(const std::string &serverDirectory, size_t budget, int spawnRadius);
+
+			std::thread thread_;
+	};
+}
@@ -0,0 +1,503 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "instance.h"
+
+using namespace minecraftd;
+
+namespace {
+	const std::string DEFAULT_LOG_CONFIG_FILENAME{MINECRAFTDCONFDIR "/log4j2.xml"};
+
+	/**
+	 * Looks up a setting by path (e.g. "jvm.arguments") in each of the given settings in turn, returning the first
+	 * match, or nullptr if none of them contain it.
+	 */
+	const libconfig::Setting *lookup(std::initializer_list<const libconfig::Setting*> scopes, const std::string &path) {
+
+		for(auto scope: scopes) {
+			if(scope == nullptr) {
+				continue;
+			}
+
+			const libconfig::Setting *setting = scope;
+			std::string::size_type start = 0;
+			while(setting != nullptr) {
+				auto end = path.find('.', start);
+				std::string name{path.substr(start, end - start)};
+				setting = setting->exists(name.c_str()) ? &(*setting)[name.c_str()] : nullptr;
+				if(end == std::string::npos) {
+					break;
+				}
+				start = end + 1;
+			}
+
+			if(setting != nullptr) {
+				return setting;
+			}
+		}
+		return nullptr;
+	}
+
+	void lookupString(std::initializer_list<const libconfig::Setting*> scopes, const std::string &path,
+			std::string &value) {
+
+		const libconfig::Setting *setting = lookup(scopes, path);
+		if(setting != nullptr) {
+			value = static_cast<const char*>(*setting);
+		}
+	}
+
+	/** Parses an I/O priority class name into the class numbers of ioprio_set(2), naming setting in any error. */
+	int parseIoClass(const std::string &ioClass, const std::string &setting) {
+
+		if(ioClass == "realtime") {
+			return 1;
+		} else if(ioClass == "best-effort") {
+			return 2;
+		} else if(ioClass == "idle") {
+			return 3;
+		}
+		throw std::runtime_error{setting + " must be realtime, best-effort or idle"};
+	}
+
+	InstanceConfiguration readConfiguration(const libconfig::Setting *root, const libconfig::Setting *instance) {
+
+		InstanceConfiguration configuration;
+		std::initializer_list<const libconfig::Setting*> scopes{instance, root};
+
+		configuration.serverDirectory = MINECRAFTSERVERDIR;
+		lookupString({root}, "serverDirectory", configuration.serverDirectory);
+		if(instance != nullptr) {
+			if(!instance->lookupValue("name", configuration.name) || configuration.name.empty()) {
+				throw std::runtime_error{"Instance at line " + std::to_string(instance->getSourceLine())
+					+ " does not have a name"};
+			}
+			auto invalid = std::find_if_not(configuration.name.cbegin(), configuration.name.cend(), [](char c) {
+				return ((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9'))
+					|| (c == '_');
+			});
+			if(invalid != configuration.name.cend()) {
+				throw std::runtime_error{"Instance name '" + configuration.name
+					+ "' may only contain the characters [A-Za-z0-9_]"};
+			}
+
+			configuration.serverDirectory += '/' + configuration.name;
+			lookupString({instance}, "serverDirectory", configuration.serverDirectory);
+		}
+
+		configuration.backupDirectory = MINECRAFTSERVERDIR "/.backups";
+		lookupString({root}, "backupDirectory", configuration.backupDirectory);
+		if(instance != nullptr) {
+			configuration.backupDirectory += '/' + configuration.name;
+			lookupString({instance}, "backupDirectory", configuration.backupDirectory);
+		}
+
+		configuration.jarPath = MINECRAFTJARDIR "/minecraft_server.jar";
+		lookupString(scopes, "jar", configuration.jarPath);
+
+		configuration.jvmLibPath = JVMLIBPATH;
+		lookupString(scopes, "jvm.jvmLibrary", configuration.jvmLibPath);
+
+		configuration.logConfigFileName = DEFAULT_LOG_CONFIG_FILENAME;
+		const libconfig::Setting *customLogConfiguration = lookup(scopes, "customLogConfiguration");
+		if(customLogConfiguration != nullptr) {
+			if(customLogConfiguration->getType() == libconfig::Setting::TypeBoolean) {
+				if(!static_cast<bool>(*customLogConfiguration)) {
+					configuration.logConfigFileName.clear();
+					configuration.logConfigFileName.shrink_to_fit();
+				}
+			} else {
+				configuration.logConfigFileName = static_cast<const char*>(*customLogConfiguration);
+			}
+		}
+
+		configuration.sharedArchiveDirectory = MINECRAFTSERVERDIR "/.cds";
+		const libconfig::Setting *classDataSharing = lookup(scopes, "jvm.classDataSharing");
+		if(classDataSharing != nullptr) {
+			if(classDataSharing->getType() == libconfig::Setting::TypeBoolean) {
+				if(!static_cast<bool>(*classDataSharing)) {
+					configuration.sharedArchiveDirectory.clear();
+				}
+			} else {
+				configuration.sharedArchiveDirectory = static_cast<const char*>(*classDataSharing);
+			}
+		}
+
+		configuration.profileDirectory = MINECRAFTSERVERDIR "/.profiles";
+		if(instance != nullptr) {
+			configuration.profileDirectory += '/' + configuration.name;
+		}
+		const libconfig::Setting *profiling = lookup(scopes, "jvm.profiling");
+		if(profiling != nullptr) {
+			if(profiling->getType() == libconfig::Setting::TypeBoolean) {
+				if(!static_cast<bool>(*profiling)) {
+					configuration.profileDirectory.clear();
+				}
+			} else {
+				configuration.profileDirectory = static_cast<const char*>(*profiling);
+			}
+		}
+
+		const libconfig::Setting *preloadClasses = lookup(scopes, "jvm.preloadClasses");
+		if(preloadClasses != nullptr) {
+			const int minutes = *preloadClasses;
+			if(minutes < 0) {
+				throw std::runtime_error{"jvm.preloadClasses must not be negative"};
+			}
+			configuration.classPreloadRecordTime = std::chrono::minutes{minutes};
+		}
+
+		configuration.logStoreDirectory = configuration.serverDirectory + "/.logs";
+		const libconfig::Setting *logStoreDirectory = lookup(scopes, "logStore.directory");
+		if(logStoreDirectory != nullptr) {
+			if(logStoreDirectory->getType() == libconfig::Setting::TypeBoolean) {
+				if(!static_cast<bool>(*logStoreDirectory)) {
+					configuration.logStoreDirectory.clear();
+				}
+			} else {
+				configuration.logStoreDirectory = static_cast<const char*>(*logStoreDirectory);
+			}
+		}
+		const libconfig::Setting *logStoreMaxSize = lookup(scopes, "logStore.maxSize");
+		if(logStoreMaxSize != nullptr) {
+			const int mebibytes = *logStoreMaxSize;
+			if(mebibytes <= 0) {
+				throw std::runtime_error{"logStore.maxSize must be positive"};
+			}
+			configuration.logStoreMaxSize = uint64_t(mebibytes) * 1024 * 1024;
+		}
+
+		const libconfig::Setting *metricsInterval = lookup(scopes, "metrics.interval");
+		if(metricsInterval != nullptr) {
+			const int seconds = *metricsInterval;
+			if(seconds < 0) {
+				throw std::runtime_error{"metrics.interval must not be negative"};
+			}
+			configuration.metricsInterval = std::chrono::seconds{seconds};
+		}
+
+		configuration.metricsSocket = configuration.serverDirectory + "/.minecraftd-metrics.sock";
+		const libconfig::Setting *metricsSocket = lookup(scopes, "metrics.socket");
+		if(metricsSocket != nullptr) {
+			if(metricsSocket->getType() == libconfig::Setting::TypeBoolean) {
+				if(!static_cast<bool>(*metricsSocket)) {
+					configuration.metricsSocket.clear();
+				}
+			} else {
+				configuration.metricsSocket = static_cast<const char*>(*metricsSocket);
+			}
+		}
+
+		lookupString(scopes, "proxy.address", configuration.proxyAddress);
+		const libconfig::Setting *proxyPort = lookup(scopes, "proxy.port");
+		if(proxyPort != nullptr) {
+			const libconfig::Setting *backendPort = lookup(scopes, "proxy.backendPort");
+			const int port = *proxyPort;
+			const int backend = (backendPort != nullptr) ? static_cast<int>(*backendPort) : 0;
+			if((port < 0) || (port > 65535) || (backend < 0) || (backend > 65535) || ((port != 0) && (backend == 0))) {
+				throw std::runtime_error{"proxy.port and proxy.backendPort must be valid ports"};
+			}
+			configuration.proxyPort = port;
+			configuration.proxyBackendPort = backend;
+		}
+
+		const libconfig::Setting *rconSocket = lookup(scopes, "rcon.socket");
+		if((rconSocket != nullptr) && (rconSocket->getType() != libconfig::Setting::TypeBoolean)) {
+			configuration.rconSocket = static_cast<const char*>(*rconSocket);
+		}
+		const libconfig::Setting *rconPort = lookup(scopes, "rcon.port");
+		if(rconPort != nullptr) {
+			const int port = *rconPort;
+			if((port < 0) || (port > 65535)) {
+				throw std::runtime_error{"rcon.port must be a valid port"};
+			}
+			configuration.rconPort = port;
+		}
+		lookupString(scopes, "rcon.password", configuration.rconPassword);
+		const libconfig::Setting *rconRateLimit = lookup(scopes, "rcon.rateLimit");
+		if(rconRateLimit != nullptr) {
+			const int rate = *rconRateLimit;
+			if(rate <= 0) {
+				throw std::runtime_error{"rcon.rateLimit must be positive"};
+			}
+			configuration.rconRateLimit = rate;
+		}
+
+		const libconfig::Setting *hibernateAfter = lookup(scopes, "hibernation.idle");
+		if(hibernateAfter != nullptr) {
+			const int seconds = *hibernateAfter;
+			if(seconds < 0) {
+				throw std::runtime_error{"hibernation.idle must not be negative"};
+			}
+			configuration.hibernateAfter = std::chrono::seconds{seconds};
+		}
+
+		const libconfig::Setting *watchdogStall = lookup(scopes, "watchdog.stall");
+		if(watchdogStall != nullptr) {
+			const int seconds = *watchdogStall;
+			if(seconds < 0) {
+				throw std::runtime_error{"watchdog.stall must not be negative"};
+			}
+			configuration.watchdogStall = std::chrono::seconds{seconds};
+		}
+		configuration.watchdogDumpDirectory = configuration.serverDirectory + "/.dumps";
+		const libconfig::Setting *watchdogDumps = lookup(scopes, "watchdog.dumps");
+		if(watchdogDumps != nullptr) {
+			if(watchdogDumps->getType() == libconfig::Setting::TypeBoolean) {
+				if(!static_cast<bool>(*watchdogDumps)) {
+					configuration.watchdogDumpDirectory.clear();
+				}
+			} else {
+				configuration.watchdogDumpDirectory = static_cast<const char*>(*watchdogDumps);
+			}
+		}
+
+		const libconfig::Setting *warmupBudget = lookup(scopes, "warmup.budget");
+		if(warmupBudget != nullptr) {
+			const int mebibytes = *warmupBudget;
+			if(mebibytes < 0) {
+				throw std::runtime_error{"warmup.budget must not be negative"};
+			}
+			configuration.warmupBudget = size_t(mebibytes) * 1024 * 1024;
+		}
+		const libconfig::Setting *warmupSpawnRadius = lookup(scopes, "warmup.spawnRadius");
+		if(warmupSpawnRadius != nullptr) {
+			configuration.warmupSpawnRadius = *warmupSpawnRadius;
+		}
+
+		const libconfig::Setting *arguments = lookup(scopes, "jvm.arguments");
+		if(arguments != nullptr) {
+			const int count = arguments->getLength();
+			for(int i = 0; i < count; ++i) {
+				configuration.jvmArguments.push_back((*arguments)[i]);
+			}
+		}
+
+		const libconfig::Setting *autoTune = lookup(scopes, "jvm.autoTune");
+		if(autoTune != nullptr) {
+			if(autoTune->getType() == libconfig::Setting::TypeBoolean) {
+				configuration.autoTune.enabled = *autoTune;
+			} else {
+				configuration.autoTune.enabled = true;
+				autoTune->lookupValue("enabled", configuration.autoTune.enabled);
+				autoTune->lookupValue("heapPercent", configuration.autoTune.heapPercent);
+				autoTune->lookupValue("preTouch", configuration.autoTune.preTouch);
+				autoTune->lookupValue("largePages", configuration.autoTune.largePages);
+				if((configuration.autoTune.heapPercent <= 0) || (configuration.autoTune.heapPercent > 100)) {
+					throw std::runtime_error{"jvm.autoTune.heapPercent must be between 1 and 100"};
+				}
+			}
+		}
+
+		const libconfig::Setting *threads = lookup(scopes, "jvm.threads");
+		if(threads != nullptr) {
+			const int count = threads->getLength();
+			for(int i = 0; i < count; ++i) {
+				const libconfig::Setting &setting = (*threads)[i];
+				ThreadRule rule;
+				if(!setting.lookupValue("role", rule.role) || !setting.lookupValue("pattern", rule.pattern)) {
+					throw std::runtime_error{"Thread rule at line " + std::to_string(setting.getSourceLine())
+						+ " must have a role and a pattern"};
+				}
+				std::string cpus;
+				if(setting.lookupValue("cpus", cpus)) {
+					rule.cpus = parseCpuList(cpus);
+				}
+				rule.renice = setting.lookupValue("nice", rule.nice);
+				if((rule.nice < -20) || (rule.nice > 19)) {
+					throw std::runtime_error{"Thread rule " + rule.role + ": nice must be between -20 and 19"};
+				}
+
+				std::string policy;
+				if(setting.lookupValue("policy", policy)) {
+					static const std::vector<std::pair<std::string, int>> POLICIES{{"other", SCHED_OTHER},
+						{"batch", SCHED_BATCH}, {"idle", SCHED_IDLE}, {"fifo", SCHED_FIFO}, {"rr", SCHED_RR}};
+					for(const auto &candidate: POLICIES) {
+						if(candidate.first == policy) {
+							rule.policy = candidate.second;
+						}
+					}
+					if(rule.policy == -1) {
+						throw std::runtime_error{"Thread rule " + rule.role
+							+ ": policy must be other, batch, idle, fifo or rr"};
+					}
+				}
+				const bool realTime = (rule.policy == SCHED_FIFO) || (rule.policy == SCHED_RR);
+				rule.priority = realTime ? 1 : 0;
+				setting.lookupValue("priority", rule.priority);
+				if(realTime ? ((rule.priority < 1) || (rule.priority > 99)) : (rule.priority != 0)) {
+					throw std::runtime_error{"Thread rule " + rule.role
+						+ ": priority must be between 1 and 99 with fifo and rr, and is not used otherwise"};
+				}
+
+				std::string ioClass;
+				if(setting.lookupValue("ioClass", ioClass)) {
+					rule.ioClass = parseIoClass(ioClass, "Thread rule " + rule.role + ": ioClass");
+				}
+				setting.lookupValue("ioPriority", rule.ioPriority);
+				if((rule.ioPriority < 0) || (rule.ioPriority > 7)) {
+					throw std::runtime_error{"Thread rule " + rule.role + ": ioPriority must be between 0 and 7"};
+				}
+				configuration.threadRules.push_back(rule);
+			}
+		}
+
+		const libconfig::Setting *memoryPressure = lookup(scopes, "memoryPressure");
+		if(memoryPressure != nullptr) {
+			MemoryPressureConfiguration &thresholds = configuration.memoryPressure;
+			memoryPressure->lookupValue("window", thresholds.window);
+			memoryPressure->lookupValue("collect", thresholds.collect);
+			memoryPressure->lookupValue("warn", thresholds.warn);
+			memoryPressure->lookupValue("save", thresholds.save);
+			memoryPressure->lookupValue("stop", thresholds.stop);
+			memoryPressure->lookupValue("warning", thresholds.warning);
+			// Unprivileged processes may only register PSI triggers on windows that are multiples of 2 seconds
+			if((thresholds.window < 2) || (thresholds.window > 10) || (thresholds.window % 2 != 0)) {
+				throw std::runtime_error{"memoryPressure.window must be 2, 4, 6, 8 or 10 seconds"};
+			}
+			for(int threshold: {thresholds.collect, thresholds.warn, thresholds.save, thresholds.stop}) {
+				if((threshold < 0) || (threshold > 99)) {
+					throw std::runtime_error{"memoryPressure thresholds must be between 0 and 99"};
+				}
+			}
+		}
+
+		const libconfig::Setting *saves = lookup(scopes, "saves");
+		if(saves != nullptr) {
+			SaveConfiguration &pacing = configuration.saves;
+			int milliseconds;
+			if(saves->lookupValue("flushInterval", milliseconds)) {
+				if(milliseconds < 0) {
+					throw std::runtime_error{"saves.flushInterval must not be negative"};
+				}
+				pacing.flushInterval = std::chrono::milliseconds{milliseconds};
+			}
+			std::string ioClass;
+			if(saves->lookupValue("ioClass", ioClass)) {
+				pacing.ioClass = parseIoClass(ioClass, "saves.ioClass");
+			}
+			saves->lookupValue("ioPriority", pacing.ioPriority);
+			if((pacing.ioPriority < 0) || (pacing.ioPriority > 7)) {
+				throw std::runtime_error{"saves.ioPriority must be between 0 and 7"};
+			}
+			const libconfig::Setting *threadPattern = saves->exists("threads") ? &(*saves)["threads"] : nullptr;
+			if((threadPattern != nullptr) && (threadPattern->getType() == libconfig::Setting::TypeBoolean)) {
+				if(!static_cast<bool>(*threadPattern)) {
+					pacing.threadPattern.clear();
+				}
+			} else if(threadPattern != nullptr) {
+				pacing.threadPattern = static_cast<const char*>(*threadPattern);
+			}
+		}
+
+		if(instance != nullptr) {
+			std::string cpus;
+			if(instance->lookupValue("cpus", cpus)) {
+				configuration.cpus = parseCpuList(cpus);
+			}
+			instance->lookupValue("numaNode", configuration.numaNode);
+		}
+
+		return configuration;
+	}
+}
+
+InstanceConfiguration minecraftd::readInstanceConfiguration(const libconfig::Setting &root) {
+
+	return readConfiguration(&root, nullptr);
+}
+
+InstanceConfiguration minecraftd::readInstanceConfiguration(const libconfig::Setting &root,
+		const libconfig::Setting &instance) {
+
+	return readConfiguration(&root, &instance);
+}
+
+void minecraftd::enterServerDirectory(const std::string &serverDirectory) {
+
+	if(chdir(serverDirectory.c_str()) != 0) {
+		if(errno == ENOENT) {
+			// TODO: Create directory recursively
+			if(mkdir(serverDirectory.c_str(), 0777) != 0) {
+				throw std::system_error(errno, std::system_category());
+			}
+			if(chdir(serverDirectory.c_str()) != 0) {
+				throw std::system_error(errno, std::system_category());
+			}
+		} else {
+			throw std::system_error(errno, std::system_category());
+		}
+	}
+}
+
+std::string minecraftd::formatCpuList(const std::vector<int> &cpus) {
+
+	std::ostringstream formatted;
+	for(size_t i = 0; i < cpus.size();) {
+		size_t j = i;
+		while((j + 1 < cpus.size()) && (cpus[j + 1] == cpus[j] + 1)) {
+			++j;
+		}
+		formatted << ((i == 0) ? "" : ",") << cpus[i];
+		if(j > i) {
+			formatted << '-' << cpus[j];
+		}
+		i = j + 1;
+	}
+	return formatted.str();
+}
+
+std::vector<int> minecraftd::parseCpuList(const std::string &cpuList) {
+
+	std::vector<int> cpus;
+	std::string::size_type start = 0;
+	while(start < cpuList.size()) {
+		auto end = cpuList.find(',', start);
+		std::string range{cpuList.substr(start, end - start)};
+		start = (end == std::string::npos) ? cpuList.size() : end + 1;
+
+		range.erase(0, range.find_first_not_of(" \t\n"));
+		range.erase(range.find_last_not_of(" \t\n") + 1);
+		if(range.empty()) {
+			continue;
+		}
+
+		try {
+			auto dash = range.find('-');
+			int first = std::stoi(range.substr(0, dash));
+			int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+			if((first < 0) || (last < first)) {
+				throw std::invalid_argument{range};
+			}
+			for(int cpu = first; cpu <= last; ++cpu) {
+				cpus.push_back(cpu);
+			}
+		} catch(const std::logic_error&) {
+			throw std::runtime_error{"Invalid CPU list: " + cpuList};
+		}
+	}
+
+	std::sort(cpus.begin(), cpus.end());
+	cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+	return cpus;
+}
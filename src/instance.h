@@ -0,0 +1,163 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <libconfig.h++>
+
+namespace minecraftd {
+
+	/** Settings for sizing the JVM from the memory and CPUs actually available to the instance. */
+	struct AutoTuneConfiguration {
+
+		bool enabled = false;
+		/** Percentage of the available memory given to the Java heap. */
+		int heapPercent = 75;
+		/** Whether the heap may be pre-touched and backed by huge pages. */
+		bool preTouch = true;
+		bool largePages = true;
+	};
+
+	/**
+	 * Thresholds at which the memory-pressure governor acts, as percentages of the PSI window during which some task
+	 * was stalled waiting for memory. A threshold of zero disables its action.
+	 */
+	struct MemoryPressureConfiguration {
+
+		/** PSI window, in seconds. */
+		int window = 2;
+		int collect = 0;
+		int warn = 0;
+		int save = 0;
+		int stop = 0;
+		/** Broadcast to players with "say" at the warn threshold. */
+		std::string warning{"The server is running low on memory, and may have to stop soon."};
+
+		bool enabled() const { return (collect != 0) || (warn != 0) || (save != 0) || (stop != 0); }
+	};
+
+	/** Settings for pacing the writeback of world saves, and for the I/O priority saves are written at. */
+	struct SaveConfiguration {
+
+		/** Interval at which writeback of the region files written is started, or zero to leave it to the kernel. */
+		std::chrono::milliseconds flushInterval{250};
+		/** I/O priority class (as in ThreadRule) and level of the flushes and of the server's save threads. */
+		int ioClass = 2;
+		int ioPriority = 7;
+		/** Regular expression matching the names of the server's save threads, or empty to leave them alone. */
+		std::string threadPattern{"^IO-Worker-"};
+	};
+
+	/**
+	 * How the JVM threads whose names match a pattern are scheduled. Each setting is only applied if given; the others
+	 * are left as the thread inherited them.
+	 */
+	struct ThreadRule {
+
+		/** Name under which matching threads are reported. */
+		std::string role;
+		/** Regular expression matched against thread names. */
+		std::string pattern;
+		/** CPUs matching threads are restricted to, or empty to leave their affinity alone. */
+		std::vector<int> cpus;
+		bool renice = false;
+		int nice = 0;
+		/** SCHED_* policy and its static priority, or a policy of -1 to leave it alone. */
+		int policy = -1;
+		int priority = 0;
+		/** I/O priority class (1 for real-time, 2 for best-effort, 3 for idle) and level, or a class of 0. */
+		int ioClass = 0;
+		int ioPriority = 4;
+	};
+
+	/**
+	 * Settings describing a single hosted Minecraft server. In single-instance mode, these are read from the root of
+	 * the configuration file; in supervisor mode, each entry of the instances list is read with the root settings
+	 * acting as defaults.
+	 */
+	struct InstanceConfiguration {
+
+		std::string name;
+		std::string serverDirectory;
+		std::string jarPath;
+		std::string jvmLibPath;
+		std::string logConfigFileName;
+		std::list<std::string> jvmArguments;
+		AutoTuneConfiguration autoTune;
+		/** Rules classifying the JVM's threads, of which the first matching a thread's name applies. */
+		std::vector<ThreadRule> threadRules;
+		/** Time over which the classes a run loads are recorded, to be preloaded on later runs, or zero to disable. */
+		std::chrono::seconds classPreloadRecordTime{5 * 60};
+		/** Directory holding the content-addressed backups of serverDirectory. */
+		std::string backupDirectory;
+		/** Interval at which JVM and tick metrics are sampled, or zero if metrics are disabled. */
+		std::chrono::seconds metricsInterval{5};
+		/** Unix socket on which metrics are served in the Prometheus text format, or empty for none. */
+		std::string metricsSocket;
+		/** Directory holding the compressed, time-indexed store of log events, or empty if it is disabled. */
+		std::string logStoreDirectory;
+		/** Bytes of log events kept in the store before the oldest are deleted. */
+		uint64_t logStoreMaxSize = 256 * 1024 * 1024;
+		/** Directory to which profiles are written, or empty if profiling is disabled. */
+		std::string profileDirectory;
+		/** Public address and port relayed to the server by the front proxy, or a port of zero for no proxy. */
+		std::string proxyAddress{"0.0.0.0"};
+		unsigned int proxyPort = 0;
+		/** Loopback port the server itself listens on, behind the front proxy. */
+		unsigned int proxyBackendPort = 0;
+		/** Unix socket and loopback TCP port on which RCON is served, either of which may be empty or zero. */
+		std::string rconSocket;
+		unsigned int rconPort = 0;
+		/** Password RCON clients log in with. */
+		std::string rconPassword;
+		/** Commands per second each RCON client may run. */
+		unsigned int rconRateLimit = 20;
+		MemoryPressureConfiguration memoryPressure;
+		SaveConfiguration saves;
+		/** Time without a completed tick after which the server is considered stalled, or zero for no watchdog. */
+		std::chrono::seconds watchdogStall{0};
+		/** Directory to which thread dumps of a stalled server are written, or empty for no dumps. */
+		std::string watchdogDumpDirectory;
+		/** Time the server must be empty before it is hibernated, or zero if hibernation is disabled. */
+		std::chrono::seconds hibernateAfter{0};
+		/** Bytes of region files prefetched into the page cache at startup, or zero if warm-up is disabled. */
+		size_t warmupBudget = 0;
+		/** Distance, in regions, from the spawn region within which regions are prefetched first. */
+		int warmupSpawnRadius = 1;
+		/** Directory holding class-data sharing archives, or empty if class-data sharing is disabled. */
+		std::string sharedArchiveDirectory;
+
+		/** CPUs the instance is restricted to. If empty, the instance may run on any CPU. */
+		std::vector<int> cpus;
+		/** NUMA node the instance's memory is bound to, or -1 if memory placement is left to the kernel. */
+		int numaNode = -1;
+	};
+
+	InstanceConfiguration readInstanceConfiguration(const libconfig::Setting &root);
+	InstanceConfiguration readInstanceConfiguration(const libconfig::Setting &root, const libconfig::Setting &instance);
+
+	/** Changes the working directory to serverDirectory, creating it if it does not already exist. */
+	void enterServerDirectory(const std::string &serverDirectory);
+
+	/** Formats a sorted list of CPU indices as a kernel-style CPU list. */
+	std::string formatCpuList(const std::vector<int> &cpus);
+
+	/** Parses a kernel-style CPU list (e.g. "0-3,8,10-11") into a sorted list of CPU indices. */
+	std::vector<int> parseCpuList(const std::string &cpuList);
+}
@@ -10,10 +10,27 @@
  * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
  * specific language governing permissions and limitations under the License.
  */
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+
+#include "JarReader.h"
+#include "JvmTuning.h"
+#include "LogAppender.h"
 #include "jvm.h"
 
 using namespace minecraftd;
 
+namespace {
+	/** Versioned, so that profiles recorded before the classes of bundled servers were kept are recorded afresh. */
+	const std::string CLASS_PROFILE_FILE_PREFIX{".minecraftd-classes-2-"};
+	const std::string MANIFEST_CACHE_FILE_NAME{".minecraftd-manifests"};
+}
+
 JavaException::JavaException(JNIEnv *jni, bool clearException) {
 
 	jthrowable throwable = jni->ExceptionOccurred();
@@ -83,3 +100,239 @@ const char *JavaException::what() const noexcept(true) {
 
 	return message_.c_str();
 }
+
+std::unique_ptr<JvmMainArguments> minecraftd::createJvmMainArguments(const InstanceConfiguration &instance) {
+
+	ManifestCache manifestCache{MANIFEST_CACHE_FILE_NAME};
+	JarReader jarReader{instance.jarPath, &manifestCache};
+	const std::string mainClassName = jarReader.getMainClassName();
+	const std::vector<std::string> classPath = jarReader.getClassPath();
+	if(classPath.size() > 1) {
+		std::cout << "Class path contains " << classPath.size() << " entries" << std::endl;
+	}
+
+	std::unique_ptr<JvmMainArguments> arguments{new JvmMainArguments{instance.jvmLibPath, classPath, mainClassName,
+		instance.logConfigFileName}};
+	arguments->additionalArguments = instance.jvmArguments;
+	if(instance.autoTune.enabled) {
+		for(const auto &argument: tuneJvmArguments(instance.autoTune, instance.numaNode, instance.jvmArguments)) {
+			arguments->additionalArguments.push_back(argument);
+		}
+	}
+	if(instance.classPreloadRecordTime.count() > 0) {
+		// Keyed by the JAR's contents, so that a profile is recorded afresh whenever the server is upgraded
+		arguments->classProfilePath = CLASS_PROFILE_FILE_PREFIX + jarReader.getContentHash().substr(0, 16);
+		arguments->classRecordTime = instance.classPreloadRecordTime;
+	}
+	arguments->logStoreDirectory = instance.logStoreDirectory;
+	arguments->logStoreMaxSize = instance.logStoreMaxSize;
+	arguments->metricsInterval = instance.metricsInterval;
+	arguments->metricsSocketPath = instance.metricsSocket;
+	arguments->profileDirectory = instance.profileDirectory;
+	std::vector<ThreadRule> threadRules{instance.threadRules};
+	if(!instance.saves.threadPattern.empty()) {
+		// After the configured rules, which may give the save threads settings of their own
+		ThreadRule saveRule;
+		saveRule.role = "save";
+		saveRule.pattern = instance.saves.threadPattern;
+		saveRule.ioClass = instance.saves.ioClass;
+		saveRule.ioPriority = instance.saves.ioPriority;
+		threadRules.push_back(saveRule);
+	}
+	if(!threadRules.empty()) {
+		arguments->threadClassifier.reset(new ThreadClassifier{threadRules});
+	}
+
+	if(!instance.sharedArchiveDirectory.empty()) {
+		arguments->sharedArchive.reset(new SharedArchive{instance.sharedArchiveDirectory, instance.jvmLibPath,
+				classPath, jarReader.getContentHash(), arguments->additionalArguments});
+		for(const auto &option: arguments->sharedArchive->jvmOptions()) {
+			arguments->additionalArguments.push_back(option);
+		}
+		arguments->sharedArchive->buildInBackground();
+	}
+
+	manifestCache.save();
+	return arguments;
+}
+
+namespace {
+	/** Runs the server as jvmMain does, throwing on failure. */
+	void runJvm(JvmMainArguments *arguments) {
+
+		const auto startTime = std::chrono::steady_clock::now();
+
+		void *libjvm = dlopen(arguments->libjvmPath.c_str(), RTLD_LAZY);
+		if(libjvm == nullptr) {
+			throw std::runtime_error{"Failed to load JVM dynamic library: " + std::string{dlerror()}};
+		}
+		const auto loadTime = std::chrono::steady_clock::now();
+
+		minecraftd::JNI_CreateJavaVM JNI_CreateJavaVM = reinterpret_cast<minecraftd::JNI_CreateJavaVM>(dlsym(libjvm,
+					"JNI_CreateJavaVM"));
+		if(JNI_CreateJavaVM == nullptr) {
+			throw std::runtime_error{"Failed to load JNI_CreateJavaVM function: " + std::string{dlerror()}};
+		}
+
+		JavaVMInitArgs jvmArguments;
+		jvmArguments.version = JNI_VERSION_1_6;
+
+		std::vector<JavaVMOption> jvmOptions;
+
+		std::string classPath{"-Djava.class.path="};
+		for(const auto &entry: arguments->classPath) {
+			classPath += ((&entry == &arguments->classPath.front()) ? "" : ":") + entry;
+		}
+		jvmOptions.push_back(JavaVMOption{const_cast<char*>(classPath.c_str()), nullptr});
+
+		// For Oracle-based JVMs, give the process a name for tools such as jcmd and jconsole
+		jvmOptions.push_back(JavaVMOption{const_cast<char*>("-Dsun.java.command=minecraftd"), nullptr});
+
+		std::string log4jOption{"-Dlog4j.configurationFile="};
+		if(!arguments->customLogConfiguration.empty()) {
+			log4jOption += arguments->customLogConfiguration;
+			jvmOptions.push_back(JavaVMOption{const_cast<char*>(log4jOption.c_str()), nullptr});
+		}
+
+		for(auto argument: arguments->additionalArguments) {
+			jvmOptions.push_back(JavaVMOption{const_cast<char*>(argument.c_str()), nullptr});
+		}
+
+		jvmArguments.options = jvmOptions.data();
+		jvmArguments.nOptions = jvmOptions.size();
+		jvmArguments.ignoreUnrecognized = false;
+
+		JavaVM *jvm;
+		JNIEnv *jni;
+		jint jrc = JNI_CreateJavaVM(&jvm, reinterpret_cast<void**>(&jni), &jvmArguments);
+		if(jrc != JNI_OK) {
+			throw std::runtime_error{"Failed to create Java virtual machine"};
+		}
+		arguments->jvm = jvm;
+		const auto createTime = std::chrono::steady_clock::now();
+
+		// Before the server starts any threads of its own
+		if(arguments->threadClassifier != nullptr) {
+			try {
+				arguments->threadClassifier->attach(jvm);
+			} catch(const std::exception &e) {
+				std::cerr << "Threads will not be classified: " << e.what() << std::endl;
+			}
+		}
+
+		// The profiler has to be registered before the server's classes load, for their methods to be identifiable
+		if(!arguments->profileDirectory.empty()) {
+			try {
+				arguments->profiler.reset(new Profiler{jvm, libjvm, arguments->profileDirectory});
+			} catch(const std::runtime_error &e) {
+				std::cerr << "Profiling is unavailable: " << e.what() << std::endl;
+			}
+		}
+
+		// Likewise for recording the classes the server loads; preloading them overlaps with the server's startup
+		if(!arguments->classProfilePath.empty()) {
+			try {
+				arguments->classPreloader.reset(new ClassPreloader{jvm, arguments->classProfilePath,
+						arguments->classRecordTime});
+			} catch(const std::exception &e) {
+				std::cerr << "Classes will not be preloaded: " << e.what() << std::endl;
+			}
+		}
+
+		std::string mainClassSpec{arguments->mainClassName};
+		for(size_t i = mainClassSpec.find('.'); i != std::string::npos; i = mainClassSpec.find('.', i)) {
+			mainClassSpec[i] = '/';
+		}
+
+		jclass mainClass = jni->FindClass(mainClassSpec.c_str());
+		if(mainClass == nullptr) {
+			JavaException e{jni};
+			if(e.type() == "java.lang.NoClassDefFoundError") {
+				throw std::runtime_error{"Could not find main class: " + arguments->mainClassName};
+			} else {
+				throw e;
+			}
+		}
+
+		jmethodID mainMethod = jni->GetStaticMethodID(mainClass, "main", "([Ljava/lang/String;)V");
+		if(mainMethod == nullptr) {
+			JavaException e{jni};
+			if(e.type() == "java.lang.NoSuchMethodError") {
+				throw std::runtime_error{"Could not find `void main(String[])' method in " + arguments->mainClassName};
+			} else {
+				throw e;
+			}
+		}
+
+		const auto lookupTime = std::chrono::steady_clock::now();
+		const auto startupTime = std::chrono::duration_cast<std::chrono::milliseconds>(lookupTime - startTime);
+		auto microseconds = [](std::chrono::steady_clock::duration duration) {
+			return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+		};
+		// Parsed by the startup benchmark (bench/minecraftd-bench.cpp)
+		std::cout << "JVM startup phases: dlopen " << microseconds(loadTime - startTime) << " us, JNI_CreateJavaVM "
+			<< microseconds(createTime - loadTime) << " us, main class lookup " << microseconds(lookupTime - createTime)
+			<< " us" << std::endl;
+		if(arguments->sharedArchive != nullptr) {
+			arguments->sharedArchive->recordStartupTime(startupTime);
+		} else {
+			std::cout << "JVM start took " << startupTime.count() << " ms" << std::endl;
+		}
+
+		jclass stringClass = jni->FindClass("java/lang/String");
+		if(stringClass == nullptr) {
+			throw JavaException{jni};
+		}
+
+		jobjectArray mainArguments = jni->NewObjectArray(1, stringClass, nullptr);
+		if(mainArguments == nullptr) {
+			throw JavaException{jni};
+		}
+
+		jstring noguiString = jni->NewStringUTF("nogui");
+		if(noguiString == nullptr) {
+			throw JavaException{jni};
+		}
+
+		jni->SetObjectArrayElement(mainArguments, 0, noguiString);
+		if(jni->ExceptionCheck()) {
+			throw JavaException{jni};
+		}
+
+		if(arguments->metricsInterval.count() > 0) {
+			arguments->metrics.reset(new JvmMetrics{jvm, arguments->metricsInterval, arguments->metricsSocketPath});
+		}
+
+		// Added before the server starts, so that it sees every event logged (or, for bundled servers, waits for log4j)
+		if(!arguments->logStoreDirectory.empty()) {
+			try {
+				installLogAppender(jni, std::unique_ptr<LogStore>{new LogStore{arguments->logStoreDirectory,
+						arguments->logStoreMaxSize}});
+			} catch(const std::exception &e) {
+				std::cerr << "Log events will not be stored: " << e.what() << std::endl;
+			}
+		}
+
+		if(arguments->lifecycle != nullptr) {
+			std::cout << "Signalling completion of JVM startup" << std::endl;
+			arguments->lifecycle->post(JvmLifecycle::Event::CREATED);
+		}
+
+		jni->CallStaticVoidMethod(mainClass, mainMethod, mainArguments);
+		if(jni->ExceptionCheck()) {
+			throw JavaException{jni};
+		}
+	}
+}
+
+void minecraftd::jvmMain(JvmMainArguments *arguments) {
+
+	try {
+		runJvm(arguments);
+	} catch(const std::exception &e) {
+		if(arguments->lifecycle == nullptr) {
+			throw;
+		}
+		arguments->lifecycle->post(JvmLifecycle::Event::FAILED, e.what());
+	}
+}
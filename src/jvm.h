@@ -12,28 +12,64 @@
  */
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <list>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <glibmm.h>
 #include <jni.h>
 
+#include "ClassPreloader.h"
+#include "JvmLifecycle.h"
+#include "JvmMetrics.h"
+#include "Profiler.h"
+#include "SharedArchive.h"
+#include "ThreadClassifier.h"
+#include "instance.h"
+
 namespace minecraftd {
 	typedef jint (JNICALL *JNI_CreateJavaVM)(JavaVM **pvm, void  **penv, void *args);
 
 	struct JvmMainArguments {
 
-		JvmMainArguments(const std::string &libjvmPath_, const std::string &jarPath_, const std::string &mainClassName_,
-				const std::string &customLogConfiguration_)
-			: customLogConfiguration{customLogConfiguration_}, jarPath{jarPath_}, libjvmPath{libjvmPath_},
+		JvmMainArguments(const std::string &libjvmPath_, const std::vector<std::string> &classPath_,
+				const std::string &mainClassName_, const std::string &customLogConfiguration_)
+			: classPath(classPath_), customLogConfiguration{customLogConfiguration_}, libjvmPath{libjvmPath_},
 			mainClassName{mainClassName_} { }
 
 		std::list<std::string> additionalArguments;
+		/** Created by jvmMain along with the JVM, if classProfilePath is not empty and the JVM supports it. */
+		std::unique_ptr<ClassPreloader> classPreloader;
+		/** Profile of the classes the server loads, recorded over classRecordTime of a run and preloaded later. */
+		std::string classProfilePath;
+		std::chrono::seconds classRecordTime;
+		/** The server JAR, followed by the JARs it references through Class-Path manifest attributes. */
+		const std::vector<std::string> classPath;
 		const std::string customLogConfiguration;
-		const std::string jarPath;
-		pthread_cond_t jvmCompleteCondition;
+		/** Set by jvmMain once the JVM has been created. */
+		JavaVM *jvm = nullptr;
 		const std::string libjvmPath;
+		/** If not null, told once the JVM has been created, or if it fails. */
+		JvmLifecycle *lifecycle = nullptr;
+		/** If not empty, log events are kept in a log store in this directory, fed by jvmMain's log4j appender. */
+		std::string logStoreDirectory;
+		uint64_t logStoreMaxSize;
 		const std::string mainClassName;
+		/** Created by jvmMain once the JVM is up, if metricsInterval is not zero. */
+		std::unique_ptr<JvmMetrics> metrics;
+		std::chrono::seconds metricsInterval;
+		std::string metricsSocketPath;
+		/** Created by jvmMain along with the JVM, if profileDirectory is not empty and the JVM supports it. */
+		std::unique_ptr<Profiler> profiler;
+		std::string profileDirectory;
+		/** If not null, the class-data sharing archive whose options are included in additionalArguments. */
+		std::unique_ptr<const SharedArchive> sharedArchive;
+		/** If not null, attached by jvmMain to the JVM as soon as it has been created. */
+		std::unique_ptr<ThreadClassifier> threadClassifier;
 	};
 
 	class JavaException : public std::exception {
@@ -48,4 +84,18 @@ namespace minecraftd {
 			Glib::ustring message_;
 			Glib::ustring type_;
 	};
+
+	/**
+	 * Prepares the arguments for jvmMain from an instance's configuration: reads the server JAR's manifest (through the
+	 * manifest cache in the current directory) and sets up class-data sharing. The current directory must already be
+	 * the instance's server directory.
+	 */
+	std::unique_ptr<JvmMainArguments> createJvmMainArguments(const InstanceConfiguration &instance);
+
+	/**
+	 * Loads the JVM library, creates a Java virtual machine and invokes the main class' main method on the calling
+	 * thread, returning once the main method does. If arguments has a lifecycle, CREATED is posted to it once the JVM
+	 * has been created (and metrics, if enabled, started), and FAILED in place of any exception being thrown.
+	 */
+	void jvmMain(JvmMainArguments *arguments);
 }
@@ -10,10 +10,18 @@
  * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
  * specific language governing permissions and limitations under the License.
  */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <iostream>
+#include <map>
 #include <mutex>
-#include <unordered_map>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <vector>
 
 #include "minecraftd-dbus.h"
 
@@ -21,108 +29,748 @@ using namespace minecraftd;
 
 const Glib::ustring Minecraftd1::INTERFACE{"net.za.slyfox.Minecraftd1"};
 
-namespace std {
-	template<>
-	struct hash<Glib::ustring> {
-
-		size_t operator()(const Glib::ustring &value) const {
-
-			size_t hash = 31;
-			for(auto i: value) {
-				hash = 31 * hash + i;
-			}
-			return hash;
-		}
-	};
-}
-
 namespace {
 	const Glib::ustring INTROSPECTION_XML{
 		"<node>\n"
 		"\t<interface name='net.za.slyfox.Minecraftd1'>\n"
+		"\t\t<method name='Backup'>\n"
+		"\t\t\t<arg name='snapshot' type='s' direction='out' />\n"
+		"\t\t\t<arg name='files' type='t' direction='out' />\n"
+		"\t\t\t<arg name='filesCopied' type='t' direction='out' />\n"
+		"\t\t\t<arg name='bytesCopied' type='t' direction='out' />\n"
+		"\t\t\t<arg name='saveOffMilliseconds' type='t' direction='out' />\n"
+		"\t\t</method>\n"
+		"\t\t<method name='ExecuteCommand'>\n"
+		"\t\t\t<arg name='command' type='s' direction='in' />\n"
+		"\t\t\t<arg name='output' type='as' direction='out' />\n"
+		"\t\t</method>\n"
+		"\t\t<method name='ProxyConnections'>\n"
+		"\t\t\t<arg name='connections' type='a(stttub)' direction='out' />\n"
+		"\t\t</method>\n"
+		"\t\t<method name='QueryLogs'>\n"
+		"\t\t\t<arg name='from' type='t' direction='in' />\n"
+		"\t\t\t<arg name='to' type='t' direction='in' />\n"
+		"\t\t\t<arg name='minLevel' type='s' direction='in' />\n"
+		"\t\t\t<arg name='pattern' type='s' direction='in' />\n"
+		"\t\t\t<arg name='events' type='a(tssss)' direction='out' />\n"
+		"\t\t</method>\n"
 		"\t\t<method name='SaveAll' />\n"
 		"\t\t<method name='SaveOff' />\n"
 		"\t\t<method name='SaveOn' />\n"
+		"\t\t<method name='StartProfiling'>\n"
+		"\t\t\t<arg name='interval' type='u' direction='in' />\n"
+		"\t\t</method>\n"
 		"\t\t<method name='Stop' />\n"
+		"\t\t<method name='StopProfiling'>\n"
+		"\t\t\t<arg name='path' type='s' direction='out' />\n"
+		"\t\t</method>\n"
+		"\t\t<method name='Tail'>\n"
+		"\t\t\t<arg name='count' type='u' direction='in' />\n"
+		"\t\t\t<arg name='firstSequence' type='t' direction='out' />\n"
+		"\t\t\t<arg name='lines' type='as' direction='out' />\n"
+		"\t\t</method>\n"
+		"\t\t<signal name='ConsoleOutput'>\n"
+		"\t\t\t<arg name='firstSequence' type='t' />\n"
+		"\t\t\t<arg name='lines' type='as' />\n"
+		"\t\t\t<arg name='skipped' type='t' />\n"
+		"\t\t</signal>\n"
+		"\t\t<property name='CommandQueueCapacity' type='u' access='read' />\n"
+		"\t\t<property name='CommandQueueDepth' type='u' access='read' />\n"
+		"\t\t<property name='CommandQueueHighWaterMark' type='u' access='read' />\n"
+		"\t\t<property name='CommandsRejected' type='t' access='read' />\n"
+		"\t\t<property name='CommandWriteLatency' type='t' access='read' />\n"
+		"\t\t<property name='CommandWriteLatencyMax' type='t' access='read' />\n"
+		"\t\t<property name='State' type='s' access='read' />\n"
+		"\t\t<property name='StartupTime' type='t' access='read' />\n"
+		"\t\t<property name='StartupTimeline' type='a(stt)' access='read' />\n"
+		"\t\t<property name='HeapUsed' type='t' access='read' />\n"
+		"\t\t<property name='HeapCommitted' type='t' access='read' />\n"
+		"\t\t<property name='HeapMax' type='t' access='read' />\n"
+		"\t\t<property name='NonHeapUsed' type='t' access='read' />\n"
+		"\t\t<property name='GcCount' type='t' access='read' />\n"
+		"\t\t<property name='GcTime' type='t' access='read' />\n"
+		"\t\t<property name='ThreadCount' type='u' access='read' />\n"
+		"\t\t<property name='LoadedClassCount' type='u' access='read' />\n"
+		"\t\t<property name='MeanTickTime' type='d' access='read'>\n"
+		"\t\t\t<annotation name='org.freedesktop.DBus.Description' value='Mean of the last 100 tick durations, in "
+			"milliseconds, inferred from the server&apos;s fields rather than measured.' />\n"
+		"\t\t</property>\n"
+		"\t\t<property name='MaxTickTime' type='d' access='read'>\n"
+		"\t\t\t<annotation name='org.freedesktop.DBus.Description' value='Longest of the last 100 tick durations, in "
+			"milliseconds, inferred from the server&apos;s fields rather than measured.' />\n"
+		"\t\t</property>\n"
+		"\t\t<property name='HibernationState' type='s' access='read' />\n"
+		"\t\t<property name='PlayersOnline' type='u' access='read' />\n"
+		"\t\t<property name='MemoryPressureActions' type='a(tss)' access='read' />\n"
+		"\t\t<property name='ProxyConnectionCount' type='u' access='read' />\n"
+		"\t\t<property name='ThreadRoles' type='a(usss)' access='read' />\n"
+		"\t\t<property name='CurrentSave' type='(ttuttt)' access='read' />\n"
+		"\t\t<property name='RecentSaves' type='a(ttuttt)' access='read' />\n"
 		"\t</interface>\n"
 		"</node>"
 	};
 
-	/* The bucket_count value used here should result in no hash collisions, if possibly at the expense of some wasted
-	 * memory. */
-	std::unordered_map<Glib::ustring,
-		std::function<void(Minecraftd1*, const Glib::RefPtr<Gio::DBus::MethodInvocation>&)>> handlerMap{11};
+	/** Maps method names to their handlers; ordered, so that lookups cost no more however the names would hash. */
+	std::map<Glib::ustring, std::function<void(Minecraftd1*, const Glib::VariantContainerBase&,
+		const Glib::RefPtr<Gio::DBus::MethodInvocation>&)>> handlerMap;
+
+	/** Maps property names to functions returning their current values. */
+	std::map<Glib::ustring, std::function<Glib::VariantBase(const Minecraftd1*)>> propertyMap;
+
+	/** Names of the properties backed by JvmMetrics, whose changes are announced through PropertiesChanged. */
+	const std::vector<const char*> METRIC_PROPERTIES{"HeapUsed", "HeapCommitted", "HeapMax", "NonHeapUsed", "GcCount",
+		"GcTime", "ThreadCount", "LoadedClassCount", "MeanTickTime", "MaxTickTime"};
+	/** Names of the properties backed by Hibernator, whose changes are announced through PropertiesChanged. */
+	const std::vector<const char*> HIBERNATION_PROPERTIES{"HibernationState", "PlayersOnline"};
+	const std::vector<const char*> STATE_PROPERTIES{"State", "StartupTime", "StartupTimeline"};
+	/** Names of the properties backed by SavePacer, whose changes are announced through PropertiesChanged. */
+	const std::vector<const char*> SAVE_PROPERTIES{"CurrentSave", "RecentSaves"};
+
+	typedef std::tuple<guint64, guint64, guint32, guint64, guint64, guint64> SaveTuple;
+
+	/** Converts a save to its D-Bus form: start (ms since the epoch), duration (ms), regions, bytes, latency (us). */
+	SaveTuple saveToTuple(const minecraftd::SavePacer::Save &save) {
+
+		return SaveTuple{std::chrono::duration_cast<std::chrono::milliseconds>(save.start.time_since_epoch()).count(),
+			save.duration.count(), save.regions, save.bytesWritten, save.bytesPending, save.peakLatency.count()};
+	}
 
 	std::once_flag handlerMapInitFlag;
 
-	void writeAll(const int fd, const std::string &buffer_) {
+	/**
+	 * Converts console output to the UTF-8 that D-Bus requires, replacing any invalid byte sequences with U+FFFD.
+	 */
+	Glib::ustring toUtf8(const std::string &text) {
+
+		std::string result;
+		const char *begin = text.data();
+		const char *end = begin + text.size();
+		const gchar *invalid;
+		while(!g_utf8_validate(begin, end - begin, &invalid)) {
+			result.append(begin, invalid);
+			result.append("\xEF\xBF\xBD");
+			begin = invalid + 1;
+		}
+		result.append(begin, end);
+		return result;
+	}
 
-		const std::string::size_type size = buffer_.size();
-		const char *buffer = buffer_.c_str();
+	/** Converts lines of console output to the arguments of a Tail reply or ConsoleOutput signal. */
+	std::vector<Glib::VariantBase> linesToVariants(const std::vector<ConsoleBuffer::Line> &lines,
+			uint64_t firstSequence) {
 
-		size_t totalWritten = 0;
-		while(totalWritten < size) {
-			ssize_t written = write(fd, buffer + totalWritten, size - totalWritten);
-			if(written == -1) {
-				throw std::system_error(errno, std::system_category());
-			}
-			totalWritten += written;
+		std::vector<Glib::ustring> text;
+		text.reserve(lines.size());
+		for(const auto &line: lines) {
+			text.push_back(toUtf8(line.text));
 		}
+		return std::vector<Glib::VariantBase>{Glib::Variant<guint64>::create(lines.empty() ? firstSequence
+				: lines.front().sequence), Glib::Variant<std::vector<Glib::ustring>>::create(text)};
 	}
 }
 
-Minecraftd1::Minecraftd1(const Glib::ustring &objectName, const PosixPipe &pipe)
-	: busName_{Gio::DBus::own_name(Gio::DBus::BUS_TYPE_SYSTEM, INTERFACE,
-			sigc::mem_fun(*this, &Minecraftd1::onBusAcquired))},
+const unsigned int Minecraftd1::CONSOLE_SIGNAL_INTERVAL;
+const size_t Minecraftd1::MAX_SIGNALLED_LINES;
+const unsigned int Minecraftd1::HOLD_TIMEOUT;
+
+Minecraftd1::Minecraftd1(const Glib::ustring &objectName, const InstanceConfiguration &configuration,
+		CommandQueue &commandQueue, const ConsoleBuffer &console, StartupTracker &startup, Hibernator *hibernator,
+		const MemoryGovernor *governor, const FrontProxy *proxy)
+	: commandQueue_(commandQueue),
+	console_(console),
+	consoleSequence_{console.sequence()},
+	executor_{commandQueue, console},
+	governor_{governor},
+	hibernator_{hibernator},
 	introspectionData_{Gio::DBus::NodeInfo::create_for_xml(INTROSPECTION_XML)},
+	metrics_{nullptr},
 	objectName_{objectName},
-	pipe_(pipe),
-	vtable_{sigc::mem_fun(*this, &Minecraftd1::onMethodCall)} {
+	profiler_{nullptr},
+	proxy_{proxy},
+	startup_(startup),
+	registrationId_{0},
+	state_{startup.ready() ? State::RUNNING : State::STARTING},
+	threadClassifier_{nullptr},
+	vtable_{sigc::mem_fun(*this, &Minecraftd1::onMethodCall), sigc::mem_fun(*this, &Minecraftd1::onGetProperty)} {
+
+	// Commands sent while the server starts are written once it is ready, when their output can be collected, or once
+	// it has had long enough, in case its readiness is never seen (its log configuration not logging to the console,
+	// say)
+	executor_.setHeld(state_ == State::STARTING);
+	if(state_ == State::STARTING) {
+		holdSource_ = Glib::signal_timeout().connect_seconds([this]() {
+			if(state_ == State::STARTING) {
+				std::cerr << objectName_ << ": the server has not reported ready after " << HOLD_TIMEOUT
+					<< " s; writing held commands" << std::endl;
+				executor_.setHeld(false);
+			}
+			return false;
+		}, HOLD_TIMEOUT);
+	}
+	startup.addListener([this](const std::string&, bool ready) {
+		if(ready) {
+			setState(State::RUNNING);
+		}
+	});
+
+	backup_.reset(new Backup{configuration.serverDirectory, configuration.backupDirectory,
+			{configuration.logStoreDirectory, configuration.profileDirectory, configuration.sharedArchiveDirectory},
+			executor_, console_});
+	if(!configuration.logStoreDirectory.empty()) {
+		logReader_.reset(new LogReader{configuration.logStoreDirectory});
+	}
+	if(configuration.saves.flushInterval.count() > 0) {
+		try {
+			savePacer_.reset(new SavePacer{configuration.serverDirectory, configuration.saves});
+		} catch(const std::system_error &e) {
+			std::cerr << "World saves will not be paced: " << e.what() << std::endl;
+		}
+	}
+	if(!configuration.rconSocket.empty() || (configuration.rconPort != 0)) {
+		rcon_.reset(new RconServer{executor_, configuration.rconSocket, configuration.rconPort,
+				configuration.rconPassword, configuration.rconRateLimit, [this]{
+			if(hibernator_ != nullptr) {
+				hibernator_->wake();
+			}
+		}});
+	}
 
 	std::call_once(handlerMapInitFlag, []{
 		using namespace std::placeholders;
-		handlerMap.emplace("SaveAll", std::bind(&Minecraftd1::handleSimpleCommand, _1, _2, "save-all"));
-		handlerMap.emplace("SaveOn", std::bind(&Minecraftd1::handleSimpleCommand, _1, _2, "save-on"));
-		handlerMap.emplace("SaveOff", std::bind(&Minecraftd1::handleSimpleCommand, _1, _2, "save-off"));
-		handlerMap.emplace("Stop", std::bind(&Minecraftd1::handleSimpleCommand, _1, _2, "stop"));
-
-		for(size_t i = 0; i < handlerMap.bucket_count(); ++i) {
-			if(handlerMap.bucket_size(i) > 1) {
-				std::cout << "Warning: Collision detected in handler map bucket " << i << std::endl;
+		handlerMap.emplace("Backup", std::bind(&Minecraftd1::handleBackup, _1, _3));
+		handlerMap.emplace("ExecuteCommand", std::bind(&Minecraftd1::handleExecuteCommand, _1, _2, _3));
+		handlerMap.emplace("ProxyConnections", std::bind(&Minecraftd1::handleProxyConnections, _1, _3));
+		handlerMap.emplace("QueryLogs", std::bind(&Minecraftd1::handleQueryLogs, _1, _2, _3));
+		handlerMap.emplace("SaveAll", std::bind(&Minecraftd1::handleSimpleCommand, _1, _3, "save-all"));
+		handlerMap.emplace("SaveOn", std::bind(&Minecraftd1::handleSimpleCommand, _1, _3, "save-on"));
+		handlerMap.emplace("SaveOff", std::bind(&Minecraftd1::handleSimpleCommand, _1, _3, "save-off"));
+		handlerMap.emplace("StartProfiling", std::bind(&Minecraftd1::handleStartProfiling, _1, _2, _3));
+		handlerMap.emplace("Stop", std::bind(&Minecraftd1::handleSimpleCommand, _1, _3, "stop"));
+		handlerMap.emplace("StopProfiling", std::bind(&Minecraftd1::handleStopProfiling, _1, _3));
+		handlerMap.emplace("Tail", std::bind(&Minecraftd1::handleTail, _1, _2, _3));
+
+		propertyMap.emplace("CommandQueueCapacity", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint32>::create(self->commandQueue_.statistics().capacity);
+		});
+		propertyMap.emplace("CommandQueueDepth", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint32>::create(self->commandQueue_.statistics().depth);
+		});
+		propertyMap.emplace("CommandQueueHighWaterMark", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint32>::create(self->commandQueue_.statistics().highWaterMark);
+		});
+		propertyMap.emplace("CommandsRejected", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint64>::create(self->commandQueue_.statistics().rejected);
+		});
+		propertyMap.emplace("CommandWriteLatency", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint64>::create(self->commandQueue_.statistics().lastLatency);
+		});
+		propertyMap.emplace("CommandWriteLatencyMax", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint64>::create(self->commandQueue_.statistics().maxLatency);
+		});
+		propertyMap.emplace("State", [](const Minecraftd1 *self) {
+			return Glib::Variant<Glib::ustring>::create(stateName(self->state_));
+		});
+		propertyMap.emplace("StartupTime", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint64>::create(self->startup_.startupTime().count());
+		});
+		propertyMap.emplace("StartupTimeline", [](const Minecraftd1 *self) {
+			std::vector<std::tuple<Glib::ustring, guint64, guint64>> timeline;
+			for(const auto &phase: self->startup_.timeline()) {
+				timeline.emplace_back(phase.name, phase.start.count(), phase.duration.count());
 			}
-		}
+			return Glib::Variant<std::vector<std::tuple<Glib::ustring, guint64, guint64>>>::create(timeline);
+		});
+		propertyMap.emplace("HeapUsed", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint64>::create(self->latestMetrics().heapUsed);
+		});
+		propertyMap.emplace("HeapCommitted", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint64>::create(self->latestMetrics().heapCommitted);
+		});
+		propertyMap.emplace("HeapMax", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint64>::create(self->latestMetrics().heapMax);
+		});
+		propertyMap.emplace("NonHeapUsed", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint64>::create(self->latestMetrics().nonHeapUsed);
+		});
+		propertyMap.emplace("GcCount", [](const Minecraftd1 *self) {
+			guint64 collections = 0;
+			for(const auto &collector: self->latestMetrics().garbageCollectors) {
+				collections += collector.collections;
+			}
+			return Glib::Variant<guint64>::create(collections);
+		});
+		propertyMap.emplace("GcTime", [](const Minecraftd1 *self) {
+			guint64 time = 0;
+			for(const auto &collector: self->latestMetrics().garbageCollectors) {
+				time += collector.time;
+			}
+			return Glib::Variant<guint64>::create(time);
+		});
+		propertyMap.emplace("ThreadCount", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint32>::create(self->latestMetrics().threads);
+		});
+		propertyMap.emplace("LoadedClassCount", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint32>::create(self->latestMetrics().loadedClasses);
+		});
+		propertyMap.emplace("MeanTickTime", [](const Minecraftd1 *self) {
+			return Glib::Variant<double>::create(self->latestMetrics().meanTickTime);
+		});
+		propertyMap.emplace("MaxTickTime", [](const Minecraftd1 *self) {
+			return Glib::Variant<double>::create(self->latestMetrics().maxTickTime);
+		});
+		propertyMap.emplace("HibernationState", [](const Minecraftd1 *self) {
+			return Glib::Variant<Glib::ustring>::create((self->hibernator_ != nullptr)
+					? Hibernator::stateName(self->hibernator_->state()) : "disabled");
+		});
+		propertyMap.emplace("PlayersOnline", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint32>::create((self->hibernator_ != nullptr) ? self->hibernator_->players() : 0);
+		});
+		propertyMap.emplace("MemoryPressureActions", [](const Minecraftd1 *self) {
+			std::vector<std::tuple<guint64, Glib::ustring, Glib::ustring>> actions;
+			if(self->governor_ != nullptr) {
+				for(const auto &record: self->governor_->records()) {
+					actions.emplace_back(std::chrono::duration_cast<std::chrono::milliseconds>(
+								record.time.time_since_epoch()).count(), MemoryGovernor::actionName(record.action),
+							record.pressure);
+				}
+			}
+			return Glib::Variant<std::vector<std::tuple<guint64, Glib::ustring, Glib::ustring>>>::create(actions);
+		});
+		propertyMap.emplace("ProxyConnectionCount", [](const Minecraftd1 *self) {
+			return Glib::Variant<guint32>::create((self->proxy_ != nullptr) ? self->proxy_->connections().size() : 0);
+		});
+		propertyMap.emplace("CurrentSave", [](const Minecraftd1 *self) {
+			minecraftd::SavePacer::Save save;
+			if(!self->savePacer_ || !self->savePacer_->current(save)) {
+				return Glib::Variant<SaveTuple>::create(SaveTuple{0, 0, 0, 0, 0, 0});
+			}
+			return Glib::Variant<SaveTuple>::create(saveToTuple(save));
+		});
+		propertyMap.emplace("RecentSaves", [](const Minecraftd1 *self) {
+			std::vector<SaveTuple> saves;
+			if(self->savePacer_) {
+				for(const auto &save: self->savePacer_->history()) {
+					saves.push_back(saveToTuple(save));
+				}
+			}
+			return Glib::Variant<std::vector<SaveTuple>>::create(saves);
+		});
+		propertyMap.emplace("ThreadRoles", [](const Minecraftd1 *self) {
+			std::vector<std::tuple<guint32, Glib::ustring, Glib::ustring, Glib::ustring>> roles;
+			if(self->threadClassifier_ != nullptr) {
+				for(const auto &assignment: self->threadClassifier_->assignments()) {
+					roles.emplace_back(assignment.tid, assignment.name, assignment.role, assignment.settings);
+				}
+			}
+			return Glib::Variant<std::vector<std::tuple<guint32, Glib::ustring, Glib::ustring, Glib::ustring>>>::create(
+					roles);
+		});
 	});
 }
 
 Minecraftd1::~Minecraftd1() {
 
-	Gio::DBus::unown_name(busName_);
+	consoleSource_.disconnect();
+	hibernationSource_.disconnect();
+	holdSource_.disconnect();
+	metricsSource_.disconnect();
+	saveSource_.disconnect();
+	if(connection_) {
+		connection_->unregister_object(registrationId_);
+	}
+}
+
+void Minecraftd1::registerObject(const Glib::RefPtr<Gio::DBus::Connection> &connection) {
+
+	registrationId_ = connection->register_object(objectName_, introspectionData_->lookup_interface(), vtable_);
+	connection_ = connection;
+
+	consoleSequence_ = console_.sequence();
+	consoleSource_ = Glib::signal_timeout().connect(sigc::mem_fun(*this, &Minecraftd1::onConsoleTimer),
+			CONSOLE_SIGNAL_INTERVAL);
+
+	startMetricsTimer();
+	if(hibernator_ != nullptr) {
+		hibernationSource_ = Glib::signal_timeout().connect(sigc::mem_fun(*this, &Minecraftd1::onHibernationTimer),
+				Hibernator::CHECK_INTERVAL);
+	}
+	if(savePacer_) {
+		saveSource_ = Glib::signal_timeout().connect_seconds([this]() {
+			announceChanges(SAVE_PROPERTIES);
+			return true;
+		}, 1);
+	}
+}
+
+const char* Minecraftd1::stateName(State state) {
+
+	switch(state) {
+		case State::STARTING: return "Starting";
+		case State::RUNNING: return "Running";
+		case State::STOPPING: return "Stopping";
+		case State::FAILED: return "Failed";
+	}
+	return "Unknown";
+}
+
+void Minecraftd1::attachJvm(const JvmMetrics *metrics, Profiler *profiler, const ThreadClassifier *classifier) {
+
+	metrics_ = metrics;
+	profiler_ = profiler;
+	threadClassifier_ = classifier;
+	if(connection_) {
+		startMetricsTimer();
+	}
+}
+
+void Minecraftd1::setState(State state) {
+
+	if((state == state_) || (state_ == State::FAILED) || ((state_ == State::STOPPING) && (state != State::FAILED))
+			|| ((state == State::RUNNING) && (state_ != State::STARTING))) {
+		return;
+	}
+
+	std::cout << objectName_ << ": " << stateName(state_) << " -> " << stateName(state) << std::endl;
+	state_ = state;
+	if(state_ == State::FAILED) {
+		executor_.abandon();
+	}
+	executor_.setHeld(state_ == State::STARTING);
+	if(connection_) {
+		announceChanges(STATE_PROPERTIES);
+	}
+}
+
+void Minecraftd1::startMetricsTimer() {
+
+	if((metrics_ != nullptr) && !metricsSource_.connected()) {
+		// PropertiesChanged is emitted at most once per sample, however often the properties are read
+		metricsSource_ = Glib::signal_timeout().connect_seconds(sigc::mem_fun(*this, &Minecraftd1::onMetricsTimer),
+				std::max<unsigned int>(metrics_->interval().count(), 1));
+	}
+}
+
+bool Minecraftd1::onConsoleTimer() {
+
+	const uint64_t sequence = console_.sequence();
+	if(sequence == consoleSequence_) {
+		return true;
+	}
+
+	// Under a log storm, publish only the most recent lines; subscribers learn how many were skipped, and may fetch
+	// them with Tail while they are still buffered
+	const uint64_t first = std::max<uint64_t>(consoleSequence_, sequence - std::min<uint64_t>(sequence,
+			MAX_SIGNALLED_LINES));
+	std::vector<ConsoleBuffer::Line> lines = console_.since(first, sequence - first);
+	const uint64_t skipped = (sequence - consoleSequence_) - lines.size();
+	consoleSequence_ = sequence;
+
+	std::vector<Glib::VariantBase> arguments = linesToVariants(lines, first);
+	arguments.push_back(Glib::Variant<guint64>::create(skipped));
+	connection_->emit_signal(objectName_, INTERFACE, "ConsoleOutput", Glib::ustring{},
+			Glib::VariantContainerBase::create_tuple(arguments));
+	return true;
 }
 
-void Minecraftd1::onBusAcquired(const Glib::RefPtr<Gio::DBus::Connection> &connection, const Glib::ustring &name) {
+bool Minecraftd1::onHibernationTimer() {
 
-	connection->register_object(objectName_, introspectionData_->lookup_interface(), vtable_);
+	announceChanges(HIBERNATION_PROPERTIES);
+	return true;
+}
+
+bool Minecraftd1::onMetricsTimer() {
+
+	announceChanges(METRIC_PROPERTIES);
+	return true;
+}
+
+void Minecraftd1::announceChanges(const std::vector<const char*> &names) {
+
+	std::map<Glib::ustring, Glib::VariantBase> changed;
+	for(const char *name: names) {
+		Glib::VariantBase value = propertyMap.at(name)(this);
+		auto previous = announcedValues_.find(name);
+		if((previous == announcedValues_.end()) || !previous->second.equal(value)) {
+			changed[name] = value;
+			announcedValues_[name] = value;
+		}
+	}
+
+	if(!changed.empty()) {
+		connection_->emit_signal(objectName_, "org.freedesktop.DBus.Properties", "PropertiesChanged", Glib::ustring{},
+				Glib::VariantContainerBase::create_tuple(std::vector<Glib::VariantBase>{
+					Glib::Variant<Glib::ustring>::create(INTERFACE),
+					Glib::Variant<std::map<Glib::ustring, Glib::VariantBase>>::create(changed),
+					Glib::Variant<std::vector<Glib::ustring>>::create({})}));
+	}
 }
 
 void Minecraftd1::onMethodCall(const Glib::RefPtr<Gio::DBus::Connection> &connection, const Glib::ustring &sender,
 		const Glib::ustring &objectPath, const Glib::ustring &interfaceName, const Glib::ustring &methodName,
 		const Glib::VariantContainerBase &parameters, const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation) {
 
+	// The server must be running to answer anything but Tail, ProxyConnections and QueryLogs, which are answered from
+	// here
+	const bool needsServer = (methodName != "Tail") && (methodName != "ProxyConnections")
+		&& (methodName != "QueryLogs");
+	if(needsServer && (state_ == State::FAILED)) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::FAILED, "The server has failed."});
+		return;
+	} else if(needsServer && (hibernator_ != nullptr)) {
+		hibernator_->wake();
+	}
+
 	auto slot = handlerMap.find(methodName);
 	if(slot != handlerMap.end()) {
-		slot->second(this, invocation);
+		slot->second(this, parameters, invocation);
 	} else {
 		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::UNKNOWN_METHOD, "Method does not exist."});
 	}
 }
 
-void Minecraftd1::handleSimpleCommand(const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation, std::string command)
-	const {
+void Minecraftd1::onGetProperty(Glib::VariantBase &property, const Glib::RefPtr<Gio::DBus::Connection> &connection,
+		const Glib::ustring &sender, const Glib::ustring &objectPath, const Glib::ustring &interfaceName,
+		const Glib::ustring &propertyName) {
+
+	auto getter = propertyMap.find(propertyName);
+	if(getter != propertyMap.end()) {
+		property = getter->second(this);
+	}
+}
+
+void Minecraftd1::handleSimpleCommand(const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation,
+		std::string command) {
+
+	if((state_ == State::STARTING) && (command != "stop")) {
+		// Held back with the executor's other commands until the server is ready, and replied to once written; stop
+		// never is, so that a server whose readiness is never seen can still be stopped
+		const bool queued = executor_.execute(command, [this, invocation](bool written,
+				const std::vector<std::string>&) {
+			if(!written) {
+				invocation->return_error((state_ == State::FAILED)
+						? Gio::DBus::Error{Gio::DBus::Error::FAILED, "The server has failed."}
+						: Gio::DBus::Error{Gio::DBus::Error::LIMITS_EXCEEDED, "Console command queue is full."});
+				return;
+			}
+			invocation->return_value(Glib::VariantContainerBase{});
+		});
+		if(!queued) {
+			invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::LIMITS_EXCEEDED,
+					"Console command queue is full."});
+		}
+		return;
+	}
 
-	if(*command.crbegin() != '\n') {
-		command.push_back('\n');
+	if(!commandQueue_.push(command)) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::LIMITS_EXCEEDED, "Console command queue is full."});
+		return;
+	} else if(command == "stop") {
+		setState(State::STOPPING);
 	}
-	writeAll(pipe_.writeEnd(), command.c_str());
 	invocation->return_value(Glib::VariantContainerBase{});
 }
 
+void Minecraftd1::handleBackup(const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation) {
+
+	const bool started = backup_->start([invocation](const std::string &error, const Backup::Result &result) {
+		if(!error.empty()) {
+			invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::FAILED, error});
+			return;
+		}
+
+		invocation->return_value(Glib::VariantContainerBase::create_tuple(std::vector<Glib::VariantBase>{
+			Glib::Variant<Glib::ustring>::create(result.snapshot), Glib::Variant<guint64>::create(result.files),
+			Glib::Variant<guint64>::create(result.filesCopied), Glib::Variant<guint64>::create(result.bytesCopied),
+			Glib::Variant<guint64>::create(result.saveOffTime.count())}));
+	});
+	if(!started) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::LIMITS_EXCEEDED, "A backup is already running."});
+	}
+}
+
+void Minecraftd1::handleExecuteCommand(const Glib::VariantContainerBase &parameters,
+		const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation) {
+
+	Glib::Variant<Glib::ustring> command;
+	parameters.get_child(command, 0);
+	if(command.get().empty() || (command.get().find_first_of("\r\n") != Glib::ustring::npos)) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::INVALID_ARGS,
+				"Command must be a single, non-empty line."});
+		return;
+	}
+
+	const bool queued = executor_.execute(command.get(), [this, invocation](bool written,
+			const std::vector<std::string> &output) {
+		if(!written) {
+			invocation->return_error((state_ == State::FAILED)
+					? Gio::DBus::Error{Gio::DBus::Error::FAILED, "The server has failed."}
+					: Gio::DBus::Error{Gio::DBus::Error::LIMITS_EXCEEDED, "Console command queue is full."});
+			return;
+		}
+
+		std::vector<Glib::ustring> lines;
+		lines.reserve(output.size());
+		for(const auto &line: output) {
+			lines.push_back(toUtf8(line));
+		}
+		invocation->return_value(Glib::VariantContainerBase::create_tuple(
+				Glib::Variant<std::vector<Glib::ustring>>::create(lines)));
+	});
+	if(!queued) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::LIMITS_EXCEEDED,
+				"Too many commands are awaiting execution."});
+	}
+}
+
+void Minecraftd1::handleProxyConnections(const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation) const {
+
+	if(proxy_ == nullptr) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::NOT_SUPPORTED,
+				"The front proxy is not enabled for this server."});
+		return;
+	}
+
+	std::vector<std::tuple<Glib::ustring, guint64, guint64, guint64, guint32, bool>> connections;
+	for(const auto &connection: proxy_->connections()) {
+		connections.emplace_back(connection.peer, connection.bytesIn, connection.bytesOut, connection.age.count(),
+				connection.rtt.count(), connection.parked);
+	}
+	invocation->return_value(Glib::VariantContainerBase::create_tuple(Glib::Variant<std::vector<std::tuple<
+			Glib::ustring, guint64, guint64, guint64, guint32, bool>>>::create(connections)));
+}
+
+void Minecraftd1::handleQueryLogs(const Glib::VariantContainerBase &parameters,
+		const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation) {
+
+	if(!logReader_) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::NOT_SUPPORTED,
+				"The log store is not enabled for this server."});
+		return;
+	}
+
+	Glib::Variant<guint64> from, to;
+	Glib::Variant<Glib::ustring> minLevel, pattern;
+	parameters.get_child(from, 0);
+	parameters.get_child(to, 1);
+	parameters.get_child(minLevel, 2);
+	parameters.get_child(pattern, 3);
+	LogStore::Level level = LogStore::Level::TRACE;
+	Glib::RefPtr<Glib::Regex> regex;
+	try {
+		if(!minLevel.get().empty()) {
+			level = LogStore::parseLevel(minLevel.get());
+		}
+		if(!pattern.get().empty()) {
+			regex = Glib::Regex::create(pattern.get(), Glib::REGEX_OPTIMIZE);
+		}
+	} catch(const std::invalid_argument &e) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::INVALID_ARGS, e.what()});
+		return;
+	} catch(const Glib::RegexError &e) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::INVALID_ARGS, e.what()});
+		return;
+	}
+
+	const int64_t end = (to.get() == 0) ? INT64_MAX : std::min<guint64>(to.get(), INT64_MAX);
+	const bool started = logReader_->start(std::min<guint64>(from.get(), INT64_MAX), end, level, regex,
+			[invocation](const std::string &error, const std::vector<LogStore::Event> &events) {
+		if(!error.empty()) {
+			invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::FAILED, error});
+			return;
+		}
+
+		std::vector<std::tuple<guint64, Glib::ustring, Glib::ustring, Glib::ustring, Glib::ustring>> result;
+		result.reserve(events.size());
+		for(const auto &event: events) {
+			result.emplace_back(event.time, LogStore::levelName(event.level), toUtf8(event.thread),
+					toUtf8(event.logger), toUtf8(event.message));
+		}
+		invocation->return_value(Glib::VariantContainerBase::create_tuple(Glib::Variant<std::vector<std::tuple<
+				guint64, Glib::ustring, Glib::ustring, Glib::ustring, Glib::ustring>>>::create(result)));
+	});
+	if(!started) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::LIMITS_EXCEEDED,
+				"A log query is already running."});
+	}
+}
+
+void Minecraftd1::handleStartProfiling(const Glib::VariantContainerBase &parameters,
+		const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation) {
+
+	if(profiler_ == nullptr) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::NOT_SUPPORTED,
+				"Profiling is not available for this server."});
+		return;
+	}
+
+	Glib::Variant<guint32> interval;
+	parameters.get_child(interval, 0);
+	if((interval.get() != 0) && ((std::chrono::microseconds{interval.get()} < Profiler::MIN_INTERVAL)
+				|| (std::chrono::microseconds{interval.get()} > Profiler::MAX_INTERVAL))) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::INVALID_ARGS, "Interval must be from "
+				+ std::to_string(Profiler::MIN_INTERVAL.count()) + " to "
+				+ std::to_string(Profiler::MAX_INTERVAL.count()) + " microseconds, or 0 for the default."});
+		return;
+	}
+	try {
+		if(!profiler_->start((interval.get() == 0) ? Profiler::DEFAULT_INTERVAL
+					: std::chrono::microseconds{interval.get()})) {
+			invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::LIMITS_EXCEEDED,
+					"Profiling is already running."});
+			return;
+		}
+	} catch(const std::exception &e) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::FAILED, e.what()});
+		return;
+	}
+	invocation->return_value(Glib::VariantContainerBase{});
+}
+
+void Minecraftd1::handleStopProfiling(const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation) {
+
+	if(profiler_ == nullptr) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::NOT_SUPPORTED,
+				"Profiling is not available for this server."});
+		return;
+	}
+
+	try {
+		invocation->return_value(Glib::VariantContainerBase::create_tuple(
+				Glib::Variant<Glib::ustring>::create(profiler_->stop())));
+	} catch(const std::exception &e) {
+		invocation->return_error(Gio::DBus::Error{Gio::DBus::Error::FAILED, e.what()});
+	}
+}
+
+void Minecraftd1::handleTail(const Glib::VariantContainerBase &parameters,
+		const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation) const {
+
+	Glib::Variant<guint32> count;
+	parameters.get_child(count, 0);
+
+	invocation->return_value(Glib::VariantContainerBase::create_tuple(linesToVariants(console_.tail(count.get()),
+			console_.sequence())));
+}
+
+JvmMetrics::Sample Minecraftd1::latestMetrics() const {
+
+	return (metrics_ != nullptr) ? metrics_->latest() : JvmMetrics::Sample{};
+}
+
+BusName::BusName(const std::vector<Minecraftd1*> &objects)
+	: objects_(objects),
+	busName_{Gio::DBus::own_name(Gio::DBus::BUS_TYPE_SYSTEM, Minecraftd1::INTERFACE,
+			sigc::mem_fun(*this, &BusName::onBusAcquired))} {
+}
+
+BusName::~BusName() {
+
+	Gio::DBus::unown_name(busName_);
+}
+
+void BusName::onBusAcquired(const Glib::RefPtr<Gio::DBus::Connection> &connection, const Glib::ustring &name) {
+
+	for(auto object: objects_) {
+		object->registerObject(connection);
+	}
+}
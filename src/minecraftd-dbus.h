@@ -12,38 +12,179 @@
  */
 #pragma once
 
+#include <map>
+#include <memory>
+#include <vector>
+
 #include <giomm.h>
 #include <glibmm.h>
 
-#include "pipe.h"
+#include "Backup.h"
+#include "CommandExecutor.h"
+#include "CommandQueue.h"
+#include "ConsoleBuffer.h"
+#include "FrontProxy.h"
+#include "Hibernator.h"
+#include "JvmMetrics.h"
+#include "LogStore.h"
+#include "MemoryGovernor.h"
+#include "Profiler.h"
+#include "RconServer.h"
+#include "SavePacer.h"
+#include "StartupTracker.h"
+#include "ThreadClassifier.h"
+#include "instance.h"
 
 namespace minecraftd {
 	class Minecraftd1 {
 		public:
-			Minecraftd1(const Glib::ustring &objectName, const PosixPipe &pipe);
+			/**
+			 * Lines of console output are published through the ConsoleOutput signal at most this often, in
+			 * milliseconds, and no more than MAX_SIGNALLED_LINES at a time.
+			 */
+			static const unsigned int CONSOLE_SIGNAL_INTERVAL = 250;
+			static const size_t MAX_SIGNALLED_LINES = 256;
+			/**
+			 * Commands are held back during startup for at most this long, in seconds, after which they are written
+			 * whether or not the server has reported itself ready.
+			 */
+			static const unsigned int HOLD_TIMEOUT = 300;
+
+			/** State of the server, as published through the State property. */
+			enum class State {STARTING, RUNNING, STOPPING, FAILED};
+
+			static const char* stateName(State state);
+
+			/**
+			 * The object starts out in the STARTING state, and moves to RUNNING once startup reports the server ready;
+			 * until then, or for HOLD_TIMEOUT, commands other than Stop are held back rather than written to the
+			 * console. hibernator, if not null, is woken
+			 * by any method call that may need the server, and backs the hibernation properties. governor, if not
+			 * null, backs MemoryPressureActions, which is otherwise empty. proxy, if not null, backs ProxyConnections,
+			 * which otherwise fails as not supported.
+			 */
+			Minecraftd1(const Glib::ustring &objectName, const InstanceConfiguration &configuration,
+					CommandQueue &commandQueue, const ConsoleBuffer &console, StartupTracker &startup,
+					Hibernator *hibernator, const MemoryGovernor *governor, const FrontProxy *proxy);
 			~Minecraftd1();
 
+			/**
+			 * Attaches the objects created along with the JVM. metrics, if not null, backs the JVM and tick time
+			 * properties, which are otherwise zero; changes to them are announced through PropertiesChanged no more
+			 * often than the metrics are sampled. profiler, if not null, backs StartProfiling and StopProfiling, which
+			 * otherwise fail as not supported. classifier, if not null, backs ThreadRoles, which is otherwise empty.
+			 */
+			void attachJvm(const JvmMetrics *metrics, Profiler *profiler, const ThreadClassifier *classifier);
+			void registerObject(const Glib::RefPtr<Gio::DBus::Connection> &connection);
+			/**
+			 * Moves the server to state, announcing the change. FAILED is final, and STOPPING only gives way to it.
+			 * Commands held back during startup are written once the server leaves STARTING, or fail if it has failed.
+			 */
+			void setState(State state);
+			State state() const { return state_; }
+
+			static const Glib::ustring INTERFACE;
+
 		private:
-			void onBusAcquired(const Glib::RefPtr<Gio::DBus::Connection> &connection, const Glib::ustring &name);
 			void onMethodCall(const Glib::RefPtr<Gio::DBus::Connection> &connection, const Glib::ustring &sender,
 					const Glib::ustring &objectPath, const Glib::ustring &interfaceName,
 					const Glib::ustring &methodName, const Glib::VariantContainerBase &parameters,
 					const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation);
+			bool onConsoleTimer();
+			bool onHibernationTimer();
+			bool onMetricsTimer();
+			void onGetProperty(Glib::VariantBase &property, const Glib::RefPtr<Gio::DBus::Connection> &connection,
+					const Glib::ustring &sender, const Glib::ustring &objectPath, const Glib::ustring &interfaceName,
+					const Glib::ustring &propertyName);
 
 			/**
-			 * Implements a handler for simple commands that simply write the given command to the write end of pipe_
-			 * and return an empty value.
+			 * Implements a handler for simple commands that simply queue the given command for the server's console
+			 * and return an empty value, or a LimitsExceeded error if the command queue is full. While the server is
+			 * starting, any command but stop is held back, and the reply sent once it has been written.
 			 */
-			void handleSimpleCommand(const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation, std::string command)
-				const;
+			void handleSimpleCommand(const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation, std::string command);
+			/** Takes a snapshot of the server directory, replying once it has been stored. */
+			void handleBackup(const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation);
+			/**
+			 * Runs a console command, returning the console output it produced. The command is written to the console,
+			 * and its output is whatever the console prints until it has been quiet for a moment, which may include
+			 * unrelated lines; see CommandExecutor. Commands run one at a time, and one that prints nothing takes a
+			 * second, so this is not suited to issuing many commands quickly.
+			 */
+			void handleExecuteCommand(const Glib::VariantContainerBase &parameters,
+					const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation);
+			/** Lists the connections relayed by the front proxy, with their byte counts, age and round-trip time. */
+			void handleProxyConnections(const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation) const;
+			/**
+			 * Returns the stored log events from from to to (in milliseconds since the epoch; a to of zero is no
+			 * limit) of at least minLevel whose message matches pattern, a regular expression; either may be empty.
+			 * At most LogReader::MAX_EVENTS events are returned, the earliest in the range.
+			 */
+			void handleQueryLogs(const Glib::VariantContainerBase &parameters,
+					const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation);
+			/** Starts sampling Java stacks every interval microseconds of CPU time (or the default, if zero). */
+			void handleStartProfiling(const Glib::VariantContainerBase &parameters,
+					const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation);
+			/** Stops sampling, returning the path of the collapsed stacks file written. */
+			void handleStopProfiling(const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation);
+			/** Returns the last count lines of console output, along with the sequence number of the first. */
+			void handleTail(const Glib::VariantContainerBase &parameters,
+					const Glib::RefPtr<Gio::DBus::MethodInvocation> &invocation) const;
 
-			static const Glib::ustring INTERFACE;
+			/** Emits PropertiesChanged for those of names whose values have changed since they were last announced. */
+			void announceChanges(const std::vector<const char*> &names);
+			void startMetricsTimer();
+			JvmMetrics::Sample latestMetrics() const;
 
-			guint busName_;
+			std::unique_ptr<Backup> backup_;
+			CommandQueue &commandQueue_;
+			Glib::RefPtr<Gio::DBus::Connection> connection_;
+			const ConsoleBuffer &console_;
+			sigc::connection consoleSource_;
+			/** Sequence number of the first console line not yet published through the ConsoleOutput signal. */
+			uint64_t consoleSequence_;
+			CommandExecutor executor_;
+			const MemoryGovernor *const governor_;
+			Hibernator *const hibernator_;
+			sigc::connection hibernationSource_;
+			sigc::connection holdSource_;
 			Glib::RefPtr<Gio::DBus::NodeInfo> introspectionData_;
+			/** Answers QueryLogs, if the log store is enabled; the store itself is written in the JVM's process. */
+			std::unique_ptr<LogReader> logReader_;
+			const JvmMetrics *metrics_;
+			sigc::connection metricsSource_;
+			/** Values of the metric and hibernation properties as last announced through PropertiesChanged. */
+			std::map<Glib::ustring, Glib::VariantBase> announcedValues_;
 			Glib::ustring objectName_;
-			const PosixPipe &pipe_;
+			Profiler *profiler_;
+			const FrontProxy *const proxy_;
+			/** RCON endpoint feeding executor_, declared after it so that it is destroyed first. */
+			std::unique_ptr<RconServer> rcon_;
+			/** Paces the writeback of world saves and backs the save properties, unless pacing is disabled. */
+			std::unique_ptr<SavePacer> savePacer_;
+			sigc::connection saveSource_;
+			const StartupTracker &startup_;
+			guint registrationId_;
+			State state_;
+			const ThreadClassifier *threadClassifier_;
 			const Gio::DBus::InterfaceVTable vtable_;
 	};
+
+	/**
+	 * Owns the net.za.slyfox.Minecraftd1 name on the system bus, and registers the given objects once the bus
+	 * connection has been acquired. In single-instance mode, this is a single object at /net/za/slyfox/Minecraftd1;
+	 * in supervisor mode, there is one object per instance beneath that path.
+	 */
+	class BusName {
+		public:
+			BusName(const std::vector<Minecraftd1*> &objects);
+			~BusName();
+
+		private:
+			void onBusAcquired(const Glib::RefPtr<Gio::DBus::Connection> &connection, const Glib::ustring &name);
+
+			const std::vector<Minecraftd1*> objects_;
+			guint busName_;
+	};
 }
 
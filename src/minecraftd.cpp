@@ -10,154 +10,41 @@
  * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
  * specific language governing permissions and limitations under the License.
  */
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <system_error>
 #include <thread>
 #include <vector>
 
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <dlfcn.h>
 #include <pthread.h>
+#include <signal.h>
 #include <unistd.h>
 
 #include <giomm.h>
 #include <glibmm.h>
 #include <libconfig.h++>
-#include <jni.h>
 
-#include "JarReader.h"
+#include "CommandQueue.h"
+#include "ConsoleBuffer.h"
+#include "FrontProxy.h"
+#include "JvmLifecycle.h"
+#include "MemoryGovernor.h"
+#include "RegionCompactor.h"
+#include "StartupTracker.h"
+#include "Watchdog.h"
+#include "WorldWarmup.h"
+#include "instance.h"
 #include "jvm.h"
 #include "minecraftd-dbus.h"
+#include "notify.h"
 #include "pipe.h"
+#include "supervisor.h"
 
 namespace {
 	const std::string DEFAULT_CONFIG_FILE_NAME{MINECRAFTDCONFDIR "/minecraftd.conf"};
-	const std::string DEFAULT_LOG_CONFIG_FILENAME{MINECRAFTDCONFDIR "/log4j2.xml"};
-
-	class EnsureConditionBroadcast {
-
-		public:
-			EnsureConditionBroadcast(pthread_cond_t *condition) : condition_(condition), signalled_(false) { }
-			~EnsureConditionBroadcast() {
-
-				signal();
-			}
-
-			void signal() {
-
-				if(!signalled_) {
-					pthread_cond_broadcast(condition_);
-					signalled_ = true;
-				}
-			}
-
-		private:
-			pthread_cond_t *condition_;
-			bool signalled_;
-	};
-
-	void jvmMain(minecraftd::JvmMainArguments *arguments) {
-
-		EnsureConditionBroadcast ensureConditionBroadcast{&arguments->jvmCompleteCondition};
-
-		void *libjvm = dlopen(arguments->libjvmPath.c_str(), RTLD_LAZY);
-		if(libjvm == nullptr) {
-			throw std::runtime_error{"Failed to load JVM dynamic library: " + std::string{dlerror()}};
-		}
-
-		minecraftd::JNI_CreateJavaVM JNI_CreateJavaVM = reinterpret_cast<minecraftd::JNI_CreateJavaVM>(dlsym(libjvm,
-					"JNI_CreateJavaVM"));
-		if(JNI_CreateJavaVM == nullptr) {
-			throw std::runtime_error{"Failed to load JNI_CreateJavaVM function: " + std::string{dlerror()}};
-		}
-
-		JavaVMInitArgs jvmArguments;
-		jvmArguments.version = JNI_VERSION_1_6;
-
-		std::vector<JavaVMOption> jvmOptions;
-
-		std::string classPath{"-Djava.class.path=" + arguments->jarPath};
-		jvmOptions.push_back(JavaVMOption{const_cast<char*>(classPath.c_str()), nullptr});
-
-		// For Oracle-based JVMs, give the process a name for tools such as jcmd and jconsole
-		jvmOptions.push_back(JavaVMOption{const_cast<char*>("-Dsun.java.command=minecraftd"), nullptr});
-
-		std::string log4jOption{"-Dlog4j.configurationFile="};
-		if(!arguments->customLogConfiguration.empty()) {
-			log4jOption += arguments->customLogConfiguration;
-			jvmOptions.push_back(JavaVMOption{const_cast<char*>(log4jOption.c_str()), nullptr});
-		}
-
-		for(auto argument: arguments->additionalArguments) {
-			jvmOptions.push_back(JavaVMOption{const_cast<char*>(argument.c_str()), nullptr});
-		}
-
-		jvmArguments.options = jvmOptions.data();
-		jvmArguments.nOptions = jvmOptions.size();
-		jvmArguments.ignoreUnrecognized = false;
-
-		JavaVM *jvm;
-		JNIEnv *jni;
-		jint jrc = JNI_CreateJavaVM(&jvm, reinterpret_cast<void**>(&jni), &jvmArguments);
-		if(jrc != JNI_OK) {
-			throw std::runtime_error{"Failed to create Java virtual machine"};
-		}
-
-		std::string mainClassSpec{arguments->mainClassName};
-		for(size_t i = mainClassSpec.find('.'); i != std::string::npos; i = mainClassSpec.find('.', i)) {
-			mainClassSpec[i] = '/';
-		}
-
-		jclass mainClass = jni->FindClass(mainClassSpec.c_str());
-		if(mainClass == nullptr) {
-			minecraftd::JavaException e{jni};
-			if(e.type() == "java.lang.NoClassDefFoundError") {
-				throw std::runtime_error{"Could not find main class: " + arguments->mainClassName};
-			} else {
-				throw e;
-			}
-		}
-
-		jmethodID mainMethod = jni->GetStaticMethodID(mainClass, "main", "([Ljava/lang/String;)V");
-		if(mainMethod == nullptr) {
-			minecraftd::JavaException e{jni};
-			if(e.type() == "java.lang.NoSuchMethodError") {
-				throw std::runtime_error{"Could not find `void main(String[])' method in " + arguments->mainClassName};
-			} else {
-				throw e;
-			}
-		}
-
-		jclass stringClass = jni->FindClass("java/lang/String");
-		if(stringClass == nullptr) {
-			throw minecraftd::JavaException{jni};
-		}
-
-		jobjectArray mainArguments = jni->NewObjectArray(1, stringClass, nullptr);
-		if(mainArguments == nullptr) {
-			throw minecraftd::JavaException{jni};
-		}
-
-		jstring noguiString = jni->NewStringUTF("nogui");
-		if(noguiString == nullptr) {
-			throw minecraftd::JavaException{jni};
-		}
-
-		jni->SetObjectArrayElement(mainArguments, 0, noguiString);
-		if(jni->ExceptionCheck()) {
-			throw minecraftd::JavaException{jni};
-		}
-
-		std::cout << "Signalling completion of JVM startup" << std::endl;
-		ensureConditionBroadcast.signal();
-
-		jni->CallStaticVoidMethod(mainClass, mainMethod, mainArguments);
-		if(jni->ExceptionCheck()) {
-			throw minecraftd::JavaException{jni};
-		}
-	}
 
 	pthread_t mainThread;
 	Glib::RefPtr<Glib::MainLoop> mainLoop;
@@ -174,12 +61,18 @@ int main(int argc, char **argv) {
 
 	std::vector<std::string> arguments{argv + 1, argv + argc};
 	std::string configFileName{DEFAULT_CONFIG_FILE_NAME};
+	bool compactWorld = false;
+	minecraftd::CompactionOptions compactionOptions;
 	for(auto it = arguments.cbegin(); it != arguments.cend(); ++it) {
 		if((*it == "--help") || (*it == "-h") || (*it == "-?")) {
 			std::cout << "Usage: " << argv[0] << " [options]" << std::endl << std::endl
 				<< "  --help/-h/-?\t\tPrints this message" << std::endl
 				<< "  --config/-c <path>\tSpecifies an alternate configuration file (default:" << std::endl
-				<< "  \t" << DEFAULT_CONFIG_FILE_NAME << ')' << std::endl;
+				<< "  \t" << DEFAULT_CONFIG_FILE_NAME << ')' << std::endl
+				<< "  --compact-world\tCompacts the region files of every configured world, then" << std::endl
+				<< "  \texits; the servers must be stopped" << std::endl
+				<< "  --recompress\t\tWith --compact-world, recompresses chunks at the highest level" << std::endl
+				<< "  --drop-uninhabited\tWith --compact-world, drops chunks no player has spent time in" << std::endl;
 			return 0;
 		} else if((*it == "--config") || (*it == "-c")) {
 			if(++it == arguments.cend()) {
@@ -187,6 +80,12 @@ int main(int argc, char **argv) {
 				return 1;
 			}
 			configFileName = *it;
+		} else if(*it == "--compact-world") {
+			compactWorld = true;
+		} else if(*it == "--recompress") {
+			compactionOptions.recompress = true;
+		} else if(*it == "--drop-uninhabited") {
+			compactionOptions.dropUninhabited = true;
 		}
 	}
 
@@ -201,42 +100,85 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
-	std::string serverDirectory{MINECRAFTSERVERDIR};
-	configFile.lookupValue("serverDirectory", serverDirectory);
-	if(chdir(serverDirectory.c_str()) != 0) {
-		if(errno == ENOENT) {
-			// TODO: Create directory recursively
-			if(mkdir(serverDirectory.c_str(), 0777) != 0) {
-				throw std::system_error(errno, std::system_category());
+	if(configFile.exists("instances")) {
+		std::vector<minecraftd::InstanceConfiguration> instances;
+		try {
+			libconfig::Setting &instanceSettings = configFile.lookup("instances");
+			const int count = instanceSettings.getLength();
+			for(int i = 0; i < count; ++i) {
+				instances.push_back(minecraftd::readInstanceConfiguration(configFile.getRoot(), instanceSettings[i]));
+				for(int j = 0; j < i; ++j) {
+					if(instances[j].name == instances[i].name) {
+						std::cerr << "Duplicate instance name: " << instances[i].name << std::endl;
+						return 1;
+					}
+				}
 			}
-		} else {
-			throw std::system_error(errno, std::system_category());
+		} catch(const std::runtime_error &e) {
+			std::cerr << "Invalid instance configuration: " << e.what() << std::endl;
+			return 1;
+		} catch(const libconfig::SettingException &e) {
+			std::cerr << "Invalid instance configuration: " << e.what() << " at " << e.getPath() << std::endl;
+			return 1;
 		}
-	}
-
-	std::string jarPath{MINECRAFTJARDIR "/minecraft_server.jar"};
-	configFile.lookupValue("jar", jarPath);
 
-	std::string jvmLibPath{JVMLIBPATH};
-	configFile.lookupValue("jvm.jvmLibrary", jvmLibPath);
+		if(instances.empty()) {
+			std::cerr << "No instances configured" << std::endl;
+			return 1;
+		}
 
-	std::string logConfigFileName{DEFAULT_LOG_CONFIG_FILENAME};
-	try {
-		libconfig::Setting &customLogConfiguration = configFile.lookup("customLogConfiguration");
-		if(customLogConfiguration.getType() == libconfig::Setting::TypeBoolean) {
-			if(!static_cast<bool>(customLogConfiguration)) {
-				logConfigFileName.clear();
-				logConfigFileName.shrink_to_fit();
+		if(compactWorld) {
+			std::vector<std::string> serverDirectories;
+			for(const auto &instance: instances) {
+				serverDirectories.push_back(instance.serverDirectory);
 			}
-		} else {
-			logConfigFileName = static_cast<const char*>(customLogConfiguration);
+			return minecraftd::compactWorlds(serverDirectories, compactionOptions);
 		}
-	} catch(libconfig::SettingNotFoundException&) {
-		// No custom logging configuration
+
+		minecraftd::Supervisor supervisor{instances};
+		return supervisor.run();
+	}
+
+	minecraftd::InstanceConfiguration instance;
+	try {
+		instance = minecraftd::readInstanceConfiguration(configFile.getRoot());
+	} catch(const std::runtime_error &e) {
+		std::cerr << "Invalid configuration: " << e.what() << std::endl;
+		return 1;
+	} catch(const libconfig::SettingException &e) {
+		std::cerr << "Invalid configuration: " << e.what() << " at " << e.getPath() << std::endl;
+		return 1;
+	}
+	if(compactWorld) {
+		return minecraftd::compactWorlds({instance.serverDirectory}, compactionOptions);
+	}
+	if(instance.hibernateAfter.count() > 0) {
+		std::cerr << "Hibernation is only available with instances, where each server has its own process" << std::endl;
+	}
+	minecraftd::enterServerDirectory(instance.serverDirectory);
+	std::unique_ptr<minecraftd::WorldWarmup> warmup;
+	if(instance.warmupBudget != 0) {
+		warmup.reset(new minecraftd::WorldWarmup{instance.serverDirectory, instance.warmupBudget,
+				instance.warmupSpawnRadius});
 	}
 
-	minecraftd::JarReader jarReader{jarPath};
-	std::string mainClassName = jarReader.getMainClassName();
+	std::unique_ptr<minecraftd::FrontProxy> proxy;
+	std::unique_ptr<minecraftd::JvmMainArguments> jvmMainArguments;
+	try {
+		if(instance.proxyPort != 0) {
+			// The proxy splices into client sockets, for which there is no MSG_NOSIGNAL; a client resetting its
+			// connection mid-transfer must fail the splice rather than kill the process
+			struct sigaction ignore{};
+			ignore.sa_handler = SIG_IGN;
+			sigaction(SIGPIPE, &ignore, nullptr);
+			proxy.reset(new minecraftd::FrontProxy{instance.proxyAddress, instance.proxyPort,
+					instance.proxyBackendPort, instance.serverDirectory});
+		}
+		jvmMainArguments = minecraftd::createJvmMainArguments(instance);
+	} catch(const std::runtime_error &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
 
 	minecraftd::PosixPipe pipe;
 
@@ -250,47 +192,83 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
-	pthread_mutex_t mutex;
-	if(pthread_mutex_init(&mutex, nullptr) != 0) {
-		std::cerr << "Failed to create mutex object" << std::endl;
-		return 1;
-	}
-
-	minecraftd::JvmMainArguments jvmMainArguments{jvmLibPath, jarPath, mainClassName, logConfigFileName};
-	if(pthread_cond_init(&jvmMainArguments.jvmCompleteCondition, nullptr) != 0) {
-		std::cerr << "Failed to create JVM completion condition" << std::endl;
-		return 1;
-	}
-
+	std::unique_ptr<minecraftd::ConsoleBuffer> console;
 	try {
-		libconfig::Setting &additionalArguments = configFile.lookup("jvm.arguments");
-		const int count = additionalArguments.getLength();
-		for(int i = 0; i < count; ++i) {
-			jvmMainArguments.additionalArguments.push_back(additionalArguments[i]);
-		}
-	} catch(libconfig::SettingNotFoundException&) {
-		// No additional arguments to pass
+		console.reset(new minecraftd::ConsoleBuffer{{minecraftd::ConsoleBuffer::redirect(STDOUT_FILENO),
+				minecraftd::ConsoleBuffer::redirect(STDERR_FILENO)}});
+	} catch(const std::system_error &e) {
+		std::cerr << "Failed to capture standard output: " << e.what() << std::endl;
+		return 1;
 	}
 
+	// The server exits the process itself, through System.exit, so the main loop must exist before the JVM does
+	Gio::init();
+	mainLoop = Glib::MainLoop::create();
 	mainThread = pthread_self();
 	std::atexit(onExit);
 
-	std::thread jvmMainThread(jvmMain, &jvmMainArguments);
-
-	pthread_mutex_lock(&mutex);
-	std::cout << "Waiting for JVM to complete startup" << std::endl;
-	pthread_cond_wait(&jvmMainArguments.jvmCompleteCondition, &mutex);
-	pthread_mutex_unlock(&mutex);
-
-	Gio::init();
-	minecraftd::Minecraftd1 dbusObject{"/net/za/slyfox/Minecraftd1", pipe};
+	// Readiness is only reported once the server says it is done, not when the JVM has merely been created
+	minecraftd::StartupTracker startup{*console, [](const std::string &phase, bool ready) {
+		minecraftd::notifyServiceManager(ready ? "READY=1\nSTATUS=Running" : "STATUS=Starting: " + phase);
+	}};
+	minecraftd::notifyServiceManager("STATUS=Starting: " + startup.timeline().back().name);
+
+	// The object is exported straight away, reporting the server as starting and holding back commands until it is
+	// ready; the bus name is acquired on the main loop while the JVM starts
+	minecraftd::CommandQueue commandQueue{pipe.writeEnd()};
+	std::unique_ptr<minecraftd::MemoryGovernor> governor;
+	if(instance.memoryPressure.enabled()) {
+		try {
+			governor.reset(new minecraftd::MemoryGovernor{instance.memoryPressure, commandQueue});
+		} catch(const std::system_error &e) {
+			std::cerr << "Memory pressure will not be governed: " << e.what() << std::endl;
+		}
+	}
+	minecraftd::Minecraftd1 dbusObject{"/net/za/slyfox/Minecraftd1", instance, commandQueue, *console, startup,
+		nullptr, governor.get(), proxy.get()};
+	minecraftd::BusName busName{{&dbusObject}};
+
+	int exitStatus = 0;
+	std::unique_ptr<minecraftd::Watchdog> watchdog;
+	minecraftd::JvmLifecycle lifecycle{[&](minecraftd::JvmLifecycle::Event event, const std::string &detail) {
+		if(event == minecraftd::JvmLifecycle::Event::CREATED) {
+			dbusObject.attachJvm(jvmMainArguments->metrics.get(), jvmMainArguments->profiler.get(),
+					jvmMainArguments->threadClassifier.get());
+			if(governor) {
+				governor->attachJvm(jvmMainArguments->jvm);
+			}
+			if(instance.watchdogStall.count() > 0) {
+				watchdog.reset(new minecraftd::Watchdog{jvmMainArguments->jvm, instance.watchdogStall,
+						instance.watchdogDumpDirectory});
+			}
+		} else {
+			std::cerr << "Failed to start the server: " << detail << std::endl;
+			minecraftd::notifyServiceManager("STATUS=Failed: " + detail);
+			dbusObject.setState(minecraftd::Minecraftd1::State::FAILED);
+			exitStatus = 1;
+			mainLoop->quit();
+		}
+	}};
+	jvmMainArguments->lifecycle = &lifecycle;
+
+	// The service manager's watchdog is fed for as long as the server keeps ticking, so that it restarts a server
+	// that has stalled for good
+	const std::chrono::microseconds watchdogInterval = minecraftd::watchdogInterval();
+	if(watchdogInterval.count() > 0) {
+		Glib::signal_timeout().connect([&watchdog]() {
+			if(!watchdog || watchdog->healthy()) {
+				minecraftd::notifyServiceManager("WATCHDOG=1");
+			}
+			return true;
+		}, std::chrono::duration_cast<std::chrono::milliseconds>(watchdogInterval).count() / 2);
+	}
+	std::thread jvmMainThread(minecraftd::jvmMain, jvmMainArguments.get());
 
 	std::cout << "Starting main loop" << std::endl;
-	mainLoop = Glib::MainLoop::create();
 	mainLoop->run();
 
 	jvmMainThread.join();
 	std::cout << "And we're done!" << std::endl;
-	return 0;
+	return exitStatus;
 }
 
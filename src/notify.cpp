@@ -0,0 +1,62 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "notify.h"
+
+bool minecraftd::notifyServiceManager(const std::string &state) {
+
+	const char *socketPath = std::getenv("NOTIFY_SOCKET");
+	if((socketPath == nullptr) || ((socketPath[0] != '/') && (socketPath[0] != '@'))) {
+		return false;
+	}
+
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	const size_t length = std::strlen(socketPath);
+	if(length >= sizeof(address.sun_path)) {
+		return false;
+	}
+	std::memcpy(address.sun_path, socketPath, length);
+	if(address.sun_path[0] == '@') {
+		// Abstract namespace socket
+		address.sun_path[0] = '\0';
+	}
+
+	const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(fd == -1) {
+		return false;
+	}
+	const bool sent = sendto(fd, state.data(), state.size(), MSG_NOSIGNAL, reinterpret_cast<sockaddr*>(&address),
+			offsetof(sockaddr_un, sun_path) + length) == static_cast<ssize_t>(state.size());
+	close(fd);
+	return sent;
+}
+
+std::chrono::microseconds minecraftd::watchdogInterval() {
+
+	const char *interval = std::getenv("WATCHDOG_USEC");
+	const char *pid = std::getenv("WATCHDOG_PID");
+	if((interval == nullptr) || ((pid != nullptr) && (std::strtol(pid, nullptr, 10) != getpid()))) {
+		return std::chrono::microseconds{0};
+	}
+	return std::chrono::microseconds{std::strtoull(interval, nullptr, 10)};
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <string>
+
+namespace minecraftd {
+
+	/**
+	 * Sends state (newline-separated assignments such as "READY=1" or "STATUS=...") to the service manager over the
+	 * socket named by $NOTIFY_SOCKET, as sd_notify does. Returns false if there is no service manager to notify, or
+	 * the message could not be sent.
+	 */
+	bool notifyServiceManager(const std::string &state);
+
+	/**
+	 * Returns the interval within which the service manager expects "WATCHDOG=1" from this process (as
+	 * sd_watchdog_enabled does), or zero if it expects none.
+	 */
+	std::chrono::microseconds watchdogInterval();
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace minecraftd {
+
+	/**
+	 * Runs task(i) for every i in [0, count) on a pool of threads, one per CPU. Rethrows the first exception thrown by
+	 * any task, once all threads have finished.
+	 */
+	inline void parallelFor(size_t count, const std::function<void(size_t)> &task) {
+
+		std::atomic<size_t> next{0};
+		std::exception_ptr exception;
+		std::mutex exceptionMutex;
+		auto worker = [&] {
+			for(size_t i = next++; i < count; i = next++) {
+				try {
+					task(i);
+				} catch(...) {
+					std::lock_guard<std::mutex> lock{exceptionMutex};
+					if(!exception) {
+						exception = std::current_exception();
+					}
+					next = count;
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		const size_t threadCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1U), count);
+		for(size_t i = 1; i < threadCount; ++i) {
+			threads.emplace_back(worker);
+		}
+		worker();
+		for(auto &thread: threads) {
+			thread.join();
+		}
+
+		if(exception) {
+			std::rethrow_exception(exception);
+		}
+	}
+}
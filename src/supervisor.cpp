@@ -0,0 +1,439 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <giomm.h>
+#include <glib-unix.h>
+
+#include "WorldWarmup.h"
+#include "jvm.h"
+#include "notify.h"
+#include "supervisor.h"
+
+using namespace minecraftd;
+
+namespace {
+	const std::string NODE_SYSFS_DIRECTORY{"/sys/devices/system/node"};
+
+	struct NumaNode {
+		int id;
+		std::vector<int> cpus;
+	};
+
+	std::string readFirstLine(const std::string &path) {
+
+		std::ifstream file{path};
+		std::string line;
+		std::getline(file, line);
+		return line;
+	}
+
+	/**
+	 * Reads the NUMA nodes of the host along with the CPUs belonging to each, restricted to the CPUs this process is
+	 * allowed to run on. If the kernel does not expose NUMA topology, a single node with ID -1 is returned.
+	 */
+	std::vector<NumaNode> readTopology() {
+
+		cpu_set_t allowed;
+		if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+			throw std::system_error(errno, std::system_category());
+		}
+
+		std::vector<NumaNode> nodes;
+		for(int id: parseCpuList(readFirstLine(NODE_SYSFS_DIRECTORY + "/online"))) {
+			NumaNode node{id, {}};
+			const std::string cpuListPath{NODE_SYSFS_DIRECTORY + "/node" + std::to_string(id) + "/cpulist"};
+			for(int cpu: parseCpuList(readFirstLine(cpuListPath))) {
+				if((cpu < CPU_SETSIZE) && CPU_ISSET(cpu, &allowed)) {
+					node.cpus.push_back(cpu);
+				}
+			}
+			if(!node.cpus.empty()) {
+				nodes.push_back(node);
+			}
+		}
+
+		if(nodes.empty()) {
+			NumaNode node{-1, {}};
+			for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+				if(CPU_ISSET(cpu, &allowed)) {
+					node.cpus.push_back(cpu);
+				}
+			}
+			nodes.push_back(node);
+		}
+		return nodes;
+	}
+
+	/** Restricts the calling process to the CPUs and NUMA node assigned to the instance. */
+	void applyPlacement(const InstanceConfiguration &configuration) {
+
+		if(!configuration.cpus.empty()) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			for(int cpu: configuration.cpus) {
+				if(cpu < CPU_SETSIZE) {
+					CPU_SET(cpu, &cpus);
+				}
+			}
+			if(sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+				throw std::system_error(errno, std::system_category());
+			}
+		}
+
+		if(configuration.numaNode >= 0) {
+			const size_t bitsPerWord = sizeof(unsigned long) * 8;
+			std::vector<unsigned long> nodeMask(configuration.numaNode / bitsPerWord + 1);
+			nodeMask[configuration.numaNode / bitsPerWord] |= 1UL << (configuration.numaNode % bitsPerWord);
+			if(syscall(SYS_set_mempolicy, MPOL_BIND, nodeMask.data(), nodeMask.size() * bitsPerWord + 1) != 0) {
+				throw std::system_error(errno, std::system_category());
+			}
+		}
+	}
+
+	/**
+	 * Runs an instance's server in the current (child) process, with the read end of the console pipe as standard
+	 * input. Only returns once the server has exited.
+	 */
+	int runInstance(const InstanceConfiguration &configuration, int consoleFd) {
+
+		enterServerDirectory(configuration.serverDirectory);
+		std::unique_ptr<WorldWarmup> warmup;
+		if(configuration.warmupBudget != 0) {
+			warmup.reset(new WorldWarmup{configuration.serverDirectory, configuration.warmupBudget,
+					configuration.warmupSpawnRadius});
+		}
+
+		std::unique_ptr<JvmMainArguments> jvmMainArguments = createJvmMainArguments(configuration);
+
+		if(dup2(consoleFd, STDIN_FILENO) != STDIN_FILENO) {
+			throw std::system_error(errno, std::system_category());
+		}
+
+		// Without a lifecycle to post failures to, jvmMain rethrows them; they are carried back to this thread, where
+		// spawn reports them and exits with a failure status, rather than terminating the process from the JVM's thread
+		std::exception_ptr failure;
+		std::thread jvmMainThread([&jvmMainArguments, &failure]() {
+			try {
+				jvmMain(jvmMainArguments.get());
+			} catch(...) {
+				failure = std::current_exception();
+			}
+		});
+		jvmMainThread.join();
+		if(failure) {
+			std::rethrow_exception(failure);
+		}
+		return 0;
+	}
+}
+
+Supervisor::Supervisor(const std::vector<InstanceConfiguration> &instances) : running_{0}, exitStatus_{0} {
+
+	for(const auto &configuration: instances) {
+		instances_.push_back(Instance{configuration, nullptr, nullptr, nullptr, {-1, -1}, -1, nullptr, nullptr,
+			nullptr, nullptr});
+	}
+}
+
+int Supervisor::run() {
+
+	// The proxies splice into client sockets, for which there is no MSG_NOSIGNAL; a client resetting its connection
+	// mid-transfer must fail the splice rather than kill the supervisor
+	struct sigaction ignore{};
+	ignore.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &ignore, nullptr);
+
+	assignPlacement();
+	for(auto &instance: instances_) {
+		spawn(instance);
+	}
+	for(auto &instance: instances_) {
+		watch(instance);
+	}
+
+	Gio::init();
+	mainLoop_ = Glib::MainLoop::create();
+
+	std::vector<Minecraftd1*> objects;
+	for(auto &instance: instances_) {
+		instance.commandQueue.reset(new CommandQueue{instance.console->writeEnd()});
+		if(instance.configuration.proxyPort != 0) {
+			// Owned here rather than by the child, so that players are parked rather than refused while it starts
+			instance.proxy.reset(new FrontProxy{instance.configuration.proxyAddress, instance.configuration.proxyPort,
+					instance.configuration.proxyBackendPort, instance.configuration.serverDirectory});
+		}
+		if(instance.configuration.hibernateAfter.count() > 0) {
+			try {
+				instance.hibernator.reset(new Hibernator{instance.pid, instance.configuration.serverDirectory,
+						instance.configuration.hibernateAfter, *instance.output, *instance.commandQueue,
+						*instance.startup});
+			} catch(const std::runtime_error &e) {
+				std::cerr << "Instance " << instance.configuration.name << " will not hibernate: " << e.what()
+					<< std::endl;
+			}
+		}
+		// Each instance's JVM lives in its child, which serves its metrics on its own socket, and can not be profiled
+		// or collected from here, so no JVM is ever attached to its object, its memory pressure is not governed, and
+		// its ticks are not watched
+		if(instance.configuration.memoryPressure.enabled()) {
+			std::cerr << "Memory pressure is only governed in single-instance mode, where the JVM is in-process"
+				<< std::endl;
+		}
+		if(instance.configuration.watchdogStall.count() > 0) {
+			std::cerr << "Stalled ticks are only watched for in single-instance mode, where the JVM is in-process"
+				<< std::endl;
+		}
+		instance.object.reset(new Minecraftd1{"/net/za/slyfox/Minecraftd1/" + instance.configuration.name,
+				instance.configuration, *instance.commandQueue, *instance.output, *instance.startup,
+				instance.hibernator.get(), nullptr, instance.proxy.get()});
+		objects.push_back(instance.object.get());
+		Glib::signal_child_watch().connect(sigc::mem_fun(*this, &Supervisor::onChildExit), instance.pid);
+	}
+
+	g_unix_signal_add(SIGINT, &Supervisor::onTerminate, this);
+	g_unix_signal_add(SIGTERM, &Supervisor::onTerminate, this);
+
+	BusName busName{objects};
+
+	// The service manager's watchdog attests only that the supervisor's main loop is running
+	const std::chrono::microseconds interval = watchdogInterval();
+	if(interval.count() > 0) {
+		Glib::signal_timeout().connect(sigc::mem_fun(*this, &Supervisor::onWatchdogTimer),
+				std::chrono::duration_cast<std::chrono::milliseconds>(interval).count() / 2);
+	}
+
+	std::cout << "Supervising " << instances_.size() << " instances" << std::endl;
+	reportStartup();
+	mainLoop_->run();
+	return exitStatus_;
+}
+
+void Supervisor::assignPlacement() {
+
+	const std::vector<NumaNode> nodes = readTopology();
+
+	size_t nextNode = 0;
+	std::map<int, std::vector<InstanceConfiguration*>> sharing;
+	for(auto &instance: instances_) {
+		InstanceConfiguration &configuration = instance.configuration;
+		if(!configuration.cpus.empty()) {
+			continue;
+		}
+
+		if((configuration.numaNode < 0) && (nodes.size() > 1)) {
+			configuration.numaNode = nodes[nextNode++ % nodes.size()].id;
+		}
+		sharing[configuration.numaNode].push_back(&configuration);
+	}
+
+	for(const auto &entry: sharing) {
+		std::vector<int> cpus;
+		for(const auto &node: nodes) {
+			if((entry.first < 0) || (node.id == entry.first)) {
+				cpus.insert(cpus.end(), node.cpus.cbegin(), node.cpus.cend());
+			}
+		}
+		if(cpus.empty()) {
+			throw std::runtime_error{"NUMA node " + std::to_string(entry.first)
+				+ " does not exist or has no usable CPUs"};
+		}
+		std::sort(cpus.begin(), cpus.end());
+
+		// Divide the node's CPUs into contiguous, equally-sized slices, one per instance
+		const size_t count = entry.second.size();
+		for(size_t i = 0; i < count; ++i) {
+			size_t first = i * cpus.size() / count;
+			size_t last = std::max((i + 1) * cpus.size() / count, first + 1);
+			entry.second[i]->cpus.assign(cpus.cbegin() + first, cpus.cbegin() + last);
+		}
+	}
+
+	for(const auto &instance: instances_) {
+		std::cout << "Instance " << instance.configuration.name << ": CPUs "
+			<< formatCpuList(instance.configuration.cpus);
+		if(instance.configuration.numaNode >= 0) {
+			std::cout << ", NUMA node " << instance.configuration.numaNode;
+		}
+		std::cout << std::endl;
+	}
+}
+
+void Supervisor::spawn(Instance &instance) {
+
+	instance.console.reset(new PosixPipe);
+
+	int outputPipes[2][2];
+	for(auto &outputPipe: outputPipes) {
+		if(pipe2(outputPipe, O_CLOEXEC) != 0) {
+			throw std::system_error(errno, std::system_category());
+		}
+	}
+
+	std::cout.flush();
+	std::cerr.flush();
+	pid_t pid = fork();
+	if(pid == -1) {
+		throw std::system_error(errno, std::system_category());
+	} else if(pid == 0) {
+		if((dup2(outputPipes[0][1], STDOUT_FILENO) == -1) || (dup2(outputPipes[1][1], STDERR_FILENO) == -1)) {
+			_exit(1);
+		}
+
+		// Without an exec, nothing is closed on the way into the child; another instance's console left open here
+		// would keep that instance from ever seeing the end of its input
+		for(const auto &other: instances_) {
+			if(other.console && (&other != &instance)) {
+				close(other.console->readEnd());
+				close(other.console->writeEnd());
+				close(other.outputFds[0]);
+				close(other.outputFds[1]);
+			}
+		}
+		close(instance.console->writeEnd());
+		for(auto &outputPipe: outputPipes) {
+			close(outputPipe[0]);
+			close(outputPipe[1]);
+		}
+
+		int rc = 1;
+		try {
+			applyPlacement(instance.configuration);
+			rc = runInstance(instance.configuration, instance.console->readEnd());
+		} catch(const std::exception &e) {
+			std::cerr << "Instance " << instance.configuration.name << " failed: " << e.what() << std::endl;
+		}
+		std::cout.flush();
+		_exit(rc);
+	}
+
+	close(outputPipes[0][1]);
+	close(outputPipes[1][1]);
+	instance.outputFds[0] = outputPipes[0][0];
+	instance.outputFds[1] = outputPipes[1][0];
+	instance.pid = pid;
+	++running_;
+}
+
+void Supervisor::watch(Instance &instance) {
+
+	instance.output.reset(new ConsoleBuffer{{
+		ConsoleBuffer::Stream{instance.outputFds[0], fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0), -1},
+		ConsoleBuffer::Stream{instance.outputFds[1], fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0), -1}}});
+
+	instance.startup.reset(new StartupTracker{*instance.output, [this](const std::string&, bool) {
+		reportStartup();
+	}});
+}
+
+void Supervisor::reportStartup() const {
+
+	size_t ready = 0;
+	std::string starting;
+	for(const auto &instance: instances_) {
+		if(instance.startup->ready()) {
+			++ready;
+		} else {
+			starting += (starting.empty() ? "; " : ", ") + instance.configuration.name + ": "
+				+ instance.startup->timeline().back().name;
+		}
+	}
+
+	if(ready == instances_.size()) {
+		std::cout << "All instances ready" << std::endl;
+		notifyServiceManager("READY=1\nSTATUS=" + std::to_string(ready) + " instances running");
+	} else {
+		notifyServiceManager("STATUS=" + std::to_string(ready) + '/' + std::to_string(instances_.size())
+				+ " instances ready" + starting);
+	}
+}
+
+void Supervisor::stopAll() {
+
+	for(const auto &instance: instances_) {
+		instance.object->setState(Minecraftd1::State::STOPPING);
+		if(instance.hibernator) {
+			instance.hibernator->wake();
+		}
+		if((instance.pid != -1) && instance.commandQueue) {
+			// Best effort only; an instance whose console is backed up will still be stopped by systemd's SIGTERM
+			if(!instance.commandQueue->push("stop")) {
+				std::cerr << "Failed to queue stop command for instance " << instance.configuration.name << std::endl;
+			}
+		}
+	}
+}
+
+void Supervisor::onChildExit(GPid pid, int status) {
+
+	for(auto &instance: instances_) {
+		if(instance.pid != pid) {
+			continue;
+		}
+
+		std::cout << "Instance " << instance.configuration.name << " exited";
+		if(WIFEXITED(status)) {
+			std::cout << " with status " << WEXITSTATUS(status);
+		} else if(WIFSIGNALED(status)) {
+			std::cout << " on signal " << WTERMSIG(status);
+		}
+		std::cout << std::endl;
+
+		if(!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+			exitStatus_ = 1;
+			instance.object->setState(Minecraftd1::State::FAILED);
+		} else {
+			instance.object->setState(Minecraftd1::State::STOPPING);
+		}
+		instance.pid = -1;
+		if(instance.hibernator) {
+			instance.hibernator->childExited();
+		}
+	}
+
+	Glib::spawn_close_pid(pid);
+	if(--running_ == 0) {
+		mainLoop_->quit();
+	}
+}
+
+bool Supervisor::onWatchdogTimer() {
+
+	notifyServiceManager("WATCHDOG=1");
+	return true;
+}
+
+gboolean Supervisor::onTerminate(gpointer supervisor) {
+
+	std::cout << "Stopping all instances" << std::endl;
+	notifyServiceManager("STOPPING=1");
+	static_cast<Supervisor*>(supervisor)->stopAll();
+	return TRUE;
+}
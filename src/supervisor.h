@@ -0,0 +1,91 @@
+/*
+ * Copyright 2014 Philip Cronje
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <glibmm.h>
+
+#include "CommandQueue.h"
+#include "ConsoleBuffer.h"
+#include "FrontProxy.h"
+#include "Hibernator.h"
+#include "StartupTracker.h"
+#include "instance.h"
+#include "minecraftd-dbus.h"
+#include "pipe.h"
+
+namespace minecraftd {
+
+	/**
+	 * Hosts several Minecraft servers from a single daemon. Each instance runs in its own child process hosting its
+	 * own JVM, pinned to its own set of CPUs (and NUMA node, where the host has more than one). The supervisor keeps
+	 * the write end of each child's console pipe, and exports one Minecraftd1 object per instance beneath
+	 * /net/za/slyfox/Minecraftd1. The daemon is reported ready to the service manager once every instance is. Being
+	 * in separate processes, instances may be hibernated while they are empty.
+	 */
+	class Supervisor {
+		public:
+			Supervisor(const std::vector<InstanceConfiguration> &instances);
+			Supervisor(const Supervisor&) = delete;
+
+			/**
+			 * Starts every instance and runs the main loop until all of them have exited. Returns the exit status for
+			 * the daemon.
+			 */
+			int run();
+
+		private:
+			struct Instance {
+				InstanceConfiguration configuration;
+				std::unique_ptr<CommandQueue> commandQueue;
+				std::unique_ptr<PosixPipe> console;
+				std::unique_ptr<ConsoleBuffer> output;
+				/** Read ends of the child's standard output and error pipes, until output takes them over. */
+				int outputFds[2];
+				pid_t pid;
+				std::unique_ptr<StartupTracker> startup;
+				/** Suspends the child while nobody is playing, if hibernation is enabled for the instance. */
+				std::unique_ptr<Hibernator> hibernator;
+				/** Relays the public game port to the child, if the front proxy is enabled for the instance. */
+				std::unique_ptr<FrontProxy> proxy;
+				/** Exports the instance on D-Bus; declared last, as it refers to the members above. */
+				std::unique_ptr<Minecraftd1> object;
+			};
+
+			/** Assigns CPUs (and NUMA nodes) to those instances that do not explicitly specify them. */
+			void assignPlacement();
+			/** Reports the instances' startup progress to the service manager, and readiness once all have started. */
+			void reportStartup() const;
+			/**
+			 * Forks the instance's child. Every child is forked before any thread is started or main loop source added,
+			 * and closes the descriptors of the instances forked before it.
+			 */
+			void spawn(Instance &instance);
+			void stopAll();
+			/** Starts collecting the output of the instance's child, and tracking its startup. */
+			void watch(Instance &instance);
+
+			void onChildExit(GPid pid, int status);
+			static gboolean onTerminate(gpointer supervisor);
+			bool onWatchdogTimer();
+
+			std::vector<Instance> instances_;
+			Glib::RefPtr<Glib::MainLoop> mainLoop_;
+			size_t running_;
+			int exitStatus_;
+	};
+}